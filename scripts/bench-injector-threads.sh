@@ -0,0 +1,59 @@
+#!/bin/bash
+# Measure injector proxy throughput (requests/second)
+# for an increasing number of injector threads,
+# both with default logging and with per-request debug logging (`--debug`).
+#
+# Usage: bench-injector-threads.sh ORIGIN_URL [MAX_THREADS]
+#
+# `ORIGIN_URL` must not point to a loopback address
+# (the injector refuses to proxy those),
+# e.g. start `python3 -m http.server` and use this host's LAN address.
+#
+# Needs ApacheBench (`ab`).
+# Set `OUINET_BUILD_DIR` to the directory containing the `injector` binary.
+
+set -e
+
+ORIGIN_URL=$1
+MAX_THREADS=${2:-$(nproc)}
+REQUESTS=${REQUESTS:-20000}
+CONCURRENCY=${CONCURRENCY:-64}
+PORT=${PORT:-7171}
+
+if [ -z "$ORIGIN_URL" ]; then
+    echo "Usage: $0 ORIGIN_URL [MAX_THREADS]" >&2
+    exit 1
+fi
+
+[ -z "$OUINET_BUILD_DIR" ] && OUINET_BUILD_DIR="$(dirname "$0")/ouinet-local-build"
+INJECTOR="$OUINET_BUILD_DIR/injector"
+
+if [ ! -x "$INJECTOR" ]; then
+    echo "Cannot find the injector in $OUINET_BUILD_DIR" >&2
+    exit 1
+fi
+
+REPO=$(mktemp -d)
+trap 'rm -rf "$REPO"' EXIT
+
+# Usage: run_bench THREADS [INJECTOR_ARGS...]
+run_bench() {
+    local threads=$1; shift
+    "$INJECTOR" --repo "$REPO" --listen-on-tcp "127.0.0.1:$PORT" \
+                --threads $threads "$@" > /dev/null 2>&1 &
+    local pid=$!
+    sleep 2  # let it start listening
+
+    ab -q -k -n "$REQUESTS" -c "$CONCURRENCY" -X "127.0.0.1:$PORT" "$ORIGIN_URL" \
+        | awk '/^Requests per second:/ { print $4 }'
+
+    kill -INT $pid
+    wait $pid || true
+}
+
+echo "threads requests/s requests/s(--debug)"
+threads=1
+while [ $threads -le $MAX_THREADS ]; do
+    echo "$threads $(run_bench $threads) $(run_bench $threads --debug)"
+    threads=$((threads * 2))
+done
@@ -42,64 +42,66 @@ std::string bencoding_encode(const BencodedValue& value)
 
 
 
-boost::optional<int64_t> destructive_parse_int(std::string& encoded)
-{
-    boost::string_view sw = encoded;
-    auto opt_num = parse::number<int64_t>(sw);
-    if (!opt_num) return boost::none;
-    encoded.erase(0, encoded.size() - sw.size());
-    return opt_num;
-}
+/*
+ * Parsing functions consume the parsed value from the front of `encoded`.
+ */
 
-boost::optional<std::string> destructive_parse_string(std::string& encoded)
+static boost::optional<boost::string_view> parse_string(boost::string_view& encoded)
 {
-    boost::optional<int64_t> size = destructive_parse_int(encoded);
-    if (!size) {
+    boost::optional<int64_t> size = parse::number<int64_t>(encoded);
+    if (!size || *size < 0) {
         return boost::none;
     }
-    if (encoded[0] != ':') {
+    if (encoded.empty() || encoded[0] != ':') {
         return boost::none;
     }
-    encoded.erase(0, 1);
+    encoded.remove_prefix(1);
     if (encoded.size() < (size_t)*size) {
         return boost::none;
     }
-    std::string value = encoded.substr(0, *size);
-    encoded.erase(0, *size);
+    auto value = encoded.substr(0, *size);
+    encoded.remove_prefix(*size);
+    return value;
+}
+
+static boost::optional<int64_t> parse_int(boost::string_view& encoded)
+{
+    assert(!encoded.empty() && encoded[0] == 'i');
+    encoded.remove_prefix(1);
+    boost::optional<int64_t> value = parse::number<int64_t>(encoded);
+    if (!value) {
+        return boost::none;
+    }
+    if (encoded.empty() || encoded[0] != 'e') {
+        return boost::none;
+    }
+    encoded.remove_prefix(1);
     return value;
 }
 
-boost::optional<BencodedValue> destructive_parse_value(std::string& encoded)
+static boost::optional<BencodedValue> parse_value(boost::string_view& encoded)
 {
     if (encoded.size() == 0) {
         return boost::none;
     }
 
     if (encoded[0] == 'i') {
-        encoded.erase(0, 1);
-        boost::optional<int64_t> value = destructive_parse_int(encoded);
+        boost::optional<int64_t> value = parse_int(encoded);
         if (!value) {
             return boost::none;
         }
-        if (encoded.size() == 0) {
-            return boost::none;
-        }
-        if (encoded[0] != 'e') {
-            return boost::none;
-        }
-        encoded.erase(0, 1);
         return BencodedValue(*value);
     } else if ('0' <= encoded[0] && encoded[0] <= '9') {
-        boost::optional<std::string> value = destructive_parse_string(encoded);
+        boost::optional<boost::string_view> value = parse_string(encoded);
         if (!value) {
             return boost::none;
         }
-        return BencodedValue(std::move(*value));
+        return BencodedValue(value->to_string());
     } else if (encoded[0] == 'l') {
-        encoded.erase(0, 1);
+        encoded.remove_prefix(1);
         BencodedList output;
         while (encoded.size() > 0 && encoded[0] != 'e') {
-            boost::optional<BencodedValue> value = destructive_parse_value(encoded);
+            boost::optional<BencodedValue> value = parse_value(encoded);
             if (!value) {
                 return boost::none;
             }
@@ -109,17 +111,17 @@ boost::optional<BencodedValue> destructive_parse_value(std::string& encoded)
             return boost::none;
         }
         assert(encoded[0] == 'e');
-        encoded.erase(0, 1);
-        return BencodedValue(output);
+        encoded.remove_prefix(1);
+        return BencodedValue(std::move(output));
     } else if (encoded[0] == 'd') {
-        encoded.erase(0, 1);
+        encoded.remove_prefix(1);
         BencodedMap output;
         while (encoded.size() > 0 && encoded[0] != 'e') {
-            boost::optional<std::string> key = destructive_parse_string(encoded);
+            boost::optional<boost::string_view> key = parse_string(encoded);
             if (!key) {
                 return boost::none;
             }
-            boost::optional<BencodedValue> value = destructive_parse_value(encoded);
+            boost::optional<BencodedValue> value = parse_value(encoded);
             if (!value) {
                 return boost::none;
             }
@@ -127,28 +129,132 @@ boost::optional<BencodedValue> destructive_parse_value(std::string& encoded)
              * key/value pairs MUST be in ascending key order.
              */
             if (!output.empty()) {
-                if (output.rbegin()->first >= key) {
+                if (output.rbegin()->first >= *key) {
                     return boost::none;
                 }
             }
-            output[std::move(*key)] = std::move(*value);
+            output.emplace_hint(output.end(), key->to_string(), std::move(*value));
         }
         if (encoded.size() == 0) {
             return boost::none;
         }
         assert(encoded[0] == 'e');
-        encoded.erase(0, 1);
-        return BencodedValue(output);
+        encoded.remove_prefix(1);
+        return BencodedValue(std::move(output));
     } else {
         return boost::none;
     }
 }
 
+/*
+ * Like `parse_value`, but only checking the value, without decoding it.
+ */
+static bool skip_value(boost::string_view& encoded)
+{
+    if (encoded.size() == 0) {
+        return false;
+    }
+
+    if (encoded[0] == 'i') {
+        return bool(parse_int(encoded));
+    } else if ('0' <= encoded[0] && encoded[0] <= '9') {
+        return bool(parse_string(encoded));
+    } else if (encoded[0] == 'l') {
+        encoded.remove_prefix(1);
+        while (encoded.size() > 0 && encoded[0] != 'e') {
+            if (!skip_value(encoded)) {
+                return false;
+            }
+        }
+        if (encoded.size() == 0) {
+            return false;
+        }
+        encoded.remove_prefix(1);
+        return true;
+    } else if (encoded[0] == 'd') {
+        encoded.remove_prefix(1);
+        boost::optional<boost::string_view> last_key;
+        while (encoded.size() > 0 && encoded[0] != 'e') {
+            boost::optional<boost::string_view> key = parse_string(encoded);
+            if (!key) {
+                return false;
+            }
+            if (!skip_value(encoded)) {
+                return false;
+            }
+            /*
+             * key/value pairs MUST be in ascending key order.
+             */
+            if (last_key && *last_key >= *key) {
+                return false;
+            }
+            last_key = key;
+        }
+        if (encoded.size() == 0) {
+            return false;
+        }
+        encoded.remove_prefix(1);
+        return true;
+    } else {
+        return false;
+    }
+}
+
 boost::optional<BencodedValue> bencoding_decode(boost::string_view encoded)
 {
-    // TODO: We shouldn't need to create the string here
-    auto encoded_s = encoded.to_string();
-    return destructive_parse_value(encoded_s);
+    return parse_value(encoded);
+}
+
+boost::optional<BencodedView> bencoding_decode_view(boost::string_view encoded)
+{
+    auto rest = encoded;
+    if (!skip_value(rest)) {
+        return boost::none;
+    }
+    return BencodedView(encoded.substr(0, encoded.size() - rest.size()));
+}
+
+BencodedView BencodedView::first_value(boost::string_view encoded)
+{
+    auto rest = encoded;
+    bool valid = skip_value(rest);
+    assert(valid); (void) valid;
+    return BencodedView(encoded.substr(0, encoded.size() - rest.size()));
+}
+
+boost::optional<int64_t> BencodedView::as_int() const
+{
+    if (!is_int()) return boost::none;
+    auto encoded = _encoded;
+    return parse_int(encoded);
+}
+
+boost::optional<boost::string_view> BencodedView::as_string() const
+{
+    if (!is_string()) return boost::none;
+    auto encoded = _encoded;
+    return parse_string(encoded);
+}
+
+BencodedView BencodedView::operator[](boost::string_view key) const
+{
+    if (!is_map()) return {};
+    auto rest = _encoded.substr(1);
+    while (rest[0] != 'e') {
+        auto k = *parse_string(rest);
+        auto value = first_value(rest);
+        rest.remove_prefix(value._encoded.size());
+        if (k == key) return value;
+        if (k > key) break;  // keys are sorted
+    }
+    return {};
+}
+
+BencodedValue BencodedView::decode() const
+{
+    if (is_null()) return BencodedValue();
+    auto encoded = _encoded;
+    return *parse_value(encoded);
 }
 
 std::ostream& operator<<(std::ostream& os, const BencodedValue& value)
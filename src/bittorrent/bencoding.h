@@ -86,9 +86,78 @@ class BencodedValue : public detail::value {
     }
 };
 
+/*
+ * A non-owning view of an encoded value,
+ * which must outlive the view and any values taken from it.
+ *
+ * Values are only looked up when accessed, without allocating anything,
+ * so the view is cheap to get for short-lived messages
+ * (e.g. incoming DHT datagrams) where only a few values are needed.
+ *
+ * Looking up a missing key or using a view of the wrong type
+ * results in a null view, for which all `is_*` and `as_*` calls fail.
+ */
+class BencodedView {
+    public:
+    BencodedView() = default;
+
+    bool is_null() const { return _encoded.empty(); }
+    bool is_int() const { return !is_null() && _encoded[0] == 'i'; }
+    bool is_string() const { return !is_null() && '0' <= _encoded[0] && _encoded[0] <= '9'; }
+    bool is_list() const { return !is_null() && _encoded[0] == 'l'; }
+    bool is_map() const { return !is_null() && _encoded[0] == 'd'; }
+
+    boost::optional<int64_t> as_int() const;
+    boost::optional<boost::string_view> as_string() const;
+
+    // Get the value for the given key in a map.
+    BencodedView operator[](boost::string_view key) const;
+    bool count(boost::string_view key) const { return !(*this)[key].is_null(); }
+
+    // Call `f(BencodedView)` for each item in a list.
+    template<class F> void for_each_item(F&& f) const {
+        if (!is_list()) return;
+        auto rest = _encoded.substr(1);
+        while (rest[0] != 'e') {
+            auto item = first_value(rest);
+            rest.remove_prefix(item._encoded.size());
+            f(item);
+        }
+    }
+
+    // The encoded value as received.
+    boost::string_view encoded() const { return _encoded; }
+
+    // Get a copy of the value which does not depend on the encoded data.
+    BencodedValue decode() const;
+
+    bool operator==(boost::string_view str) const {
+        auto opt_str = as_string();
+        return opt_str && *opt_str == str;
+    }
+
+    bool operator!=(boost::string_view str) const {
+        return !(*this == str);
+    }
+
+    private:
+    friend boost::optional<BencodedView> bencoding_decode_view(boost::string_view);
+
+    explicit BencodedView(boost::string_view encoded) : _encoded(encoded) {}
+
+    // The (already validated) value at the start of `encoded`.
+    static BencodedView first_value(boost::string_view encoded);
+
+    boost::string_view _encoded;
+};
+
 std::string bencoding_encode(const BencodedValue& value);
 boost::optional<BencodedValue> bencoding_decode(boost::string_view encoded);
 
+// Check that `encoded` starts with a valid value
+// and return a view of it (see `BencodedView`).
+boost::optional<BencodedView> bencoding_decode_view(boost::string_view encoded);
+
 std::ostream& operator<<(std::ostream&, const BencodedValue&);
 
 } // bittorrent namespace
@@ -35,6 +35,7 @@
 #include <boost/accumulators/statistics/rolling_variance.hpp>
 #include <boost/accumulators/statistics/rolling_count.hpp>
 
+#include <algorithm>
 #include <chrono>
 #include <random>
 #include <set>
@@ -861,10 +862,11 @@ void dht::DhtNode::receive_loop(asio::yield_context yield)
             break;
         }
 
-        // TODO: The bencode parser should only need a string_view.
-        boost::optional<BencodedValue> decoded_message = bencoding_decode(packet);
+        // Only look at the values needed from the datagram,
+        // which stays in the multiplexer buffer until the next receive.
+        boost::optional<BencodedView> message = bencoding_decode_view(packet);
 
-        if (!decoded_message) {
+        if (!message) {
 #           if DEBUG_SHOW_MESSAGES
             std::cerr << "recv: " << sender
                       << " Failed parsing \"" << packet << "\"" << std::endl;
@@ -874,30 +876,27 @@ void dht::DhtNode::receive_loop(asio::yield_context yield)
         }
 
 #       if DEBUG_SHOW_MESSAGES
-        std::cerr << "recv: " << sender << " " << *decoded_message << std::endl;
+        std::cerr << "recv: " << sender << " " << message->decode() << std::endl;
 #       endif
 
-        boost::optional<BencodedMap> message_map = decoded_message->as_map();
-        if (!message_map) {
+        if (!message->is_map()) {
             continue;
         }
 
-        if (!message_map->count("y") || !message_map->count("t")) {
-            continue;
-        }
-
-        boost::optional<std::string> message_type = (*message_map)["y"].as_string();
-        boost::optional<std::string> transaction_id = (*message_map)["t"].as_string();
+        boost::optional<boost::string_view> message_type = (*message)["y"].as_string();
+        boost::optional<boost::string_view> transaction_id = (*message)["t"].as_string();
         if (!message_type || !transaction_id) {
             continue;
         }
 
         if (*message_type == "q") {
-            handle_query(sender, *message_map);
+            handle_query(sender, *message);
         } else if (*message_type == "r" || *message_type == "e") {
-            auto it = _active_requests.find(*transaction_id);
+            auto it = _active_requests.find(transaction_id->to_string());
             if (it != _active_requests.end() && it->second.destination == sender) {
-                it->second.callback(*message_map);
+                // Replies may be kept beyond the datagram, so copy them.
+                auto reply = message->decode();
+                it->second.callback(boost::get<BencodedMap>(reply));
             }
         }
     }
@@ -1109,15 +1108,15 @@ BencodedMap dht::DhtNode::send_query_await_reply(
     return or_throw<BencodedMap>(yield, *first_error_code, std::move(response));
 }
 
-void dht::DhtNode::handle_query(udp::endpoint sender, BencodedMap query)
+void dht::DhtNode::handle_query(udp::endpoint sender, BencodedView query)
 {
     assert(query["y"] == "q");
 
-    boost::optional<std::string> transaction_ = query["t"].as_string();
+    boost::optional<boost::string_view> transaction_ = query["t"].as_string();
 
     if (!transaction_) { return; }
 
-    std::string transaction = *transaction_;
+    std::string transaction = transaction_->to_string();
 
     auto send_error = [&] (int code, std::string description) {
         send_datagram(
@@ -1146,14 +1145,14 @@ void dht::DhtNode::handle_query(udp::endpoint sender, BencodedMap query)
     if (!query["q"].is_string()) {
         return send_error(203, "Missing field 'q'");
     }
-    std::string query_type = *query["q"].as_string();
+    boost::string_view query_type = *query["q"].as_string();
 
     if (!query["a"].is_map()) {
         return send_error(203, "Missing field 'a'");
     }
-    BencodedMap arguments = *query["a"].as_map();
+    BencodedView arguments = query["a"];
 
-    boost::optional<std::string> sender_id = arguments["id"].as_string();
+    boost::optional<boost::string_view> sender_id = arguments["id"].as_string();
     if (!sender_id) {
         return send_error(203, "Missing argument 'id'");
     }
@@ -1179,7 +1178,7 @@ void dht::DhtNode::handle_query(udp::endpoint sender, BencodedMap query)
     if (query_type == "ping") {
         return send_reply({});
     } else if (query_type == "find_node") {
-        boost::optional<std::string> target_id_ = arguments["target"].as_string();
+        boost::optional<boost::string_view> target_id_ = arguments["target"].as_string();
         if (!target_id_) {
             return send_error(203, "Missing argument 'target'");
         }
@@ -1214,7 +1213,7 @@ void dht::DhtNode::handle_query(udp::endpoint sender, BencodedMap query)
 
         return send_reply(reply);
     } else if (query_type == "get_peers") {
-        boost::optional<std::string> infohash_ = arguments["info_hash"].as_string();
+        boost::optional<boost::string_view> infohash_ = arguments["info_hash"].as_string();
         if (!infohash_) {
             return send_error(203, "Missing argument 'info_hash'");
         }
@@ -1260,7 +1259,7 @@ void dht::DhtNode::handle_query(udp::endpoint sender, BencodedMap query)
 
         return send_reply(reply);
     } else if (query_type == "announce_peer") {
-        boost::optional<std::string> infohash_ = arguments["info_hash"].as_string();
+        boost::optional<boost::string_view> infohash_ = arguments["info_hash"].as_string();
         if (!infohash_) {
             return send_error(203, "Missing argument 'info_hash'");
         }
@@ -1269,11 +1268,11 @@ void dht::DhtNode::handle_query(udp::endpoint sender, BencodedMap query)
         }
         NodeID infohash = NodeID::from_bytestring(*infohash_);
 
-        boost::optional<std::string> token_ = arguments["token"].as_string();
+        boost::optional<boost::string_view> token_ = arguments["token"].as_string();
         if (!token_) {
             return send_error(203, "Missing argument 'token'");
         }
-        std::string token = *token_;
+        std::string token = token_->to_string();
         boost::optional<int64_t> port_ = arguments["port"].as_int();
         if (!port_) {
             return send_error(203, "Missing argument 'port'");
@@ -1314,7 +1313,7 @@ void dht::DhtNode::handle_query(udp::endpoint sender, BencodedMap query)
 
         return send_reply({});
     } else if (query_type == "get") {
-        boost::optional<std::string> target_ = arguments["target"].as_string();
+        boost::optional<boost::string_view> target_ = arguments["target"].as_string();
         if (!target_) {
             return send_error(203, "Missing argument 'target'");
         }
@@ -1365,7 +1364,7 @@ void dht::DhtNode::handle_query(udp::endpoint sender, BencodedMap query)
 
         return send_reply(reply);
     } else if (query_type == "put") {
-        boost::optional<std::string> token_ = arguments["token"].as_string();
+        boost::optional<boost::string_view> token_ = arguments["token"].as_string();
         if (!token_) {
             return send_error(203, "Missing argument 'token'");
         }
@@ -1373,7 +1372,7 @@ void dht::DhtNode::handle_query(udp::endpoint sender, BencodedMap query)
         if (!arguments.count("v")) {
             return send_error(203, "Missing argument 'v'");
         }
-        BencodedValue value = arguments["v"];
+        BencodedValue value = arguments["v"].decode();
         /*
          * Size limit specified in BEP 44
          */
@@ -1385,7 +1384,7 @@ void dht::DhtNode::handle_query(udp::endpoint sender, BencodedMap query)
             /*
              * This is a mutable data item.
              */
-            boost::optional<std::string> public_key_ = arguments["k"].as_string();
+            boost::optional<boost::string_view> public_key_ = arguments["k"].as_string();
             if (!public_key_) {
                 return send_error(203, "Missing argument 'k'");
             }
@@ -1394,7 +1393,7 @@ void dht::DhtNode::handle_query(udp::endpoint sender, BencodedMap query)
             }
             util::Ed25519PublicKey public_key(util::bytes::to_array<uint8_t, util::Ed25519PublicKey::key_size>(*public_key_));
 
-            boost::optional<std::string> signature_ = arguments["sig"].as_string();
+            boost::optional<boost::string_view> signature_ = arguments["sig"].as_string();
             if (!signature_) {
                 return send_error(203, "Missing argument 'sig'");
             }
@@ -1409,18 +1408,18 @@ void dht::DhtNode::handle_query(udp::endpoint sender, BencodedMap query)
             }
             int64_t sequence_number = *sequence_number_;
 
-            boost::optional<std::string> salt_ = arguments["salt"].as_string();
+            boost::optional<boost::string_view> salt_ = arguments["salt"].as_string();
             /*
              * Size limit specified in BEP 44
              */
             if (salt_ && salt_->size() > 64) {
                 return send_error(207, "Argument 'salt' too big");
             }
-            std::string salt = salt_ ? *salt_ : "";
+            std::string salt = salt_ ? salt_->to_string() : "";
 
             NodeID target = _data_store->mutable_get_id(public_key, salt);
 
-            if (!_data_store->verify_token(sender.address(), target, *token_)) {
+            if (!_data_store->verify_token(sender.address(), target, token_->to_string())) {
                 return send_error(203, "Incorrect put token");
             }
 
@@ -1483,7 +1482,7 @@ void dht::DhtNode::handle_query(udp::endpoint sender, BencodedMap query)
              */
             NodeID target = _data_store->immutable_get_id(value);
 
-            if (!_data_store->verify_token(sender.address(), target, *token_)) {
+            if (!_data_store->verify_token(sender.address(), target, token_->to_string())) {
                 return send_error(203, "Incorrect put token");
             }
 
@@ -1852,6 +1851,11 @@ void dht::DhtNode::collect(
         added_endpoints.insert(contact.endpoint);
     }
 
+    for (auto& contact : closest_lookup_contacts(target_id, RESPONSIBLE_TRACKERS_PER_SWARM)) {
+        if (!added_endpoints.insert(contact.endpoint).second) continue;
+        seed_candidates.insert(contact);
+    }
+
     for (auto ep : _bootstrap_endpoints) {
         if (added_endpoints.count(ep) != 0) continue;
         seed_candidates.insert({ ep, boost::none });
@@ -2445,11 +2449,53 @@ void dht::DhtNode::tracker_do_search_peers(
     for (auto& i : responsible_nodes_full) {
         peers.insert(i.second.peers.begin(), i.second.peers.end());
         responsible_nodes[i.first] = { i.second.node_endpoint, i.second.put_token };
+        add_lookup_contact({ i.first, i.second.node_endpoint });
     }
 
     or_throw(yield, ec);
 }
 
+void dht::DhtNode::add_lookup_contact(const NodeContact& contact)
+{
+    auto inserted = _lookup_contacts.emplace(contact.id, contact.endpoint);
+    if (!inserted.second) {
+        inserted.first->second = contact.endpoint;
+        return;
+    }
+    _lookup_contacts_order.push_back(contact.id);
+
+    if (_lookup_contacts_order.size() > LOOKUP_CONTACTS_MAX) {
+        _lookup_contacts.erase(_lookup_contacts_order.front());
+        _lookup_contacts_order.pop_front();
+    }
+}
+
+std::vector<dht::NodeContact>
+dht::DhtNode::closest_lookup_contacts(const NodeID& target, size_t max) const
+{
+    // Nodes closest to the target share the longest prefix with it,
+    // so they are around it when sorted by id.
+    std::vector<NodeContact> ret;
+    auto hi = _lookup_contacts.lower_bound(target);
+    auto lo = hi;
+    while (ret.size() < 2 * max && (lo != _lookup_contacts.begin() || hi != _lookup_contacts.end())) {
+        if (hi != _lookup_contacts.end()) {
+            ret.push_back({ hi->first, hi->second });
+            ++hi;
+        }
+        if (lo != _lookup_contacts.begin()) {
+            --lo;
+            ret.push_back({ lo->first, lo->second });
+        }
+    }
+
+    std::sort(ret.begin(), ret.end(), [&] (const NodeContact& l, const NodeContact& r) {
+        return target.closer_to(l.id, r.id);
+    });
+    if (ret.size() > max) ret.resize(max);
+    return ret;
+}
+
 
 MainlineDht::MainlineDht( const asio::executor& exec
                         , fs::path storage_dir)
@@ -6,6 +6,7 @@
 #include <boost/filesystem/path.hpp>
 
 #include <chrono>
+#include <deque>
 #include <vector>
 #include <set>
 
@@ -71,6 +72,8 @@ namespace dht {
 class DhtNode {
     public:
     const size_t RESPONSIBLE_TRACKERS_PER_SWARM = 8;
+    // Maximum number of contacts from recent lookups used to start new ones.
+    const size_t LOOKUP_CONTACTS_MAX = 1024;
 
     public:
     DhtNode( const asio::executor&
@@ -256,7 +259,7 @@ class DhtNode {
         asio::yield_context
     );
 
-    void handle_query(udp::endpoint sender, BencodedMap query);
+    void handle_query(udp::endpoint sender, BencodedView query);
 
     void bootstrap(asio::yield_context);
 
@@ -343,6 +346,13 @@ class DhtNode {
         asio::yield_context
     );
 
+    // Lookups for targets close to those of recent lookups
+    // also start from nodes which replied to the latter,
+    // which saves a few hops when looking up many close targets
+    // (e.g. when announcing infohashes in order).
+    void add_lookup_contact(const NodeContact&);
+    std::vector<NodeContact> closest_lookup_contacts(const NodeID& target, size_t max) const;
+
     fs::path stored_contacts_path() const;
 
     void store_contacts() const;
@@ -372,6 +382,9 @@ class DhtNode {
 
     std::vector<udp::endpoint> _bootstrap_endpoints;
 
+    std::map<NodeID, udp::endpoint> _lookup_contacts;
+    std::deque<NodeID> _lookup_contacts_order;  // oldest first
+
     class Stats;
     std::unique_ptr<Stats> _stats;
     boost::filesystem::path _storage_dir;
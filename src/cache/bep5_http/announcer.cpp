@@ -1,6 +1,7 @@
 #include <list>
+#include <map>
+#include <unordered_map>
 #include "announcer.h"
-#include "../../util/async_queue.h"
 #include "../../logger.h"
 #include "../../async_sleep.h"
 #include "../../bittorrent/node_id.h"
@@ -33,6 +34,7 @@ struct Entry {
     string key;
     bt::NodeID infohash;
 
+    Clock::time_point added;
     Clock::time_point successful_update;
     Clock::time_point failed_update;
 
@@ -41,6 +43,7 @@ struct Entry {
     Entry(Announcer::Key key)
         : key(move(key))
         , infohash(util::sha1_digest(this->key))
+        , added(Clock::now())
     { }
 
     bool attempted_update() const {
@@ -52,11 +55,23 @@ struct Entry {
 //--------------------------------------------------------------------
 // Loop
 struct Announcer::Loop {
-    using Entries = util::AsyncQueue<Entry, std::list>;
+    using Entries = std::list<Entry>;
+    using NewEntries = std::map<bt::NodeID, Entry>;
 
     asio::executor ex;
-    shared_ptr<bt::MainlineDht> dht;
+    shared_ptr<bt::MainlineDht> dht;  // may be null
+    AnnounceFunc announce_infohash;
+    // Entries not yet announced are announced in infohash order,
+    // so that consecutive announcements go to close areas of the DHT
+    // and can start from nodes found by previous ones.
+    NewEntries new_entries;
+    bt::NodeID new_entries_pos = bt::NodeID::zero();
+    // Entries already announced, from least to most recently attempted.
     Entries entries;
+    // Keys of all entries, including those being announced,
+    // with the number of times they were added and not removed.
+    unordered_map<Key, size_t> keys;
+    size_t running = 0;
     Cancel _cancel;
     Cancel _timer_cancel;
     LogLevel _log_level;
@@ -65,38 +80,45 @@ struct Announcer::Loop {
 
     static Clock::duration success_reannounce_period() { return 20min; }
     static Clock::duration failure_reannounce_period() { return 5min;  }
+    static size_t max_parallel_announcements() { return 8; }
 
     Loop(shared_ptr<bt::MainlineDht> dht, log_level_t log_level)
         : ex(dht->get_executor())
-        , dht(move(dht))
-        , entries(ex)
+        , dht(dht)
+        , announce_infohash([dht = dht.get()] (auto& infohash, auto& cancel, auto yield) {
+              dht->tracker_announce(infohash, boost::none, cancel, yield);
+          })
         , _log_level(log_level)
     { }
 
-    bool already_has(const Key& key) const {
-        for (auto& e : entries) {
-            if (e.first.key == key) return true;
-        }
-        return false;
-    }
+    Loop(const asio::executor& ex, AnnounceFunc announce, log_level_t log_level)
+        : ex(ex)
+        , announce_infohash(move(announce))
+        , _log_level(log_level)
+    { }
 
     void add(Key key) {
-        if (already_has(key)) return;
-
-        // To preserve the order in which entries are added and updated we put
-        // this new entry _after_ all entries that have not yet been updated.
-        Entries::iterator i = entries.begin();
+        if (keys[key]++ > 0) return;
 
-        for (; i != entries.end(); ++i) {
-            const auto& e = i->first;
-            if (e.attempted_update()) break;
-        }
-
-        entries.insert(i, Entry(move(key)));
+        // New entries go before all entries already announced.
+        Entry e(move(key));
+        auto infohash = e.infohash;
+        new_entries.emplace(infohash, move(e));
         _timer_cancel();
         _timer_cancel = Cancel();
     }
 
+    void remove(const Key& key) {
+        auto ki = keys.find(key);
+        if (ki == keys.end()) return;
+        if (--ki->second > 0) return;
+        keys.erase(ki);
+
+        // An entry being announced is dropped when done (see `loop`).
+        if (new_entries.erase(bt::NodeID(util::sha1_digest(key))) > 0) return;
+        entries.remove_if([&] (const Entry& e) { return e.key == key; });
+    }
+
     Clock::duration next_update_after(const Entry& e) const
     {
         if (e.successful_update == Clock::time_point()
@@ -118,84 +140,83 @@ struct Announcer::Loop {
         }
     }
 
-    void print_entries() const {
+    Stats stats() const
+    {
         auto now = Clock::now();
-        auto print = [&] (Clock::time_point t) {
-            if (t == Clock::time_point()) {
-                cerr << "--:--:--";
-            }
-            else {
-                // TODO: For the purpose of analyzing logs, it would be better
-                // to print absolute times.
-                using namespace std::chrono;
-                unsigned secs = duration_cast<milliseconds>(now - t).count() / 1000.f;
-                unsigned hrs  = secs / (60*60);
-                secs -= hrs * 60*60;
-                unsigned mins = secs / 60;
-                secs -= mins * 60;
-
-                cerr << std::setfill('0') << std::setw(2) << hrs;
-                cerr << ':';
-                cerr << std::setfill('0') << std::setw(2) << mins;
-                cerr << ':';
-                cerr << std::setfill('0') << std::setw(2) << secs;
-            }
-            cerr << " ago";
-        };
-
-        cerr << "BEP5 HTTP announcer entries:" << "\n";
-        for (auto& ep : entries) {
-            auto& e = ep.first;
-            cerr << "  " << e.infohash << " | successful_update:";
-            print(e.successful_update);
-            cerr << " | failed_update:";
-            print(e.failed_update);
-            cerr << " | key:" << e.key << "\n";
+        Stats s{new_entries.size() + entries.size() + running, running, new_entries.size(), 0s};
+
+        for (auto& ep : new_entries)
+            s.lag = max(s.lag, now - ep.second.added);
+
+        for (auto& e : entries) {
+            if (next_update_after(e) > 0s) continue;
+            ++s.backlog;
+            auto due = (e.successful_update >= e.failed_update)
+                     ? e.successful_update + success_reannounce_period()
+                     : e.failed_update + failure_reannounce_period();
+            s.lag = max(s.lag, now - due);
         }
+
+        return s;
     }
 
-    Entries::iterator pick_entry(Cancel& cancel, asio::yield_context yield)
-    {
-        auto end = entries.end();
+    void print_stats() const {
+        using namespace std::chrono;
+        auto s = stats();
+        cerr << "BEP5 HTTP announcer:"
+             << " entries:" << s.entries
+             << " running:" << s.running
+             << " backlog:" << s.backlog
+             << " lag:" << duration_cast<seconds>(s.lag).count() << "s\n";
+    }
 
+    Entry pick_entry(Cancel& cancel, asio::yield_context yield)
+    {
         while (!cancel) {
-            if (entries.empty()) {
-                // XXX: Temporary handler tracking as this coroutine sometimes
-                // fails to exit.
-                TRACK_HANDLER();
-                sys::error_code ec;
-                entries.async_wait_for_push(cancel, yield[ec]);
-                if (cancel) ec = asio::error::operation_aborted;
-                if (ec) return or_throw(yield, ec, end);
+            if (!new_entries.empty()) {
+                // Continue from the last new entry picked, wrapping around.
+                auto i = new_entries.lower_bound(new_entries_pos);
+                if (i == new_entries.end()) i = new_entries.begin();
+                new_entries_pos = i->first;
+                Entry e = move(i->second);
+                new_entries.erase(i);
+                return e;
             }
 
-            auto i = entries.begin();
-
-            auto d = next_update_after(i->first);
+            // With no entries, just wait for new ones to be added.
+            auto d = entries.empty() ? success_reannounce_period()
+                                     : next_update_after(entries.front());
 
-            if (d == 0s) { return i; }
+            if (d == 0s) {
+                Entry e = move(entries.front());
+                entries.pop_front();
+                return e;
+            }
 
             auto cc = cancel.connect([&] { _timer_cancel(); });
             async_sleep(ex, d, _timer_cancel, yield);
         }
 
-        return or_throw(yield, asio::error::operation_aborted, end);
+        return or_throw(yield, asio::error::operation_aborted, Entry());
     }
 
     void start()
     {
-        TRACK_SPAWN(dht->get_executor(), [&] (asio::yield_context yield) {
-            Cancel cancel(_cancel);
-            sys::error_code ec;
-            loop(cancel, yield[ec]);
-        });
+        // Announcements mostly wait for DHT replies, so run a few at a time.
+        for (size_t i = 0; i < max_parallel_announcements(); ++i) {
+            TRACK_SPAWN(ex, [&] (asio::yield_context yield) {
+                Cancel cancel(_cancel);
+                sys::error_code ec;
+                loop(cancel, yield[ec]);
+            });
+        }
     }
 
     void loop(Cancel& cancel, asio::yield_context yield)
     {
         LogLevel ll = _log_level;
 
-        {
+        if (dht) {
             // XXX: Temporary handler tracking as this coroutine sometimes
             // fails to exit.
             TRACK_HANDLER();
@@ -205,7 +226,7 @@ struct Announcer::Loop {
 
         while (!cancel) {
             sys::error_code ec;
-            auto ei = pick_entry(cancel, yield[ec]);
+            auto e = pick_entry(cancel, yield[ec]);
 
             if (cancel) return;
             assert(!ec);
@@ -213,30 +234,35 @@ struct Announcer::Loop {
 
             // Try inserting three times before moving to the next entry
             bool success = false;
+            ++running;
             for (int i = 0; i != 3; ++i) {
                 // XXX: Temporary handler tracking as this coroutine sometimes
                 // fails to exit.
                 TRACK_HANDLER();
-                announce(ei->first, cancel, yield[ec]);
+                announce(e, cancel, yield[ec]);
                 if (cancel) return;
                 if (!ec) { success = true; break; }
                 async_sleep(ex, chrono::seconds(1+i), cancel, yield[ec]);
                 if (cancel) return;
                 ec = {};
             }
+            --running;
+
+            // The entry was removed while being announced
+            // (and maybe added again as a new entry).
+            if (keys.count(e.key) == 0 || new_entries.count(e.infohash) != 0)
+                continue;
 
             if (success) {
-                ei->first.failed_update     = {};
-                ei->first.successful_update = Clock::now();
+                e.failed_update     = {};
+                e.successful_update = Clock::now();
             } else  {
-                ei->first.failed_update     = Clock::now();
+                e.failed_update     = Clock::now();
             }
 
-            Entry e = move(ei->first);
-            entries.erase(ei);
             entries.push_back(move(e));
 
-            if (ll.debug()) { print_entries(); }
+            if (ll.debug()) { print_stats(); }
         }
 
         return or_throw(yield, asio::error::operation_aborted);
@@ -251,7 +277,7 @@ struct Announcer::Loop {
         }
 
         sys::error_code ec;
-        dht->tracker_announce(e.infohash, boost::none, cancel, yield[ec]);
+        announce_infohash(e.infohash, cancel, yield[ec]);
 
         if (ll.debug()) {
             cerr << "Announcing ended " << e.key << " ec:" << ec.message() << "\n";
@@ -272,14 +298,38 @@ Announcer::Announcer( std::shared_ptr<bittorrent::MainlineDht> dht
     _loop->start();
 }
 
+Announcer::Announcer( const asio::executor& ex
+                    , AnnounceFunc announce
+                    , log_level_t log_level)
+    : _loop(new Loop(ex, std::move(announce), log_level))
+{
+    _loop->start();
+}
+
+/* static */
+size_t Announcer::max_parallel_announcements()
+{
+    return Loop::max_parallel_announcements();
+}
+
 void Announcer::add(Key key)
 {
     _loop->add(move(key));
 }
 
+void Announcer::remove(const Key& key)
+{
+    _loop->remove(key);
+}
+
 void Announcer::set_log_level(log_level_t l)
 {
     _loop->set_log_level(l);
 }
 
+Announcer::Stats Announcer::stats() const
+{
+    return _loop->stats();
+}
+
 Announcer::~Announcer() {}
@@ -3,6 +3,8 @@
 #include "../../bittorrent/bep5_announcer.h"
 #include "../../util/hash.h"
 #include "../../logger.h"
+#include <chrono>
+#include <functional>
 #include <memory>
 
 namespace ouinet { namespace cache { namespace bep5_http {
@@ -14,14 +16,44 @@ private:
 public:
     using Key = std::string;
 
+    // Announce a single infohash, or fail.
+    using AnnounceFunc = std::function<void( const bittorrent::NodeID&
+                                           , Cancel&
+                                           , asio::yield_context)>;
+
     Announcer(std::shared_ptr<bittorrent::MainlineDht>, log_level_t);
 
+    // Announce infohashes with the given function instead of the DHT
+    // (e.g. for testing).
+    Announcer(const asio::executor&, AnnounceFunc, log_level_t);
+
+    // Number of announcements run at a time.
+    static std::size_t max_parallel_announcements();
+
+    // Several stored responses may share a key,
+    // so a key stays announced until it is removed
+    // as many times as it was added.
     void add(Key key);
 
+    // Removing the last entry with a key takes time linear
+    // in the number of entries.
+    void remove(const Key& key);
+
     ~Announcer();
 
     void set_log_level(log_level_t);
 
+    // Figures to check whether announcements keep up with entries.
+    struct Stats {
+        std::size_t entries;  // all entries
+        std::size_t running;  // entries being announced
+        std::size_t backlog;  // entries due for announcement, not running
+        std::chrono::steady_clock::duration lag;  // how overdue the oldest due entry is
+    };
+
+    // This takes time linear in the number of entries.
+    Stats stats() const;
+
 private:
     std::unique_ptr<Loop> _loop;
 };
@@ -2,9 +2,11 @@
 #include "announcer.h"
 #include "dht_lookup.h"
 #include "local_peer_discovery.h"
+#include "multi_peer_reader.h"
 #include "../http_sign.h"
 #include "../http_store.h"
 #include "../../http_util.h"
+#include "../../util/condition_variable.h"
 #include "../../util/wait_condition.h"
 #include "../../util/set_io.h"
 #include "../../util/async_generator.h"
@@ -14,6 +16,7 @@
 #include "../../bittorrent/is_martian.h"
 #include "../../ouiservice/utp.h"
 #include "../../logger.h"
+#include "../../parse/number.h"
 #include "../../async_sleep.h"
 #include "../../constants.h"
 #include "../../session.h"
@@ -28,6 +31,8 @@ namespace fs = boost::filesystem;
 namespace bt = bittorrent;
 
 struct Client::Impl {
+    using ConnectionGenerator = util::AsyncGenerator<pair<GenericStream, udp::endpoint>>;
+
     // The newest protocol version number seen in a trusted exchange
     // (i.e. from injector-signed cached content).
     unsigned newest_proto_seen = http_::protocol_version_current;
@@ -39,6 +44,10 @@ struct Client::Impl {
     unique_ptr<cache::AbstractHttpStore> http_store;
     Cancel lifetime_cancel;
     Announcer announcer;
+    // Stores wait for responses already in the store to be announced,
+    // so that the announcer does not count them twice.
+    bool stored_data_announced = false;
+    ConditionVariable stored_data_announced_cv;
     map<string, udp::endpoint> peer_cache;
     util::LruCache<bt::NodeID, unique_ptr<DhtLookup>> dht_lookups;
     log_level_t log_level = INFO;
@@ -60,10 +69,17 @@ struct Client::Impl {
         , cache_dir(move(cache_dir))
         , http_store(move(http_store))
         , announcer(dht, log_level)
+        , stored_data_announced_cv(ex)
         , dht_lookups(256)
         , log_level(log_level)
         , local_peer_discovery(ex, dht->local_endpoints())
-    {}
+    {
+        // Only responses still in the store are announced
+        // (see `announce_stored_data`).
+        this->http_store->on_remove([this] (const auto& info) {
+            if (auto k = dht_key(info.uri)) announcer.remove(*k);
+        });
+    }
 
     // "http(s)://www.foo.org/bar/baz" -> "www.foo.org"
     boost::optional<string> dht_key(const string& s)
@@ -105,7 +121,23 @@ struct Client::Impl {
             return handle_bad_request(sink, req, yield[ec]);
         }
 
-        auto rr = http_store->reader(*key, ec);
+        // Clients fetching from several peers ask for ranges of data blocks.
+        reader_uptr rr;
+        auto range = HttpBlockRange::parse(req[http_::block_range_hdr]);
+        if (range) {
+            rr = http_store->range_reader(*key, *range, ec);
+            if (ec == asio::error::operation_not_supported)  // send everything instead
+                ec = {};
+        }
+        // Other clients may just want part of the data (e.g. to resume or seek),
+        // which is sent with a partial response.
+        auto byte_range = HttpByteRange::parse(req[http::field::range]);
+        if (!range && byte_range) {
+            rr = http_store->range_reader(*key, *byte_range, ec);
+            if (ec == asio::error::operation_not_supported)
+                ec = {};
+        }
+        if (!rr && !ec) rr = http_store->reader(*key, ec);
         if (ec) {
             if (!cancel && log_debug()) {
                 cerr << "Bep5HTTP: Not Serving " << *key
@@ -119,6 +151,8 @@ struct Client::Impl {
         }
 
         auto s = Session::create(move(rr), cancel, yield[ec]);
+        if (ec == sys::errc::invalid_seek)
+            return handle_range_not_satisfiable(sink, req, *key, cancel, yield[ec]);
         if (!ec) s.flush_response(sink, cancel, yield[ec]);
 
         return or_throw(yield, ec);
@@ -134,6 +168,31 @@ struct Client::Impl {
         http::async_write(con, res, yield);
     }
 
+    // The response tells the size of stored data (RFC 7233#4.4),
+    // if known.
+    void handle_range_not_satisfiable( GenericStream& con
+                                     , const http::request<http::empty_body>& req
+                                     , const std::string& key
+                                     , Cancel& cancel
+                                     , asio::yield_context yield)
+    {
+        auto res = util::http_client_error(req, http::status::range_not_satisfiable, "");
+
+        sys::error_code ec;
+        auto rr = http_store->reader(key, ec);
+        if (!ec) {
+            auto head = rr->async_read_part(cancel, yield[ec]);
+            if (cancel) return or_throw(yield, asio::error::operation_aborted);
+            if (!ec && head && head->is_head()) {
+                auto data_size_s = (*head->as_head())[http_::response_data_size_hdr];
+                if (auto data_size = parse::number<std::size_t>(data_size_s))
+                    res.set(http::field::content_range, "bytes */" + std::to_string(*data_size));
+            }
+        }
+
+        http::async_write(con, res, yield);
+    }
+
     void handle_bad_request( GenericStream& con
                            , const http::request<http::empty_body>& req
                            , asio::yield_context yield)
@@ -284,7 +343,7 @@ struct Client::Impl {
             if (cancel) ec = err::operation_aborted;
             if (ec) return or_throw<Session>(yield, ec);
 
-            auto gen = make_connection_generator(eps, dbg);
+            shared_ptr<ConnectionGenerator> gen = make_connection_generator(eps, dbg);
 
             while (auto opt_con = gen->async_get_value(cancel, yield[ec])) {
                 assert(!cancel || ec == err::operation_aborted);
@@ -297,7 +356,7 @@ struct Client::Impl {
                         " chosen ep:", opt_con->second, "; fetching...");
                 }
 
-                auto session = load_from_connection(key, opt_con->first, cancel, yield[ec]);
+                auto session = load_from_connection(key, opt_con->first, gen, cancel, yield[ec]);
                 auto& hdr = session.response_header();
 
                 if (dbg) {
@@ -344,28 +403,35 @@ struct Client::Impl {
         return or_throw(yield, ec, move(rs));
     }
 
-    template<class Con>
+    // Other peers from the generator may be used to get parts of the response.
     Session load_from_connection( const string& key
-                                , Con& con
+                                , GenericStream& con
+                                , shared_ptr<ConnectionGenerator> gen
                                 , Cancel cancel
                                 , Yield yield)
     {
         auto uri = uri_from_key(key);
-        http::request<http::string_body> rq{http::verb::get, uri, 11 /* version */};
+        http::request<http::empty_body> rq{http::verb::get, uri, 11 /* version */};
         rq.set(http::field::host, "dummy_host");
         rq.set(http_::protocol_version_hdr, http_::protocol_version_hdr_current);
         rq.set(http::field::user_agent, "Ouinet.Bep5.Client");
 
-        auto cancelled2 = cancel.connect([&] { con.close(); });
+        auto more_peers = [gen = move(gen)] (Cancel& c, asio::yield_context y) {
+            using Ret = boost::optional<GenericStream>;
+            sys::error_code ec;
+            while (auto opt_con = gen->async_get_value(c, y[ec])) {
+                if (c) break;
+                if (ec) continue;
+                return Ret(move(opt_con->first));
+            }
+            if (c) ec = asio::error::operation_aborted;
+            return or_throw<Ret>(y, ec);
+        };
 
         sys::error_code ec;
-        http::async_write(con, rq, yield[ec]);
-
-        if (cancel) ec = asio::error::operation_aborted;
-        if (ec) return or_throw<Session>(yield, ec);
-
-        Session::reader_uptr vfy_reader = make_unique<cache::VerifyingReader>(move(con), cache_pk);
-        auto session = Session::create(move(vfy_reader), cancel, yield[ec]);
+        Session::reader_uptr mp_reader = make_unique<MultiPeerReader>
+            (ex, move(rq), move(con), move(more_peers), cache_pk);
+        auto session = Session::create(move(mp_reader), cancel, yield[ec]);
 
         assert(!cancel || ec == asio::error::operation_aborted);
 
@@ -399,10 +465,10 @@ struct Client::Impl {
         return GenericStream(move(s));
     }
 
-    unique_ptr<util::AsyncGenerator<pair<GenericStream, udp::endpoint>>>
+    unique_ptr<ConnectionGenerator>
     make_connection_generator(set<udp::endpoint> eps, boost::optional<uint32_t> dbg)
     {
-        using Ret = util::AsyncGenerator<pair<GenericStream, udp::endpoint>>;
+        using Ret = ConnectionGenerator;
 
         return make_unique<Ret>(ex,
         [&, lc = lifetime_cancel, eps = move(eps), dbg]
@@ -471,59 +537,52 @@ struct Client::Impl {
         if (!dk) return or_throw(yield, asio::error::invalid_argument);
 
         sys::error_code ec;
-        cache::KeepSignedReader fr(r);
-        http_store->store(key, fr, cancel, yield[ec]);
-        if (ec) return or_throw(yield, ec);
+        while (!stored_data_announced) {
+            stored_data_announced_cv.wait(yield[ec]);
+            if (cancel || ec) return or_throw(yield, asio::error::operation_aborted);
+        }
 
+        // The store may evict the response right away,
+        // so add it to the announcer before.
         announcer.add(*dk);
-    }
-
-    http::response_header<>
-    read_response_header( http_response::AbstractReader& reader
-                        , asio::yield_context yield)
-    {
-        Cancel lc(lifetime_cancel);
 
-        sys::error_code ec;
-        auto part = reader.async_read_part(lc, yield[ec]);
-        if (!ec && !part)
-            ec = sys::errc::make_error_code(sys::errc::no_message);
-        return_or_throw_on_error(yield, lc, ec, http::response_header<>());
-        auto head = part->as_head(); assert(head);
-        return *head;
+        cache::KeepSignedReader fr(r);
+        http_store->store(key, fr, cancel, yield[ec]);
+        if (ec) announcer.remove(*dk);
+        return or_throw(yield, ec);
     }
 
     void announce_stored_data(asio::yield_context y)
     {
         sys::error_code e;
-        http_store->for_each([&] (auto rr, auto yield) {
-            sys::error_code ec;
-
-            auto hdr = read_response_header(*rr, yield[ec]);
-            if (ec) return or_throw<bool>(yield, ec);
-
-            if (hdr[http_::protocol_version_hdr] != http_::protocol_version_hdr_current) {
+        http_store->for_each_info([&] (const auto& info, auto yield) {
+            if (info.protocol_version != http_::protocol_version_current) {
                 LOG_WARN( "Bep5HTTP: Cached response contains an invalid "
                         , http_::protocol_version_hdr
                         , " header field; removing");
                 return false;
             }
 
-            auto key = hdr[http_::response_uri_hdr];
-
-            if (key.empty()) {
+            if (info.uri.empty()) {
                 LOG_WARN( "Bep5HTTP: Cached response does not contain a "
                         , http_::response_uri_hdr
                         , " header field; removing");
                 return false;
             }
 
-            if (auto opt_k = dht_key(key.to_string())) {
+            return true;
+        }, y[e]);
+
+        http_store->for_each_info([&] (const auto& info, auto yield) {
+            if (auto opt_k = dht_key(info.uri)) {
                 announcer.add(*opt_k);
             }
 
             return true;
         }, y[e]);
+
+        stored_data_announced = true;
+        stored_data_announced_cv.notify();
     }
 
     void stop() {
@@ -542,6 +601,11 @@ struct Client::Impl {
     }
 
     log_level_t get_log_level() const { return log_level; }
+
+    Announcer::Stats announcer_stats() const
+    {
+        return announcer.stats();
+    }
 };
 
 /* static */
@@ -549,6 +613,7 @@ std::unique_ptr<Client>
 Client::build( shared_ptr<bt::MainlineDht> dht
              , util::Ed25519PublicKey cache_pk
              , fs::path cache_dir
+             , cache::HttpStoreLimits store_limits
              , log_level_t log_level
              , asio::yield_context yield)
 {
@@ -565,11 +630,21 @@ Client::build( shared_ptr<bt::MainlineDht> dht
         ec = {};
     }
 
-    auto store_dir = cache_dir / "data-v1";
+    auto store_dir = cache_dir / "data-packed";
     fs::create_directories(store_dir, ec);
     if (ec) return or_throw<ClientPtr>(yield, ec);
-    auto http_store = make_unique<cache::HttpStoreV1>(
-        move(store_dir), dht->get_executor());
+    auto http_store = make_unique<cache::HttpStorePacked>(
+        move(store_dir), dht->get_executor(), store_limits);
+
+    auto v1_store_dir = cache_dir / "data-v1";
+    if (is_directory(v1_store_dir)) {
+        LOG_INFO("Migrating HTTP store...");
+        Cancel cancel;
+        http_store->migrate(v1_store_dir, cancel, yield[ec]);
+        if (ec) LOG_ERROR("Migrating HTTP store: failed; ec:", ec.message());
+        else LOG_INFO("Migrating HTTP store: done");
+        ec = {};
+    }
 
     unique_ptr<Impl> impl(new Impl( move(dht)
                                   , cache_pk, move(cache_dir)
@@ -613,6 +688,11 @@ unsigned Client::get_newest_proto_version() const
     return _impl->get_newest_proto_version();
 }
 
+Announcer::Stats Client::announcer_stats() const
+{
+    return _impl->announcer_stats();
+}
+
 void Client::set_log_level(log_level_t l)
 {
     _impl->set_log_level(l);
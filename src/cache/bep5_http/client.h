@@ -5,6 +5,8 @@
 #include "../../util/crypto.h"
 #include "../../util/yield.h"
 #include "../cache_entry.h"
+#include "../http_store.h"
+#include "announcer.h"
 #include <boost/filesystem.hpp>
 
 namespace ouinet {
@@ -27,6 +29,7 @@ public:
     build( std::shared_ptr<bittorrent::MainlineDht>
          , util::Ed25519PublicKey cache_pk
          , fs::path cache_dir
+         , HttpStoreLimits
          , log_level_t
          , asio::yield_context);
 
@@ -47,6 +50,8 @@ public:
     // (e.g. to warn about potential upgrades).
     unsigned get_newest_proto_version() const;
 
+    Announcer::Stats announcer_stats() const;
+
     ~Client();
 
     void        set_log_level(log_level_t);
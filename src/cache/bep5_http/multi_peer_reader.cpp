@@ -0,0 +1,570 @@
+#include "multi_peer_reader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <queue>
+#include <vector>
+
+#include <boost/asio/spawn.hpp>
+#include <boost/beast/http/write.hpp>
+
+#include "../http_sign.h"
+#include "../../defer.h"
+#include "../../http_util.h"
+#include "../../logger.h"
+#include "../../or_throw.h"
+#include "../../parse/number.h"
+#include "../../util/condition_variable.h"
+#include "../../util/handler_tracker.h"
+#include "../../util/hash.h"
+#include "../../util/watch_dog.h"
+
+using namespace std;
+using namespace ouinet;
+using namespace cache::bep5_http;
+
+using optional_part = boost::optional<http_response::Part>;
+using sig_array_t = util::Ed25519PublicKey::sig_array_t;
+
+// Data blocks asked to a peer at a time.
+static const size_t blocks_per_range = 4;
+// Peers to get data blocks from at the same time.
+static const size_t max_peers = 4;
+// Verified data blocks kept in memory before they can be output.
+static const size_t max_blocks_ahead = 64;
+// Peers taking longer than this to send a range of data blocks are dropped.
+static const auto range_timeout = chrono::seconds(30);
+
+static
+sys::error_code
+bad_message()
+{
+    return sys::errc::make_error_code(sys::errc::bad_message);
+}
+
+static
+sys::error_code
+no_message()
+{
+    return sys::errc::make_error_code(sys::errc::no_message);
+}
+
+struct MultiPeerReader::Impl : public enable_shared_from_this<Impl> {
+    struct Block {
+        vector<uint8_t> data;
+        sig_array_t sig;
+        boost::optional<cache::HttpBlockDigest> prev_digest;  // as sent by the peer
+        cache::HttpBlockDigest digest;
+    };
+
+    asio::executor ex;
+    http::request<http::empty_body> rq;
+    util::Ed25519PublicKey pk;
+    PeerGenerator peer_gen;
+    Cancel lifetime_cancel;
+    // Blocks were verified or output, ranges became pending, peers went away...
+    // Waits are not tied to cancellation signals (which may fire after a notification),
+    // waiters just check `lifetime_cancel` again.
+    ConditionVariable changed;
+
+    GenericStream first_peer;
+
+    http_response::Head head;
+    string uri;  // for warnings
+    string injection_id;
+    boost::optional<cache::HttpBlockSigs> bs_params;
+    size_t data_size = 0;
+    size_t block_count = 0;
+
+    deque<cache::HttpBlockRange> pending;  // not assigned to any peer, sorted
+    map<size_t, Block> ready;  // verified, not output yet
+    size_t next_block = 0;  // to be output
+    size_t peer_count = 0;
+    bool has_more_peers = true;
+    sys::error_code last_error;
+
+    Impl( const asio::executor& ex
+        , http::request<http::empty_body> rq
+        , GenericStream first_peer
+        , PeerGenerator peer_gen
+        , util::Ed25519PublicKey pk)
+        : ex(ex)
+        , rq(std::move(rq))
+        , pk(std::move(pk))
+        , peer_gen(std::move(peer_gen))
+        , changed(ex)
+        , first_peer(std::move(first_peer))
+    {
+        uri = this->rq.target().to_string();
+    }
+
+    size_t block_size(size_t index) const
+    {
+        if (index + 1 < block_count) return bs_params->size;
+        return data_size - index * bs_params->size;  // last block, maybe empty
+    }
+
+    bool all_received() const
+    {
+        return next_block + ready.size() >= block_count;
+    }
+
+    // Read and verify the head from the first peer
+    // and start getting data blocks.
+    optional_part
+    start(Cancel& cancel, asio::yield_context yield)
+    {
+        sys::error_code ec;
+
+        auto first_range_rq = rq;
+        first_range_rq.set( http_::block_range_hdr
+                          , cache::HttpBlockRange{0, blocks_per_range - 1}.str());
+        {
+            auto cancelled = cancel.connect([&] { first_peer.close(); });
+            http::async_write(first_peer, first_range_rq, yield[ec]);
+        }
+        if (cancel) ec = asio::error::operation_aborted;
+        if (ec) return or_throw(yield, ec, boost::none);
+
+        auto reader = std::make_unique<http_response::Reader>(std::move(first_peer));
+        optional_part part;
+        {
+            auto cancelled = cancel.connect([&] { reader->close(); });
+            part = reader->async_read_part(cancel, yield[ec]);
+        }
+        if (cancel) ec = asio::error::operation_aborted;
+        if (!ec && (!part || !part->as_head())) ec = no_message();
+        if (ec) return or_throw(yield, ec, boost::none);
+
+        auto range = cache::HttpBlockRange::parse((*part->as_head())[http_::block_range_hdr]);
+        process_head(std::move(*part->as_head()), ec);
+        if (ec) return or_throw(yield, ec, boost::none);
+
+        // Peers not supporting ranges send all data blocks.
+        // The range may go beyond the last block if the response is small.
+        auto last = min(blocks_per_range, block_count) - 1;
+        if (!range) {
+            last = block_count - 1;
+        } else if (range->first != 0 || range->last < last) {
+            LOG_WARN("Unexpected block range from peer: ", range->str(), "; uri=", uri);
+            return or_throw(yield, no_message(), boost::none);
+        }
+        for (auto b = last + 1; b < block_count; b += blocks_per_range)
+            pending.push_back({b, min(b + blocks_per_range, block_count) - 1});
+
+        auto self = shared_from_this();
+        ++peer_count;
+        TRACK_SPAWN(ex, ([self, reader = std::move(reader), last] (asio::yield_context y) mutable {
+            self->run_first_peer(std::move(reader), {0, last}, y);
+        }));
+        TRACK_SPAWN(ex, ([self] (asio::yield_context y) {
+            self->recruit_peers(y);
+        }));
+
+        return http_response::Part(head);  // do not move
+    }
+
+    void
+    process_head(http_response::Head inh, sys::error_code& ec)
+    {
+        inh.erase(http_::block_range_hdr);  // not signed
+        head = cache::http_injection_verify(std::move(inh), pk);
+        if (head.cbegin() == head.cend()) {
+            LOG_WARN("Failed to verify HTTP head signatures; uri=", uri);
+            ec = no_message();
+            return;
+        }
+        if (!head.chunked()) {
+            LOG_WARN("Verification of non-chunked HTTP responses is not supported; uri=", uri);
+            ec = no_message();
+            return;
+        }
+        bs_params = cache::HttpBlockSigs::parse(head[http_::response_block_signatures_hdr]);
+        if (!bs_params) {
+            LOG_WARN("Missing or malformed parameters for HTTP data block signatures; uri=", uri);
+            ec = no_message();
+            return;
+        }
+        if (bs_params->size == 0 || bs_params->size > http_::response_data_block_max) {
+            LOG_WARN("Invalid size of signed HTTP data blocks: ", bs_params->size, "; uri=", uri);
+            ec = no_message();
+            return;
+        }
+        injection_id = util::http_injection_id(head).to_string();
+        if (injection_id.empty()) {
+            LOG_WARN("Missing injection identifier in HTTP head; uri=", uri);
+            ec = no_message();
+            return;
+        }
+        // The number of data blocks must be known in advance to split them.
+        auto ds_h = head[http_::response_data_size_hdr];
+        auto ds = parse::number<size_t>(ds_h);
+        if (!ds) {
+            LOG_WARN("Missing signed length; uri=", uri);
+            ec = no_message();
+            return;
+        }
+        data_size = *ds;
+        // An empty body still has a signature for its single, empty data block.
+        block_count = max<size_t>(1, (data_size + bs_params->size - 1) / bs_params->size);
+    }
+
+    // Get the first pending range, unless it is too far ahead of output.
+    boost::optional<cache::HttpBlockRange>
+    take_range()
+    {
+        if (pending.empty()) return boost::none;
+        if (pending.front().first >= next_block + max_blocks_ahead) return boost::none;
+        auto range = pending.front();
+        pending.pop_front();
+        return range;
+    }
+
+    void
+    give_back_range(const cache::HttpBlockRange& range)
+    {
+        auto it = find_if( pending.begin(), pending.end()
+                         , [&] (const auto& r) { return r.first > range.first; });
+        pending.insert(it, range);
+        changed.notify();
+    }
+
+    // Keep asking for pending ranges to the peer
+    // until all blocks are received or the peer fails.
+    void
+    run_peer(GenericStream con, asio::yield_context yield)
+    {
+        auto on_exit = defer([&] { --peer_count; changed.notify(); });
+
+        while (!lifetime_cancel && !all_received()) {
+            auto range = take_range();
+            if (!range) {
+                sys::error_code ec;
+                changed.wait(yield[ec]);
+                continue;
+            }
+
+            sys::error_code ec;
+            auto next = fetch_range(con, *range, yield[ec]);
+            if (next <= range->last) give_back_range({next, range->last});
+            if (ec) {
+                if (!lifetime_cancel) {
+                    LOG_DEBUG( "Dropping peer after failing to get block range "
+                             , range->str(), "; ec=", ec.message(), " uri=", uri);
+                    last_error = ec;
+                }
+                return;
+            }
+        }
+    }
+
+    void
+    run_first_peer( unique_ptr<http_response::Reader> reader
+                  , cache::HttpBlockRange range
+                  , asio::yield_context yield)
+    {
+        sys::error_code ec;
+        auto next = read_range(*reader, range, true, yield[ec]);
+        if (next <= range.last) give_back_range({next, range.last});
+        if (ec) {
+            if (!lifetime_cancel) last_error = ec;
+            --peer_count;
+            changed.notify();
+            return;
+        }
+        run_peer(reader->release_stream(), yield);
+    }
+
+    // Get new peers while there are ranges which no peer is working on.
+    void
+    recruit_peers(asio::yield_context yield)
+    {
+        auto self = shared_from_this();
+
+        while (!lifetime_cancel && !all_received()) {
+            if (pending.empty() || peer_count >= max_peers) {
+                sys::error_code ec;
+                changed.wait(yield[ec]);
+                continue;
+            }
+
+            sys::error_code ec;
+            auto con = peer_gen(lifetime_cancel, yield[ec]);
+            if (lifetime_cancel) return;
+            if (ec || !con) break;
+
+            ++peer_count;
+            TRACK_SPAWN(ex, ([self, con = std::move(*con)] (asio::yield_context y) mutable {
+                self->run_peer(std::move(con), y);
+            }));
+        }
+
+        has_more_peers = false;
+        changed.notify();
+    }
+
+    // Ask the peer for a range of data blocks and read them,
+    // returning the index of the first block in the range not received.
+    // The connection is left ready for the next request.
+    size_t
+    fetch_range( GenericStream& con
+               , const cache::HttpBlockRange& range
+               , asio::yield_context yield)
+    {
+        sys::error_code ec;
+
+        auto range_rq = rq;
+        range_rq.set(http_::block_range_hdr, range.str());
+        {
+            bool timed_out = false;
+            auto cancelled = lifetime_cancel.connect([&] { con.close(); });
+            WatchDog wd(ex, range_timeout, [&] { timed_out = true; con.close(); });
+            http::async_write(con, range_rq, yield[ec]);
+            if (timed_out) ec = asio::error::timed_out;
+        }
+        if (lifetime_cancel) ec = asio::error::operation_aborted;
+        if (ec) return or_throw(yield, ec, range.first);
+
+        http_response::Reader reader(std::move(con));
+        auto next = read_range(reader, range, false, yield[ec]);
+        if (ec) return or_throw(yield, ec, next);
+
+        con = reader.release_stream();
+        return next;
+    }
+
+    size_t
+    read_range( http_response::Reader& reader
+              , const cache::HttpBlockRange& range
+              , bool head_done
+              , asio::yield_context yield)
+    {
+        bool timed_out = false;
+        auto cancelled = lifetime_cancel.connect([&] { reader.close(); });
+        WatchDog wd(ex, range_timeout, [&] { timed_out = true; reader.close(); });
+
+        sys::error_code ec;
+        auto next = read_blocks(reader, range, head_done, yield[ec]);
+        if (timed_out) ec = asio::error::timed_out;
+        if (lifetime_cancel) ec = asio::error::operation_aborted;
+        return or_throw(yield, ec, next);
+    }
+
+    // Read the data blocks in the range, one chunk per block.
+    // Each block is verified once the next chunk header
+    // with its signature and the chained hash of the previous block arrives.
+    size_t
+    read_blocks( http_response::Reader& reader
+               , const cache::HttpBlockRange& range
+               , bool head_done
+               , asio::yield_context yield)
+    {
+        size_t index = range.first;
+        vector<uint8_t> data;
+        bool in_block = (block_size(index) == 0);  // empty body, no chunk for it
+
+        sys::error_code ec;
+        while (true) {
+            auto part = reader.async_read_part(lifetime_cancel, yield[ec]);
+            if (!ec && !part) ec = bad_message();  // truncated response
+            if (ec) return or_throw(yield, ec, index);
+
+            if (auto inh = part->as_head()) {
+                if (head_done) return or_throw(yield, bad_message(), index);
+                head_done = true;
+                if (inh->result() != http::status::ok)
+                    return or_throw(yield, asio::error::not_found, index);
+                auto r = cache::HttpBlockRange::parse((*inh)[http_::block_range_hdr]);
+                if (!r || r->first != range.first || r->last != range.last)
+                    return or_throw(yield, asio::error::operation_not_supported, index);
+                continue;
+            }
+
+            if (auto ch = part->as_chunk_hdr()) {
+                if (in_block) {
+                    if (data.size() != block_size(index)) {
+                        LOG_WARN("Incomplete data block from peer: ", index, "; uri=", uri);
+                        return or_throw(yield, bad_message(), index);
+                    }
+                    add_block(index, std::move(data), ch->exts, yield[ec]);
+                    if (ec) return or_throw(yield, ec, index);
+                    ++index;
+                    in_block = false;
+                    data = {};
+                }
+                if (ch->size == 0) continue;  // last chunk, trailer comes next
+                if (index > range.last || ch->size != block_size(index)) {
+                    LOG_WARN("Chunk does not match data block from peer: ", index, "; uri=", uri);
+                    return or_throw(yield, bad_message(), index);
+                }
+                data.reserve(ch->size);
+                in_block = true;
+                continue;
+            }
+
+            if (auto cb = part->as_chunk_body()) {
+                if (!in_block || data.size() + cb->size() > block_size(index)) {
+                    LOG_WARN("Chunk data overflows data block boundary; uri=", uri);
+                    return or_throw(yield, bad_message(), index);
+                }
+                data.insert(data.end(), cb->begin(), cb->end());
+                continue;
+            }
+
+            if (part->is_trailer()) break;
+
+            return or_throw(yield, bad_message(), index);  // not chunked
+        }
+
+        return index;
+    }
+
+    void
+    add_block( size_t index, vector<uint8_t> data
+             , boost::string_view exts
+             , asio::yield_context yield)
+    {
+        auto sig = cache::http_block_signature(exts);
+        boost::optional<cache::HttpBlockDigest> prev_digest;
+        if (index > 0) prev_digest = cache::http_block_prev_digest(exts);
+        if (!sig || (index > 0 && !prev_digest)) {
+            LOG_WARN("Missing signature or chain hash for data block ", index, "; uri=", uri);
+            return or_throw(yield, bad_message());
+        }
+
+        auto digest = cache::http_block_digest(prev_digest, asio::buffer(data));
+        if (!cache::http_block_verify(*bs_params, injection_id, digest, *sig, yield)) {
+            LOG_WARN("Failed to verify data block ", index, "; uri=", uri);
+            return or_throw(yield, bad_message());
+        }
+
+        if (index >= next_block)
+            ready.emplace(index, Block{std::move(data), *sig, std::move(prev_digest), digest});
+        changed.notify();
+    }
+
+    // Output
+    // ------
+
+    queue<http_response::Part> pending_parts;
+    bool is_head_done = false;
+    bool is_done = false;
+    bool is_closed = false;
+    cache::HttpBlockChain chain;
+    util::SHA256 body_hash;
+    size_t body_length = 0;
+
+    optional_part
+    read_part(Cancel& cancel, asio::yield_context yield)
+    {
+        if (!is_head_done) {
+            is_head_done = true;
+            return start(cancel, yield);
+        }
+
+        if (!pending_parts.empty()) {
+            auto part = std::move(pending_parts.front());
+            pending_parts.pop();
+            return part;
+        }
+
+        if (is_done) return boost::none;
+
+        sys::error_code ec;
+
+        if (next_block >= block_count) {
+            cache::http_check_body(head, body_length, body_hash, uri, ec);
+            if (ec) return or_throw(yield, ec, boost::none);
+            is_done = true;
+            pending_parts.push(http_response::Trailer());
+            return http_response::Part(http_response::ChunkHdr(0, chain.chunk_exts()));
+        }
+
+        auto bit = ready.find(next_block);
+        while (bit == ready.end()) {
+            if (peer_count == 0 && !has_more_peers) {
+                LOG_WARN("No more peers to get data block ", next_block, " from; uri=", uri);
+                return or_throw( yield
+                               , last_error ? last_error : asio::error::not_found
+                               , boost::none);
+            }
+            // Waking everybody up is harmless, they just check again.
+            auto cancelled = cancel.connect([&] { changed.notify(asio::error::operation_aborted); });
+            changed.wait(yield[ec]);
+            if (cancel) return or_throw(yield, asio::error::operation_aborted, boost::none);
+            bit = ready.find(next_block);
+        }
+
+        auto block = std::move(bit->second);
+        ready.erase(bit);
+        if (block.prev_digest != chain.digest()) {
+            LOG_WARN("Chain hash mismatch for data block ", next_block, "; uri=", uri);
+            return or_throw(yield, bad_message(), boost::none);
+        }
+        ++next_block;
+        changed.notify();  // peers may be waiting to get further ahead
+
+        http_response::ChunkHdr ch(block.data.size(), chain.chunk_exts());
+        chain.add(block.sig, block.digest);
+
+        body_length += block.data.size();
+        body_hash.update(block.data);
+
+        if (block.data.empty())  // empty body, no chunk for it
+            return read_part(cancel, yield);
+
+        pending_parts.push(http_response::ChunkBody(std::move(block.data), 0));
+        return http_response::Part(std::move(ch));
+    }
+
+    void
+    close()
+    {
+        is_closed = true;
+        if (!lifetime_cancel) lifetime_cancel();
+        first_peer.close();
+        changed.notify(asio::error::operation_aborted);
+    }
+};
+
+MultiPeerReader::MultiPeerReader( const asio::executor& ex
+                                , http::request<http::empty_body> rq
+                                , GenericStream first_peer
+                                , PeerGenerator peer_gen
+                                , util::Ed25519PublicKey pk)
+    : _impl(std::make_shared<Impl>( ex, std::move(rq), std::move(first_peer)
+                             , std::move(peer_gen), std::move(pk)))
+{
+}
+
+MultiPeerReader::~MultiPeerReader()
+{
+    _impl->close();
+}
+
+optional_part
+MultiPeerReader::async_read_part(Cancel cancel, asio::yield_context yield)
+{
+    if (!is_open()) return or_throw(yield, asio::error::bad_descriptor, boost::none);
+    return _impl->read_part(cancel, yield);
+}
+
+bool
+MultiPeerReader::is_done() const
+{
+    return _impl->is_done;
+}
+
+bool
+MultiPeerReader::is_open() const
+{
+    return !_impl->is_closed;
+}
+
+void
+MultiPeerReader::close()
+{
+    _impl->close();
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+
+#include <boost/beast/http/empty_body.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/optional.hpp>
+
+#include "../../generic_stream.h"
+#include "../../response_reader.h"
+#include "../../util/crypto.h"
+#include "../../util/signal.h"
+
+namespace ouinet { namespace cache { namespace bep5_http {
+
+// Reads a signed response from several peers in parallel,
+// each of them sending different ranges of data blocks
+// (see `http_::block_range_hdr`).
+//
+// The head comes from the first peer, along with the first few data blocks.
+// If the response has more blocks, connections to other peers are taken
+// from the given generator (which returns none when there are no more peers),
+// and the rest of blocks are spread among them.
+// Every data block is verified on its own as soon as it is received,
+// and blocks are output in order once the chain of hashes is checked.
+// Slow or misbehaving peers are dropped and their ranges handed to others.
+//
+// Peers not supporting ranges just send the whole response,
+// which is read from them as a single range.
+//
+// The output preserves all the information and formatting needed
+// to be verified again, as with `VerifyingReader`.
+// Reading fails with `boost::system::errc::no_message`
+// if the response head failed to be verified or was not acceptable;
+// or with `boost::system::errc::bad_message`
+// if verification fails later on.
+class MultiPeerReader : public http_response::AbstractReader {
+public:
+    using PeerGenerator
+        = std::function<boost::optional<GenericStream>(Cancel&, asio::yield_context)>;
+
+public:
+    // The request is sent to every peer (with a block range header added).
+    MultiPeerReader( const asio::executor&
+                   , http::request<http::empty_body>
+                   , GenericStream first_peer
+                   , PeerGenerator
+                   , util::Ed25519PublicKey);
+
+    ~MultiPeerReader() override;
+
+    boost::optional<http_response::Part>
+    async_read_part(Cancel, asio::yield_context) override;
+
+    bool is_done() const override;
+    bool is_open() const override;
+    void close() override;
+
+private:
+    struct Impl;
+    std::shared_ptr<Impl> _impl;
+};
+
+}}} // namespaces
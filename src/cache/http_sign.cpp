@@ -1,9 +1,11 @@
 #include "http_sign.h"
 
 #include <algorithm>
+#include <deque>
 #include <map>
 #include <queue>
 #include <sstream>
+#include <thread>
 #include <tuple>
 #include <utility>
 #include <vector>
@@ -21,8 +23,12 @@
 #include "../split_string.h"
 #include "../util.h"
 #include "../util/bytes.h"
+#include "../util/condition_variable.h"
+#include "../util/handler_tracker.h"
 #include "../util/hash.h"
 #include "../util/quantized_buffer.h"
+#include "../util/shared_bytes.h"
+#include "../util/thread_pool.h"
 #include "../util/variant.h"
 
 namespace ouinet { namespace cache {
@@ -231,7 +237,7 @@ http_injection_verify( http::response_header<> rsh
         } else hit++;
     }
 
-    auto keyId = http_key_id_for_injection(pk);  // TODO: cache this
+    auto keyId = http_key_id_for_injection(pk);
     bool sig_ok = false;
     http::fields extra = rsh;  // all extra for the moment
 
@@ -563,6 +569,88 @@ http_signature( const http::response_header<>& rsh
 
 using optional_part = boost::optional<http_response::Part>;
 
+// Hashing and signing data blocks (and signing heads and trailers)
+// takes most of the injector's CPU time,
+// so it is done here instead of in the I/O thread,
+// which keeps reading from origins and writing to clients meanwhile.
+static
+util::ThreadPool&
+block_signing_pool()
+{
+    static util::ThreadPool pool(std::max(1u, std::min(4u, std::thread::hardware_concurrency())));
+    return pool;
+}
+
+// Maximum number of data blocks read from the origin
+// while waiting to be hashed and signed.
+static const std::size_t block_signing_max_pending = 4;
+
+// Hashes and signs data blocks in the signing pool
+// in the order they are added, one at a time
+// (since the hash of each block depends on the previous one).
+//
+// It is shared with the coroutine doing the work,
+// so it may outlive the reader.
+struct BlockSigner {
+    const std::string injection_id;
+    const util::Ed25519PrivateKey sk;
+
+    util::SHA256 body_hash;
+    util::SHA512 block_hash;  // of the next block
+    // Blocks waiting to be hashed and signed (the first one may be in progress).
+    std::deque<util::SharedBytes> pending;
+    // Chunk extensions of signed blocks, in order.
+    std::deque<std::string> exts;
+    bool running = false;
+    ConditionVariable cv;
+
+    BlockSigner( const asio::executor& ex
+               , std::string injection_id
+               , util::Ed25519PrivateKey sk)
+        : injection_id(std::move(injection_id))
+        , sk(std::move(sk))
+        , cv(ex)
+    {}
+
+    static
+    void add( const std::shared_ptr<BlockSigner>& self
+            , util::SharedBytes block
+            , const asio::executor& ex)
+    {
+        self->pending.push_back(std::move(block));
+        if (self->running) return;
+
+        self->running = true;
+        TRACK_SPAWN(ex, ([self] (asio::yield_context yield) {
+            while (!self->pending.empty()) {
+                // Keep the block here so that its storage is released in this thread.
+                auto block = self->pending.front();
+                auto ext = block_signing_pool().run([&] {
+                    return self->sign(block);
+                }, yield);
+                self->pending.pop_front();
+                self->exts.push_back(std::move(ext));
+                self->cv.notify();
+            }
+            self->running = false;
+        }));
+    }
+
+    bool idle() const { return !running; }
+
+private:
+    std::string sign(const util::SharedBytes& block)
+    {
+        body_hash.update(block);
+        // HASH[0]=SHA2-512(BLOCK[0]), HASH[i]=SHA2-512(HASH[i-1] BLOCK[i])
+        block_hash.update(block);
+        auto block_digest = block_hash.close();
+        block_hash.reset();
+        block_hash.update(block_digest);
+        return block_chunk_ext(injection_id, block_digest, sk);
+    }
+};
+
 struct SigningReader::Impl {
     const http::request_header<> rqh;
     const std::string injection_id;
@@ -580,14 +668,16 @@ struct SigningReader::Impl {
         , injection_ts(std::move(injection_ts))
         , sk(std::move(sk))
     {
-        httpsig_key_id = http_key_id_for_injection(sk.public_key());  // TODO: cache this
+        httpsig_key_id = http_key_id_for_injection(this->sk.public_key());
     }
 
+    asio::executor ex;
     bool do_inject = false;
     http::response_header<> outh;
+    std::shared_ptr<BlockSigner> signer;
 
     optional_part
-    process_part(http_response::Head inh, Cancel, asio::yield_context)
+    process_part(http_response::Head inh, Cancel cancel, asio::yield_context yield)
     {
         auto inh_orig = inh;
         sys::error_code ec_;
@@ -595,9 +685,13 @@ struct SigningReader::Impl {
         if (ec_) return http_response::Part(std::move(inh_orig));  // will not inject, just proxy
 
         do_inject = true;
-        inh = cache::http_injection_head( rqh, std::move(inh)
-                                        , injection_id, injection_ts
-                                        , sk, httpsig_key_id);
+        signer = std::make_shared<BlockSigner>(ex, injection_id, sk);
+        inh = block_signing_pool().run([&] {
+            return cache::http_injection_head( rqh, std::move(inh)
+                                             , injection_id, injection_ts
+                                             , sk, httpsig_key_id);
+        }, yield);
+        if (cancel) return or_throw(yield, asio::error::operation_aborted, boost::none);
         // We will use the trailer to send the body digest and head signature.
         assert(http::response<http::empty_body>(inh).chunked());
 
@@ -616,44 +710,74 @@ struct SigningReader::Impl {
     }
 
     size_t body_length = 0;
-    size_t block_offset = 0;
-    util::SHA256 body_hash;
-    util::SHA512 block_hash;  // for first block
     // Simplest implementation: one output chunk per data block.
     util::quantized_buffer qbuf{http_::response_data_block};
     std::queue<http_response::Part> pending_parts;
+    util::SlabAllocator block_alloc;
+    // Blocks being signed and not yet sent.
+    std::queue<util::SharedBytes> unsent_blocks;
+    size_t sent_blocks = 0;
 
     // If a whole data block has been processed,
-    // return a chunk header and keep block as chunk body.
+    // return a chunk header and keep block as chunk body
+    // (when injecting, the block is kept until it can be sent, see `pop_block`).
     optional_part
-    process_part(std::vector<uint8_t> inbuf, Cancel, asio::yield_context)
+    process_part(const util::SharedBytes& inbuf, Cancel, asio::yield_context)
     {
-        // Just count transferred data and feed the hash.
+        // Just count transferred data.
         body_length += inbuf.size();
-        if (do_inject) body_hash.update(inbuf);
-        qbuf.put(asio::buffer(inbuf));
+        qbuf.put(asio::const_buffer(inbuf));
         auto block_buf =
             (inbuf.size() > 0) ? qbuf.get() : qbuf.get_rest();  // send rest if no more input
 
         if (block_buf.size() == 0)
             return boost::none;  // no data to send yet
+        auto block = block_alloc.copy(block_buf);
+
+        if (do_inject) {
+            BlockSigner::add(signer, block, ex);
+            unsent_blocks.push(std::move(block));
+            return boost::none;
+        }
+
         // Keep block as chunk body.
-        auto block_vec = util::bytes::to_vector<uint8_t>(block_buf);
-        pending_parts.push(http_response::ChunkBody(std::move(block_vec), 0));
-
-        http_response::ChunkHdr ch(block_buf.size(), {});
-        if (do_inject) {  // if injecting and sending data
-            if (block_offset > 0) {  // add chunk extension for previous block
-                auto block_digest = block_hash.close();
-                ch.exts = block_chunk_ext(injection_id, block_digest, sk);
-                // Prepare chunk extension for next block: HASH[i]=SHA2-512(HASH[i-1] BLOCK[i])
-                block_hash = {};
-                block_hash.update(block_digest);
-            }  // else HASH[0]=SHA2-512(BLOCK[0])
-            block_hash.update(block_buf);
-            block_offset += block_buf.size();
+        pending_parts.push(http_response::ChunkBody(std::move(block), 0));
+        return http_response::Part(http_response::ChunkHdr(block_buf.size(), {}));
+    }
+
+    // If the next block to send can already carry the signature
+    // of the previous block, return a chunk header and keep block as chunk body.
+    optional_part
+    pop_block()
+    {
+        if (unsent_blocks.empty()) return boost::none;
+
+        http_response::ChunkHdr ch(unsent_blocks.front().size(), {});
+        if (sent_blocks > 0) {  // add chunk extension for previous block
+            if (signer->exts.empty()) return boost::none;
+            ch.exts = std::move(signer->exts.front());
+            signer->exts.pop_front();
         }
-        return http_response::Part(std::move(ch));  // pass data on, drop origin extensions
+
+        pending_parts.push(http_response::ChunkBody(std::move(unsent_blocks.front()), 0));
+        unsent_blocks.pop();
+        ++sent_blocks;
+        return http_response::Part(std::move(ch));
+    }
+
+    // Whether too many blocks are waiting to be signed
+    // to read more data from the origin.
+    bool signer_is_busy() const
+    {
+        return do_inject && signer->pending.size() >= block_signing_max_pending;
+    }
+
+    void wait_for_signer(Cancel& cancel, asio::yield_context yield)
+    {
+        sys::error_code ec;
+        signer->cv.wait(cancel, yield[ec]);
+        if (cancel) ec = asio::error::operation_aborted;
+        return or_throw(yield, ec);
     }
 
     http::fields trailer_in;
@@ -673,23 +797,38 @@ struct SigningReader::Impl {
         if (is_done) return boost::none;  // avoid adding a last chunk indefinitely
 
         sys::error_code ec;
-        auto last_block_ch = process_part(std::vector<uint8_t>(), cancel, yield[ec]);
+        auto last_block_ch = process_part(util::SharedBytes(), cancel, yield[ec]);
         return_or_throw_on_error(yield, cancel, ec, boost::none);
         if (last_block_ch) return last_block_ch;
 
-        is_done = true;
         if (!do_inject) {
+            is_done = true;
             pending_parts.push(std::move(trailer_in));
             return http_response::Part(http_response::ChunkHdr());
         }
 
-        auto block_digest = block_hash.close();
-        auto last_ch = http_response::ChunkHdr(
-            0, block_chunk_ext(injection_id, block_digest, sk));
-        auto trailer = cache::http_injection_trailer( outh, std::move(trailer_in)
-                                                    , body_length, body_hash.close()
-                                                    , sk
-                                                    , httpsig_key_id);
+        // Send blocks still being signed, then wait for the last signature.
+        while (!unsent_blocks.empty() || !signer->idle()) {
+            if (auto ch = pop_block()) return ch;
+            wait_for_signer(cancel, yield[ec]);
+            return_or_throw_on_error(yield, cancel, ec, boost::none);
+        }
+
+        is_done = true;
+        http_response::ChunkHdr last_ch;
+        http::fields trailer;
+        block_signing_pool().run([&] {
+            // With no data blocks, sign the digest of empty data.
+            last_ch.exts = signer->exts.empty()
+                ? block_chunk_ext(injection_id, signer->block_hash.close(), sk)
+                : std::move(signer->exts.front());
+            trailer = cache::http_injection_trailer( outh, std::move(trailer_in)
+                                                   , body_length, signer->body_hash.close()
+                                                   , sk
+                                                   , httpsig_key_id);
+        }, yield);
+        if (cancel) return or_throw(yield, asio::error::operation_aborted, boost::none);
+
         pending_parts.push(std::move(trailer));
         return http_response::Part(std::move(last_ch));
     }
@@ -706,6 +845,7 @@ SigningReader::SigningReader( GenericStream in
                                   , std::move(injection_ts)
                                   , std::move(sk)))
 {
+    _impl->ex = get_executor();
 }
 
 SigningReader::~SigningReader()
@@ -724,6 +864,17 @@ SigningReader::async_read_part(Cancel cancel, asio::yield_context yield)
     }
 
     while (!part) {
+        // Send signed blocks as soon as possible,
+        // but keep reading from the origin while they are being signed.
+        part = _impl->pop_block();
+        if (part) break;
+
+        if (_impl->signer_is_busy()) {
+            _impl->wait_for_signer(cancel, yield[ec]);
+            return_or_throw_on_error(yield, cancel, ec, boost::none);
+            continue;
+        }
+
         part = http_response::Reader::async_read_part(cancel, yield[ec]);
         assert(!_impl->is_done || (_impl->is_done && !part));
         return_or_throw_on_error(yield, cancel, ec, boost::none);
@@ -817,6 +968,55 @@ HttpBlockSigs::parse(boost::string_view bsigs)
     return hbs;
 }
 
+std::string
+HttpBlockRange::str() const
+{
+    return util::str(first, '-', last);
+}
+
+boost::optional<HttpBlockRange>
+HttpBlockRange::parse(boost::string_view s)
+{
+    auto first = parse::number<size_t>(s);
+    if (!first || s.empty() || s[0] != '-') return {};
+    s.remove_prefix(1);
+    auto last = parse::number<size_t>(s);
+    if (!last || !s.empty() || *last < *first) return {};
+    return HttpBlockRange{*first, *last};
+}
+
+boost::optional<HttpBlockRange>
+HttpByteRange::blocks(size_t block_size, size_t data_size) const
+{
+    if (block_size == 0 || first >= data_size) return {};
+    auto l = std::min(last ? *last : data_size - 1, data_size - 1);
+    return HttpBlockRange{first / block_size, l / block_size};
+}
+
+boost::optional<HttpByteRange>
+HttpByteRange::parse(boost::string_view s)
+{
+    static const boost::string_view unit = "bytes=";
+    if (!s.starts_with(unit)) return {};
+    s.remove_prefix(unit.size());
+    auto first = parse::number<size_t>(s);  // no suffix ranges
+    if (!first || s.empty() || s[0] != '-') return {};
+    s.remove_prefix(1);
+    if (s.empty()) return HttpByteRange{*first, boost::none};
+    auto last = parse::number<size_t>(s);
+    if (!last || !s.empty() || *last < *first) return {};  // also multiple ranges
+    return HttpByteRange{*first, *last};
+}
+
+std::string
+http_content_range( const HttpBlockRange& range
+                  , size_t block_size, size_t data_size)
+{
+    auto first = range.first * block_size;
+    auto last = std::min((range.last + 1) * block_size, data_size) - 1;
+    return util::str("bytes ", first, '-', last, '/', data_size);
+}
+
 boost::optional<HttpSignature>
 HttpSignature::parse(boost::string_view sig)
 {
@@ -898,6 +1098,138 @@ HttpSignature::verify( const http::response_header<>& rsh
 
 // begin VerifyingReader
 
+// Data block signatures are verified in a pool of threads shared by all readers,
+// so that verification neither blocks the I/O thread
+// nor is limited to a single core.
+static
+util::ThreadPool&
+block_verification_pool()
+{
+    static util::ThreadPool pool(std::max(1u, std::min(4u, std::thread::hardware_concurrency())));
+    return pool;
+}
+
+boost::optional<sig_array_t>
+http_block_signature(boost::string_view chunk_exts)
+{
+    return block_sig_from_exts(chunk_exts);
+}
+
+boost::optional<HttpBlockDigest>
+http_block_prev_digest(boost::string_view xs)
+{
+    if (xs.empty()) return {};  // no extensions
+
+    sys::error_code ec;
+    http::chunk_extensions xp;
+    xp.parse(xs, ec);
+    if (ec) return {};
+
+    auto xit = std::find_if( xp.begin(), xp.end()
+                           , [](const auto& x) {
+                                 return x.first == http_::response_block_chain_hash_ext;
+                             });
+    if (xit == xp.end()) return {};  // no chain hash
+
+    auto decoded_hash = util::base64_decode(xit->second);
+    if (decoded_hash.size() != std::tuple_size<HttpBlockDigest>::value) {
+        LOG_WARN("Malformed data block chain hash");
+        return {};  // invalid Base64, invalid length
+    }
+
+    return util::bytes::to_array<uint8_t, std::tuple_size<HttpBlockDigest>::value>(decoded_hash);
+}
+
+std::string
+http_block_chunk_exts( const boost::optional<sig_array_t>& sig
+                     , const boost::optional<HttpBlockDigest>& prev_digest)
+{
+    return block_chunk_ext(sig, prev_digest);
+}
+
+HttpBlockDigest
+http_block_digest( const boost::optional<HttpBlockDigest>& prev_digest
+                 , asio::const_buffer block)
+{
+    util::SHA512 hash;
+    if (prev_digest) hash.update(*prev_digest);
+    hash.update(block);
+    return hash.close();
+}
+
+bool
+http_block_verify( const HttpBlockSigs& bs_params
+                 , boost::string_view injection_id
+                 , const HttpBlockDigest& digest
+                 , const sig_array_t& sig
+                 , asio::yield_context yield)
+{
+    auto sig_str = block_sig_str(injection_id, digest);
+    return block_verification_pool().run([&] {
+        return bs_params.pk.verify(sig_str, sig);
+    }, yield);
+}
+
+std::string
+HttpBlockChain::chunk_exts() const
+{
+    return block_chunk_ext(_sig, _prev_digest);
+}
+
+void
+HttpBlockChain::add(const sig_array_t& sig, const HttpBlockDigest& digest)
+{
+    _sig = sig;
+    _prev_digest = std::move(_digest);
+    _digest = digest;
+}
+
+void
+http_check_body( const http::response_header<>& head
+               , size_t body_length, util::SHA256& body_hash
+               , boost::string_view uri, sys::error_code& ec)
+{
+    // Check body length.
+    auto h_body_length_h = head[http_::response_data_size_hdr];
+    auto h_body_length = parse::number<size_t>(h_body_length_h);
+    if (!h_body_length) {
+        LOG_WARN("Missing signed length; uri=", uri);
+        ec = sys::errc::make_error_code(sys::errc::bad_message);
+        return;
+    }
+    if (*h_body_length != body_length) {
+        LOG_WARN( "Body length mismatch: ", *h_body_length, "!=", body_length
+                , "; uri=", uri);
+        ec = sys::errc::make_error_code(sys::errc::bad_message);
+        return;
+    }
+    LOG_DEBUG("Body matches signed length: ", body_length, "; uri=", uri);
+
+    // Get body digest value.
+    auto b_digest = http_digest(body_hash);
+    auto b_digest_s = split_string_pair(b_digest, '=');
+
+    // Get digest values in head and compare (if algorithm matches).
+    auto h_digests = head.equal_range(http::field::digest);
+    for (auto hit = h_digests.first; hit != h_digests.second; hit++) {
+        auto h_digest_s = split_string_pair(hit->value(), '=');
+        if (boost::algorithm::iequals(b_digest_s.first, h_digest_s.first)) {
+            if (b_digest_s.second != h_digest_s.second) {
+                LOG_WARN( "Body digest mismatch: ", hit->value(), "!=", b_digest
+                        , "; uri=", uri);
+                ec = sys::errc::make_error_code(sys::errc::bad_message);
+                return;
+            }
+            LOG_DEBUG("Body matches signed digest: ", b_digest, "; uri=", uri);
+        }
+    }
+}
+
+// Verified data blocks are released in batches:
+// the first batch has a single block (to output data as soon as possible),
+// then each batch doubles in size up to this number of blocks.
+static const std::size_t block_verification_batch_max = 8;
+
 struct VerifyingReader::Impl {
     const util::Ed25519PublicKey pk;
 
@@ -911,10 +1243,33 @@ struct VerifyingReader::Impl {
     std::string injection_id;
     boost::optional<HttpBlockSigs> bs_params;
     std::unique_ptr<util::quantized_buffer> qbuf;
+    util::SlabAllocator block_alloc;
+
+    // For partial responses, the first and last bytes of data that they carry.
+    boost::optional<std::pair<size_t, size_t>> partial_range;
 
     optional_part
     process_part(http_response::Head inh, Cancel, asio::yield_context y)
     {
+        // A partial response from a range request to a cache
+        // needs the original status and no range header to verify its head,
+        // but they are restored on output.
+        std::string orig_status, content_range;
+        if (!inh[http_::response_original_http_status].empty()) {
+            orig_status = inh[http_::response_original_http_status].to_string();
+            content_range = inh[http::field::content_range].to_string();
+            boost::string_view os(orig_status);
+            auto status = parse::number<unsigned>(os);
+            if ( !status || !os.empty() || content_range.empty()
+               || inh.result() != http::status::partial_content) {
+                LOG_WARN("Malformed partial HTTP response head");
+                return or_throw(y, sys::errc::make_error_code(sys::errc::no_message), boost::none);
+            }
+            inh.result(*status);
+            inh.erase(http_::response_original_http_status);
+            inh.erase(http::field::content_range);
+        }
+
         // Verify head signature.
         head = cache::http_injection_verify(std::move(inh), pk);
         if (head.cbegin() == head.cend()) {
@@ -949,16 +1304,57 @@ struct VerifyingReader::Impl {
             return or_throw(y, sys::errc::make_error_code(sys::errc::no_message), boost::none);
         }
         qbuf = std::make_unique<util::quantized_buffer>(bs_params->size);
-        return http_response::Part(head);  // do not move
+
+        if (content_range.empty())
+            return http_response::Part(head);  // do not move
+
+        // Partial data must start and end at data block boundaries,
+        // so that its blocks can be verified.
+        auto ds_h = head[http_::response_data_size_hdr];
+        auto data_size = parse::number<size_t>(ds_h);
+        partial_range = parse_content_range(content_range, data_size);
+        if ( !partial_range
+           || partial_range->first % bs_params->size != 0
+           || ( (partial_range->second + 1) % bs_params->size != 0
+              && partial_range->second + 1 != *data_size)) {
+            LOG_WARN("Invalid range in partial HTTP response: ", content_range, "; uri=", uri);
+            return or_throw(y, sys::errc::make_error_code(sys::errc::no_message), boost::none);
+        }
+        block_offset = partial_range->first;
+
+        auto out_head = head;
+        out_head.result(http::status::partial_content);
+        out_head.set(http_::response_original_http_status, orig_status);
+        out_head.set(http::field::content_range, content_range);
+        return http_response::Part(std::move(out_head));
+    }
+
+    // Parse `bytes FIRST-LAST/SIZE` for data of the given size.
+    static
+    boost::optional<std::pair<size_t, size_t>>
+    parse_content_range(boost::string_view cr, const boost::optional<size_t>& data_size)
+    {
+        static const boost::string_view unit = "bytes ";
+        if (!data_size || !cr.starts_with(unit)) return {};
+        cr.remove_prefix(unit.size());
+        auto first = parse::number<size_t>(cr);
+        if (!first || cr.empty() || cr[0] != '-') return {};
+        cr.remove_prefix(1);
+        auto last = parse::number<size_t>(cr);
+        if (!last || cr.empty() || cr[0] != '/') return {};
+        cr.remove_prefix(1);
+        auto size = parse::number<size_t>(cr);
+        if (!size || !cr.empty() || *size != *data_size) return {};
+        if (*last < *first || *last >= *size) return {};
+        return std::make_pair(*first, *last);
     }
 
     size_t block_offset = 0;
     util::SHA512 block_hash;
-    opt_sig_array_t prev_block_sig;
-    opt_block_digest_t block_dig, prev_block_dig;
+    HttpBlockChain chain;
     // Simplest implementation: one output chunk per data block.
-    // If a whole data block has been processed,
-    // return its chunk header and push the block as its chunk body.
+    // Once a batch of whole data blocks has been verified,
+    // queue the chunk header and body of each block.
     std::queue<http_response::Part> pending_parts;
 
     optional_part
@@ -984,52 +1380,108 @@ struct VerifyingReader::Impl {
             LOG_WARN("Missing signature for data block with offset ", block_offset, "; uri=", uri);
             return or_throw(y, sys::errc::make_error_code(sys::errc::bad_message), boost::none);
         }
+        // The first data block of a partial response is chained to
+        // the hash of the block before it, sent in the following chunk header.
+        if (block_offset > 0 && !chain.digest()) {
+            chain = HttpBlockChain(http_block_prev_digest(inch.exts));
+            if (!chain.digest()) {
+                LOG_WARN("Missing chain hash for data block with offset ", block_offset, "; uri=", uri);
+                return or_throw(y, sys::errc::make_error_code(sys::errc::bad_message), boost::none);
+            }
+            block_hash.update(*chain.digest());
+        }
         // Complete hash for the data block; note that HASH[0]=SHA2-512(BLOCK[0])
         block_hash.update(block_buf);
         auto block_digest = block_hash.close();
         auto bsig_str = block_sig_str(injection_id, block_digest);
-        if (!bs_params->pk.verify(bsig_str, *block_sig)) {
-            LOG_WARN("Failed to verify data block with offset ", block_offset, "; uri=", uri);
-            return or_throw(y, sys::errc::make_error_code(sys::errc::bad_message), boost::none);
-        }
 
-        // Keep data block signature for next chunk header.
-        auto prev_prev_block_sig = std::move(prev_block_sig);
-        prev_block_sig = std::move(block_sig);
+        // Chunk header extensions for this data block (see `HttpBlockChain`).
+        auto chunk_exts = chain.chunk_exts();
+        chain.add(*block_sig, block_digest);
         // Prepare hash for next data block: HASH[i]=SHA2-512(HASH[i-1] BLOCK[i])
-        block_hash = {}; block_hash.update(block_digest);
+        block_hash.reset(); block_hash.update(block_digest);
+        auto this_block_offset = block_offset;
         block_offset += block_buf.size();
-        // Chain hash is to be sent along the signature of the following data block,
-        // so that it may convey the missing information for computing the signing string
-        // if the receiver does not have the previous data blocks (e.g. for range requests).
-        // (Bk0) (Sig0 Bk1) (Sig1 Hash0 Bk2) ... (SigN-1 HashN-2 BkN) (SigN HashN-1)
-        auto prev_prev_block_dig = std::move(prev_block_dig);
-        prev_block_dig = std::move(block_dig);
-        block_dig = std::move(block_digest);
 
-        if (block_buf.size() == 0)
-            return boost::none;  // empty data block
+        // Queue the data block for verification, it is only output once verified:
+        // chunk header for data block (with previous extensions),
+        // data block as chunk body.
+        unverified.push_back(UnverifiedBlock{
+            this_block_offset, std::move(bsig_str), *block_sig,
+            http_response::ChunkHdr(block_buf.size(), std::move(chunk_exts)),
+            http_response::ChunkBody(block_alloc.copy(block_buf), 0)});
+
+        // Verify queued data blocks if there are enough of them
+        // or if there are no more data blocks.
+        if (inch.size > 0 && unverified.size() < batch_size)
+            return boost::none;
 
-        // Chunk header for data block (with previous extensions),
-        // keep data block as chunk body.
-        http_response::ChunkBody cb(util::bytes::to_vector<uint8_t>(block_buf), 0);
-        pending_parts.push(std::move(cb));
+        sys::error_code ec;
+        verify_blocks(y[ec]);
+        if (ec) return or_throw(y, ec, boost::none);
 
-        http_response::ChunkHdr ch( block_buf.size()
-                                  , block_chunk_ext(prev_prev_block_sig, prev_prev_block_dig));
-        return http_response::Part(std::move(ch));
+        return pop_pending_part();
+    }
+
+    struct UnverifiedBlock {
+        size_t offset;
+        std::string sig_str;
+        sig_array_t sig;
+        http_response::ChunkHdr chunk_hdr;
+        http_response::ChunkBody chunk_body;
+    };
+    std::vector<UnverifiedBlock> unverified;
+    std::size_t batch_size = 1;
+
+    // Verify the signatures of queued data blocks in parallel
+    // and queue their chunks for output.
+    // Fail on the first data block with a bad signature.
+    void
+    verify_blocks(asio::yield_context y)
+    {
+        if (unverified.empty()) return;
+
+        std::vector<char> ok(unverified.size(), false);  // not `vector<bool>`, written concurrently
+        const auto& block_pk = bs_params->pk;
+        block_verification_pool().run_each(unverified.size(), [&] (size_t i) {
+            ok[i] = block_pk.verify(unverified[i].sig_str, unverified[i].sig);
+        }, y);
+
+        for (size_t i = 0; i < unverified.size(); ++i) {
+            if (ok[i]) continue;
+            LOG_WARN("Failed to verify data block with offset ", unverified[i].offset, "; uri=", uri);
+            unverified.clear();
+            return or_throw(y, sys::errc::make_error_code(sys::errc::bad_message));
+        }
+
+        for (auto& b : unverified) {
+            if (b.chunk_hdr.size == 0) continue;  // empty data block, no chunk for it
+            pending_parts.push(std::move(b.chunk_hdr));
+            pending_parts.push(std::move(b.chunk_body));
+        }
+        unverified.clear();
+        batch_size = std::min(2 * batch_size, block_verification_batch_max);
+    }
+
+    optional_part
+    pop_pending_part()
+    {
+        if (pending_parts.empty()) return boost::none;
+        auto part = std::move(pending_parts.front());
+        pending_parts.pop();
+        return part;
     }
 
     size_t body_length = 0;
     util::SHA256 body_hash;
 
     optional_part
-    process_part(std::vector<uint8_t> ind, Cancel, asio::yield_context y)
+    process_part(const util::SharedBytes& ind, Cancel, asio::yield_context y)
     {
         body_length += ind.size();
         body_hash.update(ind);
         try {
-            qbuf->put(asio::buffer(ind));
+            qbuf->put(asio::const_buffer(ind));
         } catch (const std::length_error&) {
             LOG_ERROR("Chunk data overflows data block boundary; uri=", uri);
             return or_throw(y, sys::errc::make_error_code(sys::errc::bad_message), boost::none);
@@ -1046,6 +1498,11 @@ struct VerifyingReader::Impl {
     optional_part
     process_part(http_response::Trailer intr, Cancel, asio::yield_context y)
     {
+        // Data blocks should have been verified on the last chunk header, anyway.
+        sys::error_code ec;
+        verify_blocks(y[ec]);
+        if (ec) return or_throw(y, ec, boost::none);
+
         // Only expected trailer headers are received here, just extend initial head.
         bool sigs_in_trailer = false;
         for (const auto& h : intr) {
@@ -1060,10 +1517,10 @@ struct VerifyingReader::Impl {
                 return or_throw(y, sys::errc::make_error_code(sys::errc::bad_message), boost::none);
         }
 
+        http_response::ChunkHdr ch(0, chain.chunk_exts());
+        pending_parts.push(std::move(ch));
         pending_parts.push(std::move(intr));
-
-        http_response::ChunkHdr ch(0, block_chunk_ext(prev_block_sig, prev_block_dig));
-        return http_response::Part(std::move(ch));
+        return pop_pending_part();
     }
 
     bool is_done = false;
@@ -1074,40 +1531,18 @@ struct VerifyingReader::Impl {
         if (is_done) return;  // avoid re-checking body indefinitely
         is_done = true;
 
-        // Check body length.
-        auto h_body_length_h = head[http_::response_data_size_hdr];
-        auto h_body_length = parse::number<size_t>(h_body_length_h);
-        if (!h_body_length) {
-            LOG_WARN("Missing signed length; uri=", uri);
-            ec = sys::errc::make_error_code(sys::errc::bad_message);
-            return;
-        }
-        if (*h_body_length != body_length) {
-            LOG_WARN( "Body length mismatch: ", *h_body_length, "!=", body_length
-                    , "; uri=", uri);
-            ec = sys::errc::make_error_code(sys::errc::bad_message);
-            return;
-        }
-        LOG_DEBUG("Body matches signed length: ", body_length, "; uri=", uri);
-
-        // Get body digest value.
-        auto b_digest = http_digest(body_hash);
-        auto b_digest_s = split_string_pair(b_digest, '=');
-
-        // Get digest values in head and compare (if algorithm matches).
-        auto h_digests = head.equal_range(http::field::digest);
-        for (auto hit = h_digests.first; hit != h_digests.second; hit++) {
-            auto h_digest_s = split_string_pair(hit->value(), '=');
-            if (boost::algorithm::iequals(b_digest_s.first, h_digest_s.first)) {
-                if (b_digest_s.second != h_digest_s.second) {
-                    LOG_WARN( "Body digest mismatch: ", hit->value(), "!=", b_digest
-                            , "; uri=", uri);
-                    ec = sys::errc::make_error_code(sys::errc::bad_message);
-                    return;
-                }
-                LOG_DEBUG("Body matches signed digest: ", b_digest, "; uri=", uri);
+        // Only the length of partial data can be checked.
+        if (partial_range) {
+            auto range_length = partial_range->second - partial_range->first + 1;
+            if (range_length != body_length) {
+                LOG_WARN( "Partial body length mismatch: ", range_length, "!=", body_length
+                        , "; uri=", uri);
+                ec = sys::errc::make_error_code(sys::errc::bad_message);
             }
+            return;
         }
+
+        http_check_body(head, body_length, body_hash, uri, ec);
     }
 };
 
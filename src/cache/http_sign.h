@@ -46,6 +46,15 @@ namespace ouinet { namespace http_ {
 
     // Maximum data block size that a receiver is going to accept.
     static const size_t response_data_block_max = 1024 * 1024;  // TODO: sensible value
+
+    // A request with this header only asks for the data blocks
+    // in the given range (see `HttpBlockRange`);
+    // a response with it only carries those blocks.
+    static const std::string block_range_hdr = header_prefix + "Block-Range";
+
+    // A partial (206) response keeps the status of the complete signed response
+    // in this header, so that its signatures can still be verified.
+    static const std::string response_original_http_status = header_prefix + "HTTP-Status";
 }}
 
 namespace ouinet { namespace cache {
@@ -177,8 +186,121 @@ struct HttpBlockSigs {
     boost::optional<HttpBlockSigs> parse(boost::string_view);
 };
 
+// A range of data blocks as `FIRST-LAST` (0-based, both inclusive),
+// e.g. as used in the `X-Ouinet-Block-Range` header.
+struct HttpBlockRange {
+    size_t first;
+    size_t last;
+
+    std::string str() const;
+
+    static
+    boost::optional<HttpBlockRange> parse(boost::string_view);
+};
+
+// A single range of data bytes from an HTTP `Range` request header,
+// as `bytes=FIRST-LAST` or `bytes=FIRST-` (0-based, both inclusive).
+// Suffix ranges and multiple ranges are not supported.
+struct HttpByteRange {
+    size_t first;
+    boost::optional<size_t> last;  // none up to the end of data
+
+    // Get the range of data blocks of the given size covering this range
+    // in data of the given size, none if the range is not satisfiable.
+    boost::optional<HttpBlockRange>
+    blocks(size_t block_size, size_t data_size) const;
+
+    static
+    boost::optional<HttpByteRange> parse(boost::string_view);
+};
+
+// Get the value of a `Content-Range` header for the given range of data blocks
+// (the last one may be shorter) in data of the given size.
+std::string
+http_content_range( const HttpBlockRange&
+                  , size_t block_size, size_t data_size);
+
+// Data block signatures
+// ---------------------
+//
+// Each data block is signed along with the chained hash of previous blocks:
+// `HASH[i]=SHA2-512(HASH[i-1] BLOCK[i])`, with `HASH[0]=SHA2-512(BLOCK[0])`.
+// The signature of a block and the chained hash of the block before it
+// are sent as extensions of the following chunk header,
+// so that blocks can be verified without having the previous ones.
+using HttpBlockDigest = util::SHA512::digest_type;
+
+// Get the data block signature from the given chunk extensions, if any.
+boost::optional<util::Ed25519PublicKey::sig_array_t>
+http_block_signature(boost::string_view chunk_exts);
+
+// Get the chained hash of the previous data block
+// from the given chunk extensions, if any.
+boost::optional<HttpBlockDigest>
+http_block_prev_digest(boost::string_view chunk_exts);
+
+// Get chunk extensions with the given data block signature
+// and chained hash of the block before it.
+std::string
+http_block_chunk_exts( const boost::optional<util::Ed25519PublicKey::sig_array_t>&
+                     , const boost::optional<HttpBlockDigest>& prev_digest);
+
+// Compute the chained hash of a data block.
+HttpBlockDigest
+http_block_digest( const boost::optional<HttpBlockDigest>& prev_digest
+                 , asio::const_buffer block);
+
+// Return whether `sig` is a good signature of the data block
+// with the given chained hash, for the injection with the given identifier.
+//
+// Verification runs in a pool of threads shared with `VerifyingReader`.
+bool
+http_block_verify( const HttpBlockSigs&
+                 , boost::string_view injection_id
+                 , const HttpBlockDigest&
+                 , const util::Ed25519PublicKey::sig_array_t&
+                 , asio::yield_context);
+
+// Keeps the signatures and chained hashes of data blocks output in order,
+// to produce the extensions of their chunk headers:
+// `(Bk0) (Sig0 Bk1) (Sig1 Hash0 Bk2) ... (SigN-1 HashN-2 BkN) (SigN HashN-1)`.
+class HttpBlockChain {
+public:
+    // For data not starting with the first block,
+    // `prev_digest` is the chained hash of the block before it.
+    HttpBlockChain(boost::optional<HttpBlockDigest> prev_digest = boost::none)
+        : _digest(std::move(prev_digest))
+    {}
+
+    // Get the extensions for the chunk header of the next data block,
+    // or for the last chunk header.
+    std::string chunk_exts() const;
+
+    // Get the chained hash of the last data block,
+    // which the next one is chained to.
+    const boost::optional<HttpBlockDigest>& digest() const { return _digest; }
+
+    void add(const util::Ed25519PublicKey::sig_array_t&, const HttpBlockDigest&);
+
+private:
+    boost::optional<util::Ed25519PublicKey::sig_array_t> _sig;  // of the last block
+    boost::optional<HttpBlockDigest> _digest, _prev_digest;  // of the last block and the one before
+};
+
+// Check that body data of the given length and hash
+// matches the signed data size and digest in the response head.
+// Fail with error `boost::system::errc::bad_message` otherwise.
+// The URI is only used for warnings.
+void
+http_check_body( const http::response_header<>&
+               , size_t body_length, util::SHA256& body_hash
+               , boost::string_view uri, sys::error_code&);
+
 // Allows reading parts of a response from stream `in`
 // while signing with the private key `sk`.
+//
+// Hashing and signing is done in a pool of threads,
+// while a few more data blocks are read from `in`.
 class SigningReader : public ouinet::http_response::Reader {
 public:
     SigningReader( GenericStream in
@@ -1,8 +1,17 @@
 #include "http_store.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <unordered_set>
+
 #include <boost/asio/buffer.hpp>
 #include <boost/asio/read.hpp>
 #include <boost/asio/read_until.hpp>
+#include <boost/beast/core/buffers_to_string.hpp>
 #include <boost/beast/core/static_buffer.hpp>
 #include <boost/beast/http/empty_body.hpp>
 #include <boost/beast/http/read.hpp>
@@ -14,12 +23,16 @@
 #include "../logger.h"
 #include "../or_throw.h"
 #include "../parse/number.h"
+#include "../http_util.h"
 #include "../util.h"
 #include "../util/atomic_dir.h"
 #include "../util/atomic_file.h"
 #include "../util/bytes.h"
 #include "../util/file_io.h"
+#include "../util/handler_tracker.h"
 #include "../util/hash.h"
+#include "../util/shared_bytes.h"
+#include "../util/temp_dir.h"
 #include "../util/variant.h"
 #include "http_sign.h"
 
@@ -41,7 +54,8 @@ static const boost::regex v1_dir_name_rx("^[0-9a-f]{38}$");
 // File names for response components.
 static const fs::path head_fname = "head";
 static const fs::path body_fname = "body";
-static const fs::path sigs_fname = "sigs";
+static const fs::path sigs_fname = "sigs";  // v1
+static const fs::path bsigs_fname = "bsigs";  // v2
 
 // Block signature and hash handling.
 static
@@ -68,7 +82,7 @@ parse_data_block_offset(const std::string& s)  // `^[0-9a-f]*$`
     for (auto& c : s) {
         assert(('0' <= c && c <= '9') || ('a' <= c && c <= 'f'));
         offset <<= 4;
-        offset += ('0' <= c && c <= '9') ? c - '0' : c - 'a';
+        offset += ('0' <= c && c <= '9') ? c - '0' : c - 'a' + 10;
     }
     return offset;
 }
@@ -81,12 +95,33 @@ struct SigEntry {
 
     using parse_buffer = std::string;
 
+    // Size of binary records (v2).
+    static const std::size_t sig_size = util::Ed25519PublicKey::sig_size;
+    static const std::size_t digest_size = std::tuple_size<util::SHA512::digest_type>::value;
+    static const std::size_t record_size = 8 + sig_size + digest_size;
+
     std::string str() const
     {
         static const auto line_format = "%x %s %s\n";
         return (boost::format(line_format) % offset % signature % prev_digest).str();
     }
 
+    // Return the empty string if the signature or digest is not valid.
+    std::string record() const
+    {
+        auto sig = util::base64_decode(signature);
+        auto dig = util::base64_decode(prev_digest);
+        if (sig.size() != sig_size) return {};
+        if (dig.empty()) dig.resize(digest_size, '\0');  // no HASH[-1]
+        if (dig.size() != digest_size) return {};
+
+        std::string rec(8, '\0');
+        uint64_t o = offset;
+        for (int i = 7; i >= 0; --i, o >>= 8)
+            rec[i] = static_cast<char>(o & 0xff);
+        return rec + sig + dig;
+    }
+
     std::string chunk_exts() const
     {
         std::stringstream exts;
@@ -145,20 +180,88 @@ struct SigEntry {
         buf.erase(0, line_len);  // consume used input
         return entry;
     }
+
+    // Like `parse`, but for binary records (v2).
+    // Records are read from the file in batches.
+    static
+    boost::optional<SigEntry>
+    parse_record( asio::posix::stream_descriptor& in, parse_buffer& buf
+                , Cancel cancel, asio::yield_context yield)
+    {
+        static const std::size_t batch_records = 64;
+
+        sys::error_code ec;
+        if (buf.size() < record_size) {
+            auto have = buf.size();
+            buf.resize(have + batch_records * record_size);
+            auto len = util::file_io::read( in, asio::buffer(&buf[have], buf.size() - have)
+                                          , cancel, yield[ec]);
+            buf.resize(have + len);
+            if (ec == asio::error::eof) ec = {};
+            return_or_throw_on_error(yield, cancel, ec, boost::none);
+        }
+
+        return take_record(buf, yield);
+    }
+
+    // Consume a binary record (v2) from the buffer, if any.
+    static
+    boost::optional<SigEntry>
+    take_record(parse_buffer& buf, asio::yield_context yield)
+    {
+        if (buf.empty()) return boost::none;
+        if (buf.size() < record_size) {
+            _ERROR("Truncated signature record");
+            return or_throw(yield, sys::errc::make_error_code(sys::errc::bad_message), boost::none);
+        }
+
+        std::size_t offset = 0;
+        for (std::size_t i = 0; i < 8; ++i)
+            offset = (offset << 8) | static_cast<uint8_t>(buf[i]);
+        boost::string_view sig(&buf[8], sig_size);
+        boost::string_view dig(&buf[8 + sig_size], digest_size);
+
+        // There is no HASH[-1] for the first block.
+        SigEntry entry{ offset, util::base64_encode(sig)
+                      , offset > 0 ? util::base64_encode(dig) : ""};
+        buf.erase(0, record_size);  // consume used input
+        return entry;
+    }
 };
 
 class SplittedWriter {
 public:
-    SplittedWriter(const fs::path& dirp, const asio::executor& ex)
-        : dirp(dirp), ex(ex) {}
+    using make_dir_func = std::function<fs::path(sys::error_code&)>;
+
+    // Block signatures are stored as binary records (v2) if `binary_sigs`,
+    // otherwise as text lines (v1).
+    SplittedWriter(const fs::path& dirp, const asio::executor& ex, bool binary_sigs)
+        : dirp(dirp), ex(ex), binary_sigs(binary_sigs) {}
+
+    // Like the above, but keep the content of files in memory
+    // while it takes no more than `max_in_memory` bytes,
+    // then write files to the directory returned by `make_dir`.
+    SplittedWriter( const asio::executor& ex, bool binary_sigs
+                  , std::size_t max_in_memory, make_dir_func make_dir)
+        : ex(ex), binary_sigs(binary_sigs)
+        , max_in_memory(max_in_memory), make_dir(std::move(make_dir)) {}
 
 private:
-    const fs::path& dirp;
+    struct File {
+        bool created = false;
+        boost::optional<asio::posix::stream_descriptor> fd;
+        std::string data;  // while in memory
+    };
+
+    fs::path dirp;
     const asio::executor& ex;
+    const bool binary_sigs;
+    boost::optional<std::size_t> max_in_memory;  // none once writing to files
+    make_dir_func make_dir;
 
     std::string uri;  // for warnings, should use `Yield::log` instead
     http_response::Head head;  // for merging in the trailer later on
-    boost::optional<asio::posix::stream_descriptor> headf, bodyf, sigsf;
+    File headf, bodyf, sigsf;
 
     std::size_t block_size;
     std::size_t byte_count = 0;
@@ -166,20 +269,69 @@ private:
     util::SHA512 block_hash;
     boost::optional<util::SHA512::digest_type> prev_block_digest;
 
-    inline
-    asio::posix::stream_descriptor
-    create_file(const fs::path& fname, Cancel cancel, sys::error_code& ec)
+    const fs::path& sigs_fname_() const
+    {
+        return binary_sigs ? bsigs_fname : sigs_fname;
+    }
+
+    void
+    create_file(File& f, const fs::path& fname, Cancel& cancel, sys::error_code& ec)
     {
-        auto f = util::file_io::open_or_create(ex, dirp / fname, ec);
+        f.created = true;
+        if (max_in_memory) return;
+        f.fd = util::file_io::open_or_create(ex, dirp / fname, ec);
         if (cancel) ec = asio::error::operation_aborted;
-        return f;
+    }
+
+    void
+    write(File& f, asio::const_buffer b, Cancel& cancel, asio::yield_context yield)
+    {
+        if (!max_in_memory)
+            return util::file_io::write(*f.fd, b, cancel, yield);
+
+        f.data.append(static_cast<const char*>(b.data()), b.size());
+        if (headf.data.size() + sigsf.data.size() + bodyf.data.size() > *max_in_memory)
+            spill(cancel, yield);
+    }
+
+    // Write the content of files kept in memory to actual files.
+    void
+    spill(Cancel& cancel, asio::yield_context yield)
+    {
+        sys::error_code ec;
+        dirp = make_dir(ec);
+        max_in_memory = boost::none;
+        for (auto fp : { std::make_pair(&headf, &head_fname)
+                       , std::make_pair(&sigsf, &sigs_fname_())
+                       , std::make_pair(&bodyf, &body_fname)}) {
+            auto& f = *fp.first;
+            if (!ec && f.created) create_file(f, *fp.second, cancel, ec);
+            if (!ec && !f.data.empty())
+                util::file_io::write(*f.fd, asio::buffer(f.data), cancel, yield[ec]);
+            f.data = std::string();
+            return_or_throw_on_error(yield, cancel, ec);
+        }
     }
 
 public:
+    // The stored head, including trailer headers if already written.
+    const http_response::Head& stored_head() const
+    {
+        return head;
+    }
+
+    // Whether the content of files is still kept in memory.
+    bool in_memory() const { return bool(max_in_memory); }
+
+    // The content of files kept in memory.
+    const std::string& head_data() const { return headf.data; }
+    const std::string& sigs_data() const { return sigsf.data; }
+    const std::string& body_data() const { return bodyf.data; }
+
     void
     async_write_part(http_response::Head h, Cancel cancel, asio::yield_context yield)
     {
-        assert(!headf);
+        assert(!headf.created);
 
         // Get block size for future alignment checks.
         uri = h[http_::response_uri_hdr].to_string();
@@ -203,20 +355,18 @@ public:
         head = http_injection_merge(std::move(h), {});
 
         sys::error_code ec;
-        auto hf = create_file(head_fname, cancel, ec);
+        create_file(headf, head_fname, cancel, ec);
         return_or_throw_on_error(yield, cancel, ec);
-        headf = std::move(hf);
-        head.async_write(*headf, cancel, yield);
+        write_head(cancel, yield);
     }
 
     void
     async_write_part(http_response::ChunkHdr ch, Cancel cancel, asio::yield_context yield)
     {
-        if (!sigsf) {
+        if (!sigsf.created) {
             sys::error_code ec;
-            auto sf = create_file(sigs_fname, cancel, ec);
+            create_file(sigsf, sigs_fname_(), cancel, ec);
             return_or_throw_on_error(yield, cancel, ec);
-            sigsf = std::move(sf);
         }
 
         SigEntry e;
@@ -242,30 +392,37 @@ public:
 
         // Prepare hash for next data block: HASH[i]=SHA2-512(HASH[i-1] BLOCK[i])
         prev_block_digest = block_hash.close();
-        block_hash = {}; block_hash.update(*prev_block_digest);
+        block_hash.reset(); block_hash.update(*prev_block_digest);
 
-        util::file_io::write(*sigsf, asio::buffer(e.str()), cancel, yield);
+        if (!binary_sigs)
+            return write(sigsf, asio::buffer(e.str()), cancel, yield);
+
+        auto rec = e.record();
+        if (rec.empty()) {
+            _ERROR("Malformed block signature; uri=", uri);
+            return or_throw(yield, asio::error::invalid_argument);
+        }
+        write(sigsf, asio::buffer(rec), cancel, yield);
     }
 
     void
-    async_write_part(std::vector<uint8_t> b, Cancel cancel, asio::yield_context yield)
+    async_write_part(const util::SharedBytes& b, Cancel cancel, asio::yield_context yield)
     {
-        if (!bodyf) {
+        if (!bodyf.created) {
             sys::error_code ec;
-            auto bf = create_file(body_fname, cancel, ec);
+            create_file(bodyf, body_fname, cancel, ec);
             return_or_throw_on_error(yield, cancel, ec);
-            bodyf = std::move(bf);
         }
 
         byte_count += b.size();
         block_hash.update(b);
-        util::file_io::write(*bodyf, asio::buffer(b), cancel, yield);
+        write(bodyf, b, cancel, yield);
     }
 
     void
     async_write_part(http_response::Trailer t, Cancel cancel, asio::yield_context yield)
     {
-        assert(headf);
+        assert(headf.created);
 
         if (t.cbegin() == t.cend()) return;
 
@@ -273,19 +430,32 @@ public:
         head = http_injection_merge(std::move(head), t);
 
         sys::error_code ec;
-        util::file_io::fseek(*headf, 0, ec);
-        if (!ec) util::file_io::truncate(*headf, 0, ec);
-        if (!ec) head.async_write(*headf, cancel, yield[ec]);
+        if (headf.fd) {
+            util::file_io::fseek(*headf.fd, 0, ec);
+            if (!ec) util::file_io::truncate(*headf.fd, 0, ec);
+        }
+        headf.data = std::string();
+        if (!ec) write_head(cancel, yield[ec]);
         return_or_throw_on_error(yield, cancel, ec);
     }
+
+private:
+    void
+    write_head(Cancel& cancel, asio::yield_context yield)
+    {
+        if (headf.fd) return head.async_write(*headf.fd, cancel, yield);
+
+        http_response::Head::writer headw(head, head.version(), head.result_int());
+        write(headf, asio::buffer(beast::buffers_to_string(headw.get())), cancel, yield);
+    }
 };
 
+// Write all parts from the `reader` with the given `writer`.
+static
 void
-http_store_v1( http_response::AbstractReader& reader, const fs::path& dirp
-             , const asio::executor& ex, Cancel cancel, asio::yield_context yield)
+http_store_split( http_response::AbstractReader& reader, SplittedWriter& writer
+                , Cancel& cancel, asio::yield_context yield)
 {
-    SplittedWriter writer(dirp, ex);
-
     while (true) {
         sys::error_code ec;
 
@@ -300,6 +470,116 @@ http_store_v1( http_response::AbstractReader& reader, const fs::path& dirp
     }
 }
 
+// Same as `http_store_v1` or `http_store_v2` (if `binary_sigs`),
+// but return the stored head.
+static
+http_response::Head
+http_store_split_head( http_response::AbstractReader& reader, const fs::path& dirp
+                     , const asio::executor& ex, bool binary_sigs
+                     , Cancel cancel, asio::yield_context yield)
+{
+    SplittedWriter writer(dirp, ex, binary_sigs);
+    sys::error_code ec;
+    http_store_split(reader, writer, cancel, yield[ec]);
+    return_or_throw_on_error(yield, cancel, ec, http_response::Head());
+    return writer.stored_head();
+}
+
+void
+http_store_v1( http_response::AbstractReader& reader, const fs::path& dirp
+             , const asio::executor& ex, Cancel cancel, asio::yield_context yield)
+{
+    sys::error_code ec;
+    http_store_split_head(reader, dirp, ex, false, cancel, yield[ec]);
+    return or_throw(yield, ec);
+}
+
+void
+http_store_v2( http_response::AbstractReader& reader, const fs::path& dirp
+             , const asio::executor& ex, Cancel cancel, asio::yield_context yield)
+{
+    sys::error_code ec;
+    http_store_split_head(reader, dirp, ex, true, cancel, yield[ec]);
+    return or_throw(yield, ec);
+}
+
+void
+http_store_migrate_v2( const fs::path& dirp, const asio::executor& ex
+                     , Cancel cancel, asio::yield_context yield)
+{
+    sys::error_code ec;
+
+    auto sigs_path = dirp / sigs_fname;
+    if (!fs::exists(sigs_path)) return;  // nothing to convert
+    // A previous conversion may have been interrupted before removal.
+    if (fs::exists(dirp / bsigs_fname)) return util::file_io::remove_file(sigs_path);
+
+    auto sigsf = util::file_io::open_readonly(ex, sigs_path, ec);
+    boost::optional<util::atomic_file> bsigsf;
+    if (!ec) bsigsf = util::atomic_file::make(ex, dirp / bsigs_fname, ec);
+    return_or_throw_on_error(yield, cancel, ec);
+
+    // Convert records in batches to avoid many small writes.
+    static const std::size_t batch_size = 64 * SigEntry::record_size;
+    auto buf = SigEntry::create_parse_buffer();
+    std::string recs;
+    for (bool done = false; !done; ) {
+        auto e = SigEntry::parse(sigsf, buf, cancel, yield[ec]);
+        return_or_throw_on_error(yield, cancel, ec);
+        done = !e;
+        if (e) {
+            auto rec = e->record();
+            if (rec.empty()) {
+                _ERROR("Malformed block signature: ", sigs_path);
+                return or_throw(yield, sys::errc::make_error_code(sys::errc::bad_message));
+            }
+            recs += rec;
+        }
+        if (recs.empty() || (!done && recs.size() < batch_size)) continue;
+        util::file_io::write(bsigsf->lowest_layer(), asio::buffer(recs), cancel, yield[ec]);
+        return_or_throw_on_error(yield, cancel, ec);
+        recs.clear();
+    }
+
+    bsigsf->commit(ec);
+    return_or_throw_on_error(yield, cancel, ec);
+    util::file_io::remove_file(sigs_path);
+}
+
+static
+HttpStoreEntryInfo
+entry_info_from_head(const http_response::Head& head)
+{
+    HttpStoreEntryInfo info;
+    info.uri = head[http_::response_uri_hdr].to_string();
+
+    auto proto_s = head[http_::protocol_version_hdr];
+    if (auto proto = parse::number<unsigned>(proto_s))
+        info.protocol_version = *proto;
+
+    auto ts_s = util::http_injection_ts(head);
+    if (auto ts = parse::number<uint64_t>(ts_s))
+        info.injection_ts = *ts;
+
+    auto data_size_s = head[http_::response_data_size_hdr];
+    info.data_size = parse::number<std::size_t>(data_size_s);
+    return info;
+}
+
+// Read the head from the given response reader and get its metadata.
+static
+HttpStoreEntryInfo
+read_entry_info( http_response::AbstractReader& reader
+               , Cancel cancel, asio::yield_context yield)
+{
+    sys::error_code ec;
+    auto part = reader.async_read_part(cancel, yield[ec]);
+    if (!ec && (!part || !part->is_head()))
+        ec = sys::errc::make_error_code(sys::errc::no_message);
+    return_or_throw_on_error(yield, cancel, ec, HttpStoreEntryInfo());
+    return entry_info_from_head(*part->as_head());
+}
+
 reader_uptr
 http_store_reader_v0(const fs::path& path, asio::executor ex, sys::error_code& ec)
 {
@@ -308,6 +588,14 @@ http_store_reader_v0(const fs::path& path, asio::executor ex, sys::error_code& e
     return std::make_unique<http_response::Reader>(std::move(file));
 }
 
+// Where the pieces of a response packed in a segment are (see `HttpStorePacked`).
+struct PackedLocation {
+    std::size_t sigs_offset;
+    std::size_t sigs_size;
+    std::size_t body_offset;
+    std::size_t body_size;
+};
+
 class HttpStore1Reader : public http_response::AbstractReader {
 private:
     static const std::size_t http_forward_block = 16384;
@@ -316,7 +604,9 @@ private:
     parse_head(Cancel cancel, asio::yield_context yield)
     {
         assert(headf.is_open());
-        auto close_headf = defer([&headf = headf] { headf.close(); });  // no longer needed
+        auto close_headf = defer([&] {  // no longer needed
+            if (!packed) headf.close();  // the rest of the response is there
+        });
 
         // Put in heap to avoid exceeding coroutine stack limit.
         auto buffer = std::make_unique<beast::static_buffer<http_forward_block>>();
@@ -365,6 +655,25 @@ private:
             head = http_injection_merge(std::move(head), {});
         }
         head.set(http::field::transfer_encoding, "chunked");
+
+        if (byte_range) {
+            auto range = data_size ? byte_range->blocks(*block_size, *data_size) : boost::none;
+            if (!range) {
+                _WARN("Range not satisfiable by stored response; uri=", uri);
+                return or_throw<http_response::Head>(yield, sys::errc::make_error_code(sys::errc::invalid_seek));
+            }
+            first_block = range->first;
+            last_block = range->last;
+            head.set(http_::response_original_http_status, std::to_string(head.result_int()));
+            head.result(http::status::partial_content);
+            head.set(http::field::content_range, http_content_range(*range, *block_size, *data_size));
+        }
+        if (last_block) {
+            block_index = first_block;
+            block_offset = first_block * *block_size;
+            if (!byte_range)
+                head.set(http_::block_range_hdr, HttpBlockRange{first_block, *last_block}.str());
+        }
         return head;
     }
 
@@ -372,42 +681,114 @@ private:
     get_sig_entry(Cancel cancel, asio::yield_context yield)
     {
         assert(_is_head_done);
+        if (packed) return get_packed_sig_entry(cancel, yield);
         if (!sigsf) {
             sys::error_code ec;
-            sigsf = util::file_io::open_readonly(ex, dirp / sigs_fname, ec);
+            // Prefer binary signatures (v2) to text ones (v1).
+            sigsf = util::file_io::open_readonly(ex, dirp / bsigs_fname, ec);
+            binary_sigs = !ec;
+            if (ec == sys::errc::no_such_file_or_directory) {
+                ec = {};
+                sigsf = util::file_io::open_readonly(ex, dirp / sigs_fname, ec);
+            }
             if (ec == sys::errc::no_such_file_or_directory)
                 return boost::none;
             return_or_throw_on_error(yield, cancel, ec, boost::none);
 
             sigs_buffer = SigEntry::create_parse_buffer();
+
+            // Records have a fixed size, so just seek to the start of the range.
+            if (binary_sigs && first_block > 0) {
+                auto range_start = first_block * SigEntry::record_size;
+                auto size = util::file_io::file_size(*sigsf, ec);
+                if (!ec && size < range_start) {
+                    _ERROR("Data block range out of stored data: ", first_block);
+                    ec = sys::errc::make_error_code(sys::errc::invalid_seek);
+                }
+                if (!ec) util::file_io::fseek(*sigsf, range_start, ec);
+                return_or_throw_on_error(yield, cancel, ec, boost::none);
+            }
+
+            // Skip signatures of data blocks before the range.
+            // Text lines (v1) have different lengths, so they cannot be seeked to
+            // (stores convert them to binary records when scanned).
+            for (std::size_t b = 0; !binary_sigs && b < first_block; ++b) {
+                auto skipped = SigEntry::parse(*sigsf, sigs_buffer, cancel, yield[ec]);
+                return_or_throw_on_error(yield, cancel, ec, boost::none);
+                if (!skipped) {
+                    _ERROR("Data block range out of stored data: ", first_block);
+                    return or_throw(yield, sys::errc::make_error_code(sys::errc::invalid_seek), boost::none);
+                }
+            }
         }
+        if (last_block && block_index > *last_block) return boost::none;  // end of range
+        if (binary_sigs)
+            return SigEntry::parse_record(*sigsf, sigs_buffer, cancel, yield);
         return SigEntry::parse(*sigsf, sigs_buffer, cancel, yield);
     }
 
+    // Packed responses have few signatures (always binary),
+    // so read all the needed ones at once.
+    boost::optional<SigEntry>
+    get_packed_sig_entry(Cancel cancel, asio::yield_context yield)
+    {
+        if (!sigs_loaded) {
+            sigs_loaded = true;
+            auto range_start = first_block * SigEntry::record_size;
+            if (range_start > packed->sigs_size) {
+                _ERROR("Data block range out of stored data: ", first_block);
+                return or_throw(yield, sys::errc::make_error_code(sys::errc::invalid_seek), boost::none);
+            }
+            sigs_buffer.resize(packed->sigs_size - range_start);
+            if (!sigs_buffer.empty()) {
+                sys::error_code ec;
+                util::file_io::fseek(headf, packed->sigs_offset + range_start, ec);
+                if (!ec) util::file_io::read(headf, asio::buffer(sigs_buffer), cancel, yield[ec]);
+                return_or_throw_on_error(yield, cancel, ec, boost::none);
+            }
+        }
+        if (last_block && block_index > *last_block) return boost::none;  // end of range
+        return SigEntry::take_record(sigs_buffer, yield);
+    }
+
     http_response::ChunkBody
     get_chunk_body(Cancel cancel, asio::yield_context yield)
     {
         assert(_is_head_done);
         sys::error_code ec;
-        http_response::ChunkBody empty_cb{{}, 0};
+        http_response::ChunkBody empty_cb(util::SharedBytes(), 0);
+
+        if (!bodyf && packed) {
+            if (block_offset >= packed->body_size) return empty_cb;
+            // Signatures have already been read, so reuse the segment file.
+            body_left = packed->body_size - block_offset;
+            bodyf = std::move(headf);
+            util::file_io::fseek(*bodyf, packed->body_offset + block_offset, ec);
+            return_or_throw_on_error(yield, cancel, ec, std::move(empty_cb));
+        }
 
         if (!bodyf) {
             bodyf = util::file_io::open_readonly(ex, dirp / body_fname, ec);
-            if (ec == sys::errc::no_such_file_or_directory)
+            if (ec == sys::errc::no_such_file_or_directory) {  // empty body
+                bodyf = boost::none;
                 return empty_cb;
+            }
+            if (!ec && block_offset > 0)  // start of the range
+                util::file_io::fseek(*bodyf, block_offset, ec);
             return_or_throw_on_error(yield, cancel, ec, std::move(empty_cb));
-
-            assert(block_size);
-            body_buffer.resize(*block_size);
         }
 
-        auto len = asio::async_read(*bodyf, asio::buffer(body_buffer), yield[ec]);
-        if (cancel) ec == asio::error::operation_aborted;
+        // Read straight into shared storage to avoid copying the data block.
+        assert(block_size);
+        auto to_read = packed ? std::min(*block_size, body_left) : *block_size;
+        auto body_buffer = body_alloc.prepare(to_read);
+        auto len = util::file_io::read(*bodyf, asio::buffer(body_buffer, to_read), cancel, yield[ec]);
         if (ec == asio::error::eof) ec = {};
         return_or_throw_on_error(yield, cancel, ec, empty_cb);
 
-        assert(len <= body_buffer.size());
-        return {std::vector<uint8_t>(body_buffer.cbegin(), body_buffer.cbegin() + len), 0};
+        assert(len <= to_read);
+        if (packed) body_left -= len;
+        return {body_alloc.commit(len), 0};
     }
 
     boost::optional<http_response::Part>
@@ -433,19 +814,25 @@ private:
         // Otherwise it is not worth sending anything.
         if (!sig_entry && next_chunk_exts.empty())
             return boost::none;
-        auto chunk_body = get_chunk_body(cancel, yield[ec]);
-        return_or_throw_on_error(yield, cancel, ec, boost::none);
+        http_response::ChunkBody chunk_body(util::SharedBytes(), 0);
+        if (sig_entry || !last_block) {  // no more data after the range
+            chunk_body = get_chunk_body(cancel, yield[ec]);
+            return_or_throw_on_error(yield, cancel, ec, boost::none);
+        }
         // Validate block offset and size.
         if (sig_entry && sig_entry->offset != block_offset) {
             _ERROR("Data block offset mismatch: ", sig_entry->offset, " != ", block_offset);
             return or_throw(yield, sys::errc::make_error_code(sys::errc::bad_message), boost::none);
         }
         block_offset += chunk_body.size();
+        ++block_index;
 
         http_response::ChunkHdr ch(chunk_body.size(), next_chunk_exts);
         next_chunk_exts = sig_entry ? sig_entry->chunk_exts() : "";
         if (sig_entry && chunk_body.size() > 0)
             next_chunk_body = std::move(chunk_body);
+        else if (sig_entry)  // empty body, do not end it before sending its signature
+            return get_chunk_part(cancel, yield);
         return http_response::Part(std::move(ch));
     }
 
@@ -455,8 +842,32 @@ public:
                     , asio::executor ex)
         : dirp(std::move(dirp)), headf(std::move(headf)), ex(std::move(ex)) {}
 
+    // Only send the data blocks in the given range.
+    HttpStore1Reader( fs::path dirp
+                    , asio::posix::stream_descriptor headf
+                    , asio::executor ex
+                    , const HttpBlockRange& range)
+        : dirp(std::move(dirp)), headf(std::move(headf)), ex(std::move(ex))
+        , first_block(range.first), last_block(range.last) {}
+
+    // Only send the data blocks covering the given byte range.
+    HttpStore1Reader( fs::path dirp
+                    , asio::posix::stream_descriptor headf
+                    , asio::executor ex
+                    , const HttpByteRange& range)
+        : dirp(std::move(dirp)), headf(std::move(headf)), ex(std::move(ex))
+        , byte_range(range) {}
+
     ~HttpStore1Reader() override {};
 
+    // Read the rest of the response from the file given for its head
+    // (a segment of `HttpStorePacked`) instead of files in the directory.
+    void packed_in(const PackedLocation& loc)
+    {
+        packed = loc;
+        binary_sigs = true;
+    }
+
     boost::optional<ouinet::http_response::Part>
     async_read_part(Cancel cancel, asio::yield_context yield) override
     {
@@ -517,15 +928,24 @@ private:
     bool _is_open = true;
 
     std::string uri;  // for warnings
+    std::size_t first_block = 0;
+    boost::optional<std::size_t> last_block;  // for ranges only
+    boost::optional<HttpByteRange> byte_range;  // resolved on head
+    std::size_t block_index = 0;
     std::size_t block_offset = 0;
     boost::optional<std::size_t> data_size;
     boost::optional<std::size_t> block_size;
 
     boost::optional<asio::posix::stream_descriptor> sigsf;
+    bool binary_sigs = false;
     SigEntry::parse_buffer sigs_buffer;
 
     boost::optional<asio::posix::stream_descriptor> bodyf;
-    std::vector<uint8_t> body_buffer;
+    util::SlabAllocator body_alloc;
+
+    boost::optional<PackedLocation> packed;
+    bool sigs_loaded = false;
+    std::size_t body_left = 0;
 
     std::string next_chunk_exts;
     boost::optional<http_response::Part> next_chunk_body;
@@ -540,6 +960,58 @@ http_store_reader_v1(fs::path dirp, asio::executor ex, sys::error_code& ec)
     return std::make_unique<HttpStore1Reader>(std::move(dirp), std::move(headf), std::move(ex));
 }
 
+reader_uptr
+http_store_range_reader_v1( fs::path dirp, asio::executor ex
+                          , const HttpBlockRange& range
+                          , sys::error_code& ec)
+{
+    auto headf = util::file_io::open_readonly(ex, dirp / head_fname, ec);
+    if (ec) return nullptr;
+
+    return std::make_unique<HttpStore1Reader>
+        (std::move(dirp), std::move(headf), std::move(ex), range);
+}
+
+reader_uptr
+http_store_range_reader_v1( fs::path dirp, asio::executor ex
+                          , const HttpByteRange& range
+                          , sys::error_code& ec)
+{
+    auto headf = util::file_io::open_readonly(ex, dirp / head_fname, ec);
+    if (ec) return nullptr;
+
+    return std::make_unique<HttpStore1Reader>
+        (std::move(dirp), std::move(headf), std::move(ex), range);
+}
+
+reader_uptr
+AbstractHttpStore::range_reader( const std::string&, const HttpBlockRange&
+                               , sys::error_code& ec)
+{
+    ec = asio::error::operation_not_supported;
+    return nullptr;
+}
+
+reader_uptr
+AbstractHttpStore::range_reader( const std::string&, const HttpByteRange&
+                               , sys::error_code& ec)
+{
+    ec = asio::error::operation_not_supported;
+    return nullptr;
+}
+
+void
+AbstractHttpStore::for_each_info(keep_info_func keep, asio::yield_context yield)
+{
+    for_each([&] (reader_uptr rr, asio::yield_context y) {
+        Cancel cancel;
+        sys::error_code ec;
+        auto info = read_entry_info(*rr, cancel, y[ec]);
+        if (ec) return or_throw(y, ec, false);
+        return keep(info, y);
+    }, yield);
+}
+
 // begin HttpStoreV0
 
 HttpStoreV0::~HttpStoreV0()
@@ -652,23 +1124,54 @@ HttpStoreV0::reader( const std::string& key
 
 // end HttpStoreV0
 
-// begin HttpStoreV0
+// begin HttpStoreV1
+
+static const fs::path v1_index_fname = "index";
+
+HttpStoreV1::HttpStoreV1(fs::path p, asio::executor ex, HttpStoreLimits limits)
+    : path(std::move(p)), executor(ex), limits(limits)
+    , index(std::make_unique<HttpStoreV1Index>())
+{
+    if (!index->load(path / v1_index_fname))
+        _DEBUG("No valid index found, a full scan is needed: ", path);
+}
 
 HttpStoreV1::~HttpStoreV1()
 {
 }
 
 static
-fs::path
-v1_path_from_key(fs::path dir, const std::string& key)
+std::string
+v1_digest_from_key(const std::string& key)
 {
     auto key_digest = util::sha1_digest(key);
-    auto hex_digest = util::bytes::to_hex(key_digest);
+    return util::bytes::to_hex(key_digest);
+}
+
+static
+fs::path
+v1_path_from_digest(fs::path dir, const std::string& hex_digest)
+{
     boost::string_view hd0(hex_digest); hd0.remove_suffix(hex_digest.size() - 2);
     boost::string_view hd1(hex_digest); hd1.remove_prefix(2);
     return dir.append(hd0.begin(), hd0.end()).append(hd1.begin(), hd1.end());
 }
 
+// Total size of the files in the response directory.
+static
+std::size_t
+v1_entry_size(const fs::path& path, sys::error_code& ec)
+{
+    std::size_t size = 0;
+    for (auto& f : fs::directory_iterator(path, ec)) {
+        if (!fs::is_regular_file(f)) continue;
+        auto fsz = fs::file_size(f, ec);
+        if (ec) return 0;
+        size += fsz;
+    }
+    return size;
+}
+
 static
 void
 v1_try_remove(const fs::path& path)
@@ -682,15 +1185,29 @@ v1_try_remove(const fs::path& path)
 }
 
 void
-HttpStoreV1::for_each(keep_func keep, asio::yield_context yield)
+HttpStoreV1::scan(scan_func scan_entry, asio::yield_context yield)
 {
+    index->clear();
+
+    auto try_remove = [&] (const fs::path& p, const std::string& digest) {
+        v1_try_remove(p);
+        index->erase(digest);
+    };
+
     for (auto& pp : fs::directory_iterator(path)) {  // iterate over `DIGEST[:2]` dirs
+        auto pp_name = pp.path().filename();
+        if (pp_name.stem() == v1_index_fname) continue;  // index or its temporary file
+        if (name_matches_model(pp_name, util::default_temp_model)) {
+            _DEBUG("Found temporary file: ", pp);
+            v1_try_remove(pp); continue;
+        }
+
         if (!fs::is_directory(pp)) {
             _WARN("Found non-directory: ", pp);
             continue;
         }
 
-        auto pp_name_s = pp.path().filename().native();
+        auto& pp_name_s = pp_name.native();
         if (!boost::regex_match(pp_name_s.begin(), pp_name_s.end(), v1_parent_name_rx)) {
             _WARN("Found unknown directory: ", pp);
             continue;
@@ -714,27 +1231,109 @@ HttpStoreV1::for_each(keep_func keep, asio::yield_context yield)
                 continue;
             }
 
+            auto digest = pp_name_s + p_name_s;
             sys::error_code ec;
 
-            auto rr = http_store_reader_v1(p, executor, ec);
-            if (ec == asio::error::operation_aborted) return;
+            // Convert responses stored by older versions.
+            Cancel cancel;
+            http_store_migrate_v2(p, executor, cancel, yield[ec]);
             if (ec) {
-               _WARN("Failed to open cached response: ", p, " ec:", ec.message());
-               v1_try_remove(p); continue;
+                _WARN("Failed to convert cached response: ", p, " ec:", ec.message());
+                try_remove(p, digest); continue;
             }
-            assert(rr);
 
-            auto keep_entry = keep(std::move(rr), yield[ec]);
+            auto info = scan_entry(p, yield[ec]);
             if (ec == asio::error::operation_aborted) return;
             if (ec) {
                 _WARN("Failed to check cached response: ", p, " ec:", ec.message());
-                v1_try_remove(p); continue;
+                try_remove(p, digest); continue;
+            }
+
+            if (!info) {
+                try_remove(p, digest); continue;
+            }
+
+            auto size = v1_entry_size(p, ec);
+            std::time_t mtime = 0;
+            if (!ec) mtime = fs::last_write_time(p, ec);
+            if (ec) {
+                _WARN("Failed to index cached response: ", p, " ec:", ec.message());
+                continue;
             }
+            index->insert(digest, {size, mtime, 0, std::move(*info)});
+        }
+    }
+
+    index->sort();
+
+    sys::error_code ec;
+    index->rewrite(ec);
+    if (ec) _WARN("Failed to write index: ", path, " ec:", ec.message());
+
+    evict();
+}
+
+void
+HttpStoreV1::for_each(keep_func keep, asio::yield_context yield)
+{
+    scan([&] (const fs::path& p, asio::yield_context y) {
+        boost::optional<HttpStoreEntryInfo> none;
+        sys::error_code ec;
+
+        auto rr = http_store_reader_v1(p, executor, ec);
+        if (ec) return or_throw(y, ec, none);
+        assert(rr);
+
+        auto keep_entry = keep(std::move(rr), y[ec]);
+        if (ec || !keep_entry) return or_throw(y, ec, none);
+
+        // The reader was consumed, open a new one to index the entry.
+        Cancel cancel;
+        rr = http_store_reader_v1(p, executor, ec);
+        if (ec) return or_throw(y, ec, none);
+        auto info = read_entry_info(*rr, cancel, y[ec]);
+        return or_throw(y, ec, boost::make_optional(std::move(info)));
+    }, yield);
+}
 
-            if (!keep_entry)
-                v1_try_remove(p);
+void
+HttpStoreV1::for_each_info(keep_info_func keep, asio::yield_context yield)
+{
+    if (!index->is_logged()) {
+        _DEBUG("Rebuilding index: ", path);
+        return scan([&] (const fs::path& p, asio::yield_context y) {
+            boost::optional<HttpStoreEntryInfo> none;
+            sys::error_code ec;
+
+            auto rr = http_store_reader_v1(p, executor, ec);
+            if (ec) return or_throw(y, ec, none);
+            assert(rr);
+
+            Cancel cancel;
+            auto info = read_entry_info(*rr, cancel, y[ec]);
+            if (ec) return or_throw(y, ec, none);
+
+            auto keep_entry = keep(info, y[ec]);
+            if (ec || !keep_entry) return or_throw(y, ec, none);
+            return boost::make_optional(std::move(info));
+        }, yield);
+    }
+
+    for (auto& digest_info : index->infos()) {
+        auto& digest = digest_info.first;
+        sys::error_code ec;
+
+        auto keep_entry = keep(digest_info.second, yield[ec]);
+        if (ec == asio::error::operation_aborted) return;
+        if (ec) _WARN("Failed to check cached response: ", digest, " ec:", ec.message());
+
+        if (ec || !keep_entry) {
+            v1_try_remove(v1_path_from_digest(path, digest));
+            index->erase(digest);
         }
     }
+
+    evict();
 }
 
 void
@@ -743,7 +1342,8 @@ HttpStoreV1::store( const std::string& key, http_response::AbstractReader& r
 {
     sys::error_code ec;
 
-    auto kpath = v1_path_from_key(path, key);
+    auto digest = v1_digest_from_key(key);
+    auto kpath = v1_path_from_digest(path, digest);
 
     auto kpath_parent = kpath.parent_path();
     fs::create_directory(kpath_parent, ec);
@@ -752,25 +1352,844 @@ HttpStoreV1::store( const std::string& key, http_response::AbstractReader& r
     // Replacing a directory is not an atomic operation,
     // so try to remove the existing entry before committing.
     auto dir = util::atomic_dir::make(kpath, ec);
-    if (!ec) http_store_v1(r, dir->temp_path(), executor, cancel, yield[ec]);
+    http_response::Head head;
+    std::size_t size = 0;
+    if (!ec) head = http_store_split_head(r, dir->temp_path(), executor, true, cancel, yield[ec]);
+    if (!ec) size = v1_entry_size(dir->temp_path(), ec);
     if (!ec && fs::exists(kpath)) fs::remove_all(kpath, ec);
+    // Index the entry before committing it,
+    // so that a crash in between leaves a dangling index entry
+    // (which is harmless) rather than an unindexed response.
+    if (!ec) index->insert(digest, {size, std::time(nullptr), 0, entry_info_from_head(head)});
     // A new version of the response may still slip in here,
     // but it may be ok since it will probably be recent enough.
-    if (!ec) dir->commit(ec);
+    if (!ec) {
+        dir->commit(ec);
+        if (ec) index->erase(digest);
+    }
     if (!ec) _DEBUG("Stored to directory; key=", key, " path=", kpath);
     else _ERROR( "Failed to store response; key=", key, " path=", kpath
                , " ec:", ec.message());
-    return or_throw(yield, ec);
+    if (ec) return or_throw(yield, ec);
+
+    evict();
 }
 
 reader_uptr
 HttpStoreV1::reader( const std::string& key
                    , sys::error_code& ec)
 {
-    auto kpath = v1_path_from_key(path, key);
-    return http_store_reader_v1(kpath, executor, ec);
+    auto digest = v1_digest_from_key(key);
+    auto kpath = v1_path_from_digest(path, digest);
+    auto rr = http_store_reader_v1(kpath, executor, ec);
+    if (!ec) index->touch(digest);
+    return rr;
 }
 
-// end HttpStoreV1
+reader_uptr
+HttpStoreV1::range_reader( const std::string& key
+                         , const HttpBlockRange& range
+                         , sys::error_code& ec)
+{
+    auto digest = v1_digest_from_key(key);
+    auto kpath = v1_path_from_digest(path, digest);
+    auto rr = http_store_range_reader_v1(kpath, executor, range, ec);
+    if (!ec) index->touch(digest);
+    return rr;
+}
+
+reader_uptr
+HttpStoreV1::range_reader( const std::string& key
+                         , const HttpByteRange& range
+                         , sys::error_code& ec)
+{
+    auto digest = v1_digest_from_key(key);
+    auto kpath = v1_path_from_digest(path, digest);
+    auto rr = http_store_range_reader_v1(kpath, executor, range, ec);
+    if (!ec) index->touch(digest);
+    return rr;
+}
+
+void
+HttpStoreV1::on_remove(on_remove_func f)
+{
+    index->on_remove(std::move(f));
+}
+
+std::size_t
+HttpStoreV1::size() const
+{
+    return index->size();
+}
+
+std::size_t
+HttpStoreV1::entry_count() const
+{
+    return index->count();
+}
+
+void
+HttpStoreV1::evict()
+{
+    auto over_limits = [&] {
+        return (limits.max_bytes && index->size() > limits.max_bytes)
+            || (limits.max_entries && index->count() > limits.max_entries);
+    };
+
+    while (over_limits()) {
+        auto digest = index->eviction_candidate();
+        if (!digest) break;
+        _DEBUG("Evicting cached response: ", *digest);
+        v1_try_remove(v1_path_from_digest(path, *digest));
+        index->erase(*digest);
+    }
+}
+
+// end HttpStoreV1
+
+// begin HttpStorePacked
+
+static const fs::path packed_large_dname = "large";
+
+static const std::string packed_record_magic = "OSR1";
+static const std::size_t packed_digest_size = std::tuple_size<util::SHA1::digest_type>::value;
+static const std::size_t packed_header_size = packed_record_magic.size() + packed_digest_size + 3 * 4 + 8;
+
+// Lowercase hexadecimal segment number.
+static const boost::regex packed_segment_name_rx("^[0-9a-f]{8}\\.seg$");
+
+static
+sys::error_code
+last_error()
+{
+    auto ec = sys::errc::make_error_code(static_cast<sys::errc::errc_t>(errno));
+    if (!ec) ec = sys::errc::make_error_code(sys::errc::no_message);
+    return ec;
+}
+
+static
+fs::path
+packed_segment_path(const fs::path& dir, unsigned n)
+{
+    return dir / (boost::format("%08x.seg") % n).str();
+}
+
+static
+fs::path
+packed_large_path(const fs::path& dir, const std::string& digest)
+{
+    return v1_path_from_digest(dir / packed_large_dname, digest);
+}
+
+static
+void
+packed_put_number(std::string& s, uint64_t n, int len)
+{
+    for (int i = len - 1; i >= 0; --i)
+        s += static_cast<char>((n >> (8 * i)) & 0xff);
+}
+
+static
+uint64_t
+packed_parse_number(const char* p, int len)
+{
+    uint64_t n = 0;
+    for (int i = 0; i < len; ++i)
+        n = (n << 8) | static_cast<uint8_t>(p[i]);
+    return n;
+}
+
+std::size_t
+HttpStorePacked::Record::size() const
+{
+    return packed_header_size + head_size + sigs_size + body_size;
+}
+
+std::string
+HttpStorePacked::Record::header(const util::SHA1::digest_type& key_digest) const
+{
+    auto hdr = packed_record_magic + util::bytes::to_string(key_digest);
+    for (auto n : {head_size, sigs_size, body_size})
+        packed_put_number(hdr, n, 4);
+    packed_put_number(hdr, mtime, 8);
+    return hdr;
+}
+
+HttpStorePacked::HttpStorePacked( fs::path p, asio::executor ex
+                                , HttpStoreLimits limits
+                                , std::size_t segment_size, std::size_t max_packed_size)
+    : path(std::move(p)), executor(ex), limits(limits)
+    , segment_size(segment_size), max_packed_size(max_packed_size)
+    , index(std::make_unique<HttpStoreV1Index>())
+    , append_done(ex)
+{
+    if (!index->load(path / v1_index_fname))
+        _DEBUG("No valid index found, a full scan is needed: ", path);
+    load();
+}
+
+HttpStorePacked::~HttpStorePacked()
+{
+    lifetime_cancel();
+}
+
+void
+HttpStorePacked::load()
+{
+    std::vector<unsigned> numbers;
+    for (auto& p : fs::directory_iterator(path)) {
+        auto p_name = p.path().filename();
+        if (p_name.stem() == v1_index_fname) continue;  // index or its temporary file
+        if (p_name == packed_large_dname) continue;
+        if (name_matches_model(p_name, util::default_temp_model)) {
+            _DEBUG("Found temporary directory: ", p);
+            v1_try_remove(p); continue;
+        }
+
+        auto& p_name_s = p_name.native();
+        if ( !fs::is_regular_file(p)
+           || !boost::regex_match(p_name_s.begin(), p_name_s.end(), packed_segment_name_rx)) {
+            _WARN("Found unknown file: ", p);
+            continue;
+        }
+        numbers.push_back(std::stoul(p_name_s.substr(0, 8), nullptr, 16));
+    }
+    std::sort(numbers.begin(), numbers.end());
+
+    // Later records replace earlier ones.
+    for (auto n : numbers) {
+        auto segp = packed_segment_path(path, n);
+        sys::error_code ec;
+        auto file_size = fs::file_size(segp, ec);
+        std::ifstream in(segp.native(), std::ios::binary);
+        if (ec || !in) {
+            _WARN("Failed to open segment: ", segp);
+            continue;
+        }
+
+        auto& seg = segments[n];
+        std::string hdr(packed_header_size, '\0');
+        while (seg.size < file_size) {
+            if (!in.read(&hdr[0], hdr.size())) break;
+            if (hdr.compare(0, packed_record_magic.size(), packed_record_magic) != 0) break;
+            auto p = hdr.data() + packed_record_magic.size();
+            auto digest = util::bytes::to_hex(boost::string_view(p, packed_digest_size));
+            p += packed_digest_size;
+            Record rec{ n, seg.size
+                      , packed_parse_number(p, 4), packed_parse_number(p + 4, 4)
+                      , packed_parse_number(p + 8, 4)
+                      , static_cast<std::time_t>(packed_parse_number(p + 12, 8))};
+            if (seg.size + rec.size() > file_size) break;
+            replace(digest, rec);
+            seg.size += rec.size();
+            in.seekg(seg.size);
+        }
+
+        if (seg.size < file_size) {
+            _WARN("Removing truncated or malformed records: ", segp, " offset=", seg.size);
+            fs::resize_file(segp, seg.size, ec);
+            if (ec) _WARN("Failed to truncate segment: ", segp, " ec:", ec.message());
+        }
+    }
+
+    if (!index->is_logged()) return;  // rebuilt on the next scan
+
+    // Indexed responses without records were lost,
+    // and responses not indexed were removed.
+    std::unordered_set<std::string> indexed;
+    for (auto& digest_info : index->infos()) {
+        auto& digest = digest_info.first;
+        if (records.count(digest)) indexed.insert(digest);
+        else index->erase(digest);
+    }
+    std::vector<std::string> removed;
+    for (auto& digest_rec : records)
+        if (!indexed.count(digest_rec.first)) removed.push_back(digest_rec.first);
+    for (auto& digest : removed)
+        drop(digest);
+}
+
+void
+HttpStorePacked::scan(scan_func scan_entry, asio::yield_context yield)
+{
+    index->clear();
+
+    // Responses may be removed or moved while scanning.
+    std::vector<std::string> digests;
+    for (auto& digest_rec : records) digests.push_back(digest_rec.first);
+
+    for (auto& digest : digests) {
+        if (!records.count(digest)) continue;
+
+        sys::error_code ec;
+        auto info = scan_entry(digest, yield[ec]);
+        if (ec == asio::error::operation_aborted) return;
+        if (ec) _WARN("Failed to check cached response: ", digest, " ec:", ec.message());
+
+        if (ec || !info) {
+            drop(digest); continue;
+        }
+
+        auto rit = records.find(digest);
+        if (rit == records.end()) continue;
+        auto& rec = rit->second;
+        auto size = rec.head_size ? rec.size()
+                                  : v1_entry_size(packed_large_path(path, digest), ec);
+        if (ec) {
+            _WARN("Failed to index cached response: ", digest, " ec:", ec.message());
+            continue;
+        }
+        index->insert(digest, {size, rec.mtime, 0, std::move(*info)});
+    }
+
+    index->sort();
+
+    sys::error_code ec;
+    index->rewrite(ec);
+    if (ec) _WARN("Failed to write index: ", path, " ec:", ec.message());
+
+    evict();
+    start_compaction();
+}
+
+void
+HttpStorePacked::for_each(keep_func keep, asio::yield_context yield)
+{
+    scan([&] (const std::string& digest, asio::yield_context y) {
+        boost::optional<HttpStoreEntryInfo> none;
+        sys::error_code ec;
+
+        auto rr = open_reader(digest, ec);
+        if (ec) return or_throw(y, ec, none);
+        assert(rr);
+
+        auto keep_entry = keep(std::move(rr), y[ec]);
+        if (ec || !keep_entry) return or_throw(y, ec, none);
+
+        // The reader was consumed, open a new one to index the entry.
+        Cancel cancel;
+        rr = open_reader(digest, ec);
+        if (ec) return or_throw(y, ec, none);
+        auto info = read_entry_info(*rr, cancel, y[ec]);
+        return or_throw(y, ec, boost::make_optional(std::move(info)));
+    }, yield);
+}
+
+void
+HttpStorePacked::for_each_info(keep_info_func keep, asio::yield_context yield)
+{
+    if (!index->is_logged()) {
+        _DEBUG("Rebuilding index: ", path);
+        return scan([&] (const std::string& digest, asio::yield_context y) {
+            boost::optional<HttpStoreEntryInfo> none;
+            sys::error_code ec;
+
+            auto rr = open_reader(digest, ec);
+            if (ec) return or_throw(y, ec, none);
+            assert(rr);
+
+            Cancel cancel;
+            auto info = read_entry_info(*rr, cancel, y[ec]);
+            if (ec) return or_throw(y, ec, none);
+
+            auto keep_entry = keep(info, y[ec]);
+            if (ec || !keep_entry) return or_throw(y, ec, none);
+            return boost::make_optional(std::move(info));
+        }, yield);
+    }
+
+    for (auto& digest_info : index->infos()) {
+        auto& digest = digest_info.first;
+        sys::error_code ec;
+
+        auto keep_entry = keep(digest_info.second, yield[ec]);
+        if (ec == asio::error::operation_aborted) return;
+        if (ec) _WARN("Failed to check cached response: ", digest, " ec:", ec.message());
+
+        if (ec || !keep_entry) drop(digest);
+    }
+
+    evict();
+    start_compaction();
+}
+
+void
+HttpStorePacked::store( const std::string& key, http_response::AbstractReader& r
+                      , Cancel cancel, asio::yield_context yield)
+{
+    sys::error_code ec;
+
+    auto key_digest = util::sha1_digest(key);
+    auto digest = util::bytes::to_hex(key_digest);
+
+    // The size of the response is not known in advance,
+    // so keep it in memory in format v2 while it fits in a segment record,
+    // and store it to a temporary directory otherwise.
+    boost::optional<util::temp_dir> dir;
+    SplittedWriter writer(executor, true, max_packed_size, [&] (sys::error_code& e) {
+        dir = util::temp_dir::make(path, e);
+        if (!dir) return fs::path();
+        dir->keep_on_close(false);
+        return dir->path();
+    });
+    http_store_split(r, writer, cancel, yield[ec]);
+    auto& head = writer.stored_head();
+    auto mtime = std::time(nullptr);
+    std::size_t size = 0;
+
+    if (!ec && writer.in_memory()) {
+        size = append_packed( digest, key_digest, mtime
+                            , writer.head_data(), writer.sigs_data(), writer.body_data()
+                            , yield[ec]);
+        if (!ec) _DEBUG("Stored to segment; key=", key);
+    } else if (!ec) {
+        size = move_large(digest, key_digest, mtime, dir->path(), yield[ec]);
+        if (!ec) dir->keep_on_close(true);  // moved in place
+        if (!ec) _DEBUG("Stored to directory; key=", key);
+    }
+
+    if (!ec) index->insert(digest, {size, mtime, 0, entry_info_from_head(head)});
+    else _ERROR("Failed to store response; key=", key, " ec:", ec.message());
+    if (ec) return or_throw(yield, ec);
+
+    evict();
+    start_compaction();
+}
+
+// Append a record with the given files of a response in format v2,
+// and return its size.
+std::size_t
+HttpStorePacked::append_packed( const std::string& digest
+                              , const util::SHA1::digest_type& key_digest
+                              , std::time_t mtime
+                              , const std::string& head, const std::string& sigs
+                              , const std::string& body, asio::yield_context yield)
+{
+    sys::error_code ec;
+    Record rec{0, 0, head.size(), sigs.size(), body.size(), mtime};
+    append(rec.header(key_digest) + head + sigs + body, rec, yield[ec]);
+    if (ec) return or_throw<std::size_t>(yield, ec, 0);
+
+    auto rit = records.find(digest);
+    bool was_large = rit != records.end() && rit->second.head_size == 0;
+    replace(digest, rec);
+    if (was_large) v1_try_remove(packed_large_path(path, digest));
+    return rec.size();
+}
+
+// Move the given directory with a response in format v2 in place,
+// and return its size.
+std::size_t
+HttpStorePacked::move_large( const std::string& digest
+                           , const util::SHA1::digest_type& key_digest
+                           , std::time_t mtime
+                           , const fs::path& dir, asio::yield_context yield)
+{
+    sys::error_code ec;
+    auto kpath = packed_large_path(path, digest);
+    auto size = v1_entry_size(dir, ec);
+    if (!ec) fs::create_directories(kpath.parent_path(), ec);
+    // Record the response before moving it in place,
+    // so that a crash in between leaves a dangling record
+    // (which is harmless) rather than an unrecorded response.
+    Record rec{0, 0, 0, 0, 0, mtime};
+    if (!ec) append(rec.header(key_digest), rec, yield[ec]);
+    if (ec) return or_throw<std::size_t>(yield, ec, 0);
+    replace(digest, rec);
+    if (fs::exists(kpath)) fs::remove_all(kpath, ec);
+    if (!ec) fs::rename(dir, kpath, ec);
+    if (ec) drop(digest);
+    return or_throw<std::size_t>(yield, ec, ec ? 0 : size);
+}
+
+// Return the content of the given file, or the empty string if missing.
+static
+std::string
+packed_read_file( const fs::path& p, const asio::executor& ex
+                , Cancel& cancel, asio::yield_context yield)
+{
+    sys::error_code ec;
+    auto f = util::file_io::open_readonly(ex, p, ec);
+    if (ec == sys::errc::no_such_file_or_directory) return {};
+    std::size_t size = 0;
+    if (!ec) size = util::file_io::file_size(f, ec);
+    std::string data(size, '\0');
+    if (!ec && size > 0) util::file_io::read(f, asio::buffer(&data[0], size), cancel, yield[ec]);
+    return_or_throw_on_error(yield, cancel, ec, std::string());
+    return data;
+}
+
+void
+HttpStorePacked::migrate( const fs::path& v1_dir
+                        , Cancel cancel, asio::yield_context yield)
+{
+    for (auto& pp : fs::directory_iterator(v1_dir)) {  // iterate over `DIGEST[:2]` dirs
+        auto pp_name = pp.path().filename();
+        auto& pp_name_s = pp_name.native();
+        if (!fs::is_directory(pp)) continue;  // index, temporary files
+        if (!boost::regex_match(pp_name_s.begin(), pp_name_s.end(), v1_parent_name_rx))
+            continue;
+
+        for (auto& p : fs::directory_iterator(pp)) {  // iterate over `DIGEST[2:]` dirs
+            auto p_name = p.path().filename();
+            auto& p_name_s = p_name.native();
+            if (!fs::is_directory(p)) continue;
+            if (!boost::regex_match(p_name_s.begin(), p_name_s.end(), v1_dir_name_rx))
+                continue;
+
+            sys::error_code ec;
+            migrate_entry(pp_name_s + p_name_s, p, cancel, yield[ec]);
+            if (cancel) return or_throw(yield, asio::error::operation_aborted);
+            if (ec) _WARN("Failed to migrate cached response: ", p, " ec:", ec.message());
+        }
+    }
+
+    index->sort();
+
+    sys::error_code ec;
+    fs::remove_all(v1_dir, ec);
+    if (ec) _WARN("Failed to remove migrated store: ", v1_dir, " ec:", ec.message());
+
+    evict();
+    start_compaction();
+}
+
+void
+HttpStorePacked::migrate_entry( const std::string& digest, const fs::path& dir
+                              , Cancel& cancel, asio::yield_context yield)
+{
+    // The response may have been migrated before an interruption.
+    if (records.find(digest) != records.end()) return v1_try_remove(dir);
+
+    sys::error_code ec;
+
+    http_store_migrate_v2(dir, executor, cancel, yield[ec]);
+
+    HttpStoreEntryInfo info;
+    if (!ec) {
+        auto rr = http_store_reader_v1(dir, executor, ec);
+        if (!ec) info = read_entry_info(*rr, cancel, yield[ec]);
+    }
+    std::size_t size = 0;
+    std::time_t mtime = 0;
+    if (!ec) size = v1_entry_size(dir, ec);
+    if (!ec) mtime = fs::last_write_time(dir, ec);
+
+    util::SHA1::digest_type key_digest;
+    if (!ec) {
+        auto kd = util::bytes::from_hex(digest);  // checked by caller
+        assert(kd && kd->size() == key_digest.size());
+        std::copy(kd->begin(), kd->end(), key_digest.begin());
+    }
+
+    if (!ec && size <= max_packed_size) {
+        std::string head_s, sigs_s, body_s;
+        head_s = packed_read_file(dir / head_fname, executor, cancel, yield[ec]);
+        if (!ec) sigs_s = packed_read_file(dir / bsigs_fname, executor, cancel, yield[ec]);
+        if (!ec) body_s = packed_read_file(dir / body_fname, executor, cancel, yield[ec]);
+        if (!ec) size = append_packed( digest, key_digest, mtime
+                                     , head_s, sigs_s, body_s, yield[ec]);
+        if (!ec) v1_try_remove(dir);
+    } else if (!ec) {
+        size = move_large(digest, key_digest, mtime, dir, yield[ec]);
+    }
+
+    if (ec) {
+        v1_try_remove(dir);
+        return or_throw(yield, ec);
+    }
+    index->insert(digest, {size, mtime, 0, std::move(info)});
+    _DEBUG("Migrated cached response: ", dir);
+}
+
+template<class... Range>
+reader_uptr
+HttpStorePacked::open_reader( const std::string& digest, sys::error_code& ec
+                            , const Range&... range)
+{
+    auto rit = records.find(digest);
+    if (rit == records.end()) {
+        ec = sys::errc::make_error_code(sys::errc::no_such_file_or_directory);
+        return nullptr;
+    }
+    auto& rec = rit->second;
+
+    if (rec.head_size == 0) {
+        auto kpath = packed_large_path(path, digest);
+        auto headf = util::file_io::open_readonly(executor, kpath / head_fname, ec);
+        if (ec) return nullptr;
+        return std::make_unique<HttpStore1Reader>
+            (std::move(kpath), std::move(headf), executor, range...);
+    }
+
+    // The reader keeps the segment open, so it may be removed meanwhile.
+    auto segp = packed_segment_path(path, rec.segment);
+    auto segf = util::file_io::open_readonly(executor, segp, ec);
+    if (!ec) util::file_io::fseek(segf, rec.offset + packed_header_size, ec);
+    if (ec) return nullptr;
+
+    auto sigs_offset = rec.offset + packed_header_size + rec.head_size;
+    auto rr = std::make_unique<HttpStore1Reader>
+        (std::move(segp), std::move(segf), executor, range...);
+    rr->packed_in({sigs_offset, rec.sigs_size, sigs_offset + rec.sigs_size, rec.body_size});
+    return rr;
+}
+
+reader_uptr
+HttpStorePacked::reader( const std::string& key
+                       , sys::error_code& ec)
+{
+    auto digest = v1_digest_from_key(key);
+    auto rr = open_reader(digest, ec);
+    if (!ec) index->touch(digest);
+    return rr;
+}
+
+reader_uptr
+HttpStorePacked::range_reader( const std::string& key
+                             , const HttpBlockRange& range
+                             , sys::error_code& ec)
+{
+    auto digest = v1_digest_from_key(key);
+    auto rr = open_reader(digest, ec, range);
+    if (!ec) index->touch(digest);
+    return rr;
+}
+
+reader_uptr
+HttpStorePacked::range_reader( const std::string& key
+                             , const HttpByteRange& range
+                             , sys::error_code& ec)
+{
+    auto digest = v1_digest_from_key(key);
+    auto rr = open_reader(digest, ec, range);
+    if (!ec) index->touch(digest);
+    return rr;
+}
+
+void
+HttpStorePacked::on_remove(on_remove_func f)
+{
+    index->on_remove(std::move(f));
+}
+
+std::size_t
+HttpStorePacked::size() const
+{
+    return index->size();
+}
+
+std::size_t
+HttpStorePacked::entry_count() const
+{
+    return index->count();
+}
+
+std::size_t
+HttpStorePacked::dead_size() const
+{
+    std::size_t dead = 0;
+    for (auto& s : segments) dead += s.second.dead;
+    return dead;
+}
+
+// Append the given record data to the last segment,
+// and set where the record is (but do not make it the response's record).
+void
+HttpStorePacked::append( const std::string& data, Record& rec
+                       , asio::yield_context yield)
+{
+    // Do not touch the store if it is destroyed while appending.
+    bool destroyed = false;
+    auto destroyed_con = lifetime_cancel.connect([&] { destroyed = true; });
+
+    // Appends are serialized, so that records from different coroutines
+    // do not get mixed.
+    while (appending) {
+        sys::error_code ec;
+        append_done.wait(yield[ec]);
+        if (destroyed) return or_throw(yield, asio::error::operation_aborted);
+    }
+    appending = true;
+    auto done = defer([&] {
+        if (destroyed) return;
+        appending = false;
+        append_done.notify();
+    });
+
+    // Start a new segment if the last one is full.
+    if (!segments.empty() && segments.rbegin()->second.size >= segment_size) {
+        active_file.reset();
+        segments[segments.rbegin()->first + 1];
+    }
+    if (segments.empty()) segments[0];
+    auto segment = segments.rbegin()->first;
+    auto offset = segments.rbegin()->second.size;
+
+    if (!active_file) {
+        auto segp = packed_segment_path(path, segment);
+        int fd = ::open(segp.c_str(), O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR);
+        if (fd == -1) return or_throw(yield, last_error());
+        active_file = std::make_shared<asio::posix::stream_descriptor>(executor, fd);
+    }
+
+    // The write is not cancelled (which would close the file),
+    // a failed one is undone below instead.
+    auto file = active_file;
+    Cancel cancel;
+    sys::error_code ec;
+    util::file_io::write(*file, asio::buffer(data), cancel, yield[ec]);
+    if (destroyed) return or_throw(yield, asio::error::operation_aborted);
+    if (ec) {
+        // Do not leave part of the record behind.
+        sys::error_code trunc_ec;
+        util::file_io::truncate(*file, offset, trunc_ec);
+        if (trunc_ec)
+            _WARN("Failed to truncate segment after error: ", packed_segment_path(path, segment));
+        return or_throw(yield, ec);
+    }
+
+    rec.segment = segment;
+    rec.offset = offset;
+    segments[segment].size += data.size();
+}
+
+void
+HttpStorePacked::replace(const std::string& digest, const Record& rec)
+{
+    auto rit = records.find(digest);
+    if (rit == records.end()) {
+        records.emplace(digest, rec);
+        return;
+    }
+    segments[rit->second.segment].dead += rit->second.size();
+    rit->second = rec;
+}
+
+void
+HttpStorePacked::drop(const std::string& digest)
+{
+    index->erase(digest);
+
+    auto rit = records.find(digest);
+    if (rit == records.end()) return;
+    auto& rec = rit->second;
+    segments[rec.segment].dead += rec.size();
+    if (rec.head_size == 0) v1_try_remove(packed_large_path(path, digest));
+    else _DEBUG("Removing cached response: ", digest);
+    records.erase(rit);
+}
+
+void
+HttpStorePacked::evict()
+{
+    auto over_limits = [&] {
+        return (limits.max_bytes && index->size() > limits.max_bytes)
+            || (limits.max_entries && index->count() > limits.max_entries);
+    };
+
+    while (over_limits()) {
+        auto digest = index->eviction_candidate();
+        if (!digest) break;
+        _DEBUG("Evicting cached response: ", *digest);
+        drop(*digest);
+    }
+}
+
+boost::optional<unsigned>
+HttpStorePacked::compaction_candidate() const
+{
+    if (segments.size() < 2) return boost::none;
+
+    auto last = std::prev(segments.end());
+    for (auto it = segments.begin(); it != last; ++it)
+        if (it->second.dead * 2 >= it->second.size) return it->first;
+    return boost::none;
+}
+
+void
+HttpStorePacked::start_compaction()
+{
+    if (compacting || !compaction_candidate()) return;
+
+    TRACK_SPAWN(executor, ([this, cancel = lifetime_cancel] (asio::yield_context yield) mutable {
+        sys::error_code ec;
+        compact(cancel, yield[ec]);
+    }));
+}
+
+void
+HttpStorePacked::compact(Cancel cancel, asio::yield_context yield)
+{
+    if (compacting) return;
+    compacting = true;
+
+    // Do not touch the store if it is destroyed while compacting.
+    bool destroyed = false;
+    auto destroyed_con = lifetime_cancel.connect([&] { destroyed = true; cancel(); });
+    auto done = defer([&] { if (!destroyed) compacting = false; });
+
+    while (auto n = compaction_candidate()) {
+        sys::error_code ec;
+        compact_segment(*n, cancel, yield[ec]);
+        if (cancel) return or_throw(yield, asio::error::operation_aborted);
+        if (ec) {
+            _WARN("Failed to compact segment: ", packed_segment_path(path, *n), " ec:", ec.message());
+            return or_throw(yield, ec);
+        }
+    }
+}
+
+void
+HttpStorePacked::compact_segment(unsigned n, Cancel& cancel, asio::yield_context yield)
+{
+    auto segp = packed_segment_path(path, n);
+    _DEBUG("Compacting segment: ", segp);
+
+    std::vector<std::string> digests;  // of live records in the segment
+    for (auto& digest_rec : records)
+        if (digest_rec.second.segment == n) digests.push_back(digest_rec.first);
+
+    sys::error_code ec;
+    boost::optional<asio::posix::stream_descriptor> segf;
+    if (!digests.empty()) {
+        segf = util::file_io::open_readonly(executor, segp, ec);
+        if (ec) return or_throw(yield, ec);
+    }
+
+    std::string data;
+    for (auto& digest : digests) {
+        auto rit = records.find(digest);
+        if (rit == records.end() || rit->second.segment != n) continue;  // removed or replaced
+        auto rec = rit->second;
+
+        data.resize(rec.size());
+        util::file_io::fseek(*segf, rec.offset, ec);
+        if (!ec) util::file_io::read(*segf, asio::buffer(&data[0], data.size()), cancel, yield[ec]);
+        return_or_throw_on_error(yield, cancel, ec);
+
+        // The record may have changed while reading it.
+        rit = records.find(digest);
+        if (rit == records.end() || rit->second.segment != n) continue;
+        auto copy = rec;
+        append(data, copy, yield[ec]);
+        if (ec) return or_throw(yield, ec);
+
+        // ... or while copying it, then the copy is not used.
+        rit = records.find(digest);
+        if ( rit != records.end()
+           && rit->second.segment == n && rit->second.offset == rec.offset) {
+            replace(digest, copy);
+        } else {
+            segments[copy.segment].dead += copy.size();
+        }
+    }
+
+    if (segf) segf->close();
+    util::file_io::remove_file(segp);
+    segments.erase(n);
+}
+
+// end HttpStorePacked
 
 }} // namespaces
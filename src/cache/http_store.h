@@ -1,17 +1,24 @@
 #pragma once
 
 #include <functional>
+#include <map>
+#include <memory>
+#include <unordered_map>
 
 #include <boost/asio/executor.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
 #include <boost/asio/spawn.hpp>
 #include <boost/filesystem/path.hpp>
 
 #include "../response_reader.h"
+#include "../util/condition_variable.h"
 #include "../util/signal.h"
 
 #include "../namespaces.h"
 
 #include "detail/http_store.h"
+#include "http_sign.h"
+#include "http_store_index.h"
 
 namespace ouinet { namespace cache {
 
@@ -65,13 +72,37 @@ void http_store_v0( http_response::AbstractReader& reader, Stream& outf
 void http_store_v1( http_response::AbstractReader&, const fs::path&
                   , const asio::executor&, Cancel, asio::yield_context);
 
+// Save the HTTP response coming from the given reader in v2 format
+// into the given directory, like `http_store_v1`.
+//
+// ----
+//
+// The v2 format is like v1, but the `sigs` file is replaced by `bsigs`,
+// which consists of fixed-width binary records for blocks i=0,1...:
+//
+//     BIG_ENDIAN_64(OFFSET[i]) SIG[i] HASH[i-1]
+//
+// Where `SIG[i]` is the raw 64-byte Ed25519 signature,
+// and `HASH[i-1]` the raw 64-byte SHA2-512 chained hash
+// (all zeros for `HASH[-1]`).
+// Thus the record for block i is at offset `i * 136` in the file.
+//
+void http_store_v2( http_response::AbstractReader&, const fs::path&
+                  , const asio::executor&, Cancel, asio::yield_context);
+
+// Convert the response stored in v1 format under the given directory
+// to v2 format.
+// Nothing is done if the response is already in v2 format.
+void http_store_migrate_v2( const fs::path&, const asio::executor&
+                          , Cancel, asio::yield_context);
+
 // Return a new reader for a response stored in v0 format
 // in the given file.
 reader_uptr
 http_store_reader_v0( const fs::path&, asio::executor
                     , sys::error_code&);
 
-// Return a new reader for a response stored in v1 format
+// Return a new reader for a response stored in v1 or v2 format
 // under the given directory.
 //
 // Both the path and the executor are kept by the reader.
@@ -86,6 +117,30 @@ reader_uptr
 http_store_reader_v1( fs::path, asio::executor
                     , sys::error_code&);
 
+// Return a new reader like `http_store_reader_v1`,
+// but only for the data blocks in the given range
+// (the response head gets an `X-Ouinet-Block-Range` header).
+//
+// Each data block comes with the signature and chained hash
+// needed to verify it on its own.
+reader_uptr
+http_store_range_reader_v1( fs::path, asio::executor
+                          , const HttpBlockRange&
+                          , sys::error_code&);
+
+// Return a new reader like `http_store_reader_v1`,
+// but only for the data blocks covering the given range of data bytes.
+//
+// The response head gets a `206 Partial Content` status
+// (with the original one in an `X-Ouinet-HTTP-Status` header)
+// and a `Content-Range` header with the actual, block-aligned range.
+// Reading the head fails with `boost::system::errc::invalid_seek`
+// if the range is not satisfiable with stored data.
+reader_uptr
+http_store_range_reader_v1( fs::path, asio::executor
+                          , const HttpByteRange&
+                          , sys::error_code&);
+
 //// High-level classes for HTTP response storage
 
 class AbstractHttpStore {
@@ -93,6 +148,12 @@ public:
     using keep_func = std::function<
         bool(reader_uptr, asio::yield_context)>;
 
+    using keep_info_func = std::function<
+        bool(const HttpStoreEntryInfo&, asio::yield_context)>;
+
+    using on_remove_func = std::function<
+        void(const HttpStoreEntryInfo&)>;
+
 public:
     virtual ~AbstractHttpStore() = default;
 
@@ -107,6 +168,16 @@ public:
     void
     for_each(keep_func, asio::yield_context) = 0;
 
+    // Iterate over stored responses like `for_each`,
+    // but only get the metadata of each response.
+    //
+    // Stores may be able to provide the metadata
+    // without reading the responses themselves.
+    // The default implementation reads the head of each response.
+    virtual
+    void
+    for_each_info(keep_info_func, asio::yield_context);
+
     virtual
     void
     store( const std::string& key, http_response::AbstractReader&
@@ -116,6 +187,30 @@ public:
     reader_uptr
     reader( const std::string& key
           , sys::error_code&) = 0;  // not const, e.g. LRU cache
+
+    // Like `reader`, but only for the data blocks in the given range.
+    // The default implementation reports `operation_not_supported`.
+    virtual
+    reader_uptr
+    range_reader( const std::string& key, const HttpBlockRange&
+                , sys::error_code&);
+
+    // Like `reader`, but only for the data blocks covering the given byte range.
+    // The default implementation reports `operation_not_supported`.
+    virtual
+    reader_uptr
+    range_reader( const std::string& key, const HttpByteRange&
+                , sys::error_code&);
+
+    // Set a function to be called with the metadata of each response
+    // which leaves the store, be it removed, evicted,
+    // or replaced by a newer one.
+    // Responses dropped while rebuilding a missing index
+    // (see `HttpStoreV1`) are not reported.
+    // The default implementation never calls it.
+    virtual
+    void
+    on_remove(on_remove_func) {}
 };
 
 // This uses format v0 to store each response
@@ -145,21 +240,139 @@ private:
     asio::executor executor;
 };
 
-// This uses format v1 to store each response
+// Limits to the resources used by a store.
+//
+// A value of zero means no limit.
+struct HttpStoreLimits {
+    std::size_t max_bytes = 0;
+    std::size_t max_entries = 0;
+};
+
+// This uses format v2 to store each response
 // in a directory named `DIGEST[:2]/DIGEST[2:]`
 // (where `DIGEST = LOWER_HEX(SHA1(KEY))`)
 // under the given directory.
+// Responses stored in format v1 can still be read,
+// and they are converted to format v2 when the store is scanned.
+//
+// The store keeps an index of stored responses
+// (see `HttpStoreV1Index`) which is persisted to the `index` file
+// under the given directory.
+// If the index file is missing or corrupt,
+// it is rebuilt by the next `for_each` or `for_each_info`,
+// otherwise the latter just iterates over the index.
+// If limits are given, responses are evicted after storing a new one
+// until the store fits in them again.
+// Responses not accessed for the longest time are evicted first,
+// but each previous access to a response allows it to skip eviction once
+// (with previous accesses being halved on every skip).
 class HttpStoreV1 : public AbstractHttpStore {
 public:
-    HttpStoreV1(fs::path p, asio::executor ex)
-        : path(std::move(p)), executor(ex)
-    {}
+    HttpStoreV1(fs::path p, asio::executor ex, HttpStoreLimits limits = {});
 
     ~HttpStoreV1() override;
 
     void
     for_each(keep_func, asio::yield_context) override;
 
+    void
+    for_each_info(keep_info_func, asio::yield_context) override;
+
+    void
+    store( const std::string& key, http_response::AbstractReader&
+         , Cancel, asio::yield_context) override;
+
+    reader_uptr
+    reader( const std::string& key
+          , sys::error_code&) override;
+
+    reader_uptr
+    range_reader( const std::string& key, const HttpBlockRange&
+                , sys::error_code&) override;
+
+    reader_uptr
+    range_reader( const std::string& key, const HttpByteRange&
+                , sys::error_code&) override;
+
+    void
+    on_remove(on_remove_func) override;
+
+    // Total size in bytes and number of indexed responses.
+    std::size_t size() const;
+    std::size_t entry_count() const;
+
+private:
+    using scan_func = std::function<
+        boost::optional<HttpStoreEntryInfo>(const fs::path&, asio::yield_context)>;
+
+    void scan(scan_func, asio::yield_context);
+    void evict();
+
+private:
+    fs::path path;
+    asio::executor executor;
+    HttpStoreLimits limits;
+    std::unique_ptr<HttpStoreV1Index> index;
+};
+
+// This stores responses like `HttpStoreV1`,
+// but instead of using a directory per response,
+// responses taking no more than `max_packed_size` bytes in format v2
+// are appended as records to large segment files
+// named `LOWER_HEX_32(NUMBER).seg` under the given directory.
+// Bigger responses are stored in directories like `HttpStoreV1` does,
+// but under a `large` subdirectory.
+//
+// Only the last segment gets new records,
+// and another one is started when it reaches `segment_size` bytes.
+// Records of removed or replaced responses are left in segments
+// until a segment has as many bytes of them as of live records,
+// then live records are copied to the last segment in the background
+// and the old segment is removed (see `compact`).
+//
+// The index, limits and eviction work as with `HttpStoreV1`.
+//
+// ----
+//
+// Each record consists of a fixed-size header
+// followed by the `head`, `bsigs` and `body` files of the response:
+//
+//     "OSR1" SHA1(KEY) BIG_ENDIAN_32(HEAD_SIZE)
+//            BIG_ENDIAN_32(SIGS_SIZE) BIG_ENDIAN_32(BODY_SIZE)
+//            BIG_ENDIAN_64(STORE_TIME)
+//
+// The store time (in seconds since the epoch) is kept by compaction,
+// and used as the last access time of the response
+// when rebuilding the index.
+//
+// A record with an empty head stands for a response
+// stored in its own directory.
+// Later records for a key (further in a segment or in later segments)
+// replace earlier ones.
+// A truncated or malformed record (e.g. because of a crash)
+// is removed from its segment along with any data after it.
+//
+// Removals are only recorded in the index,
+// so if it is missing or corrupt,
+// responses removed but not yet compacted may be found again
+// when rebuilding it.
+class HttpStorePacked : public AbstractHttpStore {
+public:
+    static const std::size_t default_max_packed_size = 256 * 1024;
+    static const std::size_t default_segment_size = 64 * 1024 * 1024;
+
+    HttpStorePacked( fs::path p, asio::executor ex, HttpStoreLimits limits = {}
+                   , std::size_t segment_size = default_segment_size
+                   , std::size_t max_packed_size = default_max_packed_size);
+
+    ~HttpStorePacked() override;
+
+    void
+    for_each(keep_func, asio::yield_context) override;
+
+    void
+    for_each_info(keep_info_func, asio::yield_context) override;
+
     void
     store( const std::string& key, http_response::AbstractReader&
          , Cancel, asio::yield_context) override;
@@ -168,9 +381,104 @@ public:
     reader( const std::string& key
           , sys::error_code&) override;
 
+    reader_uptr
+    range_reader( const std::string& key, const HttpBlockRange&
+                , sys::error_code&) override;
+
+    reader_uptr
+    range_reader( const std::string& key, const HttpByteRange&
+                , sys::error_code&) override;
+
+    void
+    on_remove(on_remove_func) override;
+
+    // Move responses stored by `HttpStoreV1` (in format v1 or v2)
+    // under the given directory into this store,
+    // then remove the directory.
+    //
+    // Small responses are packed into segments
+    // and bigger ones moved to their own directories.
+    // Responses which fail to be moved are dropped,
+    // as well as those already in this store.
+    void migrate(const fs::path& v1_dir, Cancel, asio::yield_context);
+
+    // Copy live records out of segments
+    // with at least as many bytes of removed ones,
+    // and remove those segments.
+    //
+    // This is also done in the background when responses are removed.
+    // Nothing is done if a compaction is already running.
+    void compact(Cancel, asio::yield_context);
+
+    // Total size in bytes and number of indexed responses.
+    std::size_t size() const;
+    std::size_t entry_count() const;
+
+    // Bytes in segments used by records of removed or replaced responses.
+    std::size_t dead_size() const;
+
+private:
+    // Where a response is stored.
+    struct Record {
+        unsigned segment;
+        std::size_t offset;  // of the header in the segment
+        std::size_t head_size;  // zero if stored in a directory
+        std::size_t sigs_size;
+        std::size_t body_size;
+        std::time_t mtime;  // when the response was stored
+
+        std::size_t size() const;  // in the segment
+        std::string header(const util::SHA1::digest_type& key_digest) const;
+    };
+
+    struct Segment {
+        std::size_t size = 0;
+        std::size_t dead = 0;  // bytes of records not in use
+    };
+
+    using scan_func = std::function<
+        boost::optional<HttpStoreEntryInfo>(const std::string& digest, asio::yield_context)>;
+
+    void load();
+    void scan(scan_func, asio::yield_context);
+    void evict();
+
+    template<class... Range>
+    reader_uptr open_reader(const std::string& digest, sys::error_code&, const Range&...);
+
+    void append(const std::string& data, Record&, asio::yield_context);
+    std::size_t append_packed( const std::string& digest, const util::SHA1::digest_type&
+                             , std::time_t
+                             , const std::string& head, const std::string& sigs
+                             , const std::string& body, asio::yield_context);
+    std::size_t move_large( const std::string& digest, const util::SHA1::digest_type&
+                          , std::time_t, const fs::path& dir, asio::yield_context);
+    void migrate_entry( const std::string& digest, const fs::path& dir
+                      , Cancel&, asio::yield_context);
+    void replace(const std::string& digest, const Record&);
+    void drop(const std::string& digest);
+
+    boost::optional<unsigned> compaction_candidate() const;
+    void start_compaction();
+    void compact_segment(unsigned, Cancel&, asio::yield_context);
+
 private:
     fs::path path;
     asio::executor executor;
+    HttpStoreLimits limits;
+    std::size_t segment_size;
+    std::size_t max_packed_size;
+    std::unique_ptr<HttpStoreV1Index> index;
+
+    std::unordered_map<std::string, Record> records;  // by digest
+    std::map<unsigned, Segment> segments;  // the last one gets new records
+    // Of the last segment, once appended to
+    // (appends in progress keep it open).
+    std::shared_ptr<asio::posix::stream_descriptor> active_file;
+    bool appending = false;
+    ConditionVariable append_done;
+    bool compacting = false;
+    Cancel lifetime_cancel;
 };
 
 }} // namespaces
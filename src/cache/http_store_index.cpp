@@ -0,0 +1,398 @@
+#include "http_store_index.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iterator>
+
+#include <boost/filesystem/operations.hpp>
+
+#include "../logger.h"
+#include "../parse/number.h"
+#include "../util/str.h"
+
+#define _LOGPFX "HTTP store index: "
+#define _DEBUG(...) LOG_DEBUG(_LOGPFX, __VA_ARGS__)
+#define _WARN(...) LOG_WARN(_LOGPFX, __VA_ARGS__)
+
+namespace ouinet { namespace cache {
+
+static const std::string log_header = "OUINET-HTTP-STORE-INDEX 1";
+
+// Rewrite the log when it has this many records more than twice the entries.
+static const std::size_t log_compaction_slack = 1024;
+
+// Append access records to the log once this many are pending.
+static const std::size_t touch_batch_records = 64;
+
+static
+sys::error_code
+last_error()
+{
+    auto ec = sys::errc::make_error_code(static_cast<sys::errc::errc_t>(errno));
+    if (!ec) ec = sys::errc::make_error_code(sys::errc::no_message);
+    return ec;
+}
+
+static
+void
+write_all(int fd, const std::string& data, sys::error_code& ec)
+{
+    const char* p = data.data();
+    auto left = data.size();
+    while (left > 0) {
+        auto written = ::write(fd, p, left);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            ec = last_error();
+            return;
+        }
+        p += written;
+        left -= written;
+    }
+}
+
+// Consume a field terminated by space or end of record.
+static
+boost::string_view
+take_field(boost::string_view& s)
+{
+    auto sp = s.find(' ');
+    auto f = s.substr(0, sp);
+    s.remove_prefix(sp == boost::string_view::npos ? s.size() : sp + 1);
+    return f;
+}
+
+template<class T>
+static
+boost::optional<T>
+take_number(boost::string_view& s)
+{
+    auto f = take_field(s);
+    auto n = parse::number<T>(f);
+    if (!f.empty()) return boost::none;  // trailing garbage
+    return n;
+}
+
+static
+std::string
+add_record(const std::string& digest, const HttpStoreV1Index::Entry& e)
+{
+    auto& i = e.info;
+    return util::str( "A ", digest, ' ', e.size, ' ', e.last_access, ' ', e.hits
+                    , ' ', i.protocol_version, ' ', i.injection_ts
+                    , ' ', (i.data_size ? std::to_string(*i.data_size) : "-")
+                    , ' ', i.uri, '\n');
+}
+
+HttpStoreV1Index::~HttpStoreV1Index()
+{
+    flush_touches();
+    close_log();
+}
+
+bool
+HttpStoreV1Index::replay(const std::string& record)
+{
+    boost::string_view s(record);
+
+    auto type = take_field(s);
+    auto digest = take_field(s).to_string();
+    if (digest.empty()) return false;
+
+    if (type == "R") {
+        if (!s.empty()) return false;
+        erase_entry(digest);
+        return true;
+    }
+
+    if (type == "T") {
+        auto last_access = take_number<uint64_t>(s);
+        if (!last_access || !s.empty()) return false;
+        auto it = _items.find(digest);
+        if (it == _items.end()) return true;  // removed in between
+        it->second.entry.last_access = *last_access;
+        it->second.entry.hits++;
+        return true;
+    }
+
+    if (type != "A") return false;
+
+    auto size = take_number<std::size_t>(s);
+    auto last_access = take_number<uint64_t>(s);
+    auto hits = take_number<unsigned>(s);
+    auto proto = take_number<unsigned>(s);
+    auto inj_ts = take_number<uint64_t>(s);
+    if (!size || !last_access || !hits || !proto || !inj_ts) return false;
+
+    Entry e{*size, std::time_t(*last_access), *hits, {}};
+    e.info.protocol_version = *proto;
+    e.info.injection_ts = *inj_ts;
+
+    auto data_size_s = take_field(s);
+    if (data_size_s != "-") {
+        auto data_size = parse::number<std::size_t>(data_size_s);
+        if (!data_size || !data_size_s.empty()) return false;
+        e.info.data_size = *data_size;
+    }
+
+    e.info.uri = s.to_string();  // rest of the record
+    insert_entry(digest, std::move(e));
+    return true;
+}
+
+bool
+HttpStoreV1Index::load(const fs::path& log_path)
+{
+    clear();
+    _log_path = log_path;
+
+    std::ifstream in(log_path.native(), std::ios::binary);
+    if (!in) return false;
+
+    std::string data( (std::istreambuf_iterator<char>(in))
+                    , std::istreambuf_iterator<char>());
+    if (in.bad()) return false;
+
+    // Only consider LF-terminated records,
+    // the rest may come from an interrupted append.
+    auto valid_len = data.rfind('\n');
+    if (valid_len == std::string::npos) {
+        _WARN("Ignoring empty or truncated log: ", log_path);
+        return false;
+    }
+    valid_len++;
+
+    std::size_t records = 0;
+    bool ok = true;
+    for (std::size_t pos = 0; pos < valid_len; records++) {
+        auto eol = data.find('\n', pos);
+        auto record = data.substr(pos, eol - pos);
+        pos = eol + 1;
+
+        if (records == 0) {
+            ok = (record == log_header);
+        } else {
+            ok = replay(record);
+        }
+        if (!ok) {
+            _WARN("Malformed record ", records, " in log: ", log_path);
+            break;
+        }
+    }
+
+    if (!ok) {
+        clear();
+        return false;
+    }
+
+    _log_fd = ::open(log_path.c_str(), O_WRONLY | O_APPEND);
+    if (_log_fd == -1 || (valid_len < data.size() && ::ftruncate(_log_fd, valid_len) != 0)) {
+        _WARN("Failed to open log for appending: ", log_path
+             , " ec:", last_error().message());
+        clear();
+        return false;
+    }
+
+    _log_records = records;
+    sort();
+    _DEBUG("Loaded ", count(), " entries from log: ", log_path);
+    return true;
+}
+
+void
+HttpStoreV1Index::rewrite(sys::error_code& ec)
+{
+    assert(!_log_path.empty());
+    close_log();
+
+    auto temp_path = _log_path;
+    temp_path += ".tmp";
+
+    int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        ec = last_error();
+        return;
+    }
+
+    std::string data = log_header + '\n';
+    // Oldest first, so that replaying keeps access order.
+    for (auto it = _lru.rbegin(); it != _lru.rend(); ++it)
+        data += add_record(*it, _items.at(*it).entry);
+
+    write_all(fd, data, ec);
+    if (!ec && ::fsync(fd) != 0) ec = last_error();
+    ::close(fd);
+    if (!ec) fs::rename(temp_path, _log_path, ec);
+    if (ec) {
+        sys::error_code ignored_ec;
+        fs::remove(temp_path, ignored_ec);
+        return;
+    }
+
+    _log_fd = ::open(_log_path.c_str(), O_WRONLY | O_APPEND);
+    if (_log_fd == -1) {
+        ec = last_error();
+        return;
+    }
+    _log_records = count() + 1;
+}
+
+void
+HttpStoreV1Index::clear()
+{
+    close_log();
+    _lru.clear();
+    _items.clear();
+    _size = 0;
+}
+
+void
+HttpStoreV1Index::insert(const std::string& digest, Entry e)
+{
+    auto record = add_record(digest, e);
+    boost::optional<HttpStoreEntryInfo> replaced;
+    auto it = _on_remove ? _items.find(digest) : _items.end();
+    if (it != _items.end()) replaced = std::move(it->second.entry.info);
+    insert_entry(digest, std::move(e));
+    log(record);
+    if (replaced) _on_remove(*replaced);
+}
+
+void
+HttpStoreV1Index::touch(const std::string& digest)
+{
+    auto it = _items.find(digest);
+    if (it == _items.end()) return;
+    auto& e = it->second.entry;
+    e.last_access = std::time(nullptr);
+    e.hits++;
+    _lru.splice(_lru.begin(), _lru, it->second.pos);
+
+    if (_log_fd == -1) return;
+    _pending_touches += util::str("T ", digest, ' ', e.last_access, '\n');
+    if (++_pending_touch_count >= touch_batch_records) flush_touches();
+}
+
+bool
+HttpStoreV1Index::erase(const std::string& digest)
+{
+    auto it = _items.find(digest);
+    if (it == _items.end()) return false;
+    auto info = std::move(it->second.entry.info);
+    erase_entry(digest);
+    log(util::str("R ", digest, '\n'));
+    if (_on_remove) _on_remove(info);
+    return true;
+}
+
+void
+HttpStoreV1Index::insert_entry(const std::string& digest, Entry e)
+{
+    erase_entry(digest);
+    _size += e.size;
+    _lru.push_front(digest);
+    _items.emplace(digest, Item{std::move(e), _lru.begin()});
+}
+
+bool
+HttpStoreV1Index::erase_entry(const std::string& digest)
+{
+    auto it = _items.find(digest);
+    if (it == _items.end()) return false;
+    _size -= it->second.entry.size;
+    _lru.erase(it->second.pos);
+    _items.erase(it);
+    return true;
+}
+
+void
+HttpStoreV1Index::sort()
+{
+    _lru.sort([&] (const auto& a, const auto& b) {
+        return _items.at(a).entry.last_access > _items.at(b).entry.last_access;
+    });
+}
+
+boost::optional<std::string>
+HttpStoreV1Index::eviction_candidate()
+{
+    while (!_lru.empty()) {
+        auto& e = _items.at(_lru.back()).entry;
+        if (e.hits == 0) return _lru.back();
+        e.hits /= 2;
+        _lru.splice(_lru.begin(), _lru, std::prev(_lru.end()));
+    }
+    return boost::none;
+}
+
+std::vector<std::pair<std::string, HttpStoreEntryInfo>>
+HttpStoreV1Index::infos() const
+{
+    std::vector<std::pair<std::string, HttpStoreEntryInfo>> ret;
+    ret.reserve(_items.size());
+    for (auto& d : _lru)
+        ret.emplace_back(d, _items.at(d).entry.info);
+    return ret;
+}
+
+void
+HttpStoreV1Index::flush_touches()
+{
+    if (_pending_touch_count == 0) return;
+    log({});
+}
+
+void
+HttpStoreV1Index::log(std::string record)
+{
+    if (_log_fd == -1) return;
+
+    // Keep pending accesses before the new record, in one write.
+    auto records = _pending_touch_count + (record.empty() ? 0 : 1);
+    if (_pending_touch_count > 0) {
+        record.insert(0, _pending_touches);
+        _pending_touches.clear();
+        _pending_touch_count = 0;
+    }
+
+    sys::error_code ec;
+    write_all(_log_fd, record, ec);
+    if (ec) {
+        // A log missing records would lead to an inconsistent index,
+        // so drop it to force a full scan on next load.
+        _WARN("Failed to append to log, removing it: ", _log_path
+             , " ec:", ec.message());
+        close_log();
+        fs::remove(_log_path, ec);
+        return;
+    }
+
+    _log_records += records;
+    if (_log_records > 2 * count() + log_compaction_slack) {
+        _DEBUG("Compacting log: ", _log_path);
+        rewrite(ec);
+        if (ec) {
+            _WARN("Failed to compact log, removing it: ", _log_path
+                 , " ec:", ec.message());
+            close_log();
+            fs::remove(_log_path, ec);
+        }
+    }
+}
+
+void
+HttpStoreV1Index::close_log()
+{
+    // A rewritten log already has the latest accesses,
+    // and a cleared index does not need them.
+    _pending_touches.clear();
+    _pending_touch_count = 0;
+
+    if (_log_fd == -1) return;
+    ::close(_log_fd);
+    _log_fd = -1;
+}
+
+}} // namespaces
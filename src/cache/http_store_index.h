@@ -0,0 +1,152 @@
+#pragma once
+
+#include <ctime>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/optional.hpp>
+
+#include "../namespaces.h"
+
+namespace ouinet { namespace cache {
+
+// Metadata of a stored response,
+// enough to e.g. announce it without reading the response itself.
+struct HttpStoreEntryInfo {
+    std::string uri;
+    unsigned protocol_version = 0;
+    std::time_t injection_ts = 0;
+    boost::optional<std::size_t> data_size;  // missing if incomplete
+};
+
+// Index of responses in an `HttpStoreV1` or `HttpStorePacked`,
+// with entries identified by the digest of their key.
+//
+// The index is kept in memory,
+// and it can be persisted to an append-only log file,
+// so that the store does not need to read every stored response on start.
+//
+// ----
+//
+// The log file begins with a `OUINET-HTTP-STORE-INDEX 1` line,
+// followed by LF-terminated records with space-separated fields:
+//
+//   - `A DIGEST SIZE LAST_ACCESS HITS PROTO INJ_TS DATA_SIZE URI`:
+//     An entry was added or replaced.  `DATA_SIZE` is `-` if unknown.
+//
+//   - `T DIGEST LAST_ACCESS`: An entry was accessed.
+//     These records are appended in batches,
+//     so the last accesses may be lost on a crash.
+//
+//   - `R DIGEST`: An entry was removed.
+//
+// Numbers are in decimal.
+// A truncated last record (e.g. because of a crash) is ignored,
+// but any other malformed record invalidates the whole log.
+// The log is compacted by rewriting it
+// when it has too many records for the number of entries.
+class HttpStoreV1Index {
+public:
+    struct Entry {
+        std::size_t size;  // on disk
+        std::time_t last_access;
+        unsigned hits;
+        HttpStoreEntryInfo info;
+    };
+
+private:
+    using List = std::list<std::string>;  // most recently used first
+
+    struct Item {
+        Entry entry;
+        List::iterator pos;
+    };
+
+public:
+    HttpStoreV1Index() = default;
+
+    HttpStoreV1Index(const HttpStoreV1Index&) = delete;
+    HttpStoreV1Index& operator=(const HttpStoreV1Index&) = delete;
+
+    ~HttpStoreV1Index();
+
+    // Replace the in-memory index with the content of the given log
+    // and keep appending changes to it.
+    //
+    // Return false if the log is missing or corrupt,
+    // in which case the index is left empty and changes are not logged
+    // until `rewrite` is called.
+    bool load(const fs::path& log_path);
+
+    // Dump the in-memory index to the log given on `load`
+    // (atomically replacing it) and keep appending changes to it.
+    void rewrite(sys::error_code&);
+
+    // Whether the index was loaded or written to a log
+    // that is kept up to date.
+    bool is_logged() const { return _log_fd != -1; }
+
+    // Remove all entries and stop logging changes
+    // (e.g. before rebuilding the index).
+    void clear();
+
+    // Add or replace an entry, making it the most recently used one.
+    void insert(const std::string& digest, Entry);
+
+    // Record an access to the entry, if indexed.
+    //
+    // Accesses are logged along with the next other change,
+    // or once enough of them are pending.
+    void touch(const std::string& digest);
+
+    bool erase(const std::string& digest);
+
+    // Called with the metadata of each entry removed by `erase`
+    // or replaced by `insert`
+    // (but not of those dropped by `clear` or `load`).
+    using on_remove_func = std::function<void(const HttpStoreEntryInfo&)>;
+    void on_remove(on_remove_func f) { _on_remove = std::move(f); }
+
+    // Order entries by decreasing access time
+    // (e.g. after loading them in no particular order).
+    void sort();
+
+    // Return the entry that should be evicted next, if any.
+    //
+    // Entries with previous accesses are given another chance,
+    // with their access count being halved.
+    boost::optional<std::string> eviction_candidate();
+
+    // Digests and metadata of all entries.
+    std::vector<std::pair<std::string, HttpStoreEntryInfo>> infos() const;
+
+    std::size_t size() const { return _size; }
+    std::size_t count() const { return _items.size(); }
+
+private:
+    void insert_entry(const std::string& digest, Entry);
+    bool erase_entry(const std::string& digest);
+    bool replay(const std::string& record);
+
+    void log(std::string record);
+    void flush_touches();
+    void close_log();
+
+private:
+    List _lru;
+    std::unordered_map<std::string, Item> _items;
+    std::size_t _size = 0;
+    on_remove_func _on_remove;
+
+    fs::path _log_path;
+    int _log_fd = -1;
+    std::size_t _log_records = 0;
+    std::string _pending_touches;  // `T` records not yet logged
+    std::size_t _pending_touch_count = 0;
+};
+
+}} // namespaces
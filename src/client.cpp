@@ -17,6 +17,7 @@
 
 #include "namespaces.h"
 #include "origin_pools.h"
+#include "dns_cache.h"
 #include "http_util.h"
 #include "fetch_http_page.h"
 #include "client_front_end.h"
@@ -36,10 +37,14 @@
 #include "constants.h"
 #include "util/async_queue_reader.h"
 #include "session.h"
+#include "response_tee.h"
+#include "inflight_requests.h"
 #include "create_udp_multiplexer.h"
 #include "ssl/ca_certificate.h"
 #include "ssl/dummy_certificate.h"
 #include "ssl/util.h"
+#include "util/prefixed_stream.h"
+#include "util/thread_pool.h"
 #include "bittorrent/dht.h"
 #include "bittorrent/mutable_data.h"
 
@@ -56,6 +61,7 @@
 #include "ouiservice/tcp.h"
 #include "ouiservice/utp.h"
 #include "ouiservice/tls.h"
+#include "ouiservice/multiplex.h"
 #include "ouiservice/weak_client.h"
 #include "ouiservice/bep5/client.h"
 #include "ouiservice/multi_utp_server.h"
@@ -85,6 +91,11 @@ static const fs::path OUINET_CA_CERT_FILE = "ssl-ca-cert.pem";
 static const fs::path OUINET_CA_KEY_FILE = "ssl-ca-key.pem";
 static const fs::path OUINET_CA_DH_FILE = "ssl-ca-dh.pem";
 
+// Response data kept in memory for each of its consumers
+// (agent, storage) before the rest goes to a file under this directory.
+static const size_t response_max_buffered = 1024 * 1024;
+static const fs::path OUINET_SPILL_DIR = "spill";
+
 static bool log_transactions() {
     return logger.get_threshold() <= DEBUG;
 }
@@ -97,10 +108,12 @@ public:
     State(asio::io_context& ctx, ClientConfig cfg)
         : _ctx(ctx)
         , _config(move(cfg))
-        // A certificate chain with OUINET_CA + SUBJECT_CERT
-        // can be around 2 KiB, so this would be around 2 MiB.
+        // A context with a certificate chain with OUINET_CA + SUBJECT_CERT
+        // and its session cache can take a few KiB,
+        // so this would be a few MiB.
         // TODO: Fine tune if necessary.
-        , _ssl_certificate_cache(1000)
+        , _ssl_context_cache(500)
+        , _dns_cache(ctx.get_executor())
         , ssl_ctx{asio::ssl::context::tls_client}
         , inj_ctx{asio::ssl::context::tls_client}
     {
@@ -121,6 +134,8 @@ public:
         _bep5_http_cache = nullptr;
         _upnps.clear();
         _shutdown_signal();
+        while (!_injector_connections.empty())
+            _injector_connections.pop_front().close();
         if (_injector) _injector->stop();
         if (_bt_dht) {
             _bt_dht->stop();
@@ -181,6 +196,9 @@ private:
                                     , const Request&
                                     , asio::yield_context);
 
+    shared_ptr<asio::ssl::context>
+    get_mitm_context(const string& cert_name, asio::yield_context);
+
     void serve_request(GenericStream&& con, asio::yield_context yield);
 
     // All `fetch_*` functions below take care of keeping or dropping
@@ -217,6 +235,14 @@ private:
 
     CacheControl build_cache_control(request_route::Config& request_config);
 
+    void keep_injector_connection(GenericStream);
+
+    ClientFrontEnd::InjectorPoolStats injector_pool_stats() const {
+        auto stats = _injector_pool_stats;
+        stats.idle = _injector_connections.size();
+        return stats;
+    }
+
     void listen_tcp( asio::yield_context
                    , tcp::endpoint
                    , const char* service
@@ -231,6 +257,7 @@ private:
     fs::path ca_cert_path() const { return _config.repo_root() / OUINET_CA_CERT_FILE; }
     fs::path ca_key_path()  const { return _config.repo_root() / OUINET_CA_KEY_FILE;  }
     fs::path ca_dh_path()   const { return _config.repo_root() / OUINET_CA_DH_FILE;   }
+    fs::path spill_dir()    const { return _config.repo_root() / OUINET_SPILL_DIR;   }
 
     asio::io_context& get_io_context() { return _ctx; }
     asio::executor get_executor() { return _ctx.get_executor(); }
@@ -323,7 +350,14 @@ private:
     asio::io_context& _ctx;
     ClientConfig _config;
     std::unique_ptr<CACertificate> _ca_certificate;
-    util::LruCache<string, string> _ssl_certificate_cache;
+    // Server contexts for MITM, by certificate name (see `get_mitm_context`).
+    util::LruCache<string, shared_ptr<asio::ssl::context>> _ssl_context_cache;
+    // Contexts being created, to avoid doing it more than once
+    // when the browser opens many connections to a new site.
+    std::map<string, shared_ptr<ConditionVariable>> _pending_ssl_contexts;
+    // Certificate generation happens here, out of the I/O thread.
+    // This must be destroyed before the CA certificate.
+    util::ThreadPool _ssl_certificate_pool{1};
     std::unique_ptr<OuiServiceClient> _injector;
     std::unique_ptr<cache::bep5_http::Client> _bep5_http_cache;
 
@@ -333,7 +367,14 @@ private:
     // For debugging
     uint64_t _next_connection_id = 0;
     ConnectionPool<Endpoint> _injector_connections;
+    ClientFrontEnd::InjectorPoolStats _injector_pool_stats;
     OriginPools _origin_pools;
+    DnsCache _dns_cache;
+
+    // Requests being fetched via the cache control
+    // which identical requests may follow instead of fetching them again
+    // (see `ClientCacheControl::fetch`), by cache key.
+    InFlightRequests _inflight_requests;
 
     asio::ssl::context ssl_ctx;
     asio::ssl::context inj_ctx;
@@ -387,13 +428,31 @@ Client::State::serve_utp_request(GenericStream con, Yield yield)
 
     http::request<http::empty_body> req;
     beast::flat_buffer buffer;
-    http::async_read(con, buffer, req, yield[ec]);
 
+    // Do not wait forever for a request,
+    // e.g. if the client went away without closing the connection.
+    auto read_request = [&] {
+        bool timed_out = false;
+        auto cancelled = cancel.connect([&] { con.close(); });
+        WatchDog wd(_ctx, default_timeout::http_request()
+                   , [&] { timed_out = true; con.close(); });
+        req = {};
+        http::async_read(con, buffer, req, yield[ec]);
+        if (timed_out) ec = asio::error::timed_out;
+    };
+
+    read_request();
     if (ec || cancel) return;
 
-    if (req.method() != http::verb::connect) {
+    // Clients fetching data block ranges from several peers
+    // send further requests over the same connection.
+    while (req.method() != http::verb::connect) {
         _bep5_http_cache->serve_local(req, con, cancel, yield[ec]);
-        return;
+        if (ec || cancel) return;
+        if (req[http_::block_range_hdr].empty() || !req.keep_alive()) return;
+
+        read_request();
+        if (ec || cancel) return;
     }
 
     // Connect to the injector and tunnel the transaction through it
@@ -485,10 +544,7 @@ Client::State::connect_to_origin( const Request& rq
 
     sys::error_code ec;
 
-    auto lookup = util::tcp_async_resolve( host, port
-                                         , _ctx.get_executor()
-                                         , cancel
-                                         , yield[ec]);
+    auto lookup = _dns_cache.resolve(host, port, cancel, yield[ec]);
 
     if (ec) return or_throw<GenericStream>(yield, ec);
 
@@ -529,6 +585,7 @@ Response Client::State::fetch_fresh_from_front_end(const Request& rq, Yield yiel
                                , udp_port
                                , _upnps
                                , _udp_reachability.get()
+                               , injector_pool_stats()
                                , yield.tag("serve_frontend"));
 
     res.set( http_::response_source_hdr  // for agent
@@ -708,14 +765,20 @@ Session Client::State::fetch_fresh_through_simple_proxy
 
         con = _injector_connections.wrap(std::move(c.connection));
         *con = c.remote_endpoint;
+        ++_injector_pool_stats.misses;
     } else {
         if (log_transactions()) {
             yield.log("Reusing existing injector connection");
         }
 
         con = _injector_connections.pop_front();
+        ++_injector_pool_stats.hits;
     }
 
+    // Only give the connection back to the pool once a whole response
+    // has been read from it (see below), not whenever it is dropped.
+    con.auto_add_back_to_pool(false);
+
     auto cancel_slot = cancel.connect([&] {
         con.close();
     });
@@ -773,6 +836,9 @@ Session Client::State::fetch_fresh_through_simple_proxy
     if (ec) return or_throw(yield, ec, std::move(session));
 
     // Store keep-alive connections in connection pool
+    session.on_reusable_stream([this] (GenericStream s) {
+        keep_injector_connection(std::move(s));
+    });
 
     if (can_inject) {
         maybe_add_proto_version_warning(hdr);
@@ -789,6 +855,28 @@ Session Client::State::fetch_fresh_through_simple_proxy
     return session;
 }
 
+//------------------------------------------------------------------------------
+void Client::State::keep_injector_connection(GenericStream s)
+{
+    using Connection = ConnectionPool<Endpoint>::Connection;
+
+    auto con = s.release_as<Connection>();
+    if (!con) return s.close();
+
+    // Idle connections are dropped from the pool
+    // as soon as the injector closes them or sends unexpected data.
+    auto ep = **con;
+    auto max = _config.injector_pool_max_per_endpoint();
+    auto kept = _injector_connections.count_if([&] (const Endpoint& e) { return e == ep; });
+    if (_shutdown_signal || !con->is_open() || kept >= max) {
+        con->close();
+        return;
+    }
+
+    _injector_connections.push_back(std::move(*con));
+    ++_injector_pool_stats.returned;
+}
+
 //------------------------------------------------------------------------------
 class Client::ClientCacheControl {
 public:
@@ -940,6 +1028,51 @@ public:
                     return or_throw(yield, ec, keep_alive);
                 }
                 case fresh_channel::injector: {
+                    auto exec = ctx.get_executor();
+
+                    // Identical requests being fetched at the same time
+                    // (e.g. from several tabs) get a single response
+                    // which is fetched and stored once.
+                    auto key = key_from_http_req(rq);
+                    if (!key || !is_collapsible(rq)) key = boost::none;
+
+                    auto& inflight_requests = client_state._inflight_requests;
+                    auto rr = key ? inflight_requests.follow(*key) : nullptr;
+
+                    if (rr) {
+                        Session sag = Session::create_from_reader(std::move(rr), cancel, yield[ec]);
+
+                        if (!ec) {
+                            if (log_transactions()) {
+                                yield.log("Following identical request in flight");
+                            }
+
+                            sag.flush_response(con, cancel, yield[ec]);
+
+                            bool keep_alive = !ec && rq.keep_alive() && sag.keep_alive();
+                            if (!keep_alive) {
+                                sag.close();
+                                con.close();
+                            }
+                            return or_throw(yield, ec, keep_alive);
+                        }
+
+                        if (cancel) break;
+                        // The other request failed before getting a response,
+                        // nothing was sent yet so fetch it here.
+                        ec = {};
+                        key = boost::none;
+                    }
+
+                    // A slow agent, storage or follower
+                    // does not make the response pile up in memory.
+                    http_response::Tee tee(exec, response_max_buffered, client_state.spill_dir());
+
+                    // Followers still waiting for a response
+                    // fetch it by themselves if the tee is gone before it starts.
+                    auto leader = key ? inflight_requests.lead(*key, tee)
+                                      : InFlightRequests::Leader();
+
                     sys::error_code fresh_ec;
                     sys::error_code cache_ec;
 
@@ -970,29 +1103,30 @@ public:
                         break;
                     }
 
-                    auto exec = ctx.get_executor();
-
                     using http_response::Part;
 
-                    util::AsyncQueue<boost::optional<Part>> qst(exec), qag(exec); // to storage, agent
-
-                    WaitCondition wc(ctx);
-
                     auto cache = client_state.get_cache();
                     bool do_cache =
                         ( cache
                         && rsh[http_::response_source_hdr] != http_::response_source_hdr_local_cache
                         && CacheControl::ok_to_cache(rq, rsh));
+
+                    auto rst = do_cache ? tee.add_reader() : nullptr;  // to storage
+                    auto rag = tee.add_reader();  // to agent
+
+                    WaitCondition wc(ctx);
+
                     if (do_cache)
                         TRACK_SPAWN(ctx, ([
                             &, cache = std::move(cache),
                             lock = wc.lock()
                         ] (asio::yield_context yield_) {
                             auto key = key_from_http_req(rq); assert(key);
-                            AsyncQueueReader rr(qst);
                             sys::error_code ec;
                             auto y = yield.detach(yield_);
-                            cache->store(*key, rr, cancel, y[ec]);
+                            cache->store(*key, *rst, cancel, y[ec]);
+                            // Do not hold the response back if storing failed.
+                            rst->close();
                         }));
 
                     TRACK_SPAWN(ctx, ([
@@ -1000,22 +1134,22 @@ public:
                         lock = wc.lock()
                     ] (asio::yield_context yield_) {
                         sys::error_code ec;
-                        auto rr = std::make_unique<AsyncQueueReader>(qag);
-                        Session sag = Session::create_from_reader(std::move(rr), cancel, yield_[ec]);
+                        Session sag = Session::create_from_reader(std::move(rag), cancel, yield_[ec]);
                         if (!ec) sag.flush_response(con, cancel, yield_[ec]);
                     }));
 
+                    // No more followers once the response starts.
+                    leader.stop();
+
                     s.flush_response(cancel, yield[ec],
                         [&] ( Part&& part
                             , Cancel& cancel
                             , asio::yield_context yield)
                         {
-                            if (do_cache) qst.push_back(part);
-                            qag.push_back(std::move(part));
+                            tee.async_push(std::move(part), cancel, yield);
                         });
 
-                    if (do_cache) qst.push_back(boost::none);
-                    qag.push_back(boost::none);
+                    tee.finish(ec);
 
                     wc.wait(yield);
 
@@ -1036,6 +1170,15 @@ public:
         return or_throw(yield, last_error, rq.keep_alive());
     }
 
+private:
+    // Whether the response to `rq` can be shared with identical requests.
+    static bool is_collapsible(const Request& rq) {
+        return rq.method() == http::verb::get
+            && rq[http::field::range].empty()
+            && rq[http::field::if_none_match].empty()
+            && rq[http::field::if_modified_since].empty();
+    }
+
 private:
     Client::State& client_state;
     request_route::Config& request_config;
@@ -1043,59 +1186,101 @@ private:
 };
 
 //------------------------------------------------------------------------------
+// Return the name for a MITM certificate valid for the given host:
+// the host itself for IP addresses,
+// its parent domain for host names with several dots
+// (e.g. "example.com" for "www.example.com", but not "localhost" or "example.com"),
+// since the certificate covers that domain and its subdomains.
 static
-string base_domain_from_target(const beast::string_view& target)
+string mitm_certificate_name(const string& host)
 {
-    auto full_host = target.substr(0, target.rfind(':'));
+    sys::error_code ec;
+    asio::ip::make_address(host, ec);
+    if (!ec) return host;
+
     size_t dot0, dot1 = 0;
-    if ((dot0 = full_host.find('.')) != full_host.rfind('.'))
-        // Two different dots were found
-        // (e.g. "www.example.com" but not "localhost" or "example.com").
+    if ((dot0 = host.find('.')) != host.rfind('.'))
         dot1 = dot0 + 1;  // skip first component and dot (e.g. "www.")
-    return full_host.substr(dot1).to_string();
+    return host.substr(dot1);
 }
 
 //------------------------------------------------------------------------------
-GenericStream Client::State::ssl_mitm_handshake( GenericStream&& con
-                                               , const Request& con_req
-                                               , asio::yield_context yield)
+shared_ptr<asio::ssl::context>
+Client::State::get_mitm_context(const string& cert_name, asio::yield_context yield)
 {
-    // TODO: We really should be waiting for
-    // the TLS Client Hello message to arrive at the clear text connection
-    // (after we send back 200 OK),
-    // then retrieve the value of the Server Name Indication (SNI) field
-    // and rewind the Hello message,
-    // but for the moment we will assume that the browser sends
-    // a host name instead of an IP address or its reverse resolution.
-    auto base_domain = base_domain_from_target(con_req.target());
-
-    const string* crt_chain = _ssl_certificate_cache.get(base_domain);
-
-    if (!crt_chain) {
-        DummyCertificate dummy_crt(*_ca_certificate, base_domain);
-
-        crt_chain
-            = _ssl_certificate_cache.put(move(base_domain)
-                                        , dummy_crt.pem_certificate()
-                                          + _ca_certificate->pem_certificate());
+    // Reusing the context avoids parsing keys and certificates again,
+    // and it allows the browser to resume previous TLS sessions.
+    if (auto ctx = _ssl_context_cache.get(cert_name)) return *ctx;
+
+    auto pending_i = _pending_ssl_contexts.find(cert_name);
+    if (pending_i != _pending_ssl_contexts.end()) {
+        auto created = pending_i->second;  // keep while waiting
+        sys::error_code ec;
+        created->wait(yield[ec]);
+        if (ec) return or_throw<shared_ptr<asio::ssl::context>>(yield, ec);
+        if (auto ctx = _ssl_context_cache.get(cert_name)) return *ctx;
+        return or_throw<shared_ptr<asio::ssl::context>>(yield, asio::error::invalid_argument);
     }
 
-    auto ssl_context = ssl::util::get_server_context
-        ( *crt_chain
-        , _ca_certificate->pem_private_key()
-        , _ca_certificate->pem_dh_param());
+    auto created = make_shared<ConditionVariable>(_ctx.get_executor());
+    _pending_ssl_contexts.emplace(cert_name, created);
+    auto on_exit = defer([&] {
+        _pending_ssl_contexts.erase(cert_name);
+        created->notify();
+    });
 
+    shared_ptr<asio::ssl::context> ctx;
+    try {
+        ctx = _ssl_certificate_pool.run([&] {
+            DummyCertificate dummy_crt(*_ca_certificate, cert_name);
+
+            return make_shared<asio::ssl::context>(ssl::util::get_server_context
+                ( dummy_crt.pem_certificate() + _ca_certificate->pem_certificate()
+                , _ca_certificate->pem_private_key()
+                , _ca_certificate->pem_dh_param()));
+        }, yield);
+    } catch (const std::exception& e) {
+        LOG_ERROR("Failed to create MITM certificate for ", cert_name, ": ", e.what());
+        return or_throw<shared_ptr<asio::ssl::context>>(yield, asio::error::invalid_argument);
+    }
+
+    _ssl_context_cache.put(cert_name, ctx);
+    return ctx;
+}
+
+//------------------------------------------------------------------------------
+GenericStream Client::State::ssl_mitm_handshake( GenericStream&& con
+                                               , const Request& con_req
+                                               , asio::yield_context yield)
+{
     // Send back OK to let the UA know we have the "tunnel"
     http::response<http::string_body> res{http::status::ok, con_req.version()};
     http::async_write(con, res, yield);
 
     sys::error_code ec;
 
-    auto ssl_sock = make_unique<asio::ssl::stream<GenericStream>>(move(con), ssl_context);
+    // Choose the certificate from the Server Name Indication (SNI)
+    // in the TLS Client Hello, which is put back for the handshake.
+    // Use the CONNECT target if missing (e.g. for IP addresses).
+    auto hello = ssl::util::read_client_hello(con, yield[ec]);
+    if (ec) return or_throw<GenericStream>(yield, ec);
+
+    auto host = ssl::util::client_hello_server_name(hello);
+    if (!host) host = util::get_host_port(con_req).first;
+
+    // Keep the context while the connection uses it,
+    // even if evicted from the cache.
+    auto ssl_context = get_mitm_context(mitm_certificate_name(*host), yield[ec]);
+    if (ec) return or_throw<GenericStream>(yield, ec);
+
+    using SslStream = asio::ssl::stream<util::PrefixedStream<GenericStream>>;
+
+    auto ssl_sock = make_unique<SslStream>
+        (util::PrefixedStream<GenericStream>(move(hello), move(con)), *ssl_context);
     ssl_sock->async_handshake(asio::ssl::stream_base::server, yield[ec]);
     if (ec) return or_throw<GenericStream>(yield, ec);
 
-    static const auto ssl_shutter = [](asio::ssl::stream<GenericStream>& s) {
+    auto ssl_shutter = [ssl_context] (SslStream& s) {
         // Just close the underlying connection
         // (TLS has no message exchange for shutdown).
         s.next_layer().close();
@@ -1500,6 +1685,8 @@ void Client::State::setup_cache()
                 = cache::bep5_http::Client::build( dht
                                                  , *_config.cache_http_pub_key()
                                                  , _config.repo_root()/"bep5_http"
+                                                 , cache::HttpStoreLimits{ _config.cache_max_size()
+                                                                         , _config.cache_max_entries()}
                                                  , logger.get_threshold()
                                                  , yield[ec]);
 
@@ -1618,6 +1805,12 @@ void Client::State::start()
         ( "Your own local Ouinet client"
         , ca_cert_path(), ca_key_path(), ca_dh_path());
 
+    {
+        sys::error_code ec;
+        util::file_io::check_or_create_directory(spill_dir(), ec);
+        if (ec) LOG_WARN("Failed to create directory for response data: ", ec.message());
+    }
+
     if (!_config.tls_injector_cert_path().empty()) {
         if (fs::exists(fs::path(_config.tls_injector_cert_path()))) {
             LOG_DEBUG("Loading injector certificate file");
@@ -1807,6 +2000,11 @@ void Client::State::setup_injector(asio::yield_context yield)
         client = std::move(obfs4_client);
     }
 
+    if (client && _config.injector_mux_max_channels() > 0) {
+        client = make_unique<ouiservice::MultiplexOuiServiceClient>
+            (_ctx.get_executor(), move(client), _config.injector_mux_max_channels());
+    }
+
     _injector->add(*injector_ep, std::move(client));
 
     _injector->start(yield);
@@ -1927,6 +2125,9 @@ int main(int argc, char* argv[])
         return 0;
     }
 
+    // Keep request handlers from blocking on log output.
+    logger.set_async(true);
+
     asio::io_context ctx;
 
     asio::signal_set signals(ctx, SIGINT, SIGTERM);
@@ -56,6 +56,26 @@ public:
         return _autoseed_updated;
     }
 
+    // Zero means no limit.
+    std::size_t cache_max_size() const {
+        return _cache_max_size;
+    }
+
+    std::size_t cache_max_entries() const {
+        return _cache_max_entries;
+    }
+
+    // Maximum number of idle keep-alive connections kept to each injector endpoint.
+    std::size_t injector_pool_max_per_endpoint() const {
+        return _injector_pool_max_per_endpoint;
+    }
+
+    // Maximum number of requests multiplexed over a single injector connection
+    // (0 if multiplexing is disabled).
+    std::size_t injector_mux_max_channels() const {
+        return _injector_mux_max_channels;
+    }
+
     boost::optional<std::string>
     credentials_for(const Endpoint& injector) const {
         auto i = _injector_credentials.find(injector);
@@ -121,6 +141,15 @@ public:
             , "<username>:<password> authentication pair for the injector")
            ("injector-tls-cert-file", po::value<string>(&_tls_injector_cert_path)
             , "Path to the injector's TLS certificate; enable TLS for TCP and uTP")
+           ("injector-pool-max-per-endpoint"
+            , po::value<size_t>(&_injector_pool_max_per_endpoint)->default_value(4)
+            , "Maximum number of idle keep-alive connections kept open "
+              "to each injector endpoint for reuse (0 disables reuse)")
+           ("injector-mux-max-channels"
+            , po::value<size_t>(&_injector_mux_max_channels)->default_value(0)
+            , "Multiplex up to this many concurrent requests "
+              "over each connection to the injector (0 disables multiplexing, "
+              "which is needed by injectors not supporting it)")
 
            // Cache options
            ("cache-type", po::value<string>()->default_value("none")
@@ -132,6 +161,13 @@ public:
             , po::value<int>()->default_value(_max_cached_age.total_seconds())
             , "Discard cached content older than this many seconds "
               "(0: discard all; -1: discard none)")
+           ("cache-max-size"
+            , po::value<size_t>()->default_value(0)
+            , "Maximum disk space used by locally cached responses, in MiB "
+              "(0: no limit); least used responses are removed first")
+           ("cache-max-entries"
+            , po::value<size_t>(&_cache_max_entries)->default_value(0)
+            , "Maximum number of locally cached responses (0: no limit)")
            ("autoseed-updated", po::bool_switch(&_autoseed_updated)->default_value(false)
             , "Automatically fetch and seed the data of updated index entries "
               "that this client is already publishing.")
@@ -178,6 +214,8 @@ private:
     boost::optional<Endpoint> _injector_ep;
     std::string _tls_injector_cert_path;
     std::string _tls_ca_cert_store_path;
+    std::size_t _injector_pool_max_per_endpoint = 4;
+    std::size_t _injector_mux_max_channels = 0;
     bool _enable_http_connect_requests = false;
     bool _disable_cache_access = false;
     bool _disable_origin_access = false;
@@ -188,6 +226,8 @@ private:
     boost::posix_time::time_duration _max_cached_age
         = boost::posix_time::hours(7*24);  // one week
     bool _autoseed_updated = false;
+    std::size_t _cache_max_size = 0;
+    std::size_t _cache_max_entries = 0;
 
     std::string _client_credentials;
     std::map<Endpoint, std::string> _injector_credentials;
@@ -263,6 +303,10 @@ ClientConfig::ClientConfig(int argc, char* argv[])
         _max_cached_age = boost::posix_time::seconds(vm["max-cached-age"].as<int>());
     }
 
+    if (vm.count("cache-max-size")) {
+        _cache_max_size = vm["cache-max-size"].as<size_t>() * 1024 * 1024;
+    }
+
     if (!vm.count("listen-on-tcp")) {
         throw std::runtime_error(
                 util::str( "The parameter 'listen-on-tcp' is missing.\n"
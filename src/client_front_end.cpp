@@ -144,7 +144,8 @@ void ClientFrontEnd::handle_ca_pem( const Request& req, Response& res, stringstr
 
 void ClientFrontEnd::handle_portal( ClientConfig& config
                                   , const Request& req, Response& res, stringstream& ss
-                                  , cache::bep5_http::Client* bep5_cache)
+                                  , cache::bep5_http::Client* bep5_cache
+                                  , const InjectorPoolStats& injector_pool)
 {
     res.set(http::field::content_type, "text/html");
 
@@ -238,6 +239,9 @@ void ClientFrontEnd::handle_portal( ClientConfig& config
     ss << "<br>\n";
     ss << "Now: " << now_as_string()  << "<br>\n";
     ss << "Injector endpoint: " << config.injector_endpoint() << "<br>\n";
+    ss << "Injector connections: " << injector_pool.idle << " idle, "
+       << injector_pool.hits << " reused, " << injector_pool.misses << " new, "
+       << injector_pool.returned << " kept alive<br>\n";
 
     if (_show_pending_tasks) {
         ss << "        <h2>Pending tasks " << _pending_tasks.size() << "</h2>\n";
@@ -249,6 +253,10 @@ void ClientFrontEnd::handle_portal( ClientConfig& config
     }
 
     if (bep5_cache) {
+        auto as = bep5_cache->announcer_stats();
+        ss << "Cache announcements: " << as.entries << " entries, "
+           << as.running << " running, " << as.backlog << " due, "
+           << as.lag << " behind<br>\n";
         ss << *_bep5_log_level_input;
     }
 
@@ -277,6 +285,8 @@ void ClientFrontEnd::handle_status( ClientConfig& config
                                   , boost::optional<uint32_t> udp_port
                                   , const UPnPs& upnps
                                   , const util::UdpServerReachabilityAnalysis* reachability
+                                  , cache::bep5_http::Client* bep5_cache
+                                  , const InjectorPoolStats& injector_pool
                                   , const Request& req, Response& res, stringstream& ss)
 {
     res.set(http::field::content_type, "application/json");
@@ -288,9 +298,25 @@ void ClientFrontEnd::handle_status( ClientConfig& config
         {"injector_access", config.is_injector_access_enabled()},
         {"distributed_cache", config.is_cache_access_enabled()},
         {"ouinet_version", Version::VERSION_NAME},
-        {"ouinet_build_id", Version::BUILD_ID}
+        {"ouinet_build_id", Version::BUILD_ID},
+        {"injector_connections", {
+            {"idle", injector_pool.idle},
+            {"hits", injector_pool.hits},
+            {"misses", injector_pool.misses},
+            {"returned", injector_pool.returned}
+        }}
     };
 
+    if (bep5_cache) {
+        auto as = bep5_cache->announcer_stats();
+        response["cache_announcements"] = {
+            {"entries", as.entries},
+            {"running", as.running},
+            {"backlog", as.backlog},
+            {"lag", chrono::duration_cast<chrono::seconds>(as.lag).count()}
+        };
+    }
+
     if (udp_port) {
         using namespace asio::ip;
 
@@ -337,6 +363,7 @@ Response ClientFrontEnd::serve( ClientConfig& config
                               , boost::optional<uint32_t> udp_port
                               , const UPnPs& upnps
                               , const util::UdpServerReachabilityAnalysis* reachability
+                              , const InjectorPoolStats& injector_pool
                               , Yield yield)
 {
     Response res{http::status::ok, req.version()};
@@ -353,9 +380,9 @@ Response ClientFrontEnd::serve( ClientConfig& config
     if (path == "/ca.pem") {
         handle_ca_pem(req, res, ss, ca);
     } else if (path == "/api/status") {
-        handle_status(config, udp_port, upnps, reachability, req, res, ss);
+        handle_status(config, udp_port, upnps, reachability, bep5_cache, injector_pool, req, res, ss);
     } else {
-        handle_portal(config, req, res, ss, bep5_cache);
+        handle_portal(config, req, res, ss, bep5_cache, injector_pool);
     }
 
     Response::body_type::reader reader(res, res.body());
@@ -60,6 +60,14 @@ public:
         Clock::time_point _start_time;
     };
 
+    // Usage of keep-alive connections to the injector.
+    struct InjectorPoolStats {
+        std::size_t idle = 0;      // connections currently kept for reuse
+        std::size_t hits = 0;      // requests sent over a kept connection
+        std::size_t misses = 0;    // requests needing a new connection
+        std::size_t returned = 0;  // connections kept after a complete response
+    };
+
 public:
     Response serve( ClientConfig&
                   , const http::request<http::string_body>&
@@ -68,6 +76,7 @@ public:
                   , boost::optional<uint32_t> udp_port
                   , const UPnPs&
                   , const util::UdpServerReachabilityAnalysis*
+                  , const InjectorPoolStats&
                   , Yield yield);
 
     Task notify_task(const std::string& task_name)
@@ -99,12 +108,15 @@ private:
                       , const Request&
                       , Response&
                       , std::stringstream&
-                      , cache::bep5_http::Client*);
+                      , cache::bep5_http::Client*
+                      , const InjectorPoolStats&);
 
     void handle_status( ClientConfig&
                       , boost::optional<uint32_t> udp_port
                       , const UPnPs&
                       , const util::UdpServerReachabilityAnalysis*
+                      , cache::bep5_http::Client*
+                      , const InjectorPoolStats&
                       , const Request&
                       , Response&
                       , std::stringstream&);
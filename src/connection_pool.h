@@ -368,6 +368,27 @@ class ConnectionPool {
         return _connections->empty();
     }
 
+    std::size_t size() const
+    {
+        return _connections->size();
+    }
+
+    // Number of connections whose stored value satisfies `pred`.
+    template<class Pred>
+    std::size_t count_if(Pred pred) const
+    {
+        std::size_t n = 0;
+        for (const auto& c : *_connections) if (pred(c._value)) ++n;
+        return n;
+    }
+
+    // The value stored along the connection which `pop_front` would return.
+    StoredValue& front_value()
+    {
+        assert(!_connections->empty());
+        return *_connections->front();
+    }
+
     private:
     static void push_back(Connections& connections, Connection connection)
     {
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/spawn.hpp>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "namespaces.h"
+#include "or_throw.h"
+#include "util.h"
+#include "util/condition_variable.h"
+#include "util/handler_tracker.h"
+#include "util/lru_cache.h"
+#include "util/signal.h"
+
+namespace ouinet {
+
+/*
+ * Cache of TCP name lookups (as done by `util::tcp_async_resolve`),
+ * so that connections to the same origin do not wait for the resolver
+ * every time.
+ *
+ * The system resolver does not report the TTL of DNS records,
+ * so successful lookups are kept for `positive_ttl`,
+ * and lookups of names with no addresses for `negative_ttl`
+ * (other errors are not cached).
+ * Names looked up again shortly before they expire
+ * are resolved again in the background while the cached answer is used,
+ * so names in frequent use never make callers wait.
+ * Concurrent lookups of the same name share a single resolver query.
+ * At most `max_entries` names are kept,
+ * the least recently used ones are dropped first.
+ *
+ * Cancelling a lookup only affects its caller,
+ * the query goes on for other callers and for the cache.
+ * Destroying the cache cancels all pending lookups.
+ */
+class DnsCache {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Results = asio::ip::tcp::resolver::results_type;
+
+    struct Counters {
+        std::size_t hits = 0;      // lookups answered from the cache
+        std::size_t misses = 0;    // lookups needing a resolver query
+        std::size_t coalesced = 0; // lookups waiting for an existing query
+        std::size_t refreshed = 0; // background queries for names about to expire
+    };
+
+public:
+    DnsCache( const asio::executor& ex
+            , std::size_t max_entries = 1024
+            , Clock::duration positive_ttl = std::chrono::seconds(60)
+            , Clock::duration negative_ttl = std::chrono::seconds(10))
+        : _state(std::make_shared<State>(ex, max_entries, positive_ttl, negative_ttl))
+    {}
+
+    DnsCache(const DnsCache&) = delete;
+    DnsCache& operator=(const DnsCache&) = delete;
+
+    ~DnsCache() { _state->cancel(); }
+
+    Results resolve( const std::string& host, const std::string& port
+                   , Cancel&, asio::yield_context);
+
+    const Counters& counters() const { return _state->counters; }
+
+private:
+    struct Entry {
+        Results results;
+        sys::error_code ec;
+        Clock::time_point expires;
+    };
+
+    struct Query {
+        ConditionVariable cv;
+        bool done = false;
+        Entry answer;
+
+        Query(const asio::executor& ex) : cv(ex) {}
+    };
+
+    // Shared with queries, which may outlive the cache.
+    struct State {
+        asio::executor ex;
+        Clock::duration positive_ttl;
+        Clock::duration negative_ttl;
+        util::LruCache<std::string, Entry> entries;
+        std::map<std::string, std::shared_ptr<Query>> queries;
+        Counters counters;
+        Cancel cancel;
+
+        State( const asio::executor& ex, std::size_t max_entries
+             , Clock::duration positive_ttl, Clock::duration negative_ttl)
+            : ex(ex), positive_ttl(positive_ttl), negative_ttl(negative_ttl)
+            , entries(max_entries)
+        {}
+    };
+
+    static
+    bool is_cacheable_error(const sys::error_code& ec)
+    {
+        return ec == asio::error::host_not_found
+            || ec == asio::error::no_data;
+    }
+
+    static
+    std::shared_ptr<Query> start_query( const std::shared_ptr<State>&
+                                      , const std::string& key
+                                      , const std::string& host
+                                      , const std::string& port);
+
+private:
+    std::shared_ptr<State> _state;
+};
+
+inline
+std::shared_ptr<DnsCache::Query>
+DnsCache::start_query( const std::shared_ptr<State>& st
+                     , const std::string& key
+                     , const std::string& host
+                     , const std::string& port)
+{
+    auto q = std::make_shared<Query>(st->ex);
+    st->queries[key] = q;
+
+    TRACK_SPAWN(st->ex, ([st, q, key, host, port] (asio::yield_context yield) {
+        Cancel cancel(st->cancel);
+        sys::error_code ec;
+        auto results = util::tcp_async_resolve(host, port, st->ex, cancel, yield[ec]);
+        if (cancel) ec = asio::error::operation_aborted;
+
+        auto now = Clock::now();
+        q->answer = Entry{std::move(results), ec, now};
+        q->done = true;
+
+        auto qi = st->queries.find(key);
+        if (qi != st->queries.end() && qi->second == q)
+            st->queries.erase(qi);
+
+        if (!ec)
+            q->answer.expires += st->positive_ttl;
+        else if (is_cacheable_error(ec))
+            q->answer.expires += st->negative_ttl;
+        if (!cancel && (!ec || is_cacheable_error(ec)))
+            st->entries.put(key, q->answer);
+
+        q->cv.notify();
+    }));
+
+    return q;
+}
+
+inline
+DnsCache::Results
+DnsCache::resolve( const std::string& host, const std::string& port
+                 , Cancel& cancel, asio::yield_context yield)
+{
+    if (cancel) return or_throw<Results>(yield, asio::error::operation_aborted);
+
+    auto st = _state;
+    // Host names cannot contain spaces.
+    auto key = host + ' ' + port;
+    auto now = Clock::now();
+
+    if (auto e = st->entries.get(key)) {
+        if (now < e->expires) {
+            ++st->counters.hits;
+            auto answer = *e;
+            // Keep names in use from expiring.
+            auto refresh_margin = st->positive_ttl / 6;
+            if ( !answer.ec && now + refresh_margin >= answer.expires
+               && !st->queries.count(key)) {
+                ++st->counters.refreshed;
+                start_query(st, key, host, port);
+            }
+            return or_throw(yield, answer.ec, std::move(answer.results));
+        }
+    }
+
+    std::shared_ptr<Query> q;
+    auto qi = st->queries.find(key);
+    if (qi != st->queries.end()) {
+        ++st->counters.coalesced;
+        q = qi->second;
+    } else {
+        ++st->counters.misses;
+        q = start_query(st, key, host, port);
+    }
+
+    // Other callers waiting for the query just check their condition again.
+    auto cancel_slot = cancel.connect([&q] { q->cv.notify(); });
+    while (!q->done && !cancel) q->cv.wait(yield);
+
+    if (cancel) return or_throw<Results>(yield, asio::error::operation_aborted);
+    return or_throw(yield, q->answer.ec, q->answer.results);
+}
+
+} // namespace
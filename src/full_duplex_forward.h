@@ -1,36 +1,154 @@
 #pragma once
 
 #include <boost/asio/read.hpp>
+#include <boost/asio/ip/tcp.hpp>
 #include "generic_stream.h"
 #include "util/wait_condition.h"
 #include "util/watch_dog.h"
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
 namespace ouinet {
 
-template<class Stream1, class Stream2>
+namespace full_duplex_detail {
+
+// Size of the buffer used to forward data in each direction.
+static const size_t buffer_size = 64 * 1024;
+
+inline asio::ip::tcp::socket* tcp_socket(GenericStream& s) { return s.tcp_socket(); }
+inline asio::ip::tcp::socket* tcp_socket(asio::ip::tcp::socket& s) { return &s; }
+template<class S> asio::ip::tcp::socket* tcp_socket(S&) { return nullptr; }
+
+template<class In, class Out, class WDog>
 inline
-void full_duplex(Stream1 c1, Stream2 c2, asio::yield_context yield)
+void half_duplex(In& in, Out& out, WDog& wdog, asio::yield_context yield)
 {
     static const auto timeout = std::chrono::seconds(60);
 
-    static const auto half_duplex = []( auto& in
-                                      , auto& out
-                                      , auto& wdog
-                                      , asio::yield_context& yield)
-    {
-        sys::error_code ec;
-        std::array<uint8_t, 2048> data;
+    sys::error_code ec;
+    std::vector<uint8_t> data(buffer_size);
+
+    for (;;) {
+        size_t length = in.async_read_some(asio::buffer(data), yield[ec]);
+        if (ec) break;
+
+        asio::async_write(out, asio::buffer(data, length), yield[ec]);
+        if (ec) break;
+
+        wdog.expires_after(timeout);
+    }
+}
+
+#ifdef __linux__
+// Call `splice(2)` with `SIGPIPE` blocked in this thread.
+//
+// There is no `MSG_NOSIGNAL` for `splice`, so writing to a socket
+// reset by the peer would otherwise raise `SIGPIPE` and kill the process.
+inline
+ssize_t splice_nosignal(int fd_in, int fd_out, size_t length, unsigned flags)
+{
+    sigset_t sigpipe, old_mask, pending;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+
+    sigpending(&pending);
+    bool was_pending = sigismember(&pending, SIGPIPE);
+    ::pthread_sigmask(SIG_BLOCK, &sigpipe, &old_mask);
+
+    auto ret = ::splice(fd_in, nullptr, fd_out, nullptr, length, flags);
 
-        for (;;) {
-            size_t length = in.async_read_some(asio::buffer(data), yield[ec]);
-            if (ec) break;
+    auto saved_errno = errno;
+    if (ret < 0 && saved_errno == EPIPE && !was_pending) {
+        // Discard the signal raised by this call before unblocking it.
+        static const timespec no_wait{0, 0};
+        ::sigtimedwait(&sigpipe, nullptr, &no_wait);
+    }
+    ::pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    errno = saved_errno;
 
-            asio::async_write(out, asio::buffer(data, length), yield[ec]);
-            if (ec) break;
+    return ret;
+}
+
+// Move data between two TCP sockets through a pipe with `splice(2)`,
+// so that it never gets copied to user space.
+//
+// Return false if the pipe could not be set up,
+// so that the caller may use `half_duplex` instead.
+template<class WDog>
+inline
+bool half_duplex_splice( asio::ip::tcp::socket& in
+                       , asio::ip::tcp::socket& out
+                       , WDog& wdog
+                       , asio::yield_context yield)
+{
+    static const auto timeout = std::chrono::seconds(60);
+    static const unsigned flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
 
-            wdog.expires_after(timeout);
+    int pipefd[2];
+    if (::pipe2(pipefd, O_NONBLOCK | O_CLOEXEC) != 0) return false;
+    // Ignore failure, the default pipe size is just less efficient.
+    ::fcntl(pipefd[1], F_SETPIPE_SZ, buffer_size);
+
+    sys::error_code ec;
+    in.non_blocking(true, ec);
+    if (!ec) out.non_blocking(true, ec);
+    if (ec) {
+        ::close(pipefd[0]); ::close(pipefd[1]);
+        return false;
+    }
+
+    for (bool done = false; !done;) {
+        in.async_wait(asio::socket_base::wait_read, yield[ec]);
+        if (ec) break;
+
+        auto length = ::splice( in.native_handle(), nullptr, pipefd[1], nullptr
+                              , buffer_size, flags);
+        if (length == 0) break;  // end of input
+        if (length < 0) {
+            if (errno == EAGAIN || errno == EINTR) continue;
+            break;
         }
-    };
+
+        // Drain the pipe into the output socket.
+        while (length > 0) {
+            auto written = splice_nosignal(pipefd[0], out.native_handle(), length, flags);
+            if (written >= 0) {
+                length -= written;
+                continue;
+            }
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN) { done = true; break; }
+            out.async_wait(asio::socket_base::wait_write, yield[ec]);
+            if (ec) { done = true; break; }
+        }
+
+        wdog.expires_after(timeout);
+    }
+
+    ::close(pipefd[0]); ::close(pipefd[1]);
+    return true;
+}
+#endif  // __linux__
+
+} // full_duplex_detail namespace
+
+// Forward data between both streams in both directions
+// until either of them is closed, fails or is idle for too long.
+//
+// When both are plain TCP streams,
+// data is forwarded with `splice(2)` where supported.
+template<class Stream1, class Stream2>
+inline
+void full_duplex(Stream1 c1, Stream2 c2, asio::yield_context yield)
+{
+    using namespace full_duplex_detail;
+
+    static const auto timeout = std::chrono::seconds(60);
 
     WatchDog wdog( c1.get_executor()
                  , timeout
@@ -38,16 +156,26 @@ void full_duplex(Stream1 c1, Stream2 c2, asio::yield_context yield)
 
     WaitCondition wait_condition(c1.get_executor());
 
+    auto forward = [&] (auto& in, auto& out, asio::yield_context yield) {
+#ifdef __linux__
+        auto in_tcp = tcp_socket(in);
+        auto out_tcp = tcp_socket(out);
+        if (in_tcp && out_tcp && half_duplex_splice(*in_tcp, *out_tcp, wdog, yield))
+            return;
+#endif
+        half_duplex(in, out, wdog, yield);
+    };
+
     asio::spawn
         ( yield
         , [&, lock = wait_condition.lock()](asio::yield_context yield) {
-              half_duplex(c1, c2, wdog, yield);
+              forward(c1, c2, yield);
           });
 
     asio::spawn
         ( yield
         , [&, lock = wait_condition.lock()](asio::yield_context yield) {
-              half_duplex(c2, c1, wdog, yield);
+              forward(c2, c1, yield);
           });
 
     wait_condition.wait(yield);
@@ -8,8 +8,10 @@
 #include <boost/asio/async_result.hpp>
 #include <boost/asio/spawn.hpp>
 #include <boost/asio/error.hpp>
+#include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ssl/stream.hpp>
 #include <boost/asio/post.hpp>
+#include <boost/optional.hpp>
 #include <functional>
 #include <vector>
 #include <iostream>
@@ -48,6 +50,9 @@ namespace generic_stream_detail {
 
     template<class T> bool is_open(const T& v) { return v.is_open(); }
     template<class T> bool is_open(const asio::ssl::stream<T>& v) { return v.next_layer().is_open(); }
+
+    template<class T> asio::ip::tcp::socket* tcp_socket(T&) { return nullptr; }
+    inline asio::ip::tcp::socket* tcp_socket(asio::ip::tcp::socket& s) { return &s; }
 } // namespace
 
 
@@ -88,6 +93,8 @@ private:
         virtual bool closed() const = 0;
         virtual bool is_open() const = 0;
 
+        virtual asio::ip::tcp::socket* tcp_socket() = 0;
+
         virtual ~Base() {}
 
         ReadBuffers  read_buffers;
@@ -96,6 +103,8 @@ private:
 
     template<class Impl>
     struct Wrapper : public Base {
+        friend class GenericStream;
+
         using Shutter = std::function<
             void(typename generic_stream_detail::Deref<Impl>::type&)>;
 
@@ -147,6 +156,10 @@ private:
             return generic_stream_detail::is_open(*_impl);
         }
 
+        asio::ip::tcp::socket* tcp_socket() override {
+            return generic_stream_detail::tcp_socket(*_impl);
+        }
+
     private:
         generic_stream_detail::Deref<Impl> _impl;
         Shutter _shutter;
@@ -273,6 +286,27 @@ public:
         return _impl->is_open();
     }
 
+    // The wrapped TCP socket if this is a plain TCP stream, null otherwise
+    // (e.g. to operate on its descriptor directly).
+    asio::ip::tcp::socket* tcp_socket()
+    {
+        if (!_impl) return nullptr;
+        return _impl->tcp_socket();
+    }
+
+    // If this wraps a stream of type `Impl`, move it out and return it,
+    // leaving this without an implementation (the stream is not closed).
+    // Otherwise return none and leave this untouched.
+    template<class Impl>
+    boost::optional<Impl> release_as()
+    {
+        auto w = dynamic_cast<Wrapper<Impl>*>(_impl.get());
+        if (!w) return boost::none;
+        boost::optional<Impl> ret(std::move(*w->_impl));
+        _impl = nullptr;
+        return ret;
+    }
+
     template< class MutableBufferSequence
             , class Token>
     auto async_read_some(const MutableBufferSequence& bs, Token&& token)
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "response_tee.h"
+#include "namespaces.h"
+
+namespace ouinet {
+
+/*
+ * Requests whose response is being fetched
+ * which identical requests (with the same key) may follow
+ * instead of fetching the response again.
+ *
+ * The leading request pushes the response to a `Tee`
+ * and followers read it as any other consumer of the `Tee`,
+ * so slow followers do not make the response pile up in memory.
+ *
+ * Followers may only join until the leader `stop`s taking them
+ * (e.g. when the response starts, since they would miss its head).
+ * If the leader finishes the `Tee` with an error before that
+ * (or destroys it), followers get the error before any part
+ * and may fetch the response by themselves.
+ */
+class InFlightRequests {
+private:
+    using Map = std::map<std::string, http_response::Tee*>;
+
+public:
+    class Leader {
+    public:
+        Leader() = default;
+
+        Leader(const Leader&) = delete;
+        Leader& operator=(const Leader&) = delete;
+
+        Leader(Leader&& other)
+            : _map(other._map), _it(other._it)
+        { other._map = nullptr; }
+
+        Leader& operator=(Leader&& other)
+        {
+            stop();
+            _map = other._map; _it = other._it;
+            other._map = nullptr;
+            return *this;
+        }
+
+        ~Leader() { stop(); }
+
+        // Take no more followers.
+        void stop()
+        {
+            if (!_map) return;
+            _map->erase(_it);
+            _map = nullptr;
+        }
+
+    private:
+        friend class InFlightRequests;
+
+        Leader(Map& map, Map::iterator it) : _map(&map), _it(it) {}
+
+        Map* _map = nullptr;
+        Map::iterator _it;
+    };
+
+public:
+    InFlightRequests() = default;
+
+    InFlightRequests(const InFlightRequests&) = delete;
+    InFlightRequests& operator=(const InFlightRequests&) = delete;
+
+    // Let identical requests follow the request with the given `key`
+    // by reading from the `tee`, while the returned object is alive
+    // and has not been stopped.
+    //
+    // Nothing is done if another request with that key is already leading.
+    Leader lead(const std::string& key, http_response::Tee& tee)
+    {
+        auto r = _map.emplace(key, &tee);
+        if (!r.second) return {};
+        return Leader(_map, r.first);
+    }
+
+    // Return a reader for the response to the request
+    // with the given `key` being fetched, if any.
+    std::unique_ptr<http_response::AbstractReader> follow(const std::string& key)
+    {
+        auto it = _map.find(key);
+        if (it == _map.end()) return nullptr;
+        return it->second->add_reader();
+    }
+
+    std::size_t size() const { return _map.size(); }
+
+private:
+    Map _map;
+};
+
+} // namespace
@@ -1,4 +1,5 @@
 #include <boost/asio/connect.hpp>
+#include <boost/asio/post.hpp>
 #include <boost/asio/spawn.hpp>
 #include <boost/asio/signal_set.hpp>
 #include <boost/beast/core.hpp>
@@ -13,6 +14,7 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <thread>
 
 #include "cache/http_sign.h"
 
@@ -23,6 +25,7 @@
 #include "fetch_http_page.h"
 #include "connect_to_host.h"
 #include "default_timeout.h"
+#include "dns_cache.h"
 #include "generic_stream.h"
 #include "split_string.h"
 #include "async_sleep.h"
@@ -34,6 +37,7 @@
 #include "http_util.h"
 #include "origin_pools.h"
 #include "session.h"
+#include "signed_response_cache.h"
 
 #include "ouiservice.h"
 #include "ouiservice/i2p.h"
@@ -44,11 +48,13 @@
 #include "ouiservice/tcp.h"
 #include "ouiservice/utp.h"
 #include "ouiservice/tls.h"
+#include "ouiservice/multiplex.h"
 #include "ouiservice/bep5/server.h"
 #include "ssl/ca_certificate.h"
 #include "ssl/util.h"
 
 #include "util/timeout.h"
+#include "util/wait_condition.h"
 #include "util/atomic_file.h"
 #include "util/crypto.h"
 #include "util/bytes.h"
@@ -79,6 +85,10 @@ using ResponseWithFileBody = http::response<http::basic_file_body<
 static const fs::path OUINET_TLS_CERT_FILE = "tls-cert.pem";
 static const fs::path OUINET_TLS_KEY_FILE = "tls-key.pem";
 static const fs::path OUINET_TLS_DH_FILE = "tls-dh.pem";
+static const fs::path OUINET_SPILL_DIR = "spill";
+
+// Response data kept in memory for each request following an injection.
+static const size_t response_max_buffered = 1024 * 1024;
 
 
 //------------------------------------------------------------------------------
@@ -108,10 +118,12 @@ void handle_bad_request( GenericStream& con
 // and return lookup results.
 // If not valid, set error code
 // (the returned lookup may not be usable then).
+//
+// Checks also apply to lookup results coming from the cache.
 static
 TcpLookup
 resolve_target( const Request& req
-              , asio::executor exec
+              , DnsCache& dns_cache
               , Cancel& cancel
               , Yield yield)
 {
@@ -126,10 +138,7 @@ resolve_target( const Request& req
 
     // Resolve address and also use result for more sophisticaded checking.
     if (!local)
-        lookup = util::tcp_async_resolve( host, port
-                                        , exec
-                                        , cancel
-                                        , yield[ec]);
+        lookup = dns_cache.resolve(host, port, cancel, yield[ec]);
 
     if (ec) return or_throw<TcpLookup>(yield, ec);
 
@@ -153,6 +162,7 @@ resolve_target( const Request& req
 static
 void handle_connect_request( GenericStream client_c
                            , const Request& req
+                           , DnsCache& dns_cache
                            , Cancel& cancel
                            , Yield yield)
 {
@@ -164,7 +174,7 @@ void handle_connect_request( GenericStream client_c
         client_c.close();
     });
 
-    TcpLookup lookup = resolve_target(req, exec, cancel, yield[ec]);
+    TcpLookup lookup = resolve_target(req, dns_cache, cancel, yield[ec]);
 
     if (ec) {
         // Prepare and send error message to `con`.
@@ -248,7 +258,7 @@ public:
         sys::error_code ec;
 
         // Resolve target endpoint and check its validity.
-        TcpLookup lookup = resolve_target(rq, executor, cancel, yield[ec]);
+        TcpLookup lookup = resolve_target(rq, dns_cache, cancel, yield[ec]);
 
         if (ec) return or_throw<GenericStream>(yield, ec);
 
@@ -277,6 +287,8 @@ public:
     InjectorCacheControl( asio::executor executor
                         , asio::ssl::context& ssl_ctx
                         , OriginPools& origin_pools
+                        , DnsCache& dns_cache
+                        , SignedResponseCache& response_cache
                         , const InjectorConfig& config
                         , uuid_generator& genuuid)
         : insert_id(to_string(genuuid()))
@@ -286,6 +298,8 @@ public:
         , config(config)
         , genuuid(genuuid)
         , origin_pools(origin_pools)
+        , dns_cache(dns_cache)
+        , response_cache(response_cache)
     {
     }
 
@@ -298,9 +312,30 @@ public:
 
         sys::error_code ec;
 
+        // Identical requests being injected at the same time
+        // (or shortly before) get the same signed response.
+        auto key = SignedResponseCache::key(rq);
+        if (key) {
+            if (auto rr = response_cache.find(*key)) {
+                auto sess = Session::create_from_reader(std::move(rr), cancel, yield[ec]);
+                if (!ec) {
+                    yield.log("Sending shared injection");
+                    sess.flush_response(con, cancel, yield[ec]);
+                    if (ec) yield.log("Injection failed: ", ec.message());
+                    return or_throw(yield, ec);
+                }
+                if (cancel) return or_throw(yield, asio::error::operation_aborted);
+                // The other injection failed before getting a response,
+                // nothing was sent yet so inject it here.
+                ec = {};
+            }
+        }
+
         // Pop out Ouinet internal HTTP headers.
         rq = util::to_cache_request(move(rq));
 
+        auto injection = key ? response_cache.start(*key) : nullptr;
+
         auto orig_con = get_connection(rq, cancel, yield[ec]);
         return_or_throw_on_error(yield, cancel, ec);
 
@@ -310,18 +345,25 @@ public:
         if (ec) yield.log("Failed to send request: ", ec.message());
         return_or_throw_on_error(yield, cancel, ec);
 
-        Session::reader_uptr sig_reader = make_unique<cache::SigningReader>
+        auto sig_reader_p = new cache::SigningReader
             (move(orig_con), rq, insert_id, insert_ts, config.cache_private_key());
+        Session::reader_uptr sig_reader(sig_reader_p);
         auto orig_sess = Session::create(move(sig_reader), cancel, yield[ec]);
         return_or_throw_on_error(yield, cancel, ec);
 
-        orig_sess.flush_response(con, cancel, yield[ec]);
+        auto rsh = http::response<http::empty_body>(orig_sess.response_header());
+
+        if (injection)
+            injection->flush(orig_sess, con, cancel, yield[ec]);
+        else
+            orig_sess.flush_response(con, cancel, yield[ec]);
         if (ec) yield.log("Injection failed: ", ec.message());
         return_or_throw_on_error(yield, cancel, ec);
         yield.log("Injection end");  // TODO: report whether inject or just fwd
 
-        auto rsh = http::response<http::empty_body>(orig_sess.response_header());
-        keep_connection(rq, rsh, move(orig_sess));
+        // The whole response has been read, so the origin connection
+        // may be reused (the session is still alive but done with it).
+        keep_connection(rq, rsh, sig_reader_p->release_stream());
     }
 
     bool fetch( GenericStream& con
@@ -343,6 +385,7 @@ public:
 
         auto maybe_connection = origin_pools.get_connection(rq_);
         if (maybe_connection) {
+            yield.log("Reusing origin connection");
             connection = std::move(*maybe_connection);
         } else {
             auto stream = connect(rq_, cancel, yield[ec].tag("connect"));
@@ -351,18 +394,28 @@ public:
 
             connection = origin_pools.wrap(rq_, std::move(stream));
         }
+        // Only give the connection back to the pools once a whole response
+        // has been read from it (see `keep_connection`), not whenever it is dropped.
+        connection.auto_add_back_to_pool(false);
         return connection;
     }
 
-    template<class Response, class Connection>
-    bool keep_connection(const Request& rq, const Response& rs, Connection con) {
+    // Give the origin connection `con` (as obtained from `get_connection`)
+    // back to the origin pools if both request and response allow keeping it alive.
+    // Return whether the connection was kept.
+    template<class Response>
+    bool keep_connection(const Request& rq, const Response& rs, GenericStream con) {
         if (!con.is_open()) return false;
 
-        if (!rs.keep_alive() || !rq.keep_alive()) {
+        auto opt_con = con.release_as<Connection>();
+
+        if (!opt_con || !rs.keep_alive() || !rq.keep_alive()) {
             con.close();
+            if (opt_con) opt_con->close();
             return false;
         }
 
+        origin_pools.insert_connection(rq, std::move(*opt_con));
         return true;
     }
 
@@ -374,6 +427,8 @@ private:
     const InjectorConfig& config;
     uuid_generator& genuuid;
     OriginPools& origin_pools;
+    DnsCache& dns_cache;
+    SignedResponseCache& response_cache;
 };
 
 //------------------------------------------------------------------------------
@@ -411,6 +466,8 @@ void serve( InjectorConfig& config
           , GenericStream con
           , asio::ssl::context& ssl_ctx
           , OriginPools& origin_pools
+          , DnsCache& dns_cache
+          , SignedResponseCache& response_cache
           , uuid_generator& genuuid
           , Cancel& cancel
           , asio::yield_context yield_)
@@ -422,6 +479,8 @@ void serve( InjectorConfig& config
     InjectorCacheControl cc( con.get_executor()
                            , ssl_ctx
                            , origin_pools
+                           , dns_cache
+                           , response_cache
                            , config
                            , genuuid);
 
@@ -453,6 +512,7 @@ void serve( InjectorConfig& config
         if (req.method() == http::verb::connect) {
             return handle_connect_request( move(con)
                                          , req
+                                         , dns_cache
                                          , cancel
                                          , yield.tag("handle_connect"));
         }
@@ -473,6 +533,7 @@ void serve( InjectorConfig& config
             using RespFromH = http::response<http::empty_body>;
             RespFromH res;
             auto orig_con = cc.get_connection(req, cancel, yield[ec]);
+            GenericStream orig_stream;
             size_t forwarded = 0;
             if (!ec) {
                 auto orig_req = util::to_origin_request(req);
@@ -497,7 +558,7 @@ void serve( InjectorConfig& config
                     }
                     opt_part->async_write(con, cancel, yield[ec]);
                 }
-                orig_con = rr.release_stream();  // may be reused with keep-alive
+                orig_stream = rr.release_stream();  // may be reused with keep-alive
             }
             if (ec) {
                 handle_bad_request( con, req
@@ -506,7 +567,7 @@ void serve( InjectorConfig& config
                 continue;
             }
             yield.log("Forwarded data bytes: ", forwarded);
-            keep_alive = cc.keep_connection(req, res, move(orig_con));
+            keep_alive = cc.keep_connection(req, res, move(orig_stream));
         }
         else {
             // Ouinet header found, behave like a Ouinet injector.
@@ -559,7 +620,35 @@ void listen( InjectorConfig& config
 
     uint64_t next_connection_id = 0;
 
-    OriginPools origin_pools;
+    OriginPools origin_pools( config.origin_pool_max_per_host()
+                            , config.origin_pool_idle_timeout());
+
+    DnsCache dns_cache(exec);
+
+    SignedResponseCache response_cache(exec, config.response_cache_max_bytes());
+    {
+        // Slow followers of an injection do not hold it back.
+        sys::error_code ec;
+        auto spill_dir = config.repo_root() / OUINET_SPILL_DIR;
+        util::file_io::check_or_create_directory(spill_dir, ec);
+        if (ec) LOG_WARN("Failed to create directory for response data: ", ec.message());
+        response_cache.max_buffered( response_max_buffered
+                                   , ec ? boost::none : boost::make_optional(spill_dir));
+    }
+
+    auto log_pool_counters = defer([&] {
+        auto& c = origin_pools.counters();
+        LOG_DEBUG( "Origin connections: hits=", c.hits, " misses=", c.misses
+                 , " reinserted=", c.inserted, " evicted=", c.evicted
+                 , " expired=", c.expired);
+        auto& dc = dns_cache.counters();
+        LOG_DEBUG( "Origin lookups: hits=", dc.hits, " misses=", dc.misses
+                 , " coalesced=", dc.coalesced, " refreshed=", dc.refreshed);
+        auto& rc = response_cache.counters();
+        LOG_DEBUG( "Signed responses: hits=", rc.hits, " misses=", rc.misses
+                 , " coalesced=", rc.coalesced, " stored=", rc.stored
+                 , " evicted=", rc.evicted);
+    });
 
     asio::ssl::context ssl_ctx{asio::ssl::context::tls_client};
     ssl_ctx.set_default_verify_paths();
@@ -593,6 +682,8 @@ void listen( InjectorConfig& config
             &config,
             &genuuid,
             &origin_pools,
+            &dns_cache,
+            &response_cache,
             connection_id,
             lock = shutdown_connections.lock()
         ] (boost::asio::yield_context yield) mutable {
@@ -601,6 +692,8 @@ void listen( InjectorConfig& config
                  , std::move(connection)
                  , ssl_ctx
                  , origin_pools
+                 , dns_cache
+                 , response_cache
                  , genuuid
                  , cancel
                  , yield);
@@ -608,6 +701,39 @@ void listen( InjectorConfig& config
     }
 }
 
+//------------------------------------------------------------------------------
+// An extra thread with its own I/O context, serving connections
+// from its own listeners (see `--threads`).
+//
+// Origin connection pools, name and signed response caches
+// and TLS contexts are created by `listen`
+// for each I/O context, so nothing but the (read-only) configuration
+// is shared with other threads.
+struct InjectorThread {
+    asio::io_context ioc;
+    OuiServiceServer proxy_server;
+    asio::ssl::context ssl_context{asio::ssl::context::tls_server};
+    Cancel cancel;
+    std::thread thread;
+
+    InjectorThread() : proxy_server(ioc.get_executor()) {}
+
+    void start(InjectorConfig& config)
+    {
+        asio::spawn(ioc, [this, &config] (asio::yield_context yield) {
+            sys::error_code ec;
+            listen(config, proxy_server, cancel, yield[ec]);
+        });
+        thread = std::thread([this] { ioc.run(); });
+    }
+
+    // Thread-safe.
+    void stop()
+    {
+        asio::post(ioc, [this] { cancel(); });
+    }
+};
+
 //------------------------------------------------------------------------------
 int main(int argc, const char* argv[])
 {
@@ -628,6 +754,9 @@ int main(int argc, const char* argv[])
         return EXIT_SUCCESS;
     }
 
+    // Keep request handlers from blocking on log output.
+    logger.set_async(true);
+
     if (config.open_file_limit()) {
         increase_open_file_limit(*config.open_file_limit());
     }
@@ -655,6 +784,28 @@ int main(int argc, const char* argv[])
 
     OuiServiceServer proxy_server(ex);
 
+    // The main thread serves all listeners,
+    // extra threads only serve replicas of TCP-based ones
+    // (the system spreads incoming connections among them).
+    vector<unique_ptr<InjectorThread>> extra_threads;
+    for (unsigned int i = 1; i < config.threads(); ++i)
+        extra_threads.push_back(make_unique<InjectorThread>());
+
+    // Replicas need a known port to listen on.
+    bool replicated = false;
+    auto can_replicate = [&] (const tcp::endpoint& ep, const char* what) {
+        if (extra_threads.empty()) return false;
+        if (ep.port() != 0) return replicated = true;
+        LOG_WARN(what, " listener uses a random port, serving it in a single thread");
+        return false;
+    };
+
+    // Clients may multiplex requests over a single connection,
+    // plain connections are still accepted as usual.
+    auto multiplexed = [] (const asio::executor& ex, auto base) {
+        return make_unique<ouiservice::MultiplexOuiServiceServer>(ex, move(base));
+    };
+
     if (config.tcp_endpoint()) {
         tcp::endpoint endpoint = *config.tcp_endpoint();
         LOG_INFO("TCP address: ", endpoint);
@@ -662,7 +813,13 @@ int main(int argc, const char* argv[])
         util::create_state_file( config.repo_root()/"endpoint-tcp"
                                , util::str(endpoint));
 
-        proxy_server.add(make_unique<ouiservice::TcpOuiServiceServer>(ex, endpoint));
+        bool replicate = can_replicate(endpoint, "TCP");
+        proxy_server.add(multiplexed(ex, make_unique<ouiservice::TcpOuiServiceServer>(ex, endpoint, replicate)));
+
+        if (replicate) for (auto& t : extra_threads) {
+            auto tex = t->ioc.get_executor();
+            t->proxy_server.add(multiplexed(tex, make_unique<ouiservice::TcpOuiServiceServer>(tex, endpoint, true)));
+        }
     }
 
     auto read_ssl_certs = [&] {
@@ -681,8 +838,17 @@ int main(int argc, const char* argv[])
         util::create_state_file( config.repo_root()/"endpoint-tcp-tls"
                                , util::str(endpoint));
 
-        auto base = make_unique<ouiservice::TcpOuiServiceServer>(ex, endpoint);
-        proxy_server.add(make_unique<ouiservice::TlsOuiServiceServer>(ex, move(base), ssl_context));
+        bool replicate = can_replicate(endpoint, "TCP/TLS");
+        auto base = make_unique<ouiservice::TcpOuiServiceServer>(ex, endpoint, replicate);
+        proxy_server.add(multiplexed(ex, make_unique<ouiservice::TlsOuiServiceServer>(ex, move(base), ssl_context)));
+
+        // Each thread uses its own TLS context.
+        if (replicate) for (auto& t : extra_threads) {
+            auto tex = t->ioc.get_executor();
+            t->ssl_context = read_ssl_certs();
+            auto base = make_unique<ouiservice::TcpOuiServiceServer>(tex, endpoint, true);
+            t->proxy_server.add(multiplexed(tex, make_unique<ouiservice::TlsOuiServiceServer>(tex, move(base), t->ssl_context)));
+        }
     }
 
     if (config.utp_endpoint()) {
@@ -693,7 +859,7 @@ int main(int argc, const char* argv[])
                                , util::str(endpoint));
 
         auto srv = make_unique<ouiservice::UtpOuiServiceServer>(ex, endpoint);
-        proxy_server.add(move(srv));
+        proxy_server.add(multiplexed(ex, move(srv)));
     }
 
     if (config.utp_tls_endpoint()) {
@@ -709,7 +875,7 @@ int main(int argc, const char* argv[])
             LOG_INFO("uTP/TLS address: ", *local_ep);
             util::create_state_file( config.repo_root()/"endpoint-utp-tls"
                                    , util::str(*local_ep));
-            proxy_server.add(make_unique<ouiservice::TlsOuiServiceServer>(ex, move(base), ssl_context));
+            proxy_server.add(multiplexed(ex, make_unique<ouiservice::TlsOuiServiceServer>(ex, move(base), ssl_context)));
 
         } else {
             LOG_ERROR("Failed to start uTP/TLS service on ", *config.utp_tls_endpoint());
@@ -721,8 +887,8 @@ int main(int argc, const char* argv[])
         auto dht = bittorrent_dht();
         assert(dht);
         assert(!dht->local_endpoints().empty());
-        proxy_server.add(make_unique<ouiservice::Bep5Server>
-                (move(dht), &ssl_context, *config.bep5_injector_swarm_name()));
+        proxy_server.add(multiplexed(ex, make_unique<ouiservice::Bep5Server>
+                (move(dht), &ssl_context, *config.bep5_injector_swarm_name())));
     }
 
 /*
@@ -745,7 +911,7 @@ int main(int argc, const char* argv[])
         util::create_state_file( config.repo_root()/"endpoint-obfs2"
                                , util::str(endpoint));
 
-        proxy_server.add(make_unique<ouiservice::Obfs2OuiServiceServer>(ioc, endpoint, config.repo_root()/"obfs2-server"));
+        proxy_server.add(multiplexed(ex, make_unique<ouiservice::Obfs2OuiServiceServer>(ioc, endpoint, config.repo_root()/"obfs2-server")));
     }
 
     if (config.obfs3_endpoint()) {
@@ -754,7 +920,7 @@ int main(int argc, const char* argv[])
         util::create_state_file( config.repo_root()/"endpoint-obfs3"
                                , util::str(endpoint));
 
-        proxy_server.add(make_unique<ouiservice::Obfs3OuiServiceServer>(ioc, endpoint, config.repo_root()/"obfs3-server"));
+        proxy_server.add(multiplexed(ex, make_unique<ouiservice::Obfs3OuiServiceServer>(ioc, endpoint, config.repo_root()/"obfs3-server")));
     }
 
     if (config.obfs4_endpoint()) {
@@ -775,7 +941,7 @@ int main(int argc, const char* argv[])
                 LOG_INFO("obfs4 address: ", endpoint, ",", obfs4->connection_arguments());
             }
         });
-        proxy_server.add(std::move(server));
+        proxy_server.add(multiplexed(ex, std::move(server)));
     }
 
     if (config.listen_on_i2p()) {
@@ -786,7 +952,7 @@ int main(int argc, const char* argv[])
         LOG_INFO("I2P public ID: ", ep);
         util::create_state_file(config.repo_root()/"endpoint-i2p", ep);
 
-        proxy_server.add(std::move(i2p_server));
+        proxy_server.add(multiplexed(ex, std::move(i2p_server)));
     }
 
     LOG_INFO("HTTP signing public key (Ed25519): ", config.cache_private_key().public_key());
@@ -803,22 +969,31 @@ int main(int argc, const char* argv[])
         listen(config, proxy_server, cancel, yield[ec]);
     });
 
+    if (!replicated) extra_threads.clear();  // nothing to serve there
+
+    for (auto& t : extra_threads) t->start(config);
+    if (!extra_threads.empty())
+        LOG_INFO("Serving connections in ", extra_threads.size() + 1, " threads");
+
     asio::signal_set signals(ex, SIGINT, SIGTERM);
 
     unique_ptr<ForceExitOnSignal> force_exit;
 
-    signals.async_wait([&cancel, &signals, &force_exit, &bt_dht_ptr]
+    signals.async_wait([&cancel, &signals, &force_exit, &bt_dht_ptr, &extra_threads]
                        (const sys::error_code& ec, int signal_number) {
             if (bt_dht_ptr) {
                 bt_dht_ptr->stop();
                 bt_dht_ptr = nullptr;
             }
             cancel();
+            for (auto& t : extra_threads) t->stop();
             signals.clear();
             force_exit = make_unique<ForceExitOnSignal>();
         });
 
     ioc.run();
 
+    for (auto& t : extra_threads) t->thread.join();
+
     return EXIT_SUCCESS;
 }
@@ -25,6 +25,22 @@ public:
     boost::optional<size_t> open_file_limit() const
     { return _open_file_limit; }
 
+    // Number of threads (each with its own I/O context) serving connections.
+    unsigned int threads() const
+    { return _threads; }
+
+    // Maximum number of idle keep-alive connections kept for each origin.
+    unsigned int origin_pool_max_per_host() const
+    { return _origin_pool_max_per_host; }
+
+    // Idle keep-alive connections to origins are closed after this time.
+    std::chrono::seconds origin_pool_idle_timeout() const
+    { return _origin_pool_idle_timeout; }
+
+    // Maximum size of recently signed responses kept for other requests.
+    std::size_t response_cache_max_bytes() const
+    { return _response_cache_max_bytes; }
+
     boost::filesystem::path repo_root() const
     { return _repo_root; }
 
@@ -76,7 +92,8 @@ public:
     const std::string& tls_ca_cert_store_path() const
     { return _tls_ca_cert_store_path; }
 
-    util::Ed25519PrivateKey cache_private_key() const
+    // Shared by all threads, do not modify.
+    const util::Ed25519PrivateKey& cache_private_key() const
     { return _ed25519_private_key; }
 
     unsigned int cache_local_capacity() const
@@ -91,6 +108,10 @@ private:
     bool _is_help = false;
     boost::filesystem::path _repo_root;
     boost::optional<size_t> _open_file_limit;
+    unsigned int _threads = 1;
+    unsigned int _origin_pool_max_per_host = 8;
+    std::chrono::seconds _origin_pool_idle_timeout{60};
+    std::size_t _response_cache_max_bytes = 64 * 1024 * 1024;
     bool _listen_on_i2p = false;
     std::string _tls_ca_cert_store_path;
     boost::optional<asio::ip::tcp::endpoint> _tcp_endpoint;
@@ -127,6 +148,21 @@ InjectorConfig::options_description()
         ("open-file-limit"
          , po::value<unsigned int>()
          , "To increase the maximum number of open files")
+        ("threads"
+         , po::value<unsigned int>()->default_value(1)
+         , "Number of threads serving connections, "
+           "TCP and TCP/TLS listeners are replicated on each of them")
+        ("origin-pool-max-per-host"
+         , po::value<unsigned int>()->default_value(8)
+         , "Maximum number of idle keep-alive connections kept open "
+           "to each origin for reuse (0 disables reuse)")
+        ("origin-pool-idle-timeout"
+         , po::value<unsigned int>()->default_value(60)
+         , "Seconds after which idle keep-alive connections to origins are closed")
+        ("response-cache-size"
+         , po::value<unsigned int>()->default_value(64)
+         , "MiB of fresh signed responses kept in memory (for each thread) "
+           "and sent to identical requests (0 only shares responses being injected)")
 
         // Transport options
         ("listen-on-tcp", po::value<string>(), "IP:PORT endpoint on which we'll listen (cleartext)")
@@ -215,6 +251,27 @@ InjectorConfig::InjectorConfig(int argc, const char**argv)
         _open_file_limit = vm["open-file-limit"].as<unsigned int>();
     }
 
+    if (vm.count("threads")) {
+        _threads = vm["threads"].as<unsigned int>();
+        if (_threads == 0) {
+            throw std::runtime_error("The number of threads must be positive");
+        }
+    }
+
+    if (vm.count("origin-pool-max-per-host")) {
+        _origin_pool_max_per_host = vm["origin-pool-max-per-host"].as<unsigned int>();
+    }
+
+    if (vm.count("origin-pool-idle-timeout")) {
+        _origin_pool_idle_timeout = std::chrono::seconds(
+            vm["origin-pool-idle-timeout"].as<unsigned int>());
+    }
+
+    if (vm.count("response-cache-size")) {
+        _response_cache_max_bytes = std::size_t(vm["response-cache-size"].as<unsigned int>())
+                                  * 1024 * 1024;
+    }
+
     if (vm.count("credentials")) {
         _credentials = vm["credentials"].as<string>();
         if (!_credentials.empty() && _credentials.find(':') == string::npos) {
@@ -18,6 +18,7 @@
 
 #include <sys/time.h>
 
+#include <chrono>
 #include <string>
 #include <iostream>
 #include <fstream>
@@ -38,6 +39,78 @@ log_level_t default_log_level() {
 
 Logger logger(default_log_level());
 
+// Bounded MPSC queue of strings after Dmitry Vyukov's design:
+// each cell carries a sequence number which tells producers and the consumer
+// whether the cell is free or holds a value for the current lap.
+class LogQueue {
+    struct Cell {
+        std::atomic<size_t> seq;
+        std::string data;
+    };
+
+public:
+    // `capacity` must be a power of two.
+    LogQueue(size_t capacity)
+        : _cells(new Cell[capacity])
+        , _mask(capacity - 1)
+    {
+        for (size_t i = 0; i < capacity; ++i)
+            _cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    // Return false if the queue is full (`s` is left untouched).
+    bool try_push(std::string& s) {
+        size_t pos = _push_pos.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &_cells[pos & _mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            auto dif = intptr_t(seq) - intptr_t(pos);
+            if (dif == 0) {
+                if (_push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = _push_pos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(s);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Only to be called from a single consumer thread.
+    bool try_pop(std::string& s) {
+        Cell& cell = _cells[_pop_pos & _mask];
+        size_t seq = cell.seq.load(std::memory_order_acquire);
+        if (intptr_t(seq) - intptr_t(_pop_pos + 1) < 0) return false;
+        s = std::move(cell.data);
+        cell.data.clear();
+        cell.seq.store(_pop_pos + _mask + 1, std::memory_order_release);
+        ++_pop_pos;
+        _popped.store(_pop_pos, std::memory_order_release);
+        return true;
+    }
+
+    size_t pushed() const { return _push_pos.load(std::memory_order_acquire); }
+    size_t popped() const { return _popped.load(std::memory_order_acquire); }
+
+private:
+    std::unique_ptr<Cell[]> _cells;
+    const size_t _mask;
+    std::atomic<size_t> _push_pos{0};
+    size_t _pop_pos = 0;
+    std::atomic<size_t> _popped{0};
+};
+
+// Number of queued lines before producers need to wait for the writer.
+static const size_t log_queue_capacity = 8192;
+// Maximum size of output written at once.
+static const size_t log_batch_size = 64 * 1024;
+// How long the idle writer sleeps before checking the queue anyway.
+static const auto log_writer_idle_wait = std::chrono::milliseconds(100);
+
 void Logger::initiate_textual_conversions()
 {
 }
@@ -65,6 +138,7 @@ Logger::Logger(log_level_t threshold)
 // Standard destructor
 Logger::~Logger()
 {
+    set_async(false);
     if (log_file.is_open()) {
         log_file.close();
     }
@@ -73,6 +147,8 @@ Logger::~Logger()
 // Configure the logger to log to stderr and/or to a file.
 void Logger::config(bool log_stderr, bool log_to_file, std::string fname)
 {
+    flush();
+    std::lock_guard<std::mutex> output_lock(output_mutex);
     log_to_stderr = log_stderr;
     this->log_to_file = log_to_file;
     if (log_to_file) {
@@ -130,13 +206,120 @@ void Logger::log(log_level_t level, std::string msg, std::string function_name)
       msg = std::to_string(log_get_timestamp()) + ": " + msg;
     }
 
+    msg += '\n';
+    output(std::move(msg));
+}
+
+void Logger::write_out(const std::string& text)
+{
     if (log_to_stderr) {
-        std::cerr << msg << std::endl;
-        //std::cerr.flush();
+        std::cerr.write(text.data(), text.size());
     }
     if (log_to_file && log_file.is_open()) {
-        log_file << msg << std::endl;
+        log_file.write(text.data(), text.size());
+    }
+}
+
+void Logger::output(std::string text)
+{
+    if (!_queue) {
+        std::lock_guard<std::mutex> output_lock(output_mutex);
+        write_out(text);
+        if (log_to_file) log_file.flush();
+        return;
     }
+
+    if (!_queue->try_push(text)) {
+        // Full, wait for the writer to catch up.
+        // Retrying with the lock held does not miss its notification.
+        std::unique_lock<std::mutex> lock(_writer_mutex);
+        while (!_queue->try_push(text)) {
+            _writer_cv.notify_one();
+            _written_cv.wait(lock);
+        }
+    }
+
+    if (_writer_idle.load()) {
+        std::lock_guard<std::mutex> lock(_writer_mutex);
+        _writer_cv.notify_one();
+    }
+}
+
+void Logger::run_writer()
+{
+    std::string batch, line;
+
+    for (;;) {
+        batch.clear();
+        size_t lines = 0;
+        while (batch.size() < log_batch_size && _queue->try_pop(line)) {
+            batch += line;
+            ++lines;
+        }
+
+        if (!batch.empty()) {
+            {
+                std::lock_guard<std::mutex> output_lock(output_mutex);
+                write_out(batch);
+            }
+            // Wake up full producers and flushers.
+            std::lock_guard<std::mutex> lock(_writer_mutex);
+            _written += lines;
+            _written_cv.notify_all();
+            continue;
+        }
+
+        // Nothing left for now, flush and wait for more.
+        {
+            std::lock_guard<std::mutex> output_lock(output_mutex);
+            if (log_to_file && log_file.is_open()) log_file.flush();
+        }
+
+        std::unique_lock<std::mutex> lock(_writer_mutex);
+        _writer_idle.store(true);
+        if (_queue->pushed() == _queue->popped()) {
+            if (_writer_stop.load()) break;
+            _writer_cv.wait_for(lock, log_writer_idle_wait);
+        }
+        _writer_idle.store(false);
+    }
+}
+
+void Logger::set_async(bool enable)
+{
+    if (enable == bool(_queue)) return;
+
+    if (enable) {
+        _queue.reset(new LogQueue(log_queue_capacity));
+        _written = 0;
+        _writer_stop.store(false);
+        _writer = std::thread([this] { run_writer(); });
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_writer_mutex);
+        _writer_stop.store(true);
+        _writer_cv.notify_one();
+    }
+    _writer.join();
+    _queue.reset();
+}
+
+void Logger::flush()
+{
+    if (!_queue) return;
+
+    // Wait until lines queued so far are written, not just dequeued.
+    auto target = _queue->pushed();
+    {
+        std::unique_lock<std::mutex> lock(_writer_mutex);
+        _writer_cv.notify_one();
+        _written_cv.wait(lock, [&] { return _written >= target; });
+    }
+
+    std::lock_guard<std::mutex> output_lock(output_mutex);
+    if (log_to_file && log_file.is_open()) log_file.flush();
 }
 
 // Convenience methods
@@ -174,6 +357,7 @@ void Logger::error(std::string msg, std::string function_name)
 void Logger::abort(std::string msg, std::string function_name)
 {
     log(ABORT, msg, function_name);
+    flush();
     exit(1);
 }
 
@@ -15,8 +15,13 @@
 #ifndef SRC_LOGGER_H_
 #define SRC_LOGGER_H_
 
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 #include "namespaces.h"
 #include "util/str.h"
@@ -49,6 +54,10 @@ inline std::ostream& operator<<(std::ostream& os, log_level_t ll) {
     return os << "???";
 }
 
+// A bounded multi-producer, single-consumer queue of log lines
+// which does not take locks (see `Logger::set_async`).
+class LogQueue;
+
 class Logger
 {
   protected:
@@ -58,6 +67,20 @@ class Logger
     bool log_to_file;
     std::string log_filename;
     std::ofstream log_file;
+    std::mutex output_mutex;  // messages may come from several threads
+
+    // Output written by a background thread (if enabled).
+    std::unique_ptr<LogQueue> _queue;
+    std::thread _writer;
+    std::atomic<bool> _writer_stop{false};
+    std::atomic<bool> _writer_idle{false};
+    std::mutex _writer_mutex;
+    std::condition_variable _writer_cv;
+    size_t _written = 0;  // lines written by the writer (under `_writer_mutex`)
+    std::condition_variable _written_cv;  // `_written` changed
+
+    void write_out(const std::string&);
+    void run_writer();
 
     /************************* Time Functions **************************/
 
@@ -113,6 +136,18 @@ class Logger
     void config(bool log_stderr, bool log_file, std::string fname);
     void set_threshold(log_level_t level);
     void log(log_level_t level, std::string msg, std::string function_name = "");
+
+    // Output the given text with no formatting,
+    // each line in it should already end with a newline.
+    void output(std::string text);
+
+    // When enabled, output is queued and written in batches
+    // by a background thread, so that callers never block on it.
+    // Disabling it writes any queued output first.
+    // Not to be called while other threads may be logging.
+    void set_async(bool);
+    // Return once output queued so far has been written.
+    void flush();
     void silly(std::string msg, std::string function_name = "");
     void debug(std::string msg, std::string function_name = "");
     void verbose(std::string msg, std::string function_name = "");
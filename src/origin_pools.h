@@ -1,13 +1,28 @@
 #pragma once
 
 #include "connection_pool.h"
+#include <boost/beast/http/message.hpp>
 #include <boost/optional.hpp>
+#include <chrono>
+#include <map>
 
 namespace ouinet {
 
+/*
+ * Idle keep-alive connections to origins, grouped by scheme and host
+ * so that further requests to the same origin may skip
+ * the TCP (and TLS) handshake.
+ *
+ * Connections are only reused when explicitly given back
+ * with `insert_connection` once a response has been completely read from them.
+ * At most `max_per_host` idle connections are kept for each origin
+ * (older ones are closed first),
+ * and connections idle for longer than `idle_timeout` are closed.
+ */
 class OriginPools {
 private:
-    using RequestHdr = beast::http::header<true>; 
+    using RequestHdr = beast::http::header<true>;
+    using Clock = std::chrono::steady_clock;
 
 public:
     struct PoolId {
@@ -19,20 +34,47 @@ public:
         }
     };
 
-    using Connection = ConnectionPool<bool>::Connection;
+    // The stored value is the time when the connection became idle.
+    using Connection = ConnectionPool<Clock::time_point>::Connection;
+
+    struct Counters {
+        std::size_t hits = 0;     // requests served by a pooled connection
+        std::size_t misses = 0;   // requests needing a new connection
+        std::size_t inserted = 0; // connections given back to the pools
+        std::size_t evicted = 0;  // idle connections closed because of limits
+        std::size_t expired = 0;  // idle connections closed after the timeout
+    };
 
 public:
+    OriginPools( std::size_t max_per_host = 8
+               , Clock::duration idle_timeout = std::chrono::seconds(60))
+        : _max_per_host(max_per_host)
+        , _idle_timeout(idle_timeout)
+        , _last_sweep(Clock::now())
+    {}
+
     Connection wrap(const RequestHdr&, GenericStream);
 
     boost::optional<Connection> get_connection(const RequestHdr& rq);
 
     void insert_connection(const RequestHdr& rq, Connection);
 
+    const Counters& counters() const { return _counters; }
+
+    std::size_t idle_connections() const;
+
 private:
     boost::optional<PoolId> make_pool_id(const RequestHdr& hdr);
 
+    void remove_expired(ConnectionPool<Clock::time_point>&, Clock::time_point now);
+    void sweep(Clock::time_point now);
+
 private:
-    std::map<PoolId, ConnectionPool<bool>> _pools;
+    std::size_t _max_per_host;
+    Clock::duration _idle_timeout;
+    Clock::time_point _last_sweep;
+    Counters _counters;
+    std::map<PoolId, ConnectionPool<Clock::time_point>> _pools;
 };
 
 inline
@@ -47,20 +89,17 @@ OriginPools::get_connection(const RequestHdr& rq)
 
     auto pool_i = _pools.find(*opt_pool_id);
 
-    if (pool_i == _pools.end()) return boost::none;
-
-    if (pool_i->second.empty()) {
-        _pools.erase(pool_i);
-        return boost::none;
+    if (pool_i != _pools.end()) {
+        remove_expired(pool_i->second, Clock::now());
     }
 
-    auto ret = pool_i->second.pop_front();
-
-    if (pool_i->second.empty()) {
-        _pools.erase(pool_i);
+    if (pool_i == _pools.end() || pool_i->second.empty()) {
+        ++_counters.misses;
+        return boost::none;
     }
 
-    return ret;
+    ++_counters.hits;
+    return pool_i->second.pop_front();
 }
 
 inline
@@ -83,9 +122,63 @@ OriginPools::insert_connection(const RequestHdr& rq, Connection con)
 
     assert(opt_pool_id);
 
-    if (!opt_pool_id) return;
+    if (!opt_pool_id || _max_per_host == 0) {
+        con.close();
+        return;
+    }
+
+    auto now = Clock::now();
+    sweep(now);
+
+    auto& pool = _pools[*opt_pool_id];
+
+    while (pool.size() >= _max_per_host) {
+        pool.pop_front().close();
+        ++_counters.evicted;
+    }
+
+    *con = now;
+    pool.push_back(std::move(con));
+    ++_counters.inserted;
+}
+
+inline
+std::size_t
+OriginPools::idle_connections() const
+{
+    std::size_t n = 0;
+    for (auto& p : _pools) n += p.second.size();
+    return n;
+}
+
+inline
+void
+OriginPools::remove_expired( ConnectionPool<Clock::time_point>& pool
+                           , Clock::time_point now)
+{
+    // Connections are appended as they become idle,
+    // so the oldest ones are at the front.
+    while (!pool.empty() && now - pool.front_value() >= _idle_timeout) {
+        pool.pop_front().close();
+        ++_counters.expired;
+    }
+}
+
+// Close expired connections to all origins
+// (at most once per idle timeout),
+// so that origins which are not requested again do not keep them open.
+inline
+void
+OriginPools::sweep(Clock::time_point now)
+{
+    if (now - _last_sweep < _idle_timeout) return;
+    _last_sweep = now;
 
-    _pools[*opt_pool_id].push_back(std::move(con));
+    for (auto i = _pools.begin(); i != _pools.end();) {
+        remove_expired(i->second, now);
+        if (i->second.empty()) i = _pools.erase(i);
+        else ++i;
+    }
 }
 
 inline
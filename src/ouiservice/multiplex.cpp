@@ -0,0 +1,641 @@
+#include "multiplex.h"
+#include "../or_throw.h"
+#include "../defer.h"
+#include "../async_sleep.h"
+#include "../util/prefixed_stream.h"
+#include "../util/watch_dog.h"
+#include "../util/handler_tracker.h"
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+#include <algorithm>
+#include <array>
+
+namespace ouinet {
+namespace ouiservice {
+
+using namespace std;
+
+namespace multiplex {
+
+static const size_t header_size = 9;
+static const size_t max_frame_data = 16 * 1024;
+static const size_t initial_window = 256 * 1024;
+
+enum : uint8_t {
+    frame_data = 0,
+    frame_window = 1,
+    frame_close = 2,
+};
+
+const std::string Multiplexer::preface = "OUIMUX/1";
+
+static
+void store_u32(uint8_t* p, uint32_t v)
+{
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static
+uint32_t load_u32(const uint8_t* p)
+{
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16)
+         | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+//------------------------------------------------------------------------------
+struct Channel::State {
+    std::weak_ptr<Multiplexer> mux;
+    asio::executor ex;
+    uint32_t id;  // zero until the first write from the client side
+
+    std::vector<uint8_t> rx;  // received data not read yet, from `rx_pos` on
+    size_t rx_pos = 0;
+    size_t rx_outstanding = 0;  // received but not yet acknowledged with WINDOW
+    size_t rx_unacked = 0;  // read but not yet acknowledged with WINDOW
+    size_t tx_window = initial_window;
+
+    bool local_closed = false;
+    bool remote_closed = false;
+    sys::error_code error;  // the whole connection failed
+
+    std::vector<asio::mutable_buffer> read_bufs;
+    Handler read_handler;
+    std::vector<asio::const_buffer> write_bufs;
+    Handler write_handler;
+
+    State(std::weak_ptr<Multiplexer> mux, asio::executor ex, uint32_t id)
+        : mux(std::move(mux)), ex(std::move(ex)), id(id)
+    {}
+
+    // Handlers are never called from within the initiating function.
+    void complete(Handler& h, sys::error_code ec, size_t n)
+    {
+        asio::post(ex, [h = std::move(h), ec, n] () mutable { h(ec, n); });
+        h = nullptr;
+    }
+};
+
+Channel::Channel(std::shared_ptr<State> state)
+    : _state(std::move(state))
+{}
+
+Channel& Channel::operator=(Channel&& other)
+{
+    close();
+    _state = std::move(other._state);
+    return *this;
+}
+
+Channel::~Channel()
+{
+    close();
+}
+
+Channel::executor_type Channel::get_executor()
+{
+    assert(_state);
+    return _state->ex;
+}
+
+bool Channel::is_open() const
+{
+    return _state && !_state->local_closed;
+}
+
+void Channel::close()
+{
+    auto s = _state;
+    if (!s || s->local_closed) return;
+    s->local_closed = true;
+
+    if (s->read_handler) s->complete(s->read_handler, asio::error::operation_aborted, 0);
+    if (s->write_handler) s->complete(s->write_handler, asio::error::operation_aborted, 0);
+
+    auto mux = s->mux.lock();
+    if (!mux) return;
+    if (!mux->_closed && s->id) mux->send_frame(s->id, frame_close, 0);
+    mux->forget(*s);
+}
+
+void Channel::do_read(std::vector<asio::mutable_buffer> bufs, Handler h)
+{
+    auto s = _state;
+    assert(s);
+
+    if (s->local_closed)
+        return s->complete(h, asio::error::bad_descriptor, 0);
+    if (s->read_handler)
+        return s->complete(h, asio::error::already_started, 0);
+    if (asio::buffer_size(bufs) == 0)
+        return s->complete(h, {}, 0);
+
+    auto mux = s->mux.lock();
+    if (mux && s->rx_pos < s->rx.size())
+        return s->complete(h, {}, mux->consume(*s, bufs));
+
+    if (s->remote_closed) return s->complete(h, asio::error::eof, 0);
+    if (s->error) return s->complete(h, s->error, 0);
+
+    s->read_bufs = std::move(bufs);
+    s->read_handler = std::move(h);
+}
+
+void Channel::do_write(std::vector<asio::const_buffer> bufs, Handler h)
+{
+    auto s = _state;
+    assert(s);
+
+    if (s->local_closed)
+        return s->complete(h, asio::error::bad_descriptor, 0);
+    if (s->write_handler)
+        return s->complete(h, asio::error::already_started, 0);
+    if (s->remote_closed)
+        return s->complete(h, asio::error::broken_pipe, 0);
+
+    auto mux = s->mux.lock();
+    if (!mux || mux->_closed)
+        return s->complete(h, s->error ? s->error : asio::error::connection_reset, 0);
+    if (asio::buffer_size(bufs) == 0)
+        return s->complete(h, {}, 0);
+
+    if (s->tx_window == 0) {
+        // Wait for the other side to make room.
+        s->write_bufs = std::move(bufs);
+        s->write_handler = std::move(h);
+        return;
+    }
+
+    s->complete(h, {}, mux->send_data(s, bufs));
+}
+
+//------------------------------------------------------------------------------
+Multiplexer::Multiplexer(const asio::executor& ex, GenericStream transport, Side side)
+    : _ex(ex)
+    , _transport(std::move(transport))
+    , _side(side)
+    , _idle_since(Clock::now())
+    , _tx_ready(ex)
+    , _accept_ready(ex)
+{}
+
+std::shared_ptr<Multiplexer>
+Multiplexer::create(const asio::executor& ex, GenericStream transport, Side side)
+{
+    std::shared_ptr<Multiplexer> mux(new Multiplexer(ex, std::move(transport), side));
+    if (side == Side::client) mux->_tx_queue.push_back(preface);
+    mux->start();
+    return mux;
+}
+
+Multiplexer::~Multiplexer()
+{
+    _transport.close();
+}
+
+void Multiplexer::start()
+{
+    TRACK_SPAWN(_ex, ([self = shared_from_this()] (asio::yield_context yield) {
+        self->read_loop(yield);
+    }));
+    TRACK_SPAWN(_ex, ([self = shared_from_this()] (asio::yield_context yield) {
+        self->write_loop(yield);
+    }));
+}
+
+Channel Multiplexer::open()
+{
+    assert(_side == Side::client);
+    if (_closed) return Channel();
+    ++_open_channels;
+    auto s = std::make_shared<Channel::State>(shared_from_this(), _ex, 0);
+    _new_channels.push_back(s);
+    return Channel(std::move(s));
+}
+
+boost::optional<Multiplexer::Clock::time_point> Multiplexer::idle_since() const
+{
+    if (_open_channels > 0) return boost::none;
+    return _idle_since;
+}
+
+Channel Multiplexer::accept(Cancel& cancel, asio::yield_context yield)
+{
+    assert(_side == Side::server);
+    sys::error_code ec;
+
+    while (_accept_queue.empty()) {
+        if (_closed) return or_throw<Channel>(yield, asio::error::operation_aborted);
+        _accept_ready.wait(cancel, yield[ec]);
+        if (cancel) return or_throw<Channel>(yield, asio::error::operation_aborted);
+    }
+
+    auto ch = std::move(_accept_queue.front());
+    _accept_queue.pop_front();
+    return ch;
+}
+
+void Multiplexer::close()
+{
+    fail(asio::error::operation_aborted);
+}
+
+void Multiplexer::read_loop(asio::yield_context yield)
+{
+    sys::error_code ec;
+    std::array<uint8_t, header_size> hdr;
+    std::vector<uint8_t> payload;
+
+    while (!_closed) {
+        asio::async_read(_transport, asio::buffer(hdr), yield[ec]);
+        if (ec) break;
+
+        auto id = load_u32(&hdr[0]);
+        auto type = hdr[4];
+        auto length = load_u32(&hdr[5]);
+
+        payload.clear();
+        if (type == frame_data) {
+            if (length > max_frame_data) {
+                ec = sys::errc::make_error_code(sys::errc::protocol_error);
+                break;
+            }
+            payload.resize(length);
+            asio::async_read(_transport, asio::buffer(payload), yield[ec]);
+            if (ec) break;
+        }
+
+        if (!on_frame(id, type, length, payload)) {
+            ec = sys::errc::make_error_code(sys::errc::protocol_error);
+            break;
+        }
+    }
+
+    fail(ec ? ec : asio::error::operation_aborted);
+}
+
+void Multiplexer::write_loop(asio::yield_context yield)
+{
+    sys::error_code ec;
+
+    while (!_closed) {
+        if (_tx_queue.empty()) {
+            _tx_ready.wait(yield[ec]);
+            continue;
+        }
+
+        // Send all queued frames in a single write.
+        std::deque<std::string> sending;
+        sending.swap(_tx_queue);
+        std::vector<asio::const_buffer> bufs;
+        bufs.reserve(sending.size());
+        for (auto& f : sending) bufs.push_back(asio::buffer(f));
+
+        asio::async_write(_transport, bufs, yield[ec]);
+        if (ec) return fail(ec);
+    }
+}
+
+bool Multiplexer::on_frame( uint32_t id, uint8_t type, uint32_t length
+                          , std::vector<uint8_t>& payload)
+{
+    auto it = _channels.find(id);
+
+    if (it == _channels.end()) {
+        // Either a new channel from the client,
+        // or a late frame for a channel already closed here (ignored).
+        if (_side != Side::server || type != frame_data || !(id & 1) || id <= _last_remote_id)
+            return true;
+
+        auto s = std::make_shared<Channel::State>(shared_from_this(), _ex, id);
+        it = _channels.emplace(id, s).first;
+        _last_remote_id = id;
+        ++_open_channels;
+        _accept_queue.emplace_back(std::move(s));
+        _accept_ready.notify();
+    }
+
+    auto s = it->second;
+
+    switch (type) {
+        case frame_data: {
+            if (s->remote_closed) return false;
+            s->rx_outstanding += length;
+            if (s->rx_outstanding > initial_window) return false;
+
+            if (s->rx_pos == s->rx.size()) {
+                s->rx.clear();
+                s->rx_pos = 0;
+            }
+            s->rx.insert(s->rx.end(), payload.begin(), payload.end());
+
+            if (s->read_handler && length > 0) {
+                auto n = consume(*s, s->read_bufs);
+                s->read_bufs.clear();
+                s->complete(s->read_handler, {}, n);
+            }
+            return true;
+        }
+        case frame_window: {
+            s->tx_window += length;
+            if (s->write_handler && s->tx_window > 0) {
+                auto n = send_data(s, s->write_bufs);
+                s->write_bufs.clear();
+                s->complete(s->write_handler, {}, n);
+            }
+            return true;
+        }
+        case frame_close: {
+            s->remote_closed = true;
+            if (s->read_handler && s->rx_pos == s->rx.size()) {
+                s->read_bufs.clear();
+                s->complete(s->read_handler, asio::error::eof, 0);
+            }
+            if (s->write_handler) {
+                s->write_bufs.clear();
+                s->complete(s->write_handler, asio::error::broken_pipe, 0);
+            }
+            return true;
+        }
+    }
+
+    return false;  // unknown frame type
+}
+
+void Multiplexer::fail(const sys::error_code& ec)
+{
+    if (_closed) return;
+    _closed = true;
+
+    auto channels = std::move(_channels);
+    _channels.clear();
+    auto new_channels = std::move(_new_channels);
+    _new_channels.clear();
+
+    auto fail_channel = [&] (Channel::State& s) {
+        s.error = ec;
+        if (s.read_handler) s.complete(s.read_handler, ec, 0);
+        if (s.write_handler) s.complete(s.write_handler, ec, 0);
+    };
+    for (auto& p : channels) fail_channel(*p.second);
+    for (auto& s : new_channels) fail_channel(*s);
+
+    _transport.close();
+    _tx_queue.clear();
+    _tx_ready.notify();
+    _accept_ready.notify();
+}
+
+void Multiplexer::send_frame( uint32_t id, uint8_t type, uint32_t length
+                            , const std::vector<asio::const_buffer>& data)
+{
+    std::string frame(header_size + (type == frame_data ? length : 0), '\0');
+    auto p = reinterpret_cast<uint8_t*>(&frame[0]);
+    store_u32(p, id);
+    p[4] = type;
+    store_u32(p + 5, length);
+    if (type == frame_data)
+        asio::buffer_copy(asio::buffer(p + header_size, length), data);
+
+    _tx_queue.push_back(std::move(frame));
+    _tx_ready.notify();
+}
+
+std::size_t Multiplexer::send_data( const std::shared_ptr<Channel::State>& s
+                                  , const std::vector<asio::const_buffer>& data)
+{
+    if (s->id == 0) {
+        // Client channels get their id when they send their first frame,
+        // so that the server sees ids in increasing order.
+        s->id = _next_id;
+        _next_id += 2;
+        _channels.emplace(s->id, s);
+        _new_channels.remove(s);
+    }
+
+    auto n = std::min({asio::buffer_size(data), s->tx_window, max_frame_data});
+    send_frame(s->id, frame_data, n, data);
+    s->tx_window -= n;
+    return n;
+}
+
+std::size_t Multiplexer::consume( Channel::State& s
+                                , const std::vector<asio::mutable_buffer>& bufs)
+{
+    auto n = asio::buffer_copy(bufs, asio::buffer(s.rx) + s.rx_pos);
+    s.rx_pos += n;
+
+    if (s.rx_pos == s.rx.size()) {
+        s.rx.clear();
+        s.rx_pos = 0;
+    }
+
+    // Acknowledge consumed data in chunks to avoid a frame per read.
+    s.rx_unacked += n;
+    if (!_closed && s.rx_unacked >= initial_window / 2) {
+        send_frame(s.id, frame_window, s.rx_unacked);
+        s.rx_outstanding -= s.rx_unacked;
+        s.rx_unacked = 0;
+    }
+
+    return n;
+}
+
+void Multiplexer::forget(Channel::State& s)
+{
+    if (s.id) {
+        auto it = _channels.find(s.id);
+        if (it != _channels.end() && it->second.get() == &s)
+            _channels.erase(it);
+    } else {
+        _new_channels.remove_if([&] (const auto& p) { return p.get() == &s; });
+    }
+    assert(_open_channels > 0);
+    if (--_open_channels == 0) _idle_since = Clock::now();
+}
+
+} // multiplex namespace
+
+//------------------------------------------------------------------------------
+void MultiplexOuiServiceClient::start(asio::yield_context yield) /* override */
+{
+    _base->start(yield);
+
+    TRACK_SPAWN(_ex, ([&] (asio::yield_context yield) {
+        Cancel cancel(_lifetime_cancel);
+        while (async_sleep(_ex, _idle_timeout / 2, cancel, yield))
+            close_idle();
+    }));
+}
+
+void MultiplexOuiServiceClient::close_idle()
+{
+    auto now = Clock::now();
+    _connections.remove_if([&] (const auto& mux) {
+        auto since = mux->idle_since();
+        if (mux->is_open() && (!since || now - *since < _idle_timeout))
+            return false;
+        mux->close();
+        return true;
+    });
+}
+
+MultiplexOuiServiceClient::~MultiplexOuiServiceClient()
+{
+    _lifetime_cancel();
+}
+
+void MultiplexOuiServiceClient::stop() /* override */
+{
+    _lifetime_cancel();
+    for (auto& mux : _connections) mux->close();
+    _connections.clear();
+    _base->stop();
+}
+
+GenericStream
+MultiplexOuiServiceClient::connect(asio::yield_context yield, Signal<void()>& cancel)
+{
+    using multiplex::Multiplexer;
+
+    sys::error_code ec;
+
+    while (true) {
+        _connections.remove_if([] (const auto& mux) { return !mux->is_open(); });
+
+        for (auto& mux : _connections) {
+            if (mux->channel_count() >= _max_channels) continue;
+            auto ch = mux->open();
+            if (ch.is_open()) return GenericStream(std::move(ch));
+        }
+
+        if (cancel) return or_throw<GenericStream>(yield, asio::error::operation_aborted);
+
+        if (_connecting) {
+            // Let the coroutine already connecting share its connection.
+            _connected.wait(cancel, yield[ec]);
+            if (cancel) return or_throw<GenericStream>(yield, asio::error::operation_aborted);
+            continue;
+        }
+
+        _connecting = true;
+        auto on_exit = defer([&] { _connecting = false; _connected.notify(); });
+
+        auto con = _base->connect(yield[ec], cancel);
+        if (cancel) ec = asio::error::operation_aborted;
+        if (ec) return or_throw<GenericStream>(yield, ec);
+
+        _connections.push_back(Multiplexer::create(_ex, std::move(con), Multiplexer::Side::client));
+    }
+}
+
+//------------------------------------------------------------------------------
+void MultiplexOuiServiceServer::start_listen(asio::yield_context yield) /* override */
+{
+    _base->start_listen(yield);
+
+    TRACK_SPAWN(_ex, ([&] (asio::yield_context yield) {
+            using namespace chrono_literals;
+
+            Cancel cancel(_cancel);
+
+            while (!cancel) {
+                sys::error_code ec;
+
+                auto con = _base->accept(yield[ec]);
+
+                if (cancel || ec == asio::error::operation_aborted) break;
+
+                if (ec) {
+                    async_sleep(_ex, 100ms, cancel, yield);
+                    if (cancel) break;
+                    continue;
+                }
+
+                // Spawn a new coroutine to avoid blocking accept of the next
+                // connection.
+                TRACK_SPAWN(_ex, ([this, con = move(con)] (auto yield) mutable {
+                    Cancel cancel(_cancel);
+                    serve_connection(move(con), cancel, yield);
+                }));
+            }
+        }));
+}
+
+void MultiplexOuiServiceServer::serve_connection( GenericStream con
+                                                , Cancel& cancel
+                                                , asio::yield_context yield)
+{
+    using namespace chrono_literals;
+    using multiplex::Multiplexer;
+
+    sys::error_code ec;
+    const auto& preface = Multiplexer::preface;
+
+    // Read as much as needed to tell whether this is a multiplexed connection.
+    std::string peeked;
+    {
+        bool timed_out = false;
+        WatchDog wd(_ex, 10s, [&] { con.close(); timed_out = true; });
+
+        std::array<char, 16> buf;
+        while ( peeked.size() < preface.size()
+             && preface.compare(0, peeked.size(), peeked) == 0) {
+            auto n = con.async_read_some( asio::buffer(buf, preface.size() - peeked.size())
+                                        , yield[ec]);
+            if (ec || timed_out || cancel) return;
+            peeked.append(buf.data(), n);
+        }
+    }
+
+    if (peeked != preface) {
+        // A plain connection, hand it over with the data read so far.
+        _accept_queue.async_push( GenericStream(util::PrefixedStream<GenericStream>(move(peeked), move(con)))
+                                , cancel
+                                , yield[ec]);
+        return;
+    }
+
+    // Cancellation stops accepting channels, then the connection is closed
+    // (closing it from a cancel slot would wake up `accept` twice).
+    auto mux = Multiplexer::create(_ex, move(con), Multiplexer::Side::server);
+
+    while (true) {
+        auto ch = mux->accept(cancel, yield[ec]);
+        if (ec) break;
+        _accept_queue.async_push(GenericStream(move(ch)), cancel, yield[ec]);
+        if (ec) break;
+    }
+
+    mux->close();
+}
+
+void MultiplexOuiServiceServer::stop_listen() /* override */
+{
+    _cancel();
+
+    while (!_accept_queue.empty()) {
+        auto c = move(_accept_queue.back());
+        _accept_queue.pop();
+        c.close();
+    }
+
+    _base->stop_listen();
+}
+
+GenericStream MultiplexOuiServiceServer::accept(asio::yield_context yield)
+{
+    sys::error_code ec;
+    auto s = _accept_queue.async_pop(_cancel, yield[ec]);
+    return or_throw(yield, ec, move(s));
+}
+
+MultiplexOuiServiceServer::~MultiplexOuiServiceServer()
+{
+    _cancel();
+}
+
+} // ouiservice namespace
+} // ouinet namespace
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/optional.hpp>
+
+#include "../ouiservice.h"
+#include "../util/async_queue.h"
+#include "../util/condition_variable.h"
+#include "../util/signal.h"
+#include "../util/unique_function.h"
+
+namespace ouinet {
+namespace ouiservice {
+
+/*
+ * Stream multiplexing over a single transport connection.
+ *
+ * The client side opens many logical channels over one connection
+ * (e.g. one per HTTP request to the injector),
+ * so that the (possibly slow) transport setup is only paid once.
+ *
+ * A multiplexed connection starts with `Multiplexer::preface` from the client,
+ * then each side sends frames with a 9-byte header:
+ *
+ *     <CHANNEL_ID:u32> <TYPE:u8> <LENGTH:u32>
+ *
+ * (big-endian), where TYPE is one of:
+ *
+ *   - DATA: LENGTH bytes of channel data follow (at most 16 KiB);
+ *     the first DATA frame with a new channel id opens the channel.
+ *   - WINDOW: the receiver consumed LENGTH more bytes of the channel.
+ *   - CLOSE: the sender closed the channel.
+ *
+ * Channels are only opened by the client (with odd ids).
+ * Each side may only send as much channel data as the other side has room for
+ * (an initial window of 256 KiB per channel, extended by WINDOW frames),
+ * so that a slow channel does not stall the others.
+ */
+namespace multiplex {
+
+class Multiplexer;
+
+// A logical stream over a multiplexed connection.
+// It can be wrapped in a `GenericStream`.
+class Channel {
+public:
+    using executor_type = asio::executor;
+
+    struct State;
+
+public:
+    Channel() = default;
+    Channel(std::shared_ptr<State>);
+
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+
+    Channel(Channel&&) = default;
+    Channel& operator=(Channel&&);
+
+    ~Channel();
+
+    executor_type get_executor();
+
+    template<class MutableBufferSequence, class Token>
+    auto async_read_some(const MutableBufferSequence& bs, Token&& token)
+    {
+        using Sig = void(sys::error_code, size_t);
+        asio::async_completion<Token, Sig> init(token);
+        std::vector<asio::mutable_buffer> bufs( asio::buffer_sequence_begin(bs)
+                                              , asio::buffer_sequence_end(bs));
+        do_read(std::move(bufs), std::move(init.completion_handler));
+        return init.result.get();
+    }
+
+    template<class ConstBufferSequence, class Token>
+    auto async_write_some(const ConstBufferSequence& bs, Token&& token)
+    {
+        using Sig = void(sys::error_code, size_t);
+        asio::async_completion<Token, Sig> init(token);
+        std::vector<asio::const_buffer> bufs( asio::buffer_sequence_begin(bs)
+                                            , asio::buffer_sequence_end(bs));
+        do_write(std::move(bufs), std::move(init.completion_handler));
+        return init.result.get();
+    }
+
+    // Pending operations are aborted and the other side is told to close the channel.
+    void close();
+    bool is_open() const;
+
+private:
+    using Handler = util::unique_function<void(sys::error_code, size_t)>;
+
+    void do_read(std::vector<asio::mutable_buffer>, Handler);
+    void do_write(std::vector<asio::const_buffer>, Handler);
+
+private:
+    std::shared_ptr<State> _state;
+};
+
+class Multiplexer : public std::enable_shared_from_this<Multiplexer> {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Side { client, server };
+
+    // Sent by the client before any frames.
+    static const std::string preface;
+
+public:
+    // Start reading and writing frames over `transport`.
+    // The client side sends the preface first,
+    // the server side expects it to have been consumed already.
+    static
+    std::shared_ptr<Multiplexer>
+    create(const asio::executor&, GenericStream transport, Side);
+
+    ~Multiplexer();
+
+    // Client side only: open a new channel.
+    // The returned channel is not open if the connection is closed.
+    Channel open();
+
+    // Server side only: wait for a channel opened by the client.
+    Channel accept(Cancel&, asio::yield_context);
+
+    bool is_open() const { return !_closed; }
+
+    // Number of channels currently open over this connection.
+    std::size_t channel_count() const { return _open_channels; }
+
+    // Since when no channels are open over this connection, if so.
+    boost::optional<Clock::time_point> idle_since() const;
+
+    // Close the transport connection and all its channels.
+    void close();
+
+private:
+    friend class Channel;
+
+    Multiplexer(const asio::executor&, GenericStream, Side);
+
+    void start();
+    void read_loop(asio::yield_context);
+    void write_loop(asio::yield_context);
+
+    bool on_frame(uint32_t id, uint8_t type, uint32_t length, std::vector<uint8_t>&);
+    void fail(const sys::error_code&);
+
+    void send_frame( uint32_t id, uint8_t type, uint32_t length
+                   , const std::vector<asio::const_buffer>& = {});
+    std::size_t send_data( const std::shared_ptr<Channel::State>&
+                         , const std::vector<asio::const_buffer>&);
+    std::size_t consume(Channel::State&, const std::vector<asio::mutable_buffer>&);
+    void forget(Channel::State&);
+
+private:
+    asio::executor _ex;
+    GenericStream _transport;
+    Side _side;
+    bool _closed = false;
+
+    // Channels which already have an id (client channels get it on their first write).
+    std::map<uint32_t, std::shared_ptr<Channel::State>> _channels;
+    // Client channels not written to yet.
+    std::list<std::shared_ptr<Channel::State>> _new_channels;
+    std::size_t _open_channels = 0;
+    Clock::time_point _idle_since;
+    uint32_t _next_id = 1;
+    uint32_t _last_remote_id = 0;
+
+    std::deque<std::string> _tx_queue;
+    ConditionVariable _tx_ready;
+
+    std::deque<Channel> _accept_queue;
+    ConditionVariable _accept_ready;
+};
+
+} // multiplex namespace
+
+// Opens channels over shared connections to a base service,
+// each connection carries at most `max_channels` channels.
+// Connections with no channels for `idle_timeout` are closed.
+class MultiplexOuiServiceClient : public OuiServiceImplementationClient
+{
+    public:
+    using BaseServicePtr = std::unique_ptr<OuiServiceImplementationClient>;
+    using Clock = multiplex::Multiplexer::Clock;
+
+    public:
+    MultiplexOuiServiceClient( const asio::executor& ex
+                             , BaseServicePtr base
+                             , std::size_t max_channels = 64
+                             , Clock::duration idle_timeout = std::chrono::seconds(60))
+        : _ex(ex)
+        , _base(std::move(base))
+        , _max_channels(max_channels)
+        , _idle_timeout(idle_timeout)
+        , _connected(ex)
+    {};
+
+    void start(asio::yield_context yield) override;
+    void stop() override;
+
+    GenericStream connect(asio::yield_context, Cancel&) override;
+
+    ~MultiplexOuiServiceClient();
+
+    private:
+    void close_idle();
+
+    private:
+    asio::executor _ex;
+    BaseServicePtr _base;
+    std::size_t _max_channels;
+    Clock::duration _idle_timeout;
+    Cancel _lifetime_cancel;
+    std::list<std::shared_ptr<multiplex::Multiplexer>> _connections;
+    bool _connecting = false;
+    ConditionVariable _connected;
+};
+
+// Accepts both multiplexed connections (yielding their channels)
+// and plain connections (yielded as is) from a base service.
+class MultiplexOuiServiceServer : public OuiServiceImplementationServer
+{
+    public:
+    using BaseServicePtr = std::unique_ptr<OuiServiceImplementationServer>;
+
+    MultiplexOuiServiceServer(const asio::executor& ex, BaseServicePtr base)
+        : _ex(ex)
+        , _base(std::move(base))
+        , _accept_queue(_ex)
+    {};
+
+    void start_listen(asio::yield_context) override;
+    void stop_listen() override;
+
+    GenericStream accept(asio::yield_context yield) override;
+
+    ~MultiplexOuiServiceServer();
+
+    private:
+    void serve_connection(GenericStream, Cancel&, asio::yield_context);
+
+    private:
+    asio::executor _ex;
+    BaseServicePtr _base;
+    Cancel _cancel;
+    util::AsyncQueue<GenericStream> _accept_queue;
+};
+
+} // ouiservice namespace
+} // ouinet namespace
@@ -6,10 +6,13 @@
 namespace ouinet {
 namespace ouiservice {
 
-TcpOuiServiceServer::TcpOuiServiceServer(const asio::executor& ex, asio::ip::tcp::endpoint endpoint):
+TcpOuiServiceServer::TcpOuiServiceServer( const asio::executor& ex
+                                        , asio::ip::tcp::endpoint endpoint
+                                        , bool reuse_port):
     _ex(ex),
     _acceptor(ex),
-    _endpoint(endpoint)
+    _endpoint(endpoint),
+    _reuse_port(reuse_port)
 {}
 
 void TcpOuiServiceServer::start_listen(asio::yield_context yield)
@@ -23,6 +26,19 @@ void TcpOuiServiceServer::start_listen(asio::yield_context yield)
 
     _acceptor.set_option(asio::socket_base::reuse_address(true));
 
+    if (_reuse_port) {
+#ifdef SO_REUSEPORT
+        using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+        _acceptor.set_option(reuse_port(true), ec);
+#else
+        ec = asio::error::operation_not_supported;
+#endif
+        if (ec) {
+            _acceptor.close();
+            return or_throw(yield, ec);
+        }
+    }
+
     _acceptor.bind(_endpoint, ec);
     if (ec) {
         _acceptor.close();
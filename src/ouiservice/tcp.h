@@ -12,7 +12,11 @@ namespace ouiservice {
 class TcpOuiServiceServer : public OuiServiceImplementationServer
 {
     public:
-    TcpOuiServiceServer(const asio::executor&, asio::ip::tcp::endpoint endpoint);
+    // With `reuse_port`, several servers (e.g. running on different threads)
+    // may listen on the same endpoint, and the system spreads
+    // incoming connections among them.
+    TcpOuiServiceServer( const asio::executor&, asio::ip::tcp::endpoint endpoint
+                       , bool reuse_port = false);
 
     void start_listen(asio::yield_context yield) override;
     void stop_listen() override;
@@ -23,6 +27,7 @@ class TcpOuiServiceServer : public OuiServiceImplementationServer
     asio::executor _ex;
     asio::ip::tcp::acceptor _acceptor;
     asio::ip::tcp::endpoint _endpoint;
+    bool _reuse_port;
 };
 
 class TcpOuiServiceClient : public OuiServiceImplementationClient
@@ -9,6 +9,7 @@
 #include <boost/variant.hpp>
 #include <boost/format.hpp>
 
+#include "util/shared_bytes.h"
 #include "util/signal.h"
 #include "util/variant.h"
 #include "namespaces.h"
@@ -61,10 +62,13 @@ struct Head : public http::response_header<> {
     { return detail::async_write_c(this, s, c, y); }
 };
 
-struct Body : public std::vector<uint8_t> {
-    using Base = std::vector<uint8_t>;
+// Body data is shared among copies of the part,
+// so that passing it around (e.g. to several sinks) does not copy it.
+struct Body : public util::SharedBytes {
+    using Base = util::SharedBytes;
 
-    Body(Base data) : Base(move(data)) {}
+    Body(Base data) : Base(std::move(data)) {}
+    Body(std::vector<uint8_t> data) : Base(std::move(data)) {}
 
     Body(const Body&) = default;
     Body(Body&&) = default;
@@ -73,7 +77,7 @@ struct Body : public std::vector<uint8_t> {
     template<class S>
     void async_write(S& s, asio::yield_context yield) const
     {
-        asio::async_write(s, asio::buffer(*this), yield);
+        asio::async_write(s, asio::buffer(data(), size()), yield);
     }
 
     template<class S>
@@ -113,13 +117,18 @@ struct ChunkHdr {
     { return detail::async_write_c(this, s, c, y); }
 };
 
-struct ChunkBody : public std::vector<uint8_t> {
+// Chunk data is shared like `Body` data.
+struct ChunkBody : public util::SharedBytes {
     size_t remain;
 
-    using Base = std::vector<uint8_t>;
+    using Base = util::SharedBytes;
 
-    ChunkBody(const Base& data, size_t remain)
-        : Base(data)
+    ChunkBody(Base data, size_t remain)
+        : Base(std::move(data))
+        , remain(remain) {}
+
+    ChunkBody(std::vector<uint8_t> data, size_t remain)
+        : Base(std::move(data))
         , remain(remain) {}
 
     ChunkBody(const ChunkBody&) = default;
@@ -130,7 +139,7 @@ struct ChunkBody : public std::vector<uint8_t> {
     void async_write(S& s, asio::yield_context yield) const
     {
         sys::error_code ec;
-        asio::async_write(s, asio::buffer(*this), yield[ec]);
+        asio::async_write(s, asio::buffer(data(), size()), yield[ec]);
     
         if (ec) return or_throw(yield, ec);
     
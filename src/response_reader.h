@@ -6,6 +6,7 @@
 #include "namespaces.h"
 #include "or_throw.h"
 #include "response_part.h"
+#include "util/shared_bytes.h"
 #include "util/signal.h"
 #include <boost/beast.hpp>
 
@@ -60,6 +61,8 @@ public:
     bool is_open() const override { return _in.is_open(); }
     void close()         override { return _in.close(); }
 
+    GenericStream::executor_type get_executor() { return _in.get_executor(); }
+
 private:
     http::fields filter_trailer_fields(const http::fields& hdr)
     {
@@ -80,6 +83,9 @@ private:
     Cancel _lifetime_cancel;
     beast::static_buffer<http_forward_block> _buffer;
     http::response_parser<http::buffer_body> _parser;
+    // Body data is placed here once and shared by parts from then on,
+    // since parts may outlive `_buffer` contents (e.g. when queued).
+    util::SlabAllocator _body_alloc;
 
     std::function<void(size_t, string_view, sys::error_code&)> _on_chunk_header;
     std::function<size_t(size_t, string_view, sys::error_code&)> _on_chunk_body;
@@ -120,7 +126,7 @@ void Reader::setup_parser()
 
     _on_chunk_body = [&] (auto remain, auto data, auto& ec) -> size_t {
         assert(!_next_part);
-        _next_part = ChunkBody( std::vector<uint8_t>(data.begin(), data.end())
+        _next_part = ChunkBody( _body_alloc.copy(data.data(), data.size())
                               , remain - data.size());
         return data.size();
     };
@@ -193,10 +199,11 @@ Reader::async_read_part(Cancel cancel, asio::yield_context yield) {
             return boost::none;
         }
 
-        char buf[http_forward_block];
+        // Have the parser place body data straight into shared storage.
+        auto buf = _body_alloc.prepare(http_forward_block);
 
-        _parser.get().body().data = buf;
-        _parser.get().body().size = sizeof(buf);
+        _parser.get().body().data = buf.data();
+        _parser.get().body().size = http_forward_block;
 
         http::async_read_some(_in, _buffer, _parser, yield[ec]);
 
@@ -205,14 +212,14 @@ Reader::async_read_part(Cancel cancel, asio::yield_context yield) {
         if (ec == http::error::need_buffer) ec = sys::error_code();
         if (ec) return or_throw(yield, ec, boost::none);
 
-        size_t s = sizeof(buf) - _parser.get().body().size;
+        size_t s = http_forward_block - _parser.get().body().size;
 
         if (s == 0 && _parser.is_done()) {
             _is_done = true;
             return boost::none;
         }
 
-        return Part(Body(std::vector<uint8_t>(buf, buf + s)));
+        return Part(Body(_body_alloc.commit(s)));
     }
 }
 
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+#include <deque>
+#include <list>
+#include <memory>
+
+#include "response_reader.h"
+#include "namespaces.h"
+#include "or_throw.h"
+#include "util/condition_variable.h"
+#include "util/file_io.h"
+#include "util/shared_bytes.h"
+#include "util/temp_file.h"
+
+namespace ouinet { namespace http_response {
+
+/*
+ * Copy the parts of a response to several consumers,
+ * each reading them with its own reader (see `add_reader`).
+ *
+ * At most `max_buffered` bytes of body data are kept in memory
+ * for each consumer.  When a consumer falls that much behind,
+ * the data of further parts for it is written to a temporary file
+ * under `spill_dir` (which is removed right away),
+ * and read back when the consumer gets to it;
+ * with no `spill_dir` (or if the file cannot be created),
+ * pushing a part waits for the consumer to catch up instead.
+ * Thus memory use does not depend on the size of the response
+ * nor on how slow consumers are.
+ *
+ * Consumers which close or destroy their readers no longer get parts.
+ */
+class Tee {
+public:
+    Tee( const asio::executor& ex
+       , std::size_t max_buffered
+       , boost::optional<fs::path> spill_dir = boost::none)
+        : _ex(ex)
+        , _max_buffered(max_buffered)
+        , _spill_dir(std::move(spill_dir))
+    {}
+
+    Tee(const Tee&) = delete;
+    Tee& operator=(const Tee&) = delete;
+
+    ~Tee() { finish(asio::error::operation_aborted); }
+
+    // Add a consumer getting parts pushed from now on.
+    std::unique_ptr<AbstractReader> add_reader();
+
+    // Send the part to all consumers,
+    // waiting for those without room for it (if not spilling).
+    void async_push(Part, Cancel&, asio::yield_context);
+
+    // Tell consumers that there are no more parts (or about an error).
+    void finish(const sys::error_code& = {});
+
+    // Whether some consumer still gets parts.
+    bool has_readers() const;
+
+private:
+    class Reader;
+
+    struct Item {
+        boost::optional<Part> part;  // none at the end of the response
+        sys::error_code ec;
+        // Size of the part's data in the spill file (if not in memory).
+        std::size_t spilled = 0;
+    };
+
+    struct Consumer {
+        ConditionVariable cv;  // on items pushed or popped, or on close
+        std::deque<Item> items;
+        std::size_t buffered = 0;  // bytes of data in memory
+        bool closed = false;
+
+        boost::optional<util::temp_file> spill;
+        asio::posix::stream_descriptor spill_in;
+        std::size_t spill_pending = 0;  // parts in the file not read yet
+        bool spill_writing = false;
+        util::SlabAllocator alloc;
+
+        Consumer(const asio::executor& ex) : cv(ex), spill_in(ex) {}
+
+        void close() {
+            closed = true;
+            items.clear();
+            buffered = 0;
+            // The file is still being written otherwise (see `Tee::spill`).
+            if (!spill_writing) spill = boost::none;
+            spill_in.close();
+            cv.notify();
+        }
+    };
+
+    static
+    const util::SharedBytes* data_of(const Part& p) {
+        if (auto b = p.as_body()) return b;
+        if (auto cb = p.as_chunk_body()) return cb;
+        return nullptr;
+    }
+
+    bool spill( Consumer&, const util::SharedBytes&
+              , Cancel&, asio::yield_context);
+
+private:
+    asio::executor _ex;
+    std::size_t _max_buffered;
+    boost::optional<fs::path> _spill_dir;
+    std::list<std::shared_ptr<Consumer>> _consumers;
+    bool _finished = false;
+};
+
+class Tee::Reader : public AbstractReader {
+public:
+    Reader(std::shared_ptr<Consumer> c) : _c(std::move(c)) {}
+
+    ~Reader() override { _c->close(); }
+
+    boost::optional<Part> async_read_part(Cancel, asio::yield_context) override;
+
+    bool is_done() const override { return _done; }
+    bool is_open() const override { return !_c->closed; }
+    void close() override { _c->close(); }
+
+private:
+    std::shared_ptr<Consumer> _c;
+    bool _done = false;
+};
+
+inline
+std::unique_ptr<AbstractReader>
+Tee::add_reader()
+{
+    auto c = std::make_shared<Consumer>(_ex);
+    _consumers.push_back(c);
+    return std::make_unique<Reader>(std::move(c));
+}
+
+// Write the data to the spill file of the consumer,
+// creating it if needed.  Return false if it could not be created.
+inline
+bool
+Tee::spill( Consumer& c, const util::SharedBytes& data
+          , Cancel& cancel, asio::yield_context yield)
+{
+    sys::error_code ec;
+
+    if (!c.spill) {
+        c.spill = util::temp_file::make(_ex, *_spill_dir, ec);
+        if (!ec)
+            c.spill_in = util::file_io::open_readonly(_ex, c.spill->path(), ec);
+        if (ec) {
+            c.spill = boost::none;
+            return false;
+        }
+        // The open descriptors keep the file around,
+        // and nothing is left behind if the program dies.
+        util::file_io::remove_file(c.spill->path());
+    }
+
+    c.spill_writing = true;
+    util::file_io::write(c.spill->lowest_layer(), data, cancel, yield[ec]);
+    c.spill_writing = false;
+    // The consumer went away while writing.
+    if (c.closed) c.spill = boost::none;
+    if (cancel) ec = asio::error::operation_aborted;
+    return or_throw(yield, ec, true);
+}
+
+inline
+void
+Tee::async_push(Part part, Cancel& cancel, asio::yield_context yield)
+{
+    assert(!_finished);
+
+    auto data = data_of(part);
+    std::size_t size = data ? data->size() : 0;
+
+    // Buffered data is accounted by its size,
+    // so do not let small parts keep whole slabs alive.
+    if (size > 0 && size < util::SlabAllocator::slab_size / 8) {
+        if (auto b = part.as_body()) *b = Body(b->detached());
+        if (auto cb = part.as_chunk_body()) *cb = ChunkBody(cb->detached(), cb->remain);
+        data = data_of(part);
+    }
+
+    // Copy the list since consumers may go away while waiting.
+    auto consumers = _consumers;
+    for (auto& c : consumers) {
+        sys::error_code ec;
+        bool to_file = false;
+
+        // Once some data is in the spill file,
+        // the following data goes there too to keep it in order.
+        while (size > 0 && !c->closed) {
+            bool full = c->buffered > 0 && c->buffered + size > _max_buffered;
+            if (!full && c->spill_pending == 0) break;
+            if (_spill_dir) {
+                to_file = spill(*c, *data, cancel, yield[ec]);
+                if (ec || to_file) break;
+            }
+            c->cv.wait(cancel, yield[ec]);
+            if (cancel) ec = asio::error::operation_aborted;
+            if (ec) break;
+        }
+
+        if (cancel) return or_throw(yield, asio::error::operation_aborted);
+        if (c->closed) continue;
+
+        if (ec) {
+            // The consumer does not get the rest of the response.
+            c->items.push_back({boost::none, ec});
+            c->cv.notify();
+            _consumers.remove(c);
+            continue;
+        }
+
+        if (to_file) {
+            ++c->spill_pending;
+            // Only keep the kind of part in memory.
+            if (part.is_body())
+                c->items.push_back({Part(Body(util::SharedBytes())), {}, size});
+            else
+                c->items.push_back({ Part(ChunkBody(util::SharedBytes(), part.as_chunk_body()->remain))
+                                   , {}, size});
+        } else {
+            c->buffered += size;
+            c->items.push_back({part});
+        }
+        c->cv.notify();
+    }
+}
+
+inline
+void
+Tee::finish(const sys::error_code& ec)
+{
+    if (_finished) return;
+    _finished = true;
+
+    for (auto& c : _consumers) {
+        if (c->closed) continue;
+        c->items.push_back({boost::none, ec});
+        c->cv.notify();
+    }
+    _consumers.clear();
+}
+
+inline
+bool
+Tee::has_readers() const
+{
+    for (auto& c : _consumers)
+        if (!c->closed) return true;
+    return false;
+}
+
+inline
+boost::optional<Part>
+Tee::Reader::async_read_part(Cancel cancel, asio::yield_context yield)
+{
+    auto c = _c;
+    sys::error_code ec;
+
+    while (c->items.empty() && !c->closed) {
+        c->cv.wait(cancel, yield[ec]);
+        if (cancel) ec = asio::error::operation_aborted;
+        if (ec) return or_throw<boost::optional<Part>>(yield, ec);
+    }
+    if (c->closed) return or_throw<boost::optional<Part>>(yield, asio::error::bad_descriptor);
+
+    auto item = std::move(c->items.front());
+    c->items.pop_front();
+
+    if (!item.part) {
+        _done = true;
+        return or_throw<boost::optional<Part>>(yield, item.ec);
+    }
+
+    if (!item.spilled) {
+        if (auto data = data_of(*item.part)) c->buffered -= data->size();
+        c->cv.notify();
+        return item.part;
+    }
+
+    auto buf = c->alloc.prepare(item.spilled);
+    util::file_io::read(c->spill_in, asio::buffer(buf.data(), item.spilled), cancel, yield[ec]);
+    if (cancel) ec = asio::error::operation_aborted;
+    if (ec) return or_throw<boost::optional<Part>>(yield, ec);
+    auto data = c->alloc.commit(item.spilled);
+
+    if (auto b = item.part->as_body()) *b = Body(std::move(data));
+    if (auto cb = item.part->as_chunk_body()) *cb = ChunkBody(std::move(data), cb->remain);
+
+    // Reuse the space of the spill file once it has all been read.
+    if (--c->spill_pending == 0 && !c->spill_writing) {
+        util::file_io::truncate(c->spill->lowest_layer(), 0, ec);
+        if (!ec) util::file_io::fseek(c->spill->lowest_layer(), 0, ec);
+        if (!ec) util::file_io::fseek(c->spill_in, 0, ec);
+        if (ec) return or_throw<boost::optional<Part>>(yield, ec);
+    }
+
+    return item.part;
+}
+
+}} // namespaces
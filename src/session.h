@@ -3,6 +3,8 @@
 #include "generic_stream.h"
 #include "response_reader.h"
 
+#include <functional>
+
 namespace ouinet {
 
 class Session {
@@ -44,6 +46,18 @@ public:
         return _head.keep_alive();
     }
 
+    // When the whole response has been flushed and it allows keep-alive,
+    // pass the underlying stream to `h` (e.g. to keep it in a connection pool)
+    // instead of leaving it in the session.
+    // Only sessions created from a stream support this.
+    void on_reusable_stream(std::function<void(GenericStream)> h) {
+        _on_reusable_stream = std::move(h);
+    }
+
+private:
+    // `keep_alive` is that of the head, which may have been moved out.
+    void release_reusable_stream(bool keep_alive);
+
 private:
     Session(http_response::Head&& head, reader_uptr&& reader)
         : _head(std::move(head))
@@ -53,6 +67,7 @@ private:
 private:
     http_response::Head _head;
     reader_uptr _reader;
+    std::function<void(GenericStream)> _on_reusable_stream;
 };
 
 inline
@@ -101,6 +116,22 @@ Session Session::create_from_reader( reader_uptr&& reader
     return Session{std::move(*head), std::move(reader)};
 }
 
+inline
+void
+Session::release_reusable_stream(bool keep_alive)
+{
+    auto h = std::move(_on_reusable_stream);
+    _on_reusable_stream = nullptr;
+
+    if (!h || !keep_alive || !_reader->is_done() || !_reader->is_open())
+        return;
+
+    auto reader = dynamic_cast<http_response::Reader*>(_reader.get());
+    if (!reader) return;
+
+    h(reader->release_stream());
+}
+
 template<class SinkStream>
 inline
 void
@@ -109,6 +140,7 @@ Session::flush_response(SinkStream& sink,
                         asio::yield_context yield)
 {
     sys::error_code ec;
+    bool keep_alive = this->keep_alive();
 
     _head.async_write(sink, cancel, yield[ec]);
     return_or_throw_on_error(yield, cancel, ec);
@@ -121,6 +153,8 @@ Session::flush_response(SinkStream& sink,
         opt_part->async_write(sink, cancel, yield[ec]);
         return_or_throw_on_error(yield, cancel, ec);
     }
+
+    release_reusable_stream(keep_alive);
 }
 
 template<class Handler>
@@ -131,6 +165,7 @@ Session::flush_response(Cancel& cancel,
                         Handler&& h)
 {
     sys::error_code ec;
+    bool keep_alive = this->keep_alive();  // the head is moved out below
 
     h(http_response::Part{std::move(_head)}, cancel, yield[ec]);
     return_or_throw_on_error(yield, cancel, ec);
@@ -143,6 +178,8 @@ Session::flush_response(Cancel& cancel,
         h(std::move(*opt_part), cancel, yield[ec]);
         return_or_throw_on_error(yield, cancel, ec);
     }
+
+    release_reusable_stream(keep_alive);
 }
 
 } // namespaces
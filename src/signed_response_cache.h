@@ -0,0 +1,487 @@
+#pragma once
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/optional.hpp>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "http_util.h"
+#include "namespaces.h"
+#include "parse/number.h"
+#include "response_part.h"
+#include "response_tee.h"
+#include "session.h"
+#include "split_string.h"
+#include "util.h"
+#include "util/handler_tracker.h"
+#include "util/wait_condition.h"
+
+namespace ouinet {
+
+/*
+ * Cache of responses recently signed by the injector,
+ * so that many requests for the same URL arriving within a short time
+ * (e.g. during a traffic spike) do not make it fetch and sign
+ * the same response again and again.
+ *
+ * Requests arriving while the response for their key is being injected
+ * follow that injection, and they get its parts as they are read.
+ * At most `max_buffered` bytes are kept in memory for each of them
+ * (see `http_response::Tee`), so that slow followers
+ * make the injection wait or have their data spilled to `spill_dir`.
+ * A complete response is kept while it is fresh according to the origin,
+ * but never longer than `max_age`.
+ * Responses bigger than `max_entry_bytes` are not kept,
+ * and at most `max_bytes` of responses are kept
+ * (the least recently used ones are dropped first).
+ *
+ * Usage:
+ *
+ *     auto key = SignedResponseCache::key(rq);
+ *     if (key) {
+ *         if (auto rr = cache.find(*key)) { ...read parts from `rr`... }
+ *     }
+ *     auto inj = key ? cache.start(*key) : nullptr;
+ *     // ...
+ *     inj->flush(sess, con, cancel, yield);  // `sess` reads from the `SigningReader`
+ */
+class SignedResponseCache {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Part = http_response::Part;
+    using reader_uptr = std::unique_ptr<http_response::AbstractReader>;
+
+    struct Counters {
+        std::size_t hits = 0;       // requests served from kept responses
+        std::size_t coalesced = 0;  // requests following an injection in progress
+        std::size_t misses = 0;     // injections started
+        std::size_t stored = 0;     // responses kept
+        std::size_t evicted = 0;    // kept responses dropped before expiring
+    };
+
+    class Injection;
+
+public:
+    SignedResponseCache( const asio::executor& ex
+                       , std::size_t max_bytes = 64 * 1024 * 1024
+                       , std::size_t max_entry_bytes = 4 * 1024 * 1024
+                       , Clock::duration max_age = std::chrono::minutes(5))
+        : _state(std::make_shared<State>(ex, max_bytes, max_entry_bytes, max_age))
+    {}
+
+    // Limit what is kept in memory for each follower of an injection.
+    void max_buffered(std::size_t max_buffered, boost::optional<fs::path> spill_dir)
+    {
+        _state->max_buffered = max_buffered;
+        _state->spill_dir = std::move(spill_dir);
+    }
+
+    SignedResponseCache(const SignedResponseCache&) = delete;
+    SignedResponseCache& operator=(const SignedResponseCache&) = delete;
+
+    // Return the key for sharing the response to the injector request `rq`,
+    // or none if it should not be shared.
+    static boost::optional<std::string> key(const http::request_header<>& rq);
+
+    // Return a reader for a fresh response kept for `key`,
+    // or for the injection of its response in progress,
+    // or null if neither is available.
+    reader_uptr find(const std::string& key);
+
+    // Start the injection of the response for `key`,
+    // so that requests for it follow this one.
+    // The injection ends (with an error if it was not finished)
+    // when the returned object is destroyed.
+    std::shared_ptr<Injection> start(const std::string& key);
+
+    const Counters& counters() const { return _state->counters; }
+
+    // Size of all kept responses.
+    std::size_t size() const { return _state->bytes; }
+
+private:
+    class Reader;
+
+    struct Entry {
+        std::vector<Part> parts;
+        std::size_t bytes = 0;
+        Clock::time_point expires;
+    };
+
+    using Lru = std::list<std::pair<std::string, Entry>>;
+
+    // Shared with injections, which may outlive the cache.
+    struct State {
+        asio::executor ex;
+        std::size_t max_bytes;
+        std::size_t max_entry_bytes;
+        Clock::duration max_age;
+        std::size_t max_buffered = 1024 * 1024;
+        boost::optional<fs::path> spill_dir;
+
+        Lru lru;  // most recently used first
+        std::map<std::string, Lru::iterator> entries;
+        std::size_t bytes = 0;
+        std::map<std::string, Injection*> injections;
+        Counters counters;
+
+        State( const asio::executor& ex, std::size_t max_bytes
+             , std::size_t max_entry_bytes, Clock::duration max_age)
+            : ex(ex), max_bytes(max_bytes)
+            , max_entry_bytes(std::min(max_entry_bytes, max_bytes))
+            , max_age(max_age)
+        {}
+
+        void erase(std::map<std::string, Lru::iterator>::iterator);
+        void store(const std::string& key, Entry);
+    };
+
+    static
+    std::size_t part_size(const Part&);
+
+    static
+    boost::optional<Clock::duration> freshness(const http::response_header<>&);
+
+private:
+    std::shared_ptr<State> _state;
+};
+
+// Parts coming from a kept response,
+// or those pushed by an injection so far followed by the rest of them.
+class SignedResponseCache::Reader : public http_response::AbstractReader {
+public:
+    Reader(const std::vector<Part>& parts, reader_uptr rest = nullptr)
+        : _parts(parts.begin(), parts.end()), _rest(std::move(rest))
+    {}
+
+    boost::optional<Part> async_read_part(Cancel c, asio::yield_context y) override
+    {
+        if (_closed) return or_throw<boost::optional<Part>>(y, asio::error::bad_descriptor);
+        if (!_parts.empty()) {
+            auto part = std::move(_parts.front());
+            _parts.pop_front();
+            return part;
+        }
+        if (_rest) return _rest->async_read_part(std::move(c), y);
+        _done = true;
+        return boost::none;
+    }
+
+    bool is_done() const override { return _rest ? _rest->is_done() : _done; }
+    bool is_open() const override { return !_closed; }
+
+    void close() override
+    {
+        _closed = true;
+        _parts.clear();
+        if (_rest) _rest->close();
+    }
+
+private:
+    std::deque<Part> _parts;
+    reader_uptr _rest;
+    bool _done = false;
+    bool _closed = false;
+};
+
+class SignedResponseCache::Injection
+    : public std::enable_shared_from_this<Injection> {
+public:
+    Injection(std::shared_ptr<State> st, std::string key)
+        : _state(std::move(st)), _key(std::move(key))
+        , _tee(_state->ex, _state->max_buffered, _state->spill_dir)
+    {}
+
+    Injection(const Injection&) = delete;
+    Injection& operator=(const Injection&) = delete;
+
+    ~Injection() { finish(asio::error::operation_aborted); }
+
+    // Send the response read from `sess` to `con` and to followers.
+    // If sending to `con` fails, the response is still read
+    // while followers need it or for keeping it.
+    void flush(Session& sess, GenericStream& con, Cancel&, asio::yield_context);
+
+    // Send the part to followers and keep it if the response may be kept,
+    // waiting for followers which have no room for it.
+    void async_push(Part, Cancel&, asio::yield_context);
+
+    // Tell followers that there are no more parts (or about an error),
+    // and keep the response if it is complete and it may be kept.
+    void finish(const sys::error_code&);
+
+    // Whether the rest of the response is needed by readers or for keeping it.
+    bool is_needed() const { return _tee.has_readers() || _keep; }
+
+private:
+    friend class SignedResponseCache;
+
+    // New followers need all parts pushed so far.
+    bool can_follow() const { return _keep || !_pushed; }
+
+    void drop() { _keep = false; _entry = Entry(); }
+
+    std::shared_ptr<State> _state;
+    std::string _key;
+    http_response::Tee _tee;  // to followers
+    bool _finished = false;
+    bool _pushed = false;
+    bool _keep = true;  // until the response is known not to be kept
+    Entry _entry;
+};
+
+inline
+boost::optional<std::string>
+SignedResponseCache::key(const http::request_header<>& rq)
+{
+    if (rq.method() != http::verb::get) return boost::none;
+
+    // The client wants a response straight from the origin.
+    for (auto v : SplitString(rq[http::field::cache_control], ',')) {
+        beast::string_view k, val;
+        std::tie(k, val) = split_string_pair(v, '=');
+        if (boost::iequals(k, "no-cache") || boost::iequals(k, "no-store"))
+            return boost::none;
+        if (boost::iequals(k, "max-age") && val == "0")
+            return boost::none;
+    }
+    if (boost::iequals(rq[http::field::pragma], "no-cache")) return boost::none;
+
+    // Other request headers are dropped or have fixed values
+    // in requests sent to origins (see `util::to_cache_request`).
+    return util::canonical_url(rq.target())
+        + '\n' + rq[http::field::origin].to_string()
+        + '\n' + rq[http::field::from].to_string();
+}
+
+inline
+std::size_t
+SignedResponseCache::part_size(const Part& part)
+{
+    auto fields_size = [] (const http::fields& fs) {
+        std::size_t s = 0;
+        for (const auto& f : fs) s += f.name_string().size() + f.value().size();
+        return s;
+    };
+
+    if (auto h = part.as_head()) return fields_size(*h);
+    if (auto t = part.as_trailer()) return fields_size(*t);
+    if (auto ch = part.as_chunk_hdr()) return ch->exts.size();
+    if (auto cb = part.as_chunk_body()) return cb->size();
+    if (auto b = part.as_body()) return b->size();
+    return 0;
+}
+
+// How long a response may be kept according to its head,
+// if it may be kept at all.
+inline
+boost::optional<SignedResponseCache::Clock::duration>
+SignedResponseCache::freshness(const http::response_header<>& rsh)
+{
+    switch (rsh.result()) {
+        case http::status::ok:
+        case http::status::moved_permanently:
+        case http::status::found:
+        case http::status::temporary_redirect:
+            break;
+        default:
+            return boost::none;
+    }
+
+    long max_age = -1, s_maxage = -1;  // negative if missing
+    for (auto v : SplitString(rsh[http::field::cache_control], ',')) {
+        beast::string_view k, val;
+        std::tie(k, val) = split_string_pair(v, '=');
+        // Requests for the response may be revalidated or private,
+        // do not send it to others.
+        if ( boost::iequals(k, "no-store") || boost::iequals(k, "no-cache")
+           || boost::iequals(k, "private"))
+            return boost::none;
+        auto secs = parse::number<unsigned>(val);
+        if (!secs) continue;
+        if (boost::iequals(k, "max-age")) max_age = *secs;
+        if (boost::iequals(k, "s-maxage")) s_maxage = *secs;
+    }
+    if (s_maxage >= 0) max_age = s_maxage;  // since this cache is shared
+
+    long lifetime;
+    if (max_age >= 0) {
+        lifetime = max_age;
+    } else {
+        auto expires = util::parse_date(rsh[http::field::expires]);
+        auto date = util::parse_date(rsh[http::field::date]);
+        if (expires.is_not_a_date_time() || date.is_not_a_date_time())
+            return boost::none;
+        lifetime = (expires - date).total_seconds();
+    }
+
+    auto age_s = rsh[http::field::age];
+    auto age = parse::number<unsigned>(age_s);
+    if (age) lifetime -= *age;
+
+    if (lifetime <= 0) return boost::none;
+    return Clock::duration(std::chrono::seconds(lifetime));
+}
+
+inline
+void
+SignedResponseCache::State::erase(std::map<std::string, Lru::iterator>::iterator ei)
+{
+    bytes -= ei->second->second.bytes;
+    lru.erase(ei->second);
+    entries.erase(ei);
+}
+
+inline
+void
+SignedResponseCache::State::store(const std::string& key, Entry entry)
+{
+    auto ei = entries.find(key);
+    if (ei != entries.end()) erase(ei);
+
+    bytes += entry.bytes;
+    lru.emplace_front(key, std::move(entry));
+    entries[key] = lru.begin();
+    ++counters.stored;
+
+    while (bytes > max_bytes) {
+        erase(entries.find(lru.back().first));
+        ++counters.evicted;
+    }
+}
+
+inline
+SignedResponseCache::reader_uptr
+SignedResponseCache::find(const std::string& key)
+{
+    auto st = _state;
+
+    auto ei = st->entries.find(key);
+    if (ei != st->entries.end()) {
+        auto li = ei->second;
+        if (Clock::now() < li->second.expires) {
+            ++st->counters.hits;
+            st->lru.splice(st->lru.begin(), st->lru, li);
+            return std::make_unique<Reader>(li->second.parts);
+        }
+        st->erase(ei);
+    }
+
+    auto ii = st->injections.find(key);
+    if (ii == st->injections.end() || !ii->second->can_follow())
+        return nullptr;
+
+    ++st->counters.coalesced;
+    auto inj = ii->second;
+    return std::make_unique<Reader>(inj->_entry.parts, inj->_tee.add_reader());
+}
+
+inline
+std::shared_ptr<SignedResponseCache::Injection>
+SignedResponseCache::start(const std::string& key)
+{
+    ++_state->counters.misses;
+    auto inj = std::make_shared<Injection>(_state, key);
+    // A previous injection which cannot be followed any more
+    // is still kept if it completes.
+    _state->injections[key] = inj.get();
+    return inj;
+}
+
+inline
+void
+SignedResponseCache::Injection::flush( Session& sess
+                                     , GenericStream& con
+                                     , Cancel& cancel
+                                     , asio::yield_context yield)
+{
+    auto rag = _tee.add_reader();  // to agent
+    bool agent_done = false;
+    sys::error_code agent_ec;
+
+    WaitCondition wc(_state->ex);
+
+    TRACK_SPAWN(_state->ex, ([
+        &,
+        lock = wc.lock()
+    ] (asio::yield_context y) {
+        // The agent no longer gets parts once its session is gone.
+        Session sag = Session::create_from_reader(std::move(rag), cancel, y[agent_ec]);
+        if (!agent_ec) sag.flush_response(con, cancel, y[agent_ec]);
+        agent_done = true;
+    }));
+
+    sys::error_code ec;
+    sess.flush_response(cancel, yield[ec],
+        [&] ( Part&& part
+            , Cancel& cancel
+            , asio::yield_context y)
+        {
+            sys::error_code e;
+            async_push(std::move(part), cancel, y[e]);
+            if (e) return or_throw(y, e);
+            // Nobody else needs the rest of the response.
+            if (agent_done && !is_needed())
+                or_throw(y, agent_ec ? agent_ec : sys::error_code(asio::error::operation_aborted));
+        });
+
+    finish(ec);
+
+    wc.wait(yield);
+
+    if (!ec) ec = agent_ec;
+    return or_throw(yield, ec);
+}
+
+inline
+void
+SignedResponseCache::Injection::async_push( Part part
+                                          , Cancel& cancel
+                                          , asio::yield_context yield)
+{
+    if (_finished) return;
+    _pushed = true;
+
+    if (_keep) {
+        if (auto h = part.as_head()) {
+            auto fresh = freshness(*h);
+            if (fresh)
+                _entry.expires = Clock::now() + std::min(*fresh, _state->max_age);
+            else
+                drop();
+        }
+    }
+    if (_keep) {
+        _entry.bytes += part_size(part);
+        if (_entry.bytes > _state->max_entry_bytes) drop();
+        else _entry.parts.push_back(part);
+    }
+
+    _tee.async_push(std::move(part), cancel, yield);
+}
+
+inline
+void
+SignedResponseCache::Injection::finish(const sys::error_code& ec)
+{
+    if (_finished) return;
+    _finished = true;
+
+    _tee.finish(ec);
+
+    auto ii = _state->injections.find(_key);
+    if (ii != _state->injections.end() && ii->second == this)
+        _state->injections.erase(ii);
+
+    if (!ec && _keep && _pushed && _entry.bytes <= _state->max_bytes)
+        _state->store(_key, std::move(_entry));
+    drop();
+}
+
+} // namespace
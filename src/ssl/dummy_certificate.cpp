@@ -2,6 +2,8 @@
 #include "ca_certificate.h"
 #include "util.h"
 
+#include <boost/asio/ip/address.hpp>
+
 using namespace std;
 using namespace ouinet;
 
@@ -20,8 +22,12 @@ DummyCertificate::DummyCertificate( CACertificate& ca_cert
     X509_gmtime_adj(X509_get_notAfter(_x), 3 * ssl::util::ONE_YEAR);
 
     X509_set_pubkey(_x, ca_cert.get_private_key());
-    
-    string wc_cn("*." + cn);
+
+    sys::error_code ec;
+    asio::ip::make_address(cn, ec);
+    bool is_ip = !ec;
+
+    string wc_cn(is_ip ? cn : "*." + cn);
     X509_NAME* name = X509_get_subject_name(_x); 
 
     if (!X509_NAME_add_entry_by_txt( name, "CN"
@@ -33,7 +39,7 @@ DummyCertificate::DummyCertificate( CACertificate& ca_cert
     if (!X509_set_issuer_name(_x, ca_cert.get_subject_name()))
         throw runtime_error("Failed in X509_set_issuer_name");
 
-    string alt_name("DNS.1:*." + cn + ",DNS.2:" + cn);
+    string alt_name(is_ip ? "IP:" + cn : "DNS.1:*." + cn + ",DNS.2:" + cn);
     // Add various standard extensions
     ssl::util::x509_add_ext(_x, NID_subject_alt_name, alt_name.c_str());
 
@@ -14,6 +14,7 @@ class DummyCertificate {
 public:
     // If `cn` is ``example.com``, this generates a certificate for
     // ``*.example.com`` with ``example.com`` as an alternative name.
+    // If `cn` is an IP address, the certificate is just for that address.
     DummyCertificate(CACertificate&, const std::string& cn);
 
     DummyCertificate(const DummyCertificate&) = delete;
@@ -4,9 +4,12 @@
 #include <openssl/pem.h>
 #include <openssl/ssl.h>
 
+#include <boost/asio/read.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/asio/ssl/stream.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+#include <boost/utility/string_view.hpp>
 
 #include "../generic_stream.h"
 #include "../or_throw.h"
@@ -119,6 +122,16 @@ get_server_context( const std::string& cert_chain
             return "";
         });
 
+    // Allow clients to resume sessions (via both session IDs and tickets)
+    // as long as this context is kept,
+    // so that they can skip the key exchange when reconnecting.
+    static const unsigned char session_id_context[] = "ouinet";
+    auto ctx = ssl_context.native_handle();
+    ::SSL_CTX_set_session_id_context( ctx, session_id_context
+                                    , sizeof(session_id_context) - 1);
+    ::SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    ::SSL_CTX_set_timeout(ctx, ONE_HOUR);
+
     return ssl_context;
 }
 
@@ -149,4 +162,104 @@ void load_tls_ca_certificates( asio::ssl::context& ctx
     ctx.add_certificate_authority(asio::buffer(ss.str()));
 }
 
+// Read the first TLS record sent by a client over `con`,
+// which should contain its Client Hello message,
+// and return its raw bytes.
+//
+// Nothing beyond that record is read.
+template<class Stream>
+static inline
+std::string
+read_client_hello(Stream& con, boost::asio::yield_context yield)
+{
+    static const std::size_t record_header_size = 5;
+    static const std::size_t max_record_size = record_header_size + 16384;
+
+    std::string hello;
+    auto record_size = record_header_size;
+
+    while (hello.size() < record_size) {
+        boost::system::error_code ec;
+        auto offset = hello.size();
+        hello.resize(record_size);
+        auto n = boost::asio::async_read( con
+                                        , boost::asio::buffer(&hello[offset], record_size - offset)
+                                        , yield[ec]);
+        hello.resize(offset + n);
+        if (ec) return or_throw(yield, ec, std::move(hello));
+
+        if (record_size == record_header_size) {
+            if (uint8_t(hello[0]) != 0x16)  // not a handshake record
+                return or_throw(yield, boost::asio::error::invalid_argument, std::move(hello));
+            record_size += (uint8_t(hello[3]) << 8) + uint8_t(hello[4]);
+            if (record_size > max_record_size)
+                return or_throw(yield, boost::asio::error::message_size, std::move(hello));
+        }
+    }
+
+    return hello;
+}
+
+// Return the host name in the Server Name Indication extension
+// of the given Client Hello record, if any.
+static inline
+boost::optional<std::string>
+client_hello_server_name(boost::string_view hello)
+{
+    // Consume `n` bytes from `hello` as a big-endian number,
+    // or return none if not enough bytes.
+    auto take_num = [&hello] (std::size_t n) -> boost::optional<std::size_t> {
+        if (hello.size() < n) return boost::none;
+        std::size_t v = 0;
+        for (std::size_t i = 0; i < n; ++i) v = (v << 8) + uint8_t(hello[i]);
+        hello.remove_prefix(n);
+        return v;
+    };
+    // Consume a vector of bytes with its length in `n` bytes.
+    auto take_vec = [&] (std::size_t n) -> boost::optional<boost::string_view> {
+        auto len = take_num(n);
+        if (!len || hello.size() < *len) return boost::none;
+        auto v = hello.substr(0, *len);
+        hello.remove_prefix(*len);
+        return v;
+    };
+
+    // Record header: type, version, length.
+    if (take_num(1) != std::size_t(0x16) || !take_num(2) || !take_num(2))
+        return boost::none;
+    // Handshake header: type (Client Hello), length.
+    if (take_num(1) != std::size_t(0x01) || !take_num(3))
+        return boost::none;
+    // Version, random, session id, cipher suites, compression methods.
+    if (!take_num(2) || hello.size() < 32) return boost::none;
+    hello.remove_prefix(32);
+    if (!take_vec(1) || !take_vec(2) || !take_vec(1)) return boost::none;
+
+    auto exts = take_vec(2);
+    if (!exts) return boost::none;
+    hello = *exts;
+
+    while (!hello.empty()) {
+        auto type = take_num(2);
+        auto ext = take_vec(2);
+        if (!type || !ext) return boost::none;
+        if (*type != 0x0000) continue;  // not server name
+
+        hello = *ext;
+        auto names = take_vec(2);
+        if (!names) return boost::none;
+        hello = *names;
+        while (!hello.empty()) {
+            auto name_type = take_num(1);
+            auto name = take_vec(2);
+            if (!name_type || !name) return boost::none;
+            if (*name_type == 0x00 && !name->empty())  // host name
+                return name->to_string();
+        }
+        return boost::none;
+    }
+
+    return boost::none;
+}
+
 }}} // namespaces
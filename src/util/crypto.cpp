@@ -1,6 +1,7 @@
 #include "crypto.h"
 #include "bytes.h"
 
+#include <atomic>
 #include <cassert>
 #include <exception>
 #include <vector>
@@ -9,6 +10,9 @@ extern "C" {
 #include "gcrypt.h"
 }
 
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
 #include <iostream>
 
 namespace ouinet {
@@ -21,77 +25,54 @@ void crypto_init()
     }
 }
 
-Ed25519PublicKey::Ed25519PublicKey(Ed25519PublicKey::key_array_t key):
-    _public_key(nullptr)
-{
-    if (::gcry_sexp_build(&_public_key, NULL, "(public-key (ecc (curve Ed25519) (flags eddsa) (q %b)))", key.size(), key.data())) {
-        throw std::exception();
-    }
-}
+static std::atomic<CryptoBackend> current_backend{CryptoBackend::openssl};
 
-Ed25519PublicKey::~Ed25519PublicKey()
+CryptoBackend crypto_backend()
 {
-    if (_public_key) {
-        ::gcry_sexp_release(_public_key);
-        _public_key = nullptr;
-    }
-}
-
-Ed25519PublicKey::Ed25519PublicKey(const Ed25519PublicKey& other):
-    _public_key(nullptr)
-{
-    (*this) = other;
+    return current_backend;
 }
 
-Ed25519PublicKey::Ed25519PublicKey(Ed25519PublicKey&& other):
-    _public_key(nullptr)
+void set_crypto_backend(CryptoBackend b)
 {
-    (*this) = other;
+    current_backend = b;
 }
 
-boost::optional<Ed25519PublicKey>
-Ed25519PublicKey::from_hex(boost::string_view hex)
+const char* crypto_backend_name(CryptoBackend b)
 {
-    if (hex.size() != sig_size) {
-        return boost::none;
+    switch (b) {
+        case CryptoBackend::openssl: return "openssl";
+        case CryptoBackend::gcrypt:  return "gcrypt";
     }
+    return "unknown";
+}
 
-    auto os = util::bytes::from_hex(hex);
-
-    if (!os) return boost::none;
+namespace crypto_detail {
 
-    return Ed25519PublicKey(util::bytes::to_array<uint8_t, key_size>(*os));
-}
+/*
+ * Key state is built once when the key is created,
+ * so that signing and verifying do not need to parse or derive anything.
+ * It is never modified afterwards, so it can be used by several threads at once.
+ */
 
-Ed25519PublicKey& Ed25519PublicKey::operator=(const Ed25519PublicKey& other)
-{
-    if (this != &other) {
-        if (_public_key) {
-            ::gcry_sexp_release(_public_key);
-            _public_key = nullptr;
-        }
+struct PublicKeyState {
+    virtual ~PublicKeyState() = default;
+    virtual bool verify( boost::string_view data
+                       , const Ed25519PublicKey::sig_array_t&) const = 0;
+};
 
-        if (other._public_key) {
-            if (::gcry_sexp_build(&_public_key, NULL, "%S", other._public_key)) {
-                _public_key = nullptr;
-                throw std::exception();
-            }
-        }
-    }
-    return *this;
-}
+struct PrivateKeyState {
+    virtual ~PrivateKeyState() = default;
+    virtual Ed25519PublicKey::key_array_t public_key() const = 0;
+    virtual Ed25519PrivateKey::sig_array_t sign(boost::string_view data) const = 0;
+};
 
-Ed25519PublicKey& Ed25519PublicKey::operator=(Ed25519PublicKey&& other)
-{
-    if (this != &other) {
-        std::swap(_public_key, other._public_key);
-    }
-    return *this;
-}
+// begin gcrypt
 
-Ed25519PublicKey::key_array_t Ed25519PublicKey::serialize() const
+static
+Ed25519PublicKey::key_array_t
+gcrypt_get_q(::gcry_sexp_t sexp)
 {
-    ::gcry_sexp_t q = ::gcry_sexp_find_token(_public_key, "q", 0);
+    ::gcry_sexp_t q = ::gcry_sexp_find_token(sexp, "q", 0);
     if (!q) {
         throw std::exception();
     }
@@ -101,160 +82,154 @@ Ed25519PublicKey::key_array_t Ed25519PublicKey::serialize() const
         ::gcry_sexp_release(q);
         throw std::exception();
     }
-    key_array_t output;
+    Ed25519PublicKey::key_array_t output;
     assert(q_size == output.size());
     memcpy(output.data(), q_buffer, output.size());
     ::gcry_sexp_release(q);
     return output;
 }
 
-bool Ed25519PublicKey::verify(const std::string& data, const Ed25519PublicKey::sig_array_t& signature) const
-{
-    ::gcry_sexp_t signature_sexp;
-    if (::gcry_sexp_build(&signature_sexp, NULL, "(sig-val (eddsa (r %b)(s %b)))", key_size, signature.data(), key_size, signature.data() + key_size)) {
-        throw std::exception();
+struct GcryptPublicKey : public PublicKeyState {
+    ::gcry_sexp_t _public_key = nullptr;
+
+    GcryptPublicKey(const Ed25519PublicKey::key_array_t& key)
+    {
+        if (::gcry_sexp_build(&_public_key, NULL, "(public-key (ecc (curve Ed25519) (flags eddsa) (q %b)))", key.size(), key.data())) {
+            throw std::exception();
+        }
     }
 
-    ::gcry_sexp_t data_sexp;
-    if (::gcry_sexp_build(&data_sexp, NULL, "(data (flags eddsa) (hash-algo sha512) (value %b))", data.size(), data.data())) {
-        ::gcry_sexp_release(data_sexp);
-        throw std::exception();
+    ~GcryptPublicKey()
+    {
+        ::gcry_sexp_release(_public_key);
     }
 
-    ::gcry_error_t error = gcry_pk_verify(signature_sexp, data_sexp, _public_key);
+    bool verify( boost::string_view data
+               , const Ed25519PublicKey::sig_array_t& signature) const override
+    {
+        static const size_t half = Ed25519PublicKey::sig_size / 2;
 
-    ::gcry_sexp_release(data_sexp);
-    ::gcry_sexp_release(signature_sexp);
+        ::gcry_sexp_t signature_sexp;
+        if (::gcry_sexp_build(&signature_sexp, NULL, "(sig-val (eddsa (r %b)(s %b)))", half, signature.data(), half, signature.data() + half)) {
+            throw std::exception();
+        }
 
-    return error == 0;
-}
+        ::gcry_sexp_t data_sexp;
+        if (::gcry_sexp_build(&data_sexp, NULL, "(data (flags eddsa) (hash-algo sha512) (value %b))", data.size(), data.data())) {
+            ::gcry_sexp_release(signature_sexp);
+            throw std::exception();
+        }
 
+        ::gcry_error_t error = gcry_pk_verify(signature_sexp, data_sexp, _public_key);
 
+        ::gcry_sexp_release(data_sexp);
+        ::gcry_sexp_release(signature_sexp);
 
-Ed25519PrivateKey::Ed25519PrivateKey(Ed25519PrivateKey::key_array_t key):
-    _private_key(nullptr)
-{
-    if (::gcry_sexp_build(&_private_key, NULL, "(private-key (ecc (curve Ed25519) (flags eddsa) (d %b)))", key.size(), key.data())) {
-        throw std::exception();
+        return error == 0;
     }
-}
+};
 
-Ed25519PrivateKey::~Ed25519PrivateKey()
-{
-    if (_private_key) {
-        ::gcry_sexp_release(_private_key);
-        _private_key = nullptr;
-    }
-}
+struct GcryptPrivateKey : public PrivateKeyState {
+    ::gcry_sexp_t _private_key = nullptr;
 
-Ed25519PrivateKey::Ed25519PrivateKey(const Ed25519PrivateKey& other):
-    _private_key(nullptr)
-{
-    (*this) = other;
-}
+    GcryptPrivateKey(const Ed25519PrivateKey::key_array_t& key)
+    {
+        if (::gcry_sexp_build(&_private_key, NULL, "(private-key (ecc (curve Ed25519) (flags eddsa) (d %b)))", key.size(), key.data())) {
+            throw std::exception();
+        }
+    }
 
-Ed25519PrivateKey::Ed25519PrivateKey(Ed25519PrivateKey&& other):
-    _private_key(nullptr)
-{
-    (*this) = other;
-}
+    ~GcryptPrivateKey()
+    {
+        ::gcry_sexp_release(_private_key);
+    }
 
-Ed25519PrivateKey& Ed25519PrivateKey::operator=(const Ed25519PrivateKey& other)
-{
-    if (this != &other) {
-        if (_private_key) {
-            ::gcry_sexp_release(_private_key);
-            _private_key = nullptr;
+    Ed25519PublicKey::key_array_t public_key() const override
+    {
+        /*
+         * This logic is even less well documented than the rest of gcrypt.
+         */
+        ::gcry_ctx_t public_key_parameters;
+        if (::gcry_mpi_ec_new(&public_key_parameters, _private_key, NULL)) {
+            throw std::exception();
+        }
+        ::gcry_sexp_t public_key_sexp;
+        if (::gcry_pubkey_get_sexp(&public_key_sexp, GCRY_PK_GET_PUBKEY, public_key_parameters)) {
+            ::gcry_ctx_release(public_key_parameters);
+            throw std::exception();
         }
+        ::gcry_ctx_release(public_key_parameters);
 
-        if (other._private_key) {
-            if (::gcry_sexp_build(&_private_key, NULL, "%S", other._private_key)) {
-                _private_key = nullptr;
-                throw std::exception();
-            }
+        try {
+            auto q = gcrypt_get_q(public_key_sexp);
+            ::gcry_sexp_release(public_key_sexp);
+            return q;
+        } catch (...) {
+            ::gcry_sexp_release(public_key_sexp);
+            throw;
         }
     }
-    return *this;
-}
 
-Ed25519PrivateKey& Ed25519PrivateKey::operator=(Ed25519PrivateKey&& other)
-{
-    if (this != &other) {
-        std::swap(_private_key, other._private_key);
-    }
-    return *this;
-}
+    Ed25519PrivateKey::sig_array_t sign(boost::string_view data) const override
+    {
+        static const size_t half = Ed25519PrivateKey::sig_size / 2;
 
-Ed25519PrivateKey::key_array_t Ed25519PrivateKey::serialize() const
-{
-    ::gcry_sexp_t d = ::gcry_sexp_find_token(_private_key, "d", 0);
-    if (!d) {
-        throw std::exception();
-    }
-    size_t d_size;
-    const char* d_buffer = ::gcry_sexp_nth_data(d, 1, &d_size);
-    if (!d_buffer) {
-        ::gcry_sexp_release(d);
-        throw std::exception();
-    }
-    key_array_t output;
-    assert(d_size == output.size());
-    memcpy(output.data(), d_buffer, output.size());
-    ::gcry_sexp_release(d);
-    return output;
-}
-
-boost::optional<Ed25519PrivateKey>
-Ed25519PrivateKey::from_hex(boost::string_view hex)
-{
-    if (hex.size() != sig_size) {
-        return boost::none;
-    }
+        ::gcry_sexp_t data_sexp;
+        if (::gcry_sexp_build(&data_sexp, NULL, "(data (flags eddsa) (hash-algo sha512) (value %b))", data.size(), data.data())) {
+            throw std::exception();
+        }
 
-    auto os = util::bytes::from_hex(hex);
+        ::gcry_sexp_t signature_sexp;
+        if (::gcry_pk_sign(&signature_sexp, data_sexp, _private_key)) {
+            ::gcry_sexp_release(data_sexp);
+            throw std::exception();
+        }
+        ::gcry_sexp_release(data_sexp);
 
-    if (!os) return boost::none;
+        ::gcry_sexp_t r_sexp = ::gcry_sexp_find_token(signature_sexp, "r", 0);
+        if (!r_sexp) {
+            ::gcry_sexp_release(signature_sexp);
+            throw std::exception();
+        }
+        size_t r_size;
+        const char* r_buffer = ::gcry_sexp_nth_data(r_sexp, 1, &r_size);
+        if (!r_buffer) {
+            ::gcry_sexp_release(r_sexp);
+            ::gcry_sexp_release(signature_sexp);
+            throw std::exception();
+        }
 
-    return Ed25519PrivateKey(util::bytes::to_array<uint8_t, key_size>(*os));
-}
+        ::gcry_sexp_t s_sexp = ::gcry_sexp_find_token(signature_sexp, "s", 0);
+        if (!s_sexp) {
+            ::gcry_sexp_release(r_sexp);
+            ::gcry_sexp_release(signature_sexp);
+            throw std::exception();
+        }
+        size_t s_size;
+        const char* s_buffer = ::gcry_sexp_nth_data(s_sexp, 1, &s_size);
+        if (!s_buffer) {
+            ::gcry_sexp_release(s_sexp);
+            ::gcry_sexp_release(r_sexp);
+            ::gcry_sexp_release(signature_sexp);
+            throw std::exception();
+        }
 
-Ed25519PublicKey Ed25519PrivateKey::public_key() const
-{
-    /*
-     * This logic is even less well documented than the rest of gcrypt.
-     */
-    ::gcry_ctx_t public_key_parameters;
-    if (::gcry_mpi_ec_new(&public_key_parameters, _private_key, NULL)) {
-        throw std::exception();
-    }
-    ::gcry_sexp_t public_key_sexp;
-    if (::gcry_pubkey_get_sexp(&public_key_sexp, GCRY_PK_GET_PUBKEY, public_key_parameters)) {
-        ::gcry_ctx_release(public_key_parameters);
-        throw std::exception();
-    }
-    ::gcry_ctx_release(public_key_parameters);
+        ::gcry_sexp_release(signature_sexp);
+        Ed25519PrivateKey::sig_array_t output;
+        assert(r_size == half);
+        assert(s_size == half);
+        memcpy(output.data(), r_buffer, half);
+        memcpy(output.data() + half, s_buffer, half);
+        ::gcry_sexp_release(s_sexp);
+        ::gcry_sexp_release(r_sexp);
 
-    ::gcry_sexp_t q = ::gcry_sexp_find_token(public_key_sexp, "q", 0);
-    if (!q) {
-        ::gcry_sexp_release(public_key_sexp);
-        throw std::exception();
+        return output;
     }
-    ::gcry_sexp_release(public_key_sexp);
-    size_t q_size;
-    const char* q_buffer = ::gcry_sexp_nth_data(q, 1, &q_size);
-    if (!q_buffer) {
-        ::gcry_sexp_release(q);
-        throw std::exception();
-    }
-    Ed25519PublicKey::key_array_t public_key;
-    assert(q_size == public_key.size());
-    memcpy(public_key.data(), q_buffer, public_key.size());
-    ::gcry_sexp_release(q);
-
-    return Ed25519PublicKey(public_key);
-}
+};
 
-Ed25519PrivateKey Ed25519PrivateKey::generate()
+static
+Ed25519PrivateKey::key_array_t
+gcrypt_generate()
 {
     ::gcry_sexp_t generation_parameters;
     if (gcry_sexp_build(&generation_parameters, NULL, "(genkey (ecc (curve Ed25519) (flags eddsa)))")) {
@@ -280,66 +255,187 @@ Ed25519PrivateKey Ed25519PrivateKey::generate()
         ::gcry_sexp_release(d);
         throw std::exception();
     }
-    key_array_t private_key;
+    Ed25519PrivateKey::key_array_t private_key;
     assert(d_size == private_key.size());
     memcpy(private_key.data(), d_buffer, private_key.size());
     ::gcry_sexp_release(d);
 
-    return Ed25519PrivateKey(private_key);
+    return private_key;
 }
 
-Ed25519PrivateKey::sig_array_t Ed25519PrivateKey::sign(boost::string_view data) const
+// end gcrypt
+
+// begin openssl
+
+// Reused by every signature made or verified in this thread,
+// to avoid allocating a new one each time.
+static
+::EVP_MD_CTX*
+openssl_md_ctx()
 {
-    ::gcry_sexp_t data_sexp;
-    if (::gcry_sexp_build(&data_sexp, NULL, "(data (flags eddsa) (hash-algo sha512) (value %b))", data.size(), data.data())) {
-        throw std::exception();
+    static thread_local std::unique_ptr<::EVP_MD_CTX, decltype(&::EVP_MD_CTX_free)>
+        ctx(::EVP_MD_CTX_new(), &::EVP_MD_CTX_free);
+    if (!ctx) throw std::bad_alloc();
+    ::EVP_MD_CTX_reset(ctx.get());
+    return ctx.get();
+}
+
+struct OpensslKey {
+    ::EVP_PKEY* _pkey;
+
+    OpensslKey(::EVP_PKEY* pkey) : _pkey(pkey)
+    {
+        if (!_pkey) throw std::exception();
     }
 
-    ::gcry_sexp_t signature_sexp;
-    if (::gcry_pk_sign(&signature_sexp, data_sexp, _private_key)) {
-        ::gcry_sexp_release(data_sexp);
-        throw std::exception();
+    ~OpensslKey()
+    {
+        ::EVP_PKEY_free(_pkey);
+    }
+};
+
+struct OpensslPublicKey : public PublicKeyState, private OpensslKey {
+    OpensslPublicKey(const Ed25519PublicKey::key_array_t& key)
+        : OpensslKey(::EVP_PKEY_new_raw_public_key( EVP_PKEY_ED25519, nullptr
+                                                  , key.data(), key.size()))
+    {}
+
+    bool verify( boost::string_view data
+               , const Ed25519PublicKey::sig_array_t& signature) const override
+    {
+        auto ctx = openssl_md_ctx();
+        if (::EVP_DigestVerifyInit(ctx, nullptr, nullptr, nullptr, _pkey) != 1) {
+            throw std::exception();
+        }
+        return ::EVP_DigestVerify( ctx, signature.data(), signature.size()
+                                 , reinterpret_cast<const unsigned char*>(data.data())
+                                 , data.size()) == 1;
+    }
+};
+
+struct OpensslPrivateKey : public PrivateKeyState, private OpensslKey {
+    OpensslPrivateKey(const Ed25519PrivateKey::key_array_t& key)
+        : OpensslKey(::EVP_PKEY_new_raw_private_key( EVP_PKEY_ED25519, nullptr
+                                                   , key.data(), key.size()))
+    {}
+
+    Ed25519PublicKey::key_array_t public_key() const override
+    {
+        Ed25519PublicKey::key_array_t output;
+        size_t size = output.size();
+        if (::EVP_PKEY_get_raw_public_key(_pkey, output.data(), &size) != 1) {
+            throw std::exception();
+        }
+        assert(size == output.size());
+        return output;
     }
-    ::gcry_sexp_release(data_sexp);
 
-    ::gcry_sexp_t r_sexp = ::gcry_sexp_find_token(signature_sexp, "r", 0);
-    if (!r_sexp) {
-        ::gcry_sexp_release(signature_sexp);
-        throw std::exception();
+    Ed25519PrivateKey::sig_array_t sign(boost::string_view data) const override
+    {
+        auto ctx = openssl_md_ctx();
+        if (::EVP_DigestSignInit(ctx, nullptr, nullptr, nullptr, _pkey) != 1) {
+            throw std::exception();
+        }
+        Ed25519PrivateKey::sig_array_t output;
+        size_t size = output.size();
+        if (::EVP_DigestSign( ctx, output.data(), &size
+                            , reinterpret_cast<const unsigned char*>(data.data())
+                            , data.size()) != 1) {
+            throw std::exception();
+        }
+        assert(size == output.size());
+        return output;
     }
-    size_t r_size;
-    const char* r_buffer = ::gcry_sexp_nth_data(r_sexp, 1, &r_size);
-    if (!r_buffer) {
-        ::gcry_sexp_release(r_sexp);
-        ::gcry_sexp_release(signature_sexp);
+};
+
+static
+Ed25519PrivateKey::key_array_t
+openssl_generate()
+{
+    // Any random string of the right size is a valid Ed25519 private key.
+    Ed25519PrivateKey::key_array_t private_key;
+    if (::RAND_bytes(private_key.data(), private_key.size()) != 1) {
         throw std::exception();
     }
+    return private_key;
+}
 
-    ::gcry_sexp_t s_sexp = ::gcry_sexp_find_token(signature_sexp, "s", 0);
-    if (!r_sexp) {
-        ::gcry_sexp_release(r_sexp);
-        ::gcry_sexp_release(signature_sexp);
-        throw std::exception();
+// end openssl
+
+} // namespace crypto_detail
+
+using namespace crypto_detail;
+
+Ed25519PublicKey::Ed25519PublicKey(Ed25519PublicKey::key_array_t key):
+    _key(key)
+{
+    if (crypto_backend() == CryptoBackend::gcrypt)
+        _state = std::make_shared<GcryptPublicKey>(_key);
+    else
+        _state = std::make_shared<OpensslPublicKey>(_key);
+}
+
+boost::optional<Ed25519PublicKey>
+Ed25519PublicKey::from_hex(boost::string_view hex)
+{
+    if (hex.size() != sig_size) {
+        return boost::none;
     }
-    size_t s_size;
-    const char* s_buffer = ::gcry_sexp_nth_data(s_sexp, 1, &s_size);
-    if (!s_buffer) {
-        ::gcry_sexp_release(s_sexp);
-        ::gcry_sexp_release(r_sexp);
-        ::gcry_sexp_release(signature_sexp);
-        throw std::exception();
+
+    auto os = util::bytes::from_hex(hex);
+
+    if (!os) return boost::none;
+
+    return Ed25519PublicKey(util::bytes::to_array<uint8_t, key_size>(*os));
+}
+
+bool Ed25519PublicKey::verify(const std::string& data, const Ed25519PublicKey::sig_array_t& signature) const
+{
+    return _state->verify(data, signature);
+}
+
+
+
+static
+std::shared_ptr<const PrivateKeyState>
+private_key_state(const Ed25519PrivateKey::key_array_t& key)
+{
+    if (crypto_backend() == CryptoBackend::gcrypt)
+        return std::make_shared<GcryptPrivateKey>(key);
+    return std::make_shared<OpensslPrivateKey>(key);
+}
+
+Ed25519PrivateKey::Ed25519PrivateKey(Ed25519PrivateKey::key_array_t key):
+    _key(key),
+    _state(private_key_state(key)),
+    _public_key(_state->public_key())
+{
+}
+
+boost::optional<Ed25519PrivateKey>
+Ed25519PrivateKey::from_hex(boost::string_view hex)
+{
+    if (hex.size() != sig_size) {
+        return boost::none;
     }
 
-    ::gcry_sexp_release(signature_sexp);
-    sig_array_t output;
-    assert(r_size == key_size);
-    assert(s_size == key_size);
-    memcpy(output.data(), r_buffer, key_size);
-    memcpy(output.data() + key_size, s_buffer, key_size);
-    ::gcry_sexp_release(s_sexp);
-    ::gcry_sexp_release(r_sexp);
+    auto os = util::bytes::from_hex(hex);
+
+    if (!os) return boost::none;
 
-    return output;
+    return Ed25519PrivateKey(util::bytes::to_array<uint8_t, key_size>(*os));
+}
+
+Ed25519PrivateKey Ed25519PrivateKey::generate()
+{
+    if (crypto_backend() == CryptoBackend::gcrypt)
+        return Ed25519PrivateKey(gcrypt_generate());
+    return Ed25519PrivateKey(openssl_generate());
+}
+
+Ed25519PrivateKey::sig_array_t Ed25519PrivateKey::sign(boost::string_view data) const
+{
+    return _state->sign(data);
 }
 
 std::ostream& operator<<(std::ostream& os, const Ed25519PublicKey& k)
@@ -3,18 +3,32 @@
 #include <boost/optional.hpp>
 #include <boost/utility/string_view.hpp>
 #include <array>
-
-/*
- * Forward declarations for opaque libgcrypt data structures.
- */
-struct gcry_sexp;
-typedef gcry_sexp* gcry_sexp_t;
+#include <memory>
 
 namespace ouinet {
 namespace util {
 
 void crypto_init();
 
+/*
+ * Libraries used to implement signatures and hashes.
+ *
+ * `openssl` (libcrypto) is the default since it is much faster,
+ * `gcrypt` is kept for comparison.
+ * Keys and hashes use the backend which was in use when they were created,
+ * so it should only be changed before creating any.
+ */
+enum class CryptoBackend { openssl, gcrypt };
+
+CryptoBackend crypto_backend();
+void set_crypto_backend(CryptoBackend);
+const char* crypto_backend_name(CryptoBackend);
+
+namespace crypto_detail {
+struct PublicKeyState;
+struct PrivateKeyState;
+} // namespace crypto_detail
+
 class Ed25519PublicKey {
     public:
     static const size_t key_size = 32;
@@ -23,14 +37,13 @@ class Ed25519PublicKey {
     using sig_array_t = std::array<uint8_t, sig_size>;
 
     Ed25519PublicKey(key_array_t key = {});
-    ~Ed25519PublicKey();
 
-    Ed25519PublicKey(const Ed25519PublicKey& other);
-    Ed25519PublicKey(Ed25519PublicKey&& other);
-    Ed25519PublicKey& operator=(const Ed25519PublicKey& other);
-    Ed25519PublicKey& operator=(Ed25519PublicKey&& other);
+    // Copies share key state, so they are cheap
+    // (moving is just copying, so no key is left unusable).
+    Ed25519PublicKey(const Ed25519PublicKey&) = default;
+    Ed25519PublicKey& operator=(const Ed25519PublicKey&) = default;
 
-    key_array_t serialize() const;
+    key_array_t serialize() const { return _key; }
 
     bool verify(const std::string& data, const sig_array_t& signature) const;
 
@@ -38,7 +51,8 @@ class Ed25519PublicKey {
     boost::optional<Ed25519PublicKey> from_hex(boost::string_view);
 
     private:
-    ::gcry_sexp_t _public_key;
+    key_array_t _key;
+    std::shared_ptr<const crypto_detail::PublicKeyState> _state;
 };
 
 class Ed25519PrivateKey {
@@ -49,15 +63,13 @@ class Ed25519PrivateKey {
     using sig_array_t = Ed25519PublicKey::sig_array_t;
 
     Ed25519PrivateKey(key_array_t key = {});
-    ~Ed25519PrivateKey();
 
-    Ed25519PrivateKey(const Ed25519PrivateKey& other);
-    Ed25519PrivateKey(Ed25519PrivateKey&& other);
-    Ed25519PrivateKey& operator=(const Ed25519PrivateKey& other);
-    Ed25519PrivateKey& operator=(Ed25519PrivateKey&& other);
+    // As with public keys.
+    Ed25519PrivateKey(const Ed25519PrivateKey&) = default;
+    Ed25519PrivateKey& operator=(const Ed25519PrivateKey&) = default;
 
-    key_array_t serialize() const;
-    Ed25519PublicKey public_key() const;
+    key_array_t serialize() const { return _key; }
+    Ed25519PublicKey public_key() const { return _public_key; }
 
     static Ed25519PrivateKey generate();
 
@@ -72,7 +84,9 @@ class Ed25519PrivateKey {
     boost::optional<Ed25519PrivateKey> from_hex(boost::string_view);
 
     private:
-    ::gcry_sexp_t _private_key;
+    key_array_t _key;
+    std::shared_ptr<const crypto_detail::PrivateKeyState> _state;
+    Ed25519PublicKey _public_key;  // derived once
 };
 
 std::ostream& operator<<(std::ostream&, const Ed25519PublicKey&);
@@ -1,7 +1,27 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include <boost/asio/read.hpp>
 #include <boost/asio/write.hpp>
 
 #include "file_io.h"
+#include "thread_pool.h"
+
+#if defined(__linux__) && !defined(__ANDROID__) && __has_include(<linux/io_uring.h>)
+#  include <linux/io_uring.h>
+#  ifdef IORING_FEAT_RW_CUR_POS
+#    include <sys/mman.h>
+#    include <sys/syscall.h>
+#    define OUINET_FILE_IO_URING
+#  endif
+#endif
 
 namespace ouinet { namespace util { namespace file_io {
 
@@ -14,6 +34,398 @@ sys::error_code last_error()
     return make_error_code(static_cast<errc::errc_t>(errno));
 }
 
+static
+sys::error_code error_from_errno(int e)
+{
+    return make_error_code(static_cast<errc::errc_t>(e));
+}
+
+// Files are not read or written in larger pieces,
+// so that cancellation does not wait for too long.
+static const size_t max_transfer_size = 1 << 20;
+
+enum class Op { read, write };
+
+// Run `f` (returning the result of a `read(2)`-like call and its `errno`)
+// in a pool of threads, and resume the coroutine with its result.
+static
+size_t blocking_transfer( std::function<std::pair<ssize_t, int>()> f
+                        , sys::error_code& ec
+                        , asio::yield_context yield)
+{
+    // Enough to keep a few disk operations in flight,
+    // they mostly wait for the device anyway.
+    static ThreadPool pool(4);
+
+    auto r = pool.run(f, yield);
+    if (r.first < 0) {
+        ec = error_from_errno(r.second);
+        return 0;
+    }
+    return r.first;
+}
+
+static
+size_t pool_transfer_some( Op op, int fd, void* data, size_t size
+                         , sys::error_code& ec
+                         , asio::yield_context yield)
+{
+    return blocking_transfer([op, fd, data, size] {
+        ssize_t r;
+        do {
+            r = (op == Op::read) ? ::read(fd, data, size)
+                                 : ::write(fd, data, size);
+        } while (r < 0 && errno == EINTR);
+        return std::make_pair(r, r < 0 ? errno : 0);
+    }, ec, yield);
+}
+
+#ifdef OUINET_FILE_IO_URING
+
+// A single io_uring instance shared by all executors.
+//
+// Operations are submitted from the callers' threads,
+// and a dedicated thread waits for completions
+// and resumes the callers via their executors
+// (much like `ThreadPool`, but without a thread blocking on each operation).
+//
+// Reads and writes use the current position of the file
+// (i.e. an offset of -1, thus the need for `IORING_FEAT_RW_CUR_POS`).
+class IoUring {
+public:
+    // Return null if io_uring is not available
+    // (e.g. old kernels, or blocked by a seccomp policy).
+    static IoUring* get()
+    {
+        static std::unique_ptr<IoUring> ring = [] {
+            std::unique_ptr<IoUring> r(new IoUring);
+            if (!r->setup()) r.reset();
+            return r;
+        }();
+        return ring.get();
+    }
+
+    ~IoUring()
+    {
+        if (_completion_thread.joinable()) {
+            {
+                // A null operation tells the completion thread to stop.
+                std::lock_guard<std::mutex> lock(_mutex);
+                enqueue(nullptr);
+            }
+            _completion_thread.join();
+        }
+        if (_sqes != MAP_FAILED) ::munmap(_sqes, _sqes_size);
+        if (_cq_ring != MAP_FAILED && _cq_ring != _sq_ring) ::munmap(_cq_ring, _cq_ring_size);
+        if (_sq_ring != MAP_FAILED) ::munmap(_sq_ring, _sq_ring_size);
+        if (_fd != -1) ::close(_fd);
+    }
+
+    size_t transfer_some( Op op, int fd, void* data, size_t size
+                        , sys::error_code& ec
+                        , asio::yield_context yield)
+    {
+        using Sig = void(sys::error_code);
+
+        asio::async_completion<asio::yield_context, Sig> init(yield);
+
+        // The caller's frame stays alive until the handler is called.
+        auto h = std::move(init.completion_handler);
+        auto hex = asio::get_associated_executor(h);
+        auto work = asio::make_work_guard(hex);
+
+        Operation o;
+        o.opcode = (op == Op::read) ? IORING_OP_READ : IORING_OP_WRITE;
+        o.fd = fd;
+        o.data = data;
+        o.size = size;
+        o.complete = [&h, hex] {
+            asio::post(hex, [h = std::move(h)] () mutable { h(sys::error_code()); });
+        };
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            enqueue(&o);
+        }
+
+        init.result.get();
+
+        if (o.result < 0) {
+            ec = error_from_errno(-o.result);
+            return 0;
+        }
+        return o.result;
+    }
+
+private:
+    struct Operation {
+        uint8_t opcode;
+        int fd;
+        void* data;
+        unsigned size;
+        int result = 0;
+        // Called from the completion thread.
+        std::function<void()> complete;
+    };
+
+    IoUring() = default;
+
+    bool setup()
+    {
+        io_uring_params p{};
+        _fd = ::syscall(__NR_io_uring_setup, queue_size, &p);
+        if (_fd < 0) { _fd = -1; return false; }
+        if (!(p.features & IORING_FEAT_RW_CUR_POS)) return false;
+
+        _sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        _cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap)
+            _sq_ring_size = _cq_ring_size = std::max(_sq_ring_size, _cq_ring_size);
+
+        _sq_ring = ::mmap( nullptr, _sq_ring_size, PROT_READ | PROT_WRITE
+                         , MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+        if (_sq_ring == MAP_FAILED) return false;
+
+        if (single_mmap) _cq_ring = _sq_ring;
+        else _cq_ring = ::mmap( nullptr, _cq_ring_size, PROT_READ | PROT_WRITE
+                              , MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+        if (_cq_ring == MAP_FAILED) return false;
+
+        _sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+        _sqes = ::mmap( nullptr, _sqes_size, PROT_READ | PROT_WRITE
+                      , MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+        if (_sqes == MAP_FAILED) return false;
+
+        auto sq = static_cast<char*>(_sq_ring);
+        _sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        _sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        _sq_mask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        _sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        _sq_entries = p.sq_entries;
+
+        auto cq = static_cast<char*>(_cq_ring);
+        _cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        _cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        _cq_mask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        _cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+        _completion_thread = std::thread([this] { run_completions(); });
+        return true;
+    }
+
+    // Submit the operation if there is room in the ring,
+    // otherwise queue it until some other operation completes.
+    // The mutex must be held.
+    void enqueue(Operation* o)
+    {
+        if (_in_flight >= _sq_entries) {
+            _pending.push_back(o);
+            return;
+        }
+
+        unsigned tail = *_sq_tail;
+        unsigned i = tail & _sq_mask;
+        auto& sqe = static_cast<io_uring_sqe*>(_sqes)[i];
+        std::memset(&sqe, 0, sizeof(sqe));
+        if (o) {
+            sqe.opcode = o->opcode;
+            sqe.fd = o->fd;
+            sqe.off = uint64_t(-1);
+            sqe.addr = reinterpret_cast<uint64_t>(o->data);
+            sqe.len = o->size;
+        } else {
+            sqe.opcode = IORING_OP_NOP;
+        }
+        sqe.user_data = reinterpret_cast<uint64_t>(o);
+        _sq_array[i] = i;
+        __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++_in_flight;
+
+        // Submit every entry not yet consumed by the kernel,
+        // including those left by a previously failed call.
+        unsigned to_submit = tail + 1 - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+        int r;
+        do r = ::syscall(__NR_io_uring_enter, _fd, to_submit, 0, 0, nullptr, 0);
+        while (r < 0 && errno == EINTR);
+    }
+
+    void run_completions()
+    {
+        std::vector<Operation*> done;
+        bool stop = false;
+
+        while (!stop) {
+            // Also submit entries left behind by a failed submission.
+            unsigned to_submit = __atomic_load_n(_sq_tail, __ATOMIC_ACQUIRE)
+                               - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+            int r = ::syscall( __NR_io_uring_enter, _fd, to_submit, 1
+                             , IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                break;
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+
+                unsigned head = *_cq_head;
+                unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+                for (; head != tail; ++head) {
+                    auto& cqe = _cqes[head & _cq_mask];
+                    auto o = reinterpret_cast<Operation*>(cqe.user_data);
+                    --_in_flight;
+                    if (!o) { stop = true; continue; }
+                    o->result = cqe.res;
+                    done.push_back(o);
+                }
+                __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+
+                while (!_pending.empty() && _in_flight < _sq_entries) {
+                    auto o = _pending.front();
+                    _pending.pop_front();
+                    enqueue(o);
+                }
+            }
+
+            for (auto o : done) o->complete();
+            done.clear();
+        }
+    }
+
+private:
+    static const unsigned queue_size = 256;
+
+    int _fd = -1;
+
+    void* _sq_ring = MAP_FAILED;
+    void* _cq_ring = MAP_FAILED;
+    void* _sqes = MAP_FAILED;
+    size_t _sq_ring_size = 0, _cq_ring_size = 0, _sqes_size = 0;
+
+    unsigned* _sq_head = nullptr;
+    unsigned* _sq_tail = nullptr;
+    unsigned* _sq_array = nullptr;
+    unsigned _sq_mask = 0;
+    unsigned _sq_entries = 0;
+
+    unsigned* _cq_head = nullptr;
+    unsigned* _cq_tail = nullptr;
+    io_uring_cqe* _cqes = nullptr;
+    unsigned _cq_mask = 0;
+
+    std::mutex _mutex;
+    unsigned _in_flight = 0;
+    std::deque<Operation*> _pending;
+
+    std::thread _completion_thread;
+};
+
+#endif  // OUINET_FILE_IO_URING
+
+static
+bool is_available(Backend b)
+{
+    switch (b) {
+        case Backend::io_uring:
+#ifdef OUINET_FILE_IO_URING
+            return IoUring::get();
+#else
+            return false;
+#endif
+        case Backend::thread_pool:
+        case Backend::descriptor:
+            return true;
+    }
+    return false;
+}
+
+static
+std::atomic<Backend>& current_backend()
+{
+    static std::atomic<Backend> b( is_available(Backend::io_uring)
+                                 ? Backend::io_uring
+                                 : Backend::thread_pool);
+    return b;
+}
+
+Backend backend()
+{
+    return current_backend();
+}
+
+bool set_backend(Backend b)
+{
+    if (!is_available(b)) return false;
+    current_backend() = b;
+    return true;
+}
+
+const char* backend_name(Backend b)
+{
+    switch (b) {
+        case Backend::io_uring:    return "io_uring";
+        case Backend::thread_pool: return "thread_pool";
+        case Backend::descriptor:  return "descriptor";
+    }
+    return "unknown";
+}
+
+static
+size_t transfer_some( Backend b, Op op, int fd, void* data, size_t size
+                    , sys::error_code& ec
+                    , asio::yield_context yield)
+{
+#ifdef OUINET_FILE_IO_URING
+    if (b == Backend::io_uring)
+        return IoUring::get()->transfer_some(op, fd, data, size, ec, yield);
+#endif
+    return pool_transfer_some(op, fd, data, size, ec, yield);
+}
+
+// Transfer the whole buffer, in pieces if needed.
+static
+size_t transfer( Op op
+               , posix::stream_descriptor& f
+               , void* data, size_t size
+               , Cancel& cancel
+               , asio::yield_context yield)
+{
+    auto b = backend();
+    sys::error_code ec;
+    size_t done = 0;
+
+    if (b == Backend::descriptor) {
+        auto cancel_slot = cancel.connect([&] { f.close(); });
+        done = (op == Op::read)
+             ? asio::async_read(f, asio::buffer(data, size), yield[ec])
+             : asio::async_write(f, asio::buffer(data, size), yield[ec]);
+        if (cancel) ec = asio::error::operation_aborted;
+        return or_throw(yield, ec, done);
+    }
+
+    // The descriptor must not be closed while another thread
+    // (or the kernel) is using it, so cancellation is only checked
+    // between pieces, and the file is closed afterwards.
+    while (done < size) {
+        if (!f.is_open()) { ec = asio::error::bad_descriptor; break; }
+
+        auto n = transfer_some( b, op, f.native_handle()
+                              , static_cast<char*>(data) + done
+                              , std::min(size - done, max_transfer_size)
+                              , ec, yield);
+        if (cancel) ec = asio::error::operation_aborted;
+        if (ec) break;
+        if (n == 0) {
+            ec = (op == Op::read) ? asio::error::eof
+                                  : make_error_code(errc::io_error);
+            break;
+        }
+        done += n;
+    }
+
+    if (cancel) f.close();
+    return or_throw(yield, ec, done);
+}
+
 void fseek(posix::stream_descriptor& f, size_t pos, sys::error_code& ec)
 {
     if (lseek(f.native_handle(), pos, SEEK_SET) == -1) {
@@ -142,16 +554,12 @@ bool check_or_create_directory(const fs::path& dir, sys::error_code& ec)
     }
 }
 
-void read( posix::stream_descriptor& f
-         , asio::mutable_buffer b
-         , Cancel& cancel
-         , asio::yield_context yield)
+size_t read( posix::stream_descriptor& f
+           , asio::mutable_buffer b
+           , Cancel& cancel
+           , asio::yield_context yield)
 {
-    auto cancel_slot = cancel.connect([&] { f.close(); });
-    sys::error_code ec;
-    asio::async_read(f, b, yield[ec]);
-    if (cancel) ec = asio::error::operation_aborted;
-    return or_throw(yield, ec);
+    return transfer(Op::read, f, b.data(), b.size(), cancel, yield);
 }
 
 void write( posix::stream_descriptor& f
@@ -159,11 +567,8 @@ void write( posix::stream_descriptor& f
           , Cancel& cancel
           , asio::yield_context yield)
 {
-    auto cancel_slot = cancel.connect([&] { f.close(); });
-    sys::error_code ec;
-    asio::async_write(f, b, yield[ec]);
-    if (cancel) ec = asio::error::operation_aborted;
-    return or_throw(yield, ec);
+    // Writing does not modify the data.
+    transfer(Op::write, f, const_cast<void*>(b.data()), b.size(), cancel, yield);
 }
 
 void remove_file(const fs::path& p)
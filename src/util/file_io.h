@@ -34,11 +34,40 @@ void truncate( asio::posix::stream_descriptor&
              , size_t new_length
              , sys::error_code&);
 
-void read( asio::posix::stream_descriptor&
-         , asio::mutable_buffer
-         , Cancel&
-         , asio::yield_context);
-
+// How `read` and `write` access the contents of files.
+//
+// Asynchronous operations on descriptors of regular files
+// actually block the calling thread, so by default reads and writes
+// are submitted to the kernel via io_uring where available (Linux >= 5.6),
+// or run in a small pool of threads otherwise.
+enum class Backend {
+    io_uring,
+    thread_pool,
+    // Operations run in the caller's thread (for comparison only).
+    descriptor,
+};
+
+Backend backend();
+
+// Return false if the backend is not available in this system
+// (the current one is kept then).
+bool set_backend(Backend);
+
+const char* backend_name(Backend);
+
+// Read until the buffer is full, starting at the current position.
+// Return the number of bytes read, which may be less than the buffer size
+// on error (e.g. `asio::error::eof` at the end of the file).
+//
+// If the operation is cancelled, the file is closed.
+size_t read( asio::posix::stream_descriptor&
+           , asio::mutable_buffer
+           , Cancel&
+           , asio::yield_context);
+
+// Write the whole buffer at the current position.
+//
+// If the operation is cancelled, the file is closed.
 void write( asio::posix::stream_descriptor&
           , asio::const_buffer
           , Cancel&
@@ -1,39 +1,101 @@
 #include "hash.h"
+#include "crypto.h"
 
 extern "C" {
 #include "gcrypt.h"
 }
 
+// Low-level digest functions work on contexts owned by the caller,
+// so hashing or resetting a hash never allocates (unlike with `EVP_MD_CTX`).
+// They are deprecated since OpenSSL 3.0, but still available.
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <openssl/sha.h>
+
 namespace ouinet { namespace util { namespace hash_detail {
 
 class HashImpl {
 public:
-    HashImpl(int algo) : algorithm(algo)
+    virtual ~HashImpl() = default;
+
+    virtual void update(const void* buffer, size_t size) = 0;
+    virtual uint8_t* close() = 0;
+    virtual void reset() = 0;
+};
+
+class GcryptHash : public HashImpl {
+public:
+    GcryptHash(int algo) : algorithm(algo)
     {
         if (::gcry_md_open(&digest, algorithm, 0))
             throw std::runtime_error("Failed to initialize hash");
     }
 
-    ~HashImpl()
+    ~GcryptHash()
     {
         ::gcry_md_close(digest);
     }
 
-    inline void update(const void* buffer, size_t size)
+    void update(const void* buffer, size_t size) override
     {
         ::gcry_md_write(digest, buffer, size);
     }
 
-    inline uint8_t* close()
+    uint8_t* close() override
     {
         return ::gcry_md_read(digest, algorithm);
     }
 
+    void reset() override
+    {
+        ::gcry_md_reset(digest);
+    }
+
 private:
     int algorithm;
     ::gcry_md_hd_t digest;
 };
 
+template< class Ctx
+        , int (*Init)(Ctx*)
+        , int (*Update)(Ctx*, const void*, size_t)
+        , int (*Final)(unsigned char*, Ctx*)
+        , size_t DigestLength>
+class OpensslHash : public HashImpl {
+public:
+    OpensslHash()
+    {
+        reset();
+    }
+
+    void update(const void* buffer, size_t size) override
+    {
+        Update(&ctx, buffer, size);
+    }
+
+    uint8_t* close() override
+    {
+        // Like with gcrypt, closing again returns the same digest.
+        if (!closed) Final(digest, &ctx);
+        closed = true;
+        return digest;
+    }
+
+    void reset() override
+    {
+        Init(&ctx);
+        closed = false;
+    }
+
+private:
+    Ctx ctx;
+    bool closed;
+    uint8_t digest[DigestLength];
+};
+
+using OpensslSHA1 = OpensslHash<SHA_CTX, SHA1_Init, SHA1_Update, SHA1_Final, SHA_DIGEST_LENGTH>;
+using OpensslSHA256 = OpensslHash<SHA256_CTX, SHA256_Init, SHA256_Update, SHA256_Final, SHA256_DIGEST_LENGTH>;
+using OpensslSHA512 = OpensslHash<SHA512_CTX, SHA512_Init, SHA512_Update, SHA512_Final, SHA512_DIGEST_LENGTH>;
+
 void
 HashImplDeleter::operator()(HashImpl* hi)
 {
@@ -57,7 +119,18 @@ hash_algo(hash_algorithm ha) {
 HashImpl*
 new_hash_impl(hash_algorithm ha)
 {
-    return new HashImpl(hash_algo(ha));
+    if (crypto_backend() == CryptoBackend::gcrypt)
+        return new GcryptHash(hash_algo(ha));
+
+    switch (ha) {
+        case hash_algorithm::sha1:
+            return new OpensslSHA1();
+        case hash_algorithm::sha256:
+            return new OpensslSHA256();
+        case hash_algorithm::sha512:
+            return new OpensslSHA512();
+    }
+    throw std::runtime_error("Unknown hash algorithm");
 }
 
 void
@@ -71,4 +144,9 @@ uint8_t* hash_impl_close(HashImpl& hi)
     return hi.close();
 }
 
+void hash_impl_reset(HashImpl& hi)
+{
+    hi.reset();
+}
+
 }}} // namespaces
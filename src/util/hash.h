@@ -28,6 +28,7 @@ struct HashImplDeleter {
 HashImpl* new_hash_impl(hash_algorithm);
 void hash_impl_update(HashImpl&, const void*, size_t);
 uint8_t* hash_impl_close(HashImpl&);
+void hash_impl_reset(HashImpl&);
 
 } // namespace hash_detail
 
@@ -37,7 +38,8 @@ uint8_t* hash_impl_close(HashImpl&);
  *
  * You may call `update` several times to feed the hash function with new
  * data.  When you are done, you may call the `close` function, which returns
- * the resulting digest as an array of bytes.
+ * the resulting digest as an array of bytes.  Calling `reset` then allows
+ * computing a new hash while reusing the same context.
  */
 template<hash_algorithm ALGORITHM, size_t DIGEST_LENGTH>
 class Hash {
@@ -86,6 +88,11 @@ public:
         return result;
     }
 
+    inline void reset()
+    {
+        hash_detail::hash_impl_reset(*impl);
+    }
+
     template<class... Args>
     static
     digest_type digest(Args&&... args)
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/post.hpp>
+
+#include "../namespaces.h"
+
+namespace ouinet { namespace util {
+
+/*
+ * A wrapper around a stream which first yields the given data on reads,
+ * then reads from the stream itself.
+ *
+ * This allows putting back data which was read in advance
+ * (e.g. to inspect it) before handing the stream over.
+ */
+template<class Stream>
+class PrefixedStream {
+public:
+    using executor_type = typename Stream::executor_type;
+    using next_layer_type = Stream;
+    using lowest_layer_type = typename Stream::lowest_layer_type;
+
+public:
+    PrefixedStream(std::string prefix, Stream s)
+        : _prefix(std::move(prefix))
+        , _s(std::move(s))
+    {}
+
+    executor_type get_executor() { return _s.get_executor(); }
+
+    next_layer_type& next_layer() { return _s; }
+    lowest_layer_type& lowest_layer() { return _s.lowest_layer(); }
+
+    template<class MutableBufferSequence, class Token>
+    auto async_read_some(const MutableBufferSequence& bs, Token&& token)
+    {
+        using Sig = void(sys::error_code, size_t);
+        asio::async_completion<Token, Sig> init(token);
+
+        if (_pos == _prefix.size()) {
+            _s.async_read_some(bs, std::move(init.completion_handler));
+        } else {
+            auto n = asio::buffer_copy(bs, asio::buffer(_prefix) + _pos);
+            _pos += n;
+            if (_pos == _prefix.size()) { _prefix = {}; _pos = 0; }
+
+            asio::post(get_executor(), [h = std::move(init.completion_handler), n]
+                                       () mutable { h(sys::error_code(), n); });
+        }
+
+        return init.result.get();
+    }
+
+    template<class ConstBufferSequence, class Token>
+    auto async_write_some(const ConstBufferSequence& bs, Token&& token)
+    {
+        return _s.async_write_some(bs, std::forward<Token>(token));
+    }
+
+    void close() { _s.close(); }
+    bool is_open() const { return _s.is_open(); }
+
+private:
+    std::string _prefix;
+    std::size_t _pos = 0;
+    Stream _s;
+};
+
+}} // namespaces
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/intrusive_ptr.hpp>
+
+#include "bytes.h"
+
+namespace ouinet { namespace util {
+
+namespace shared_bytes_detail {
+
+// Reference-counted storage for bytes.
+class Storage {
+public:
+    virtual ~Storage() = default;
+
+    virtual uint8_t* data() = 0;
+    virtual std::size_t capacity() const = 0;
+
+private:
+    friend void intrusive_ptr_add_ref(Storage*);
+    friend void intrusive_ptr_release(Storage*);
+
+    // Called when the last reference is dropped.
+    virtual void recycle() { delete this; }
+
+    std::atomic<std::size_t> _refs{0};
+};
+
+inline void intrusive_ptr_add_ref(Storage* s)
+{
+    s->_refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void intrusive_ptr_release(Storage* s)
+{
+    if (s->_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        s->recycle();
+}
+
+// Storage adopting an existing vector.
+class VectorStorage : public Storage {
+public:
+    VectorStorage(std::vector<uint8_t> v) : _v(std::move(v)) {}
+
+    uint8_t* data() override { return _v.data(); }
+    std::size_t capacity() const override { return _v.size(); }
+
+private:
+    std::vector<uint8_t> _v;
+};
+
+// Fixed-size storage which goes back to a per-thread pool
+// when no longer referenced, instead of being freed.
+class Slab : public Storage {
+public:
+    static constexpr std::size_t size = 64 * 1024;  // one data block
+    static constexpr std::size_t max_pooled = 64;  // per thread
+
+    static boost::intrusive_ptr<Slab> get()
+    {
+        auto& p = pool();
+        if (p.empty()) return new Slab();
+        auto s = p.back().release();
+        p.pop_back();
+        return s;
+    }
+
+    uint8_t* data() override { return _data.get(); }
+    std::size_t capacity() const override { return size; }
+
+private:
+    Slab() : _data(new uint8_t[size]) {}
+
+    static std::vector<std::unique_ptr<Slab>>& pool()
+    {
+        static thread_local std::vector<std::unique_ptr<Slab>> p;
+        return p;
+    }
+
+    void recycle() override
+    {
+        auto& p = pool();
+        if (p.size() >= max_pooled) { delete this; return; }
+        p.emplace_back(this);
+    }
+
+    std::unique_ptr<uint8_t[]> _data;
+};
+
+} // namespace shared_bytes_detail
+
+// A read-only range of bytes which shares ownership of its storage,
+// so that copying it does not copy the bytes themselves.
+//
+// The bytes may come from an adopted vector
+// or from a pooled slab (see `SlabAllocator`).
+class SharedBytes {
+private:
+    using Storage = shared_bytes_detail::Storage;
+
+public:
+    using value_type = uint8_t;
+    using const_iterator = const uint8_t*;
+    using iterator = const_iterator;
+
+    SharedBytes() = default;
+
+    SharedBytes(std::vector<uint8_t> v)
+        : _size(v.size())
+    {
+        if (v.empty()) return;
+        _storage = new shared_bytes_detail::VectorStorage(std::move(v));
+    }
+
+    SharedBytes(boost::intrusive_ptr<Storage> s, std::size_t offset, std::size_t size)
+        : _storage(std::move(s)), _offset(offset), _size(size)
+    {
+        assert(!_storage || _offset + _size <= _storage->capacity());
+    }
+
+    const uint8_t* data() const { return _storage ? _storage->data() + _offset : nullptr; }
+    std::size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    const_iterator begin() const { return data(); }
+    const_iterator end() const { return data() + _size; }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    uint8_t operator[](std::size_t i) const { return data()[i]; }
+
+    operator boost::asio::const_buffer() const { return {data(), _size}; }
+
+    // Part of these bytes sharing the same storage.
+    SharedBytes slice(std::size_t offset, std::size_t size) const
+    {
+        assert(offset + size <= _size);
+        return {_storage, _offset + offset, size};
+    }
+
+    // These bytes in their own storage,
+    // so that they do not keep alive a bigger one which they are part of.
+    SharedBytes detached() const
+    {
+        if (!_storage || _size == _storage->capacity()) return *this;
+        return std::vector<uint8_t>(begin(), end());
+    }
+
+    bool operator==(const SharedBytes& other) const
+    {
+        return _size == other._size
+            && (_size == 0 || std::memcmp(data(), other.data(), _size) == 0);
+    }
+
+    bool operator!=(const SharedBytes& other) const { return !(*this == other); }
+
+private:
+    boost::intrusive_ptr<Storage> _storage;
+    std::size_t _offset = 0;
+    std::size_t _size = 0;
+};
+
+// Allocate `SharedBytes` by filling pooled slabs one after the other,
+// so that small pieces of data share a slab
+// and no memory is allocated once slabs are recycled.
+//
+// Bytes can be copied into a slab with `copy`,
+// or placed there directly (e.g. by a read operation)
+// with `prepare` followed by `commit`.
+// Pieces bigger than a slab get their own storage.
+//
+// Note that a slab is only recycled once none of its pieces is referenced,
+// so even a small piece keeps a whole slab (64 KiB) alive.
+// Pieces which may be kept for long
+// (e.g. small parts buffered for a slow consumer)
+// should be copied out with `SharedBytes::detached`.
+class SlabAllocator {
+private:
+    using Slab = shared_bytes_detail::Slab;
+    using Storage = shared_bytes_detail::Storage;
+
+public:
+    static constexpr std::size_t slab_size = Slab::size;
+
+    // Get a writable buffer of at least `n` contiguous bytes.
+    //
+    // Its content is kept as long as no other allocation happens,
+    // so several calls with the same `n` return the same buffer.
+    boost::asio::mutable_buffer prepare(std::size_t n)
+    {
+        if (n > Slab::size) {
+            if (!_big || _big->capacity() < n) {
+                _big = new shared_bytes_detail::VectorStorage(std::vector<uint8_t>(n));
+            }
+            return {_big->data(), n};
+        }
+
+        _big = nullptr;
+        if (!_slab || Slab::size - _used < n) {
+            _slab = Slab::get();
+            _used = 0;
+        }
+        return {_slab->data() + _used, Slab::size - _used};
+    }
+
+    // Turn the first `n` bytes of the last prepared buffer into `SharedBytes`.
+    SharedBytes commit(std::size_t n)
+    {
+        if (n == 0) return {};
+
+        if (_big) {
+            SharedBytes ret(std::move(_big), 0, n);
+            _big = nullptr;
+            return ret;
+        }
+
+        assert(_slab && _used + n <= Slab::size);
+        SharedBytes ret(_slab, _used, n);
+        _used += n;
+        return ret;
+    }
+
+    SharedBytes copy(const void* data, std::size_t n)
+    {
+        if (n == 0) return {};
+        auto buf = prepare(n);
+        std::memcpy(buf.data(), data, n);
+        return commit(n);
+    }
+
+    SharedBytes copy(boost::asio::const_buffer b)
+    {
+        return copy(b.data(), b.size());
+    }
+
+private:
+    boost::intrusive_ptr<Storage> _slab;
+    std::size_t _used = 0;
+    boost::intrusive_ptr<Storage> _big;
+};
+
+namespace bytes {
+template<> struct is_bytestring_type<SharedBytes> { static const bool value = true; };
+} // namespace bytes
+
+}} // namespaces
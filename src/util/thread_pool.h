@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/optional.hpp>
+
+#include "../namespaces.h"
+
+namespace ouinet { namespace util {
+
+/*
+ * Run CPU-heavy or blocking functions in a pool of threads,
+ * so that they do not stall other coroutines running in the caller's thread.
+ *
+ * Usage:
+ *
+ *     ThreadPool pool(2);
+ *     // Suspends the coroutine until the function is run by the pool,
+ *     // the result (or exception) is then passed to it.
+ *     auto crt = pool.run([&] { return generate_certificate(); }, yield);
+ *
+ *     // Runs `verify(i)` for every `i` in `[0, n)` concurrently,
+ *     // the coroutine is resumed once all of them are done.
+ *     pool.run_each(n, [&] (size_t i) { ok[i] = verify(i); }, yield);
+ *
+ * The function must not use I/O objects of the caller
+ * (which is still free to run other coroutines).
+ */
+class ThreadPool {
+public:
+    ThreadPool(std::size_t threads) : _pool(threads) {}
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Wait for pending functions to finish.
+    ~ThreadPool() { _pool.join(); }
+
+    template<class F>
+    auto run(F&& f, asio::yield_context yield) -> decltype(f())
+    {
+        using R = decltype(f());
+        using Ret = std::conditional_t<std::is_void<R>::value, bool, R>;
+        using Sig = void(sys::error_code);
+
+        boost::optional<Ret> result;
+        std::exception_ptr error;
+
+        asio::async_completion<asio::yield_context, Sig> init(yield);
+
+        // The caller's frame stays alive until the handler is called.
+        auto h = std::move(init.completion_handler);
+        auto hex = asio::get_associated_executor(h);
+        // Keep the caller's context running while the function runs elsewhere.
+        auto work = asio::make_work_guard(hex);
+        asio::post(_pool, [ &f, &result, &error
+                          , h = std::move(h), hex ] () mutable {
+            try {
+                if constexpr (std::is_void<R>::value) { f(); result = true; }
+                else result = f();
+            } catch (...) {
+                error = std::current_exception();
+            }
+            asio::post(hex, [h = std::move(h)] () mutable { h(sys::error_code()); });
+        });
+
+        init.result.get();
+
+        if (error) std::rethrow_exception(error);
+        if constexpr (!std::is_void<R>::value) return std::move(*result);
+    }
+
+    // If any of the calls throws, one of the exceptions is rethrown
+    // (after all calls are done).
+    template<class F>
+    void run_each(std::size_t n, F&& f, asio::yield_context yield)
+    {
+        if (n == 0) return;
+
+        using Sig = void(sys::error_code);
+
+        std::atomic<std::size_t> remaining(n);
+        std::mutex error_mutex;
+        std::exception_ptr error;
+
+        asio::async_completion<asio::yield_context, Sig> init(yield);
+
+        auto h = std::move(init.completion_handler);
+        auto hex = asio::get_associated_executor(h);
+        auto work = asio::make_work_guard(hex);
+        for (std::size_t i = 0; i < n; ++i) {
+            asio::post(_pool, [ &f, &remaining, &error_mutex, &error
+                              , &h, hex, i ] {
+                try {
+                    f(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if (!error) error = std::current_exception();
+                }
+                if (--remaining > 0) return;
+                // Last call done, the caller's frame is still alive.
+                asio::post(hex, [h = std::move(h)] () mutable { h(sys::error_code()); });
+            });
+        }
+
+        init.result.get();
+
+        if (error) std::rethrow_exception(error);
+    }
+
+private:
+    asio::thread_pool _pool;
+};
+
+}} // namespaces
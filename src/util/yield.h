@@ -1,7 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include <sstream>
 #include "../namespaces.h"
+#include "../logger.h"
 #include "../util/str.h"
 #include <boost/intrusive/list.hpp>
 #include <boost/asio/spawn.hpp>
@@ -157,6 +159,8 @@ public:
         }
     }
 
+    // Log the given message tagged with this context,
+    // only if the logger is at the `DEBUG` level or lower.
     template<class... Args>
     void log(Args&&...);
     void log(boost::string_view);
@@ -165,7 +169,7 @@ private:
 
     static size_t generate_context_id()
     {
-        static size_t next_id = 0;
+        static std::atomic<size_t> next_id(0);
         return next_id++;
     }
 
@@ -215,10 +219,9 @@ void Yield::start_timing()
             if (!ts->self) return;
 
             auto notify = [&](Clock::duration d) {
-                std::cerr << ts->self->tag()
-                          << " is still working after "
-                          << Yield::duration_secs(d) << " seconds"
-                          << std::endl;
+                logger.output(util::str( ts->self->tag()
+                                       , " is still working after "
+                                       , Yield::duration_secs(d), " seconds\n"));
             };
 
             boost::optional<Clock::duration> first_duration
@@ -246,6 +249,8 @@ template<class... Args>
 inline
 void Yield::log(Args&&... args)
 {
+    // Avoid formatting messages which would be discarded.
+    if (!logger.would_log(DEBUG)) return;
     Yield::log(boost::string_view(util::str(std::forward<Args>(args)...)));
 }
 
@@ -254,10 +259,18 @@ void Yield::log(boost::string_view str)
 {
     using boost::string_view;
 
+    if (!logger.would_log(DEBUG)) return;
+
+    std::string out;
+
     while (str.size()) {
         auto endl = str.find('\n');
 
-        std::cerr << tag() << " " << str.substr(0, endl) << std::endl;
+        out += tag();
+        out += ' ';
+        auto line = str.substr(0, endl);
+        out.append(line.data(), line.size());
+        out += '\n';
 
         if (endl == std::string::npos) {
             break;
@@ -265,6 +278,8 @@ void Yield::log(boost::string_view str)
 
         str = str.substr(endl+1);
     }
+
+    if (!out.empty()) logger.output(std::move(out));
 }
 
 } // ouinet namespace
@@ -0,0 +1,111 @@
+// Measure how many KRPC messages per second can be decoded
+// and have their usual values looked up,
+// either into owned values (`bencoding_decode`)
+// or as views of the received data (`bencoding_decode_view`, as the DHT does).
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../src/bittorrent/bencoding.h"
+#include "../src/parse/number.h"
+
+using namespace std;
+using namespace ouinet;
+using namespace ouinet::bittorrent;
+
+using Clock = chrono::steady_clock;
+
+static
+void report(const string& what, size_t messages, Clock::duration elapsed)
+{
+    auto secs = chrono::duration<double>(elapsed).count();
+    cout << what << ": " << messages << " messages in " << secs << "s, "
+         << (messages / secs) << " messages/s" << endl;
+}
+
+// Typical messages received by a DHT node.
+static
+vector<string> krpc_messages()
+{
+    string id(20, 'i'), target(20, 't'), token(20, 'k');
+    string nodes;  // 8 compact IPv4 node contacts
+    for (int i = 0; i < 8; ++i) nodes += string(20, 'a' + i) + "\x7f\0\0\x01\x1a\xe1";
+
+    BencodedList peers;
+    for (int i = 0; i < 20; ++i) peers.push_back(string(6, 'p'));
+
+    vector<BencodedValue> msgs{
+        BencodedMap{ {"t", "aa"}, {"y", "q"}, {"q", "ping"}
+                   , {"a", BencodedMap{{"id", id}}} },
+        BencodedMap{ {"t", "ab"}, {"y", "q"}, {"q", "find_node"}
+                   , {"a", BencodedMap{{"id", id}, {"target", target}}} },
+        BencodedMap{ {"t", "ac"}, {"y", "q"}, {"q", "get_peers"}
+                   , {"a", BencodedMap{{"id", id}, {"info_hash", target}}} },
+        BencodedMap{ {"t", "ad"}, {"y", "q"}, {"q", "announce_peer"}
+                   , {"a", BencodedMap{ {"id", id}, {"info_hash", target}
+                                      , {"port", 6881}, {"token", token}
+                                      , {"implied_port", 1}}} },
+        BencodedMap{ {"t", "ae"}, {"y", "r"}
+                   , {"r", BencodedMap{{"id", id}, {"nodes", nodes}}} },
+        BencodedMap{ {"t", "af"}, {"y", "r"}
+                   , {"r", BencodedMap{ {"id", id}, {"nodes", nodes}
+                                      , {"token", token}, {"values", peers}}} },
+        BencodedMap{ {"t", "ag"}, {"y", "q"}, {"q", "put"}
+                   , {"a", BencodedMap{ {"id", id}, {"k", string(32, 'k')}
+                                      , {"seq", 42}, {"sig", string(64, 's')}
+                                      , {"token", token}, {"v", string(500, 'v')}}} },
+    };
+
+    vector<string> ret;
+    for (const auto& m : msgs) ret.push_back(bencoding_encode(m));
+    return ret;
+}
+
+int main(int argc, const char** argv)
+{
+    if (argc > 2) {
+        cerr << "Usage: " << argv[0] << " [<ROUNDS>]" << endl;
+        return 1;
+    }
+
+    size_t rounds = 100000;
+    if (argc > 1) {
+        boost::string_view arg(argv[1]);
+        auto n = parse::number<size_t>(arg);
+        if (!n || *n == 0) { cerr << "Invalid number of rounds" << endl; return 1; }
+        rounds = *n;
+    }
+
+    auto msgs = krpc_messages();
+    size_t total = rounds * msgs.size();
+    size_t found = 0, found_view = 0;  // also keeps work from being optimized out
+
+    auto start = Clock::now();
+    for (size_t r = 0; r < rounds; ++r) for (const auto& m : msgs) {
+        auto v = bencoding_decode(m);
+        if (!v) continue;
+        auto map = v->as_map();
+        if (!map || !(*map)["y"].as_string() || !(*map)["t"].as_string()) continue;
+        auto args = (*map)[(*map)["y"] == "q" ? "a" : "r"].as_map();
+        if (args && (*args)["id"].as_string()) ++found;
+    }
+    report("Owned values", total, Clock::now() - start);
+
+    start = Clock::now();
+    for (size_t r = 0; r < rounds; ++r) for (const auto& m : msgs) {
+        auto v = bencoding_decode_view(m);
+        if (!v || !v->is_map()) continue;
+        if (!(*v)["y"].as_string() || !(*v)["t"].as_string()) continue;
+        auto args = (*v)[(*v)["y"] == "q" ? "a" : "r"];
+        if (args["id"].as_string()) ++found_view;
+    }
+    report("Views", total, Clock::now() - start);
+
+    if (found != total || found_view != total) {
+        cerr << "Failed to decode some messages" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+// Measure how fast responses can be signed by `cache::SigningReader`
+// (as the injector does when serving them),
+// both in wall time and in CPU time used by all threads,
+// with one or several responses being signed at the same time.
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/write.hpp>
+
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <string>
+
+#include "../src/cache/http_sign.h"
+#include "../src/generic_stream.h"
+#include "../src/namespaces.h"
+#include "../src/parse/number.h"
+#include "../src/util/crypto.h"
+#include "../src/util/wait_condition.h"
+#include "connected_pair.h"
+
+using namespace std;
+using namespace ouinet;
+
+using Clock = chrono::steady_clock;
+
+// Send a response with the given body size from the "origin" side of a pair,
+// sign it on the other side and drop its parts.
+static
+void sign_response( size_t body_size, const util::Ed25519PrivateKey& sk
+                  , asio::io_context& ctx, asio::yield_context yield)
+{
+    auto ex = ctx.get_executor();
+    auto p = util::connected_pair(ex, yield);
+
+    WaitCondition wc(ctx);
+    asio::spawn(ctx, [&, lock = wc.lock()] (asio::yield_context y) {
+        string head = "HTTP/1.1 200 OK\r\n"
+                      "Date: Mon, 15 Jan 2018 20:31:50 GMT\r\n"
+                      "Content-Type: application/octet-stream\r\n"
+                      "Content-Length: " + to_string(body_size) + "\r\n\r\n";
+        asio::async_write(p.first, asio::buffer(head), y);
+        string block(http_::response_data_block, 'x');
+        for (size_t sent = 0; sent < body_size; sent += block.size())
+            asio::async_write(p.first, asio::buffer(block, min(block.size(), body_size - sent)), y);
+        p.first.close();
+    });
+
+    http::request_header<> rqh;
+    rqh.method(http::verb::get);
+    rqh.target("https://example.com/big");
+    rqh.version(11);
+    rqh.set(http::field::host, "example.com");
+    cache::SigningReader sr( GenericStream(move(p.second)), rqh
+                           , "d6076384-2295-462b-a047-fe2c9274e58d", 1516048310
+                           , sk);
+    Cancel cancel;
+    while (sr.async_read_part(cancel, yield));
+    wc.wait(yield);
+}
+
+static
+void run(size_t mib, size_t responses, const util::Ed25519PrivateKey& sk)
+{
+    asio::io_context ctx;
+
+    auto start = Clock::now();
+    auto cpu_start = clock();
+    for (size_t i = 0; i < responses; ++i)
+        asio::spawn(ctx, [&] (asio::yield_context yield) {
+            sign_response(mib * 1048576, sk, ctx, yield);
+        });
+    ctx.run();
+    auto secs = chrono::duration<double>(Clock::now() - start).count();
+    auto cpu_secs = double(clock() - cpu_start) / CLOCKS_PER_SEC;
+
+    auto total = double(mib * responses);
+    cout << responses << " response(s) of " << mib << "MiB: "
+         << (total / secs) << "MiB/s, "
+         << (total / cpu_secs) << "MiB per CPU second" << endl;
+}
+
+int main(int argc, const char** argv)
+{
+    if (argc > 3) {
+        cerr << "Usage: " << argv[0] << " [<MIB> [<RESPONSES>]]" << endl;
+        return 1;
+    }
+
+    size_t mib = 64, responses = 4;
+    for (int i = 1; i < argc; ++i) {
+        boost::string_view arg(argv[i]);
+        auto n = parse::number<size_t>(arg);
+        if (!n || *n == 0) { cerr << "Invalid number: " << arg << endl; return 1; }
+        (i == 1 ? mib : responses) = *n;
+    }
+
+    util::crypto_init();
+    auto sk = util::Ed25519PrivateKey::generate();
+
+    run(mib, 1, sk);
+    if (responses > 1) run(mib, responses, sk);
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+// Measure how many data block signatures per second can be verified
+// one at a time or in batches on a pool of threads
+// (as `cache::VerifyingReader` does).
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/spawn.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/namespaces.h"
+#include "../src/parse/number.h"
+#include "../src/util/bytes.h"
+#include "../src/util/crypto.h"
+#include "../src/util/hash.h"
+#include "../src/util/thread_pool.h"
+
+using namespace std;
+using namespace ouinet;
+
+using Clock = chrono::steady_clock;
+
+static
+void report(const string& what, size_t blocks, Clock::duration elapsed)
+{
+    auto secs = chrono::duration<double>(elapsed).count();
+    cout << what << ": " << blocks << " blocks in " << secs << "s, "
+         << (blocks / secs) << " blocks/s" << endl;
+}
+
+int main(int argc, const char** argv)
+{
+    if (argc > 3) {
+        cerr << "Usage: " << argv[0] << " [<BLOCKS> [<THREADS>]]" << endl;
+        return 1;
+    }
+
+    size_t blocks = 1000;
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    if (argc > 1) {
+        boost::string_view arg(argv[1]);
+        auto n = parse::number<size_t>(arg);
+        if (!n || *n == 0) { cerr << "Invalid number of blocks" << endl; return 1; }
+        blocks = *n;
+    }
+    if (argc > 2) {
+        boost::string_view arg(argv[2]);
+        auto n = parse::number<unsigned>(arg);
+        if (!n || *n == 0) { cerr << "Invalid number of threads" << endl; return 1; }
+        threads = *n;
+    }
+
+    util::crypto_init();
+
+    // Signing strings look like those of data blocks:
+    // injection id, null character, chained SHA2-512 digest.
+    auto sk = util::Ed25519PrivateKey::generate();
+    auto pk = sk.public_key();
+    const string injection_id("d6076384-2295-462b-a047-fe2c9274e58d");
+    vector<string> sig_strs;
+    vector<util::Ed25519PublicKey::sig_array_t> sigs;
+    util::SHA512::digest_type digest{};
+    for (size_t i = 0; i < blocks; ++i) {
+        util::SHA512 h;
+        h.update(digest);
+        h.update(to_string(i));
+        digest = h.close();
+        sig_strs.push_back(injection_id + '\0' + util::bytes::to_string(digest));
+        sigs.push_back(sk.sign(sig_strs.back()));
+    }
+
+    size_t failed = 0;
+    auto start = Clock::now();
+    for (size_t i = 0; i < blocks; ++i)
+        if (!pk.verify(sig_strs[i], sigs[i])) ++failed;
+    report("Sequential", blocks, Clock::now() - start);
+
+    asio::io_context ctx;
+    util::ThreadPool pool(threads);
+    vector<char> ok(blocks, false);
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        auto start = Clock::now();
+        pool.run_each(blocks, [&] (size_t i) {
+            ok[i] = pk.verify(sig_strs[i], sigs[i]);
+        }, yield);
+        report("Pool of " + to_string(threads) + " threads", blocks, Clock::now() - start);
+    });
+    ctx.run();
+    for (auto b : ok) if (!b) ++failed;
+
+    if (failed) {
+        cerr << "Failed to verify " << failed << " signatures" << endl;
+        return 1;
+    }
+    return 0;
+}
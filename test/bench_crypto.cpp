@@ -0,0 +1,125 @@
+// Compare how fast data block signatures can be made and verified
+// and how fast data can be hashed (as when signing responses)
+// with every crypto backend.
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../src/parse/number.h"
+#include "../src/util/bytes.h"
+#include "../src/util/crypto.h"
+#include "../src/util/hash.h"
+
+using namespace std;
+using namespace ouinet;
+
+using Clock = chrono::steady_clock;
+
+static const size_t block_size = 65536;  // as in signed responses
+
+static
+double secs_since(Clock::time_point start)
+{
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+template<class Hash>
+static
+double hash_mib_per_sec(const string& block, size_t mib)
+{
+    Hash h;
+    auto start = Clock::now();
+    size_t blocks = mib * 1048576 / block.size();
+    for (size_t i = 0; i < blocks; ++i) {
+        // Chain blocks as data block hashes do.
+        h.update(block);
+        auto digest = h.close();
+        h.reset();
+        h.update(digest);
+    }
+    return mib / secs_since(start);
+}
+
+static
+bool run(util::CryptoBackend backend, size_t sigs, size_t mib)
+{
+    util::set_crypto_backend(backend);
+    auto name = util::crypto_backend_name(backend);
+
+    // Signing strings look like those of data blocks:
+    // injection id, null character, chained SHA2-512 digest.
+    auto sk = util::Ed25519PrivateKey::generate();
+    auto pk = sk.public_key();
+    const string injection_id("d6076384-2295-462b-a047-fe2c9274e58d");
+    vector<string> sig_strs;
+    util::SHA512::digest_type digest{};
+    for (size_t i = 0; i < sigs; ++i) {
+        digest = util::sha512_digest(digest, to_string(i));
+        sig_strs.push_back(injection_id + '\0' + util::bytes::to_string(digest));
+    }
+
+    vector<util::Ed25519PrivateKey::sig_array_t> sig_vals;
+    auto start = Clock::now();
+    for (const auto& s : sig_strs)
+        sig_vals.push_back(sk.sign(s));
+    auto sign_rate = sigs / secs_since(start);
+
+    size_t failed = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < sigs; ++i)
+        if (!pk.verify(sig_strs[i], sig_vals[i])) ++failed;
+    auto verify_rate = sigs / secs_since(start);
+
+    string block(block_size, 'x');
+    auto sha256_rate = hash_mib_per_sec<util::SHA256>(block, mib);
+    auto sha512_rate = hash_mib_per_sec<util::SHA512>(block, mib);
+
+    cout << name << ": "
+         << "sign=" << sign_rate << "/s "
+         << "verify=" << verify_rate << "/s "
+         << "sha256=" << sha256_rate << "MiB/s "
+         << "sha512=" << sha512_rate << "MiB/s" << endl;
+
+    if (failed) cerr << name << ": failed to verify " << failed << " signatures" << endl;
+    return failed == 0;
+}
+
+int main(int argc, const char** argv)
+{
+    if (argc > 3) {
+        cerr << "Usage: " << argv[0] << " [<SIGNATURES> [<MIB>]]" << endl;
+        return 1;
+    }
+
+    size_t sigs = 1000, mib = 256;
+    for (int i = 1; i < argc; ++i) {
+        boost::string_view arg(argv[i]);
+        auto n = parse::number<size_t>(arg);
+        if (!n || *n == 0) { cerr << "Invalid number: " << arg << endl; return 1; }
+        (i == 1 ? sigs : mib) = *n;
+    }
+
+    util::crypto_init();
+
+    bool ok = true;
+    for (auto b : { util::CryptoBackend::gcrypt
+                  , util::CryptoBackend::openssl })
+        ok = run(b, sigs, mib) && ok;
+
+    // Signatures made by one backend must be accepted by the other.
+    util::set_crypto_backend(util::CryptoBackend::gcrypt);
+    auto gsk = util::Ed25519PrivateKey::generate();
+    auto gsig = gsk.sign(string("test"));
+    util::set_crypto_backend(util::CryptoBackend::openssl);
+    util::Ed25519PrivateKey osk(gsk.serialize());
+    if ( osk.public_key().serialize() != gsk.public_key().serialize()
+       || osk.sign(string("test")) != gsig
+       || !osk.public_key().verify("test", gsig)) {
+        cerr << "Backends do not agree" << endl;
+        ok = false;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+// Measure how late timers in the event loop fire
+// while a coroutine writes big files in data blocks
+// (as `cache::http_store_v1` does),
+// for every available backend of `util::file_io`.
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../src/defer.h"
+#include "../src/namespaces.h"
+#include "../src/parse/number.h"
+#include "../src/util/file_io.h"
+#include "../src/util/signal.h"
+
+using namespace std;
+using namespace ouinet;
+namespace file_io = util::file_io;
+
+using Clock = chrono::steady_clock;
+
+static const size_t block_size = 65536;  // as in signed responses
+static const size_t file_size = 16 * 1024 * 1024;
+static const auto tick = chrono::milliseconds(1);
+
+static
+void run(file_io::Backend backend, const fs::path& dir, size_t total_mib)
+{
+    if (!file_io::set_backend(backend)) {
+        cout << file_io::backend_name(backend) << ": not available" << endl;
+        return;
+    }
+
+    asio::io_context ctx;
+    auto ex = ctx.get_executor();
+
+    bool writing = true;
+    Clock::duration write_time{};
+    vector<Clock::duration> delays;
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        auto done = defer([&] { writing = false; });
+        const string block(block_size, 'x');
+        Cancel cancel;
+        auto start = Clock::now();
+        size_t total = total_mib * 1024 * 1024;
+        for (size_t fi = 0; fi * file_size < total; ++fi) {
+            auto path = dir / ("body-" + to_string(fi));
+            sys::error_code ec;
+            auto f = file_io::open_or_create(ex, path, ec);
+            if (ec) { cerr << "Failed to create file: " << ec.message() << endl; return; }
+            for (size_t w = 0; w < file_size; w += block_size)
+                file_io::write(f, asio::buffer(block), cancel, yield);
+            f.close();
+            file_io::remove_file(path);
+        }
+        write_time = Clock::now() - start;
+    });
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        asio::steady_timer timer(ex);
+        while (writing) {
+            auto expected = Clock::now() + tick;
+            timer.expires_at(expected);
+            timer.async_wait(yield);
+            delays.push_back(Clock::now() - expected);
+        }
+    });
+
+    ctx.run();
+
+    if (delays.empty()) delays.push_back({});
+    sort(delays.begin(), delays.end());
+    auto ms = [] (Clock::duration d) { return chrono::duration<double, milli>(d).count(); };
+    auto secs = chrono::duration<double>(write_time).count();
+    cout << file_io::backend_name(backend) << ": "
+         << total_mib << "MiB in " << secs << "s (" << (total_mib / secs) << "MiB/s), "
+         << "timer delay median=" << ms(delays[delays.size() / 2]) << "ms"
+         << " p99=" << ms(delays[delays.size() * 99 / 100]) << "ms"
+         << " max=" << ms(delays.back()) << "ms" << endl;
+}
+
+int main(int argc, const char** argv)
+{
+    if (argc > 3) {
+        cerr << "Usage: " << argv[0] << " [<MIB> [<DIR>]]" << endl;
+        return 1;
+    }
+
+    size_t total_mib = 256;
+    if (argc > 1) {
+        boost::string_view arg(argv[1]);
+        auto n = parse::number<size_t>(arg);
+        if (!n || *n == 0) { cerr << "Invalid size" << endl; return 1; }
+        total_mib = *n;
+    }
+    fs::path base = argc > 2 ? fs::path(argv[2]) : fs::temp_directory_path();
+
+    auto dir = base / fs::unique_path("ouinet-bench-file-io-%%%%-%%%%");
+    fs::create_directories(dir);
+    auto rmdir = defer([&] { sys::error_code ec; fs::remove_all(dir, ec); });
+
+    for (auto b : { file_io::Backend::descriptor
+                  , file_io::Backend::thread_pool
+                  , file_io::Backend::io_uring })
+        run(b, dir, total_mib);
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+// Measure how fast a big signed response stored in v1 and v2 format
+// can be read in full, and how fast single data blocks at its end
+// can be read as ranges (as when serving other peers).
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/filesystem.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "../src/cache/http_sign.h"
+#include "../src/cache/http_store.h"
+#include "../src/defer.h"
+#include "../src/generic_stream.h"
+#include "../src/namespaces.h"
+#include "../src/parse/number.h"
+#include "../src/util/crypto.h"
+#include "../src/util/wait_condition.h"
+#include "connected_pair.h"
+
+using namespace std;
+using namespace ouinet;
+
+using Clock = chrono::steady_clock;
+
+static
+double secs(Clock::duration d)
+{
+    return chrono::duration<double>(d).count();
+}
+
+// Sign a response with the given body size and store it in v1 format.
+static
+void store_response( const fs::path& dir, size_t body_size
+                   , asio::io_context& ctx, asio::yield_context yield)
+{
+    auto ex = ctx.get_executor();
+    auto p = util::connected_pair(ex, yield);
+
+    WaitCondition wc(ctx);
+    asio::spawn(ctx, [&, lock = wc.lock()] (asio::yield_context y) {
+        string head = "HTTP/1.1 200 OK\r\n"
+                      "Date: Mon, 15 Jan 2018 20:31:50 GMT\r\n"
+                      "Content-Type: application/octet-stream\r\n"
+                      "Content-Length: " + to_string(body_size) + "\r\n\r\n";
+        asio::async_write(p.first, asio::buffer(head), y);
+        string block(http_::response_data_block, 'x');
+        for (size_t sent = 0; sent < body_size; sent += block.size())
+            asio::async_write(p.first, asio::buffer(block, min(block.size(), body_size - sent)), y);
+        p.first.close();
+    });
+
+    http::request_header<> rqh;
+    rqh.method(http::verb::get);
+    rqh.target("https://example.com/big");
+    rqh.version(11);
+    rqh.set(http::field::host, "example.com");
+    cache::SigningReader sr( GenericStream(move(p.second)), rqh
+                           , "d6076384-2295-462b-a047-fe2c9274e58d", 1516048310
+                           , util::Ed25519PrivateKey::generate());
+    cache::http_store_v1(sr, dir, ex, {}, yield);
+    wc.wait(yield);
+}
+
+static
+size_t drain(cache::reader_uptr rr, asio::yield_context yield)
+{
+    Cancel cancel;
+    size_t bytes = 0;
+    while (auto part = rr->async_read_part(cancel, yield))
+        if (auto b = part->as_chunk_body()) bytes += b->size();
+    return bytes;
+}
+
+static
+void bench_reads( const string& what, const fs::path& dir
+                , size_t blocks, size_t ranges
+                , asio::io_context& ctx, asio::yield_context yield)
+{
+    auto ex = ctx.get_executor();
+    sys::error_code ec;
+
+    auto start = Clock::now();
+    auto bytes = drain(cache::http_store_reader_v1(dir, ex, ec), yield);
+    auto elapsed = secs(Clock::now() - start);
+    cout << what << " full: " << bytes << " bytes in " << elapsed << "s, "
+         << (bytes / elapsed / 1048576) << "MiB/s" << endl;
+
+    cache::HttpBlockRange last{blocks - 1, blocks - 1};
+    start = Clock::now();
+    for (size_t i = 0; i < ranges; ++i)
+        drain(cache::http_store_range_reader_v1(dir, ex, last, ec), yield);
+    elapsed = secs(Clock::now() - start);
+    cout << what << " last block: " << ranges << " ranges in " << elapsed << "s, "
+         << (ranges / elapsed) << " ranges/s" << endl;
+}
+
+int main(int argc, const char** argv)
+{
+    if (argc > 3) {
+        cerr << "Usage: " << argv[0] << " [<MIB> [<RANGES>]]" << endl;
+        return 1;
+    }
+
+    size_t mib = 64, ranges = 100;
+    for (int i = 1; i < argc; ++i) {
+        boost::string_view arg(argv[i]);
+        auto n = parse::number<size_t>(arg);
+        if (!n || *n == 0) { cerr << "Invalid number: " << arg << endl; return 1; }
+        (i == 1 ? mib : ranges) = *n;
+    }
+
+    util::crypto_init();
+
+    auto tmpdir = fs::temp_directory_path() / fs::unique_path("ouinet-bench-http-store-%%%%-%%%%");
+    auto v1dir = tmpdir / "v1", v2dir = tmpdir / "v2";
+    auto rmdir = defer([&] { sys::error_code ec; fs::remove_all(tmpdir, ec); });
+    fs::create_directories(v1dir);
+    fs::create_directories(v2dir);
+
+    size_t body_size = mib * 1048576;
+    size_t blocks = (body_size + http_::response_data_block - 1) / http_::response_data_block;
+
+    asio::io_context ctx;
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        store_response(v1dir, body_size, ctx, yield);
+
+        for (auto& f : fs::directory_iterator(v1dir))
+            fs::copy_file(f, v2dir / f.path().filename());
+        auto start = Clock::now();
+        cache::http_store_migrate_v2(v2dir, ctx.get_executor(), {}, yield);
+        cout << "Migration of " << blocks << " signatures: "
+             << secs(Clock::now() - start) << "s" << endl;
+
+        bench_reads("v1", v1dir, blocks, ranges, ctx, yield);
+        bench_reads("v2", v2dir, blocks, ranges, ctx, yield);
+    });
+    ctx.run();
+
+    return 0;
+}
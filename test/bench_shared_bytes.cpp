@@ -0,0 +1,155 @@
+// Compare how fast body data can be placed in freshly allocated vectors
+// and in pooled slabs via `util::SlabAllocator`
+// while the last parts are kept queued (as when forwarding responses),
+// and measure how fast `http_response::Reader` reads plain and chunked bodies
+// over a loopback connection.
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/write.hpp>
+
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../src/namespaces.h"
+#include "../src/parse/number.h"
+#include "../src/response_reader.h"
+#include "../src/util/shared_bytes.h"
+#include "../src/util/str.h"
+
+using namespace std;
+using namespace ouinet;
+
+using Clock = chrono::steady_clock;
+using tcp = asio::ip::tcp;
+
+static const size_t queue_depth = 16;  // parts kept alive at a time
+
+static
+double secs_since(Clock::time_point start)
+{
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+template<class MakePart>
+static
+double alloc_mib_per_sec(const string& data, size_t mib, MakePart make_part)
+{
+    deque<util::SharedBytes> queue;
+    size_t parts = mib * 1048576 / data.size();
+    size_t check = 0;
+    auto start = Clock::now();
+    for (size_t i = 0; i < parts; ++i) {
+        queue.push_back(make_part(data));
+        if (queue.size() > queue_depth) {
+            check += queue.front()[0];
+            queue.pop_front();
+        }
+    }
+    auto rate = mib / secs_since(start);
+    if (check == 42) cerr << "";  // keep reads from being optimized away
+    return rate;
+}
+
+static
+double read_mib_per_sec(bool chunked, size_t part_size, size_t mib)
+{
+    asio::io_context ctx;
+    tcp::acceptor acceptor(ctx, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    size_t total = mib * 1048576;
+    size_t received = 0;
+    Clock::duration elapsed{};
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        tcp::socket s(ctx);
+        acceptor.async_accept(s, yield);
+
+        string head = "HTTP/1.1 200 OK\r\n";
+        head += chunked ? "Transfer-Encoding: chunked\r\n\r\n"
+                        : "Content-Length: " + to_string(total) + "\r\n\r\n";
+        asio::async_write(s, asio::buffer(head), yield);
+
+        const string data(part_size, 'x');
+        string chunk_hdr = util::str(hex, part_size, "\r\n");
+        for (size_t sent = 0; sent < total; sent += part_size) {
+            if (chunked) {
+                asio::async_write(s, vector<asio::const_buffer>{
+                    asio::buffer(chunk_hdr), asio::buffer(data), asio::buffer("\r\n", 2)}, yield);
+            } else {
+                asio::async_write(s, asio::buffer(data), yield);
+            }
+        }
+        if (chunked) asio::async_write(s, asio::buffer("0\r\n\r\n", 5), yield);
+    });
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        tcp::socket s(ctx);
+        s.async_connect(acceptor.local_endpoint(), yield);
+        http_response::Reader reader(move(s));
+
+        deque<http_response::Part> queue;
+        Cancel cancel;
+        auto start = Clock::now();
+        while (auto part = reader.async_read_part(cancel, yield)) {
+            if (auto b = part->as_body()) received += b->size();
+            else if (auto cb = part->as_chunk_body()) received += cb->size();
+            else if (part->is_trailer()) break;
+            queue.push_back(std::move(*part));
+            if (queue.size() > queue_depth) queue.pop_front();
+        }
+        elapsed = Clock::now() - start;
+    });
+
+    ctx.run();
+
+    if (received != total) {
+        cerr << "Received " << received << " bytes instead of " << total << endl;
+        return 0;
+    }
+    return mib / chrono::duration<double>(elapsed).count();
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2) {
+        cerr << "Usage: " << argv[0] << " [<MIB>]" << endl;
+        return 1;
+    }
+
+    size_t mib = 1024;  // data to allocate or read per run
+    if (argc > 1) {
+        boost::string_view arg(argv[1]);
+        auto n = parse::number<size_t>(arg);
+        if (!n || *n == 0) { cerr << "Invalid number: " << arg << endl; return 1; }
+        mib = *n;
+    }
+
+    for (size_t part_size : {1024, 16384, 65536}) {
+        const string data(part_size, 'x');
+
+        auto vector_rate = alloc_mib_per_sec(data, mib, [] (const string& d) {
+            return util::SharedBytes(vector<uint8_t>(d.begin(), d.end()));
+        });
+
+        util::SlabAllocator alloc;
+        auto slab_rate = alloc_mib_per_sec(data, mib, [&alloc] (const string& d) {
+            return alloc.copy(d.data(), d.size());
+        });
+
+        cout << "alloc part_size=" << part_size << ": "
+             << "vector=" << vector_rate << "MiB/s "
+             << "slab=" << slab_rate << "MiB/s" << endl;
+    }
+
+    for (size_t part_size : {1024, 16384, 65536}) {
+        cout << "read part_size=" << part_size << ": "
+             << "plain=" << read_mib_per_sec(false, part_size, mib) << "MiB/s "
+             << "chunked=" << read_mib_per_sec(true, part_size, mib) << "MiB/s" << endl;
+    }
+
+    return 0;
+}
@@ -2,12 +2,15 @@
 #include <boost/test/included/unit_test.hpp>
 
 #include "connection_pool.h"
+#include "origin_pools.h"
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/read.hpp>
 #include <boost/asio/steady_timer.hpp>
 #include <boost/asio/write.hpp>
 #include <chrono>
 
+#include "connected_pair.h"
+
 using namespace ouinet;
 
 BOOST_AUTO_TEST_SUITE(connection_pool)
@@ -155,4 +158,73 @@ BOOST_AUTO_TEST_CASE(test_behavior)
     ios.run();
 }
 
+BOOST_AUTO_TEST_CASE(test_origin_pools)
+{
+    using tcp = asio::ip::tcp;
+    using Connection = OriginPools::Connection;
+
+    asio::io_context ctx;
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        auto ex = ctx.get_executor();
+
+        http::request_header<> rq;
+        rq.method(http::verb::get);
+        rq.target("http://example.com/");
+        rq.set(http::field::host, "example.com");
+
+        OriginPools pools(2, std::chrono::milliseconds(200));
+
+        BOOST_CHECK(!pools.get_connection(rq));
+        BOOST_CHECK_EQUAL(pools.counters().misses, 1);
+
+        // Keep the remote ends open so that pooled connections stay idle.
+        std::vector<tcp::socket> remotes;
+        auto new_connection = [&] {
+            auto pair = util::connected_pair(ex, yield);
+            remotes.push_back(std::move(pair.second));
+            return pools.wrap(rq, GenericStream(std::move(pair.first)));
+        };
+
+        // Connections can be recovered after being used as generic streams.
+        {
+            GenericStream s(new_connection());
+            BOOST_CHECK(!s.release_as<tcp::socket>());
+            BOOST_CHECK(s.has_implementation());
+            auto c = s.release_as<Connection>();
+            BOOST_REQUIRE(c);
+            BOOST_CHECK(c->is_open());
+            BOOST_CHECK(!s.has_implementation());
+            pools.insert_connection(rq, std::move(*c));
+        }
+
+        // At most two idle connections are kept.
+        pools.insert_connection(rq, new_connection());
+        pools.insert_connection(rq, new_connection());
+        BOOST_CHECK_EQUAL(pools.idle_connections(), 2);
+        BOOST_CHECK_EQUAL(pools.counters().inserted, 3);
+        BOOST_CHECK_EQUAL(pools.counters().evicted, 1);
+
+        {
+            auto c = pools.get_connection(rq);
+            BOOST_REQUIRE(c);
+            BOOST_CHECK(c->is_open());
+            BOOST_CHECK_EQUAL(pools.counters().hits, 1);
+            pools.insert_connection(rq, std::move(*c));
+        }
+
+        // Idle connections expire.
+        asio::steady_timer timer(ex);
+        timer.expires_from_now(std::chrono::milliseconds(300));
+        timer.async_wait(yield);
+
+        BOOST_CHECK(!pools.get_connection(rq));
+        BOOST_CHECK_EQUAL(pools.counters().misses, 2);
+        BOOST_CHECK_EQUAL(pools.counters().expired, 2);
+        BOOST_CHECK_EQUAL(pools.idle_connections(), 0);
+    });
+
+    ctx.run();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,7 @@
 #include <boost/optional/optional_io.hpp>
 #include "../src/or_throw.h"
 #include "../src/response_reader.h"
+#include "../src/session.h"
 #include "../src/util/wait_condition.h"
 
 using namespace std;
@@ -53,7 +54,7 @@ vector<uint8_t> str_to_vec(boost::string_view s) {
     return {p, p + s.size()};
 }
 
-string vec_to_str(const vector<uint8_t>& v) {
+string vec_to_str(const util::SharedBytes& v) {
     const char* p = reinterpret_cast<const char*>(v.data());
     return {p, v.size()};
 }
@@ -101,7 +102,7 @@ namespace ouinet { namespace http_response {
 }} // ouinet namespaces::http_response
 
 HR::Part read_full_body(RR& rr, Cancel& c, asio::yield_context y) {
-    HR::Body body({});
+    vector<uint8_t> body;
 
     while (true) {
         sys::error_code ec;
@@ -113,7 +114,7 @@ HR::Part read_full_body(RR& rr, Cancel& c, asio::yield_context y) {
         body.insert(body.end(), body_p->begin(), body_p->end());
     }
 
-    return body;
+    return HR::Body(move(body));
 }
 
 BOOST_AUTO_TEST_SUITE(ouinet_response_reader)
@@ -240,6 +241,45 @@ BOOST_AUTO_TEST_CASE(test_http11_body) {
     ios.run();
 }
 
+// Parts are kept until the whole response is read,
+// so their data must survive further reads.
+BOOST_AUTO_TEST_CASE(test_http11_big_body) {
+    asio::io_service ios;
+
+    asio::spawn(ios, [&] (auto y) {
+        string data;
+        for (size_t i = 0; data.size() < 4 * 1024 * 1024; ++i)
+            data += to_string(i) + ' ';
+
+        string rsp =
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Length: " + to_string(data.size()) + "\r\n"
+            "\r\n" + data;
+
+        RR rr(stream(move(rsp), ios, y));
+
+        Cancel c;
+        auto part = rr.async_read_part(c, y);
+        BOOST_REQUIRE(part);
+        BOOST_REQUIRE(part->is_head());
+
+        vector<HR::Body> parts;
+        while (true) {
+            part = rr.async_read_part(c, y);
+            if (!part) break;
+            BOOST_REQUIRE(part->is_body());
+            parts.push_back(*part->as_body());
+        }
+        BOOST_REQUIRE(rr.is_done());
+
+        string read;
+        for (const auto& b : parts) read += vec_to_str(b);
+        BOOST_REQUIRE(read == data);
+    });
+
+    ios.run();
+}
+
 BOOST_AUTO_TEST_CASE(test_http11_chunk) {
     asio::io_service ios;
 
@@ -486,6 +526,45 @@ BOOST_AUTO_TEST_CASE(test_http11_restart_chunks_body) {
     ios.run();
 }
 
+BOOST_AUTO_TEST_CASE(test_session_reusable_stream) {
+    asio::io_service ios;
+
+    asio::spawn(ios, [&] (auto y) {
+        auto flush = [&] (string rsp) {
+            auto s = Session::create(stream(move(rsp), ios, y), {}, y);
+
+            boost::optional<GenericStream> reusable;
+            s.on_reusable_stream([&] (GenericStream con) {
+                reusable = move(con);
+            });
+
+            Cancel c;
+            s.flush_response(c, y, [&] (HR::Part&&, Cancel&, asio::yield_context) {
+                BOOST_REQUIRE(!reusable);  // only after the whole response
+            });
+            return reusable;
+        };
+
+        auto keep = flush(
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Length: 10\r\n"
+            "\r\n"
+            "0123456789");
+        BOOST_REQUIRE(keep);
+        BOOST_REQUIRE(keep->is_open());
+
+        auto close = flush(
+            "HTTP/1.1 200 OK\r\n"
+            "Connection: close\r\n"
+            "Content-Length: 10\r\n"
+            "\r\n"
+            "0123456789");
+        BOOST_REQUIRE(!close);
+    });
+
+    ios.run();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 
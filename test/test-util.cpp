@@ -5,8 +5,11 @@
 #include <namespaces.h>
 #include <async_sleep.h>
 #include <util/async_generator.h>
+#include <util/thread_pool.h>
 #include <iostream>
 #include <chrono>
+#include <thread>
+#include <vector>
 
 BOOST_AUTO_TEST_SUITE(ouinet_util)
 
@@ -155,5 +158,36 @@ BOOST_AUTO_TEST_CASE(test_async_generator) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(test_thread_pool) {
+    asio::io_context ctx;
+    util::ThreadPool pool(2);
+
+    asio::spawn(ctx, [&] (auto yield) {
+        auto caller = this_thread::get_id();
+
+        auto worker = pool.run([] { return this_thread::get_id(); }, yield);
+        BOOST_REQUIRE(worker != caller);
+        BOOST_REQUIRE(this_thread::get_id() == caller);
+
+        bool ran = false;
+        pool.run([&] { ran = true; }, yield);
+        BOOST_REQUIRE(ran);
+
+        BOOST_REQUIRE_THROW( pool.run([] () -> int { throw runtime_error("x"); }, yield)
+                           , runtime_error);
+
+        vector<size_t> squares(100);
+        pool.run_each(squares.size(), [&] (size_t i) { squares[i] = i * i; }, yield);
+        for (size_t i = 0; i < squares.size(); ++i) BOOST_REQUIRE_EQUAL(squares[i], i * i);
+
+        BOOST_REQUIRE_THROW( pool.run_each(10, [] (size_t i) {
+                                 if (i == 5) throw runtime_error("x");
+                             }, yield)
+                           , runtime_error);
+    });
+
+    ctx.run();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
@@ -0,0 +1,156 @@
+#define BOOST_TEST_MODULE announcer
+#include <boost/test/included/unit_test.hpp>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/spawn.hpp>
+
+#include <async_sleep.h>
+#include <cache/bep5_http/announcer.h>
+#include <util/hash.h>
+
+#include <namespaces.h>
+
+BOOST_AUTO_TEST_SUITE(ouinet_announcer)
+
+using namespace std;
+using namespace ouinet;
+using namespace chrono_literals;
+
+using cache::bep5_http::Announcer;
+using bittorrent::NodeID;
+
+static const auto announce_duration = 50ms;
+
+// Announces nothing, just records which infohashes were announced
+// and how many announcements ran at a time.
+struct FakeDht {
+    asio::executor ex;
+    vector<NodeID> started;  // in the order announcements started
+    size_t done = 0;
+    size_t running = 0;
+    size_t max_running = 0;
+
+    Announcer::AnnounceFunc func()
+    {
+        return [this] (const NodeID& infohash, Cancel& cancel, asio::yield_context yield) {
+            started.push_back(infohash);
+            max_running = max(max_running, ++running);
+            async_sleep(ex, announce_duration, cancel, yield);
+            --running;
+            if (cancel) return or_throw(yield, asio::error::operation_aborted);
+            ++done;
+        };
+    }
+};
+
+static
+NodeID infohash(const string& key)
+{
+    return NodeID(util::sha1_digest(key));
+}
+
+// Wait until `n` announcements are done.
+static
+void wait_done(FakeDht& dht, size_t n, asio::yield_context yield)
+{
+    Cancel cancel;
+    while (dht.done < n) async_sleep(dht.ex, 10ms, cancel, yield);
+}
+
+BOOST_AUTO_TEST_CASE(test_parallel_announcements)
+{
+    asio::io_context ctx;
+    FakeDht dht{ctx.get_executor()};
+    auto announcer = make_unique<Announcer>(ctx.get_executor(), dht.func(), INFO);
+
+    const size_t parallel = Announcer::max_parallel_announcements();
+    const size_t n = 3 * parallel;
+
+    map<NodeID, string> keys;
+    for (size_t i = 0; i < n; ++i) {
+        auto key = "example" + to_string(i) + ".com";
+        keys[infohash(key)] = key;
+        announcer->add(key);
+    }
+    // Adding a key again does not announce it twice.
+    announcer->add(keys.begin()->second);
+
+    auto s = announcer->stats();
+    BOOST_CHECK_EQUAL(s.entries, n);
+    BOOST_CHECK_EQUAL(s.running, 0);
+    BOOST_CHECK_EQUAL(s.backlog, n);
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Cancel cancel;
+        async_sleep(ctx, announce_duration / 2, cancel, yield);
+
+        // A bounded number of announcements run at a time.
+        s = announcer->stats();
+        BOOST_CHECK_EQUAL(s.running, parallel);
+        BOOST_CHECK_EQUAL(s.backlog, n - parallel);
+
+        // An entry removed while being announced is not kept.
+        auto last_running = next(keys.begin(), parallel - 1)->second;
+        announcer->remove(last_running);
+
+        wait_done(dht, n, yield);
+        BOOST_CHECK_EQUAL(dht.max_running, parallel);
+
+        // New entries are announced in infohash order.
+        BOOST_REQUIRE_EQUAL(dht.started.size(), n);
+        for (size_t i = 0; i < n; ++i)
+            BOOST_CHECK(dht.started[i] == next(keys.begin(), i)->first);
+
+        s = announcer->stats();
+        BOOST_CHECK_EQUAL(s.entries, n - 1);
+        BOOST_CHECK_EQUAL(s.running, 0);
+        BOOST_CHECK_EQUAL(s.backlog, 0);
+
+        announcer.reset();
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_infohash_sweep)
+{
+    asio::io_context ctx;
+    FakeDht dht{ctx.get_executor()};
+    auto announcer = make_unique<Announcer>(ctx.get_executor(), dht.func(), INFO);
+
+    // Find keys with infohashes below and above that of the first one.
+    const string first = "example.com";
+    string below, above;
+    for (size_t i = 0; below.empty() || above.empty(); ++i) {
+        auto key = "example" + to_string(i) + ".com";
+        if (infohash(key) < infohash(first)) { if (below.empty()) below = key; }
+        else if (above.empty()) above = key;
+    }
+
+    announcer->add(first);
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        wait_done(dht, 1, yield);
+
+        // Announcements go on from the last infohash announced,
+        // then wrap around.
+        announcer->add(below);
+        announcer->add(above);
+        wait_done(dht, 3, yield);
+
+        BOOST_REQUIRE_EQUAL(dht.started.size(), 3);
+        BOOST_CHECK(dht.started[1] == infohash(above));
+        BOOST_CHECK(dht.started[2] == infohash(below));
+
+        announcer.reset();
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,7 @@
 #include <util/wait_condition.h>
 
 #define private public
+#include <bittorrent/bencoding.h>
 #include <bittorrent/node_id.h>
 #include <bittorrent/dht.h>
 #include <bittorrent/code.h>
@@ -45,6 +46,47 @@ float seconds(Clock::duration d)
     return duration_cast<milliseconds>(d).count() / 1000.f;
 }
 
+BOOST_AUTO_TEST_CASE(test_bencoding_view)
+{
+    // A `get_peers` reply with some trailing garbage.
+    string msg = "d1:rd2:id20:abcdefghij01234567895:token8:aoeusnth"
+                 "6:valuesl6:axje.u6:idhtnmee1:t2:aa1:y1:re";
+    string packet = msg + "xyz";  // views refer to it
+    auto view = bencoding_decode_view(packet);
+    BOOST_REQUIRE(view);
+    BOOST_REQUIRE_EQUAL(view->encoded(), msg);
+    BOOST_REQUIRE(view->is_map());
+
+    BOOST_REQUIRE((*view)["y"] == "r");
+    BOOST_REQUIRE((*view)["t"] == "aa");
+    BOOST_REQUIRE((*view)["x"].is_null());
+    BOOST_REQUIRE(!(*view)["x"].as_string());
+    BOOST_REQUIRE(!view->count("a"));
+
+    auto r = (*view)["r"];
+    BOOST_REQUIRE(r.is_map());
+    BOOST_REQUIRE_EQUAL(*r["id"].as_string(), "abcdefghij0123456789");
+    BOOST_REQUIRE(!r["id"].as_int());
+    vector<string> values;
+    r["values"].for_each_item([&] (BencodedView v) {
+        values.push_back(v.as_string()->to_string());
+    });
+    BOOST_REQUIRE_EQUAL(values.size(), 2);
+    BOOST_REQUIRE_EQUAL(values[1], "idhtnm");
+
+    // Decoded copies match those from the owning decoder.
+    auto value = bencoding_decode(msg);
+    BOOST_REQUIRE(value);
+    BOOST_REQUIRE_EQUAL(bencoding_encode(view->decode()), bencoding_encode(*value));
+    BOOST_REQUIRE_EQUAL(*bencoding_decode_view("i-42e")->as_int(), -42);
+
+    // Malformed values are rejected.
+    for (auto bad : {"", "i42", "4:abc", "-1:a", "l1:a", "d1:bi1e1:ai2ee", "d1:ae", "x"}) {
+        BOOST_REQUIRE(!bencoding_decode_view(bad));
+        BOOST_REQUIRE(!bencoding_decode(bad));
+    }
+}
+
 BOOST_AUTO_TEST_CASE(test_bep_5)
 {
     using namespace ouinet::bittorrent::dht;
@@ -0,0 +1,118 @@
+#define BOOST_TEST_MODULE dns_cache
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+
+#include <dns_cache.h>
+#include <util/wait_condition.h>
+
+BOOST_AUTO_TEST_SUITE(ouinet_dns_cache)
+
+using namespace std;
+using namespace ouinet;
+
+// "localhost" is resolved locally, so no network is needed.
+static const string host = "localhost";
+
+BOOST_AUTO_TEST_CASE(test_coalesce_and_hit)
+{
+    asio::io_context ctx;
+    auto ex = ctx.get_executor();
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        DnsCache cache(ex);
+
+        // Concurrent lookups share a single query.
+        WaitCondition wc(ex);
+        for (int i = 0; i < 3; ++i) {
+            asio::spawn(ctx, [&, lock = wc.lock()] (asio::yield_context y) {
+                Cancel cancel;
+                sys::error_code ec;
+                auto r = cache.resolve(host, "80", cancel, y[ec]);
+                BOOST_REQUIRE(!ec);
+                BOOST_REQUIRE(!r.empty());
+                BOOST_CHECK_EQUAL(r.begin()->endpoint().port(), 80);
+            });
+        }
+        wc.wait(yield);
+        BOOST_CHECK_EQUAL(cache.counters().misses, 1);
+        BOOST_CHECK_EQUAL(cache.counters().coalesced, 2);
+
+        // Later lookups come from the cache, different ports do not.
+        Cancel cancel;
+        cache.resolve(host, "80", cancel, yield);
+        BOOST_CHECK_EQUAL(cache.counters().hits, 1);
+        auto r = cache.resolve(host, "443", cancel, yield);
+        BOOST_CHECK_EQUAL(r.begin()->endpoint().port(), 443);
+        BOOST_CHECK_EQUAL(cache.counters().misses, 2);
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_cancel_one)
+{
+    asio::io_context ctx;
+    auto ex = ctx.get_executor();
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        DnsCache cache(ex);
+
+        // Cancelling a lookup does not affect others of the same name.
+        Cancel cancel1, cancel2;
+        sys::error_code ec1, ec2;
+        WaitCondition wc(ex);
+        asio::spawn(ctx, [&, lock = wc.lock()] (asio::yield_context y) {
+            cache.resolve(host, "80", cancel1, y[ec1]);
+        });
+        asio::spawn(ctx, [&, lock = wc.lock()] (asio::yield_context y) {
+            cache.resolve(host, "80", cancel2, y[ec2]);
+        });
+        asio::post(ex, [&] { cancel1(); });
+        wc.wait(yield);
+
+        BOOST_CHECK_EQUAL(ec1, asio::error::operation_aborted);
+        BOOST_CHECK(!ec2);
+
+        Cancel cancel;
+        cache.resolve(host, "80", cancel, yield);
+        BOOST_CHECK_EQUAL(cache.counters().hits, 1);
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_expiry)
+{
+    asio::io_context ctx;
+    auto ex = ctx.get_executor();
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        DnsCache cache(ex, 16, chrono::milliseconds(300));
+        Cancel cancel;
+
+        cache.resolve(host, "80", cancel, yield);
+        BOOST_CHECK_EQUAL(cache.counters().misses, 1);
+
+        // Looking up a name about to expire refreshes it in the background.
+        asio::steady_timer timer(ex, chrono::milliseconds(270));
+        timer.async_wait(yield);
+        cache.resolve(host, "80", cancel, yield);
+        BOOST_CHECK_EQUAL(cache.counters().hits, 1);
+        BOOST_CHECK_EQUAL(cache.counters().refreshed, 1);
+
+        // Once expired, the name is resolved again.
+        DnsCache cold(ex, 16, chrono::milliseconds(10));
+        cold.resolve(host, "80", cancel, yield);
+        timer.expires_after(chrono::milliseconds(20));
+        timer.async_wait(yield);
+        cold.resolve(host, "80", cancel, yield);
+        BOOST_CHECK_EQUAL(cold.counters().misses, 2);
+        BOOST_CHECK_EQUAL(cold.counters().hits, 0);
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,178 @@
+#define BOOST_TEST_MODULE full_duplex
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+#include <chrono>
+
+#include <full_duplex_forward.h>
+#include <generic_stream.h>
+#include <util/wait_condition.h>
+
+#include "connected_pair.h"
+
+BOOST_AUTO_TEST_SUITE(ouinet_full_duplex)
+
+using namespace std;
+using namespace ouinet;
+using tcp = asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+// A stream which is not a plain TCP socket,
+// so that data is forwarded through a user space buffer.
+struct OpaqueStream {
+    tcp::socket s;
+
+    asio::executor get_executor() { return s.get_executor(); }
+
+    template<class B, class T>
+    auto async_read_some(const B& b, T&& t)
+    { return s.async_read_some(b, std::forward<T>(t)); }
+
+    template<class B, class T>
+    auto async_write_some(const B& b, T&& t)
+    { return s.async_write_some(b, std::forward<T>(t)); }
+
+    void close() { s.close(); }
+    bool is_open() const { return s.is_open(); }
+};
+
+static const size_t transfer_size = 32 * 1024 * 1024;
+
+// Send `transfer_size` bytes from `a` to `d` and a short reply back,
+// with `b` and `c` being tunnelled with `full_duplex`.
+// Return the transfer rate in MiB/s.
+template<class MakeStream>
+static
+double tunnel(MakeStream make_stream)
+{
+    asio::io_context ctx;
+    double rate = 0;
+
+    asio::spawn(ctx, [&] (asio::yield_context y) {
+        auto ex = ctx.get_executor();
+        auto ab = util::connected_pair(ex, y);
+        auto cd = util::connected_pair(ex, y);
+        auto& a = ab.first;
+        auto& d = cd.second;
+
+        WaitCondition wc(ex);
+
+        asio::spawn(ex, [ b = make_stream(move(ab.second))
+                        , c = make_stream(move(cd.first))
+                        , lock = wc.lock()
+                        ] (asio::yield_context y) mutable {
+            full_duplex(move(b), move(c), y);
+        });
+
+        vector<uint8_t> out(64 * 1024);
+        for (size_t i = 0; i < out.size(); ++i) out[i] = i % 251;
+
+        auto start = Clock::now();
+
+        asio::spawn(ex, [&, lock = wc.lock()] (asio::yield_context y) {
+            for (size_t sent = 0; sent < transfer_size; sent += out.size())
+                asio::async_write(a, asio::buffer(out), y);
+        });
+
+        vector<uint8_t> in(out.size());
+        for (size_t recv = 0; recv < transfer_size; recv += in.size()) {
+            asio::async_read(d, asio::buffer(in), y);
+            BOOST_REQUIRE(in == out);
+        }
+
+        auto secs = chrono::duration<double>(Clock::now() - start).count();
+        rate = transfer_size / (1024.0 * 1024.0) / secs;
+
+        // Check the other direction too.
+        string reply = "done";
+        asio::async_write(d, asio::buffer(reply), y);
+        string reply_in(reply.size(), '\0');
+        asio::async_read(a, asio::buffer(&reply_in[0], reply_in.size()), y);
+        BOOST_REQUIRE_EQUAL(reply_in, reply);
+
+        a.close();
+        d.close();
+        wc.wait(y);
+    });
+
+    ctx.run();
+    return rate;
+}
+
+BOOST_AUTO_TEST_CASE(test_tcp_sockets) {
+    auto rate = tunnel([] (tcp::socket s) { return s; });
+    BOOST_TEST_MESSAGE("TCP sockets: " << rate << " MiB/s");
+}
+
+BOOST_AUTO_TEST_CASE(test_generic_tcp_streams) {
+    auto rate = tunnel([] (tcp::socket s) { return GenericStream(move(s)); });
+    BOOST_TEST_MESSAGE("Generic TCP streams: " << rate << " MiB/s");
+}
+
+BOOST_AUTO_TEST_CASE(test_generic_other_streams) {
+    auto rate = tunnel([] (tcp::socket s) {
+        return GenericStream(OpaqueStream{move(s)});
+    });
+    BOOST_TEST_MESSAGE("Other generic streams: " << rate << " MiB/s");
+}
+
+// The receiving end resets the connection while data is being forwarded.
+template<class MakeStream>
+static
+void tunnel_reset(MakeStream make_stream)
+{
+    asio::io_context ctx;
+
+    asio::spawn(ctx, [&] (asio::yield_context y) {
+        auto ex = ctx.get_executor();
+        auto ab = util::connected_pair(ex, y);
+        auto cd = util::connected_pair(ex, y);
+        auto& a = ab.first;
+        auto& d = cd.second;
+
+        WaitCondition wc(ex);
+        bool forwarded = false;
+
+        asio::spawn(ex, [ b = make_stream(move(ab.second))
+                        , c = make_stream(move(cd.first))
+                        , &forwarded
+                        , lock = wc.lock()
+                        ] (asio::yield_context y) mutable {
+            full_duplex(move(b), move(c), y);
+            forwarded = true;
+        });
+
+        vector<uint8_t> data(64 * 1024, 'x');
+        asio::async_write(a, asio::buffer(data), y);
+        asio::async_read(d, asio::buffer(data), y);
+
+        d.set_option(asio::socket_base::linger(true, 0));
+        d.close();  // sends RST
+
+        // Let the reset be seen by reading from the forwarded connection,
+        // then keep sending until forwarding stops.
+        asio::steady_timer t(ex, chrono::milliseconds(100));
+        t.async_wait(y);
+        sys::error_code ec;
+        while (!ec) asio::async_write(a, asio::buffer(data), y[ec]);
+        a.close();
+
+        wc.wait(y);
+        BOOST_CHECK(forwarded);
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_tcp_sockets_reset) {
+    tunnel_reset([] (tcp::socket s) { return s; });
+}
+
+BOOST_AUTO_TEST_CASE(test_generic_other_streams_reset) {
+    tunnel_reset([] (tcp::socket s) {
+        return GenericStream(OpaqueStream{move(s)});
+    });
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,11 +3,13 @@
 #include <boost/test/included/unit_test.hpp>
 
 #include <array>
+#include <fstream>
 #include <sstream>
 #include <string>
 
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/asio/write.hpp>
 #include <boost/filesystem.hpp>
 
@@ -16,9 +18,13 @@
 #include <defer.h>
 #include <response_part.h>
 #include <session.h>
+#include <util.h>
 #include <util/bytes.h>
+#include <util/crypto.h>
 #include <util/file_io.h>
+#include <util/hash.h>
 #include <util/str.h>
+#include <util/wait_condition.h>
 
 #include <namespaces.h>
 #include "connected_pair.h"
@@ -466,4 +472,768 @@ BOOST_DATA_TEST_CASE(test_read_response, boost::unit_test::data::make(true_false
     });
 }
 
+// Send the complete signed response over the given stream.
+template<class Stream>
+static void send_signed_response(Stream& signed_w, asio::yield_context y) {
+    asio::async_write( signed_w
+                     , asio::const_buffer(rs_head.data(), rs_head.size())
+                     , y);
+    unsigned bi;
+    for (bi = 0; bi < rs_block_data.size(); ++bi) {
+        auto cbd = util::bytes::to_vector<uint8_t>(rs_block_data[bi]);
+        http_response::ChunkHdr(cbd.size(), rs_chunk_ext[bi]).async_write(signed_w, y);
+        http_response::ChunkBody(std::move(cbd), 0).async_write(signed_w, y);
+    }
+    http_response::ChunkHdr(0, rs_chunk_ext[bi]).async_write(signed_w, y);
+    asio::async_write( signed_w
+                     , asio::const_buffer(rs_trailer.data(), rs_trailer.size())
+                     , y);
+    signed_w.close();
+}
+
+// Store the complete signed response read from a connection
+// with the given function, which is called as `store(reader, cancel, yield)`.
+template<class StoreFunc>
+static void store_signed_response_with( asio::io_context& ctx, StoreFunc store
+                                      , asio::yield_context yield) {
+    asio::ip::tcp::socket
+        signed_w(ctx), signed_r(ctx);
+    tie(signed_w, signed_r) = util::connected_pair(ctx, yield);
+
+    WaitCondition wc(ctx);
+    asio::spawn(ctx, [&signed_w, lock = wc.lock()] (auto y) {
+        send_signed_response(signed_w, y);
+    });
+
+    Cancel c;
+    sys::error_code e;
+    http_response::Reader signed_rr(std::move(signed_r));
+    store(signed_rr, c, yield[e]);
+    BOOST_CHECK_EQUAL(e.message(), "Success");
+    wc.wait(yield);
+}
+
+// Store the complete signed response under the given key.
+template<class Store>
+static void store_signed_response( asio::io_context& ctx, Store& store
+                                 , const string& key, asio::yield_context yield) {
+    store_signed_response_with(ctx, [&] (auto& rr, auto& c, auto y) {
+        store.store(key, rr, c, y);
+    }, yield);
+}
+
+BOOST_AUTO_TEST_CASE(test_store_eviction) {
+    auto tmpdir = fs::unique_path();
+    auto rmdir = defer([&tmpdir] {
+        sys::error_code ec;
+        fs::remove_all(tmpdir, ec);
+    });
+    fs::create_directory(tmpdir);
+
+    asio::io_context ctx;
+    run_spawned(ctx, [&] (auto yield) {
+        cache::HttpStoreLimits limits;
+        limits.max_entries = 2;
+        cache::HttpStoreV1 store(tmpdir, ctx.get_executor(), limits);
+
+        sys::error_code ec;
+
+        store_signed_response(ctx, store, "key0", yield);
+        store_signed_response(ctx, store, "key1", yield);
+        BOOST_CHECK_EQUAL(store.entry_count(), 2);
+        BOOST_CHECK(store.size() > rs_body_complete.size());
+
+        // Accessing the oldest entry should save it from eviction.
+        auto rr0 = store.reader("key0", ec);
+        BOOST_CHECK_EQUAL(ec.message(), "Success");
+        rr0.reset();
+
+        store_signed_response(ctx, store, "key2", yield);
+        BOOST_CHECK_EQUAL(store.entry_count(), 2);
+
+        store.reader("key0", ec);
+        BOOST_CHECK_EQUAL(ec.message(), "Success");
+        store.reader("key1", ec);
+        BOOST_CHECK_EQUAL(ec, sys::errc::no_such_file_or_directory);
+        ec = {};
+        store.reader("key2", ec);
+        BOOST_CHECK_EQUAL(ec.message(), "Success");
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_store_index) {
+    auto tmpdir = fs::unique_path();
+    auto rmdir = defer([&tmpdir] {
+        sys::error_code ec;
+        fs::remove_all(tmpdir, ec);
+    });
+    fs::create_directory(tmpdir);
+
+    asio::io_context ctx;
+    run_spawned(ctx, [&] (auto yield) {
+        auto check_infos = [&] (cache::HttpStoreV1& store, size_t expected) {
+            size_t count = 0;
+            sys::error_code e;
+            store.for_each_info([&] (const auto& info, auto) {
+                BOOST_CHECK_EQUAL(info.uri, "https://example.com/foo");
+                BOOST_CHECK_EQUAL(info.protocol_version, 3);
+                BOOST_CHECK_EQUAL(info.injection_ts, 1516048310);
+                BOOST_REQUIRE(info.data_size);
+                BOOST_CHECK_EQUAL(*info.data_size, rs_body_complete.size());
+                return ++count != 2;  // drop the second entry
+            }, yield[e]);
+            BOOST_CHECK_EQUAL(e.message(), "Success");
+            BOOST_CHECK_EQUAL(count, expected);
+        };
+
+        {
+            cache::HttpStoreV1 store(tmpdir, ctx.get_executor());
+            store_signed_response(ctx, store, "key0", yield);
+            store_signed_response(ctx, store, "key1", yield);
+            store_signed_response(ctx, store, "key2", yield);
+            check_infos(store, 3);  // full scan, no index yet
+        }
+
+        BOOST_REQUIRE(fs::exists(tmpdir / "index"));
+
+        {
+            // Loaded from the index.
+            cache::HttpStoreV1 store(tmpdir, ctx.get_executor());
+            BOOST_CHECK_EQUAL(store.entry_count(), 2);
+            check_infos(store, 2);
+            BOOST_CHECK_EQUAL(store.entry_count(), 1);
+        }
+
+        // Corrupt the index to force a full scan.
+        {
+            std::ofstream idx((tmpdir / "index").native(), std::ios::app);
+            idx << "X garbage\n";
+        }
+
+        {
+            cache::HttpStoreV1 store(tmpdir, ctx.get_executor());
+            BOOST_CHECK_EQUAL(store.entry_count(), 0);
+            check_infos(store, 1);
+            BOOST_CHECK_EQUAL(store.entry_count(), 1);
+        }
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_store_index_touch) {
+    auto tmpdir = fs::unique_path();
+    auto rmdir = defer([&tmpdir] {
+        sys::error_code ec;
+        fs::remove_all(tmpdir, ec);
+    });
+    fs::create_directory(tmpdir);
+
+    asio::io_context ctx;
+    run_spawned(ctx, [&] (auto yield) {
+        cache::HttpStoreLimits limits;
+        limits.max_entries = 2;
+        sys::error_code ec;
+
+        {
+            cache::HttpStoreV1 store(tmpdir, ctx.get_executor(), limits);
+            // Start logging changes to the index.
+            store.for_each_info([] (const auto&, auto) { return true; }, yield);
+            store_signed_response(ctx, store, "key0", yield);
+            store_signed_response(ctx, store, "key1", yield);
+            // Logged in a batch when the store goes away.
+            store.reader("key0", ec);
+            BOOST_CHECK_EQUAL(ec.message(), "Success");
+        }
+
+        // The access saves the oldest entry from eviction after reloading.
+        cache::HttpStoreV1 store(tmpdir, ctx.get_executor(), limits);
+        BOOST_CHECK_EQUAL(store.entry_count(), 2);
+        store_signed_response(ctx, store, "key2", yield);
+        store.reader("key0", ec);
+        BOOST_CHECK_EQUAL(ec.message(), "Success");
+        store.reader("key1", ec);
+        BOOST_CHECK_EQUAL(ec, sys::errc::no_such_file_or_directory);
+    });
+}
+
+static string rs_bsigs() {
+    string recs;
+    for (size_t b = 0; b < rs_block_data.size(); ++b) {
+        uint64_t offset = b * http_::response_data_block;
+        for (int i = 7; i >= 0; --i)
+            recs += static_cast<char>((offset >> (i * 8)) & 0xff);
+        recs += util::base64_decode(rs_block_sig[b]);
+        recs += rs_block_hash[b].empty() ? string(64, '\0')
+                                         : util::base64_decode(rs_block_hash[b]);
+    }
+    return recs;
+}
+
+BOOST_AUTO_TEST_CASE(test_migrate_v2) {
+    auto tmpdir = fs::unique_path();
+    auto rmdir = defer([&tmpdir] {
+        sys::error_code ec;
+        fs::remove_all(tmpdir, ec);
+    });
+    auto v1dir = tmpdir / "v1", v2dir = tmpdir / "v2";
+    fs::create_directories(v1dir);
+    fs::create_directories(v2dir);
+
+    asio::io_context ctx;
+    run_spawned(ctx, [&] (auto yield) {
+        store_signed_response_with(ctx, [&] (auto& rr, auto& c, auto y) {
+            cache::http_store_v1(rr, v1dir, ctx.get_executor(), c, y);
+        }, yield);
+        store_signed_response_with(ctx, [&] (auto& rr, auto& c, auto y) {
+            cache::http_store_v2(rr, v2dir, ctx.get_executor(), c, y);
+        }, yield);
+
+        Cancel c;
+        sys::error_code e;
+        cache::http_store_migrate_v2(v1dir, ctx.get_executor(), c, yield[e]);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        BOOST_CHECK(!fs::exists(v1dir / "sigs"));
+
+        auto read_all = [&] (const fs::path& dir, const string& fname) {
+            ifstream f((dir / fname).native(), ios::binary);
+            return string(istreambuf_iterator<char>(f), {});
+        };
+        BOOST_CHECK(read_all(v1dir, "bsigs") == rs_bsigs());
+        BOOST_CHECK(read_all(v2dir, "bsigs") == rs_bsigs());
+
+        // Converted responses are loaded like the original ones.
+        auto rr = cache::http_store_reader_v1(v1dir, ctx.get_executor(), e);
+        BOOST_REQUIRE(rr);
+        auto part = rr->async_read_part(c, yield[e]);
+        BOOST_REQUIRE(part && part->is_head());
+        for (unsigned bi = 0; bi < rs_block_data.size(); ++bi) {
+            part = rr->async_read_part(c, yield[e]);
+            BOOST_CHECK_EQUAL(e.message(), "Success");
+            BOOST_REQUIRE(part && part->is_chunk_hdr());
+            BOOST_REQUIRE_EQUAL( *(part->as_chunk_hdr())
+                               , http_response::ChunkHdr( rs_block_data[bi].size()
+                                                        , rrs_chunk_ext[bi]));
+            part = rr->async_read_part(c, yield[e]);
+            BOOST_REQUIRE(part && part->is_chunk_body());
+        }
+        part = rr->async_read_part(c, yield[e]);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        BOOST_REQUIRE(part && part->is_chunk_hdr());
+        BOOST_REQUIRE_EQUAL( *(part->as_chunk_hdr())
+                           , http_response::ChunkHdr(0, rrs_chunk_ext[3]));
+
+        // Converting again does nothing.
+        cache::http_store_migrate_v2(v1dir, ctx.get_executor(), c, yield[e]);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        BOOST_CHECK(read_all(v1dir, "bsigs") == rs_bsigs());
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_read_block_range) {
+    auto tmpdir = fs::unique_path();
+    auto rmdir = defer([&tmpdir] {
+        sys::error_code ec;
+        fs::remove_all(tmpdir, ec);
+    });
+    fs::create_directory(tmpdir);
+
+    asio::io_context ctx;
+    run_spawned(ctx, [&] (auto yield) {
+        cache::HttpStoreV1 store(tmpdir, ctx.get_executor());
+        store_signed_response(ctx, store, "key", yield);
+
+        // The first block in the range comes without extensions,
+        // later chunk headers carry the signature and chain hash of the previous block.
+        Cancel c;
+        sys::error_code e;
+        auto rr = store.range_reader("key", cache::HttpBlockRange{1, 2}, e);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        BOOST_REQUIRE(rr);
+
+        auto part = rr->async_read_part(c, yield[e]);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        BOOST_REQUIRE(part && part->is_head());
+        BOOST_CHECK_EQUAL((*part->as_head())[http_::block_range_hdr], "1-2");
+
+        for (unsigned bi = 1; bi < rs_block_data.size(); ++bi) {
+            part = rr->async_read_part(c, yield[e]);
+            BOOST_CHECK_EQUAL(e.message(), "Success");
+            BOOST_REQUIRE(part && part->is_chunk_hdr());
+            BOOST_REQUIRE_EQUAL( *(part->as_chunk_hdr())
+                               , http_response::ChunkHdr( rs_block_data[bi].size()
+                                                        , bi == 1 ? "" : rrs_chunk_ext[bi]));
+
+            part = rr->async_read_part(c, yield[e]);
+            BOOST_CHECK_EQUAL(e.message(), "Success");
+            BOOST_REQUIRE(part && part->is_chunk_body());
+            auto& d = *(part->as_chunk_body());
+            BOOST_CHECK_EQUAL(d.remain, 0);
+            BOOST_REQUIRE_EQUAL(string(d.cbegin(), d.cend()), rs_block_data[bi]);
+        }
+
+        part = rr->async_read_part(c, yield[e]);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        BOOST_REQUIRE(part && part->is_chunk_hdr());
+        BOOST_REQUIRE_EQUAL( *(part->as_chunk_hdr())
+                           , http_response::ChunkHdr(0, rrs_chunk_ext[3]));
+
+        part = rr->async_read_part(c, yield[e]);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        BOOST_REQUIRE(part && part->is_trailer());
+
+        // A range ending before the last block stops after its signature.
+        rr = store.range_reader("key", cache::HttpBlockRange{0, 0}, e);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        BOOST_REQUIRE(rr);
+        rr->async_read_part(c, yield[e]);  // head
+        rr->async_read_part(c, yield[e]);  // block 0 header
+        rr->async_read_part(c, yield[e]);  // block 0 body
+        part = rr->async_read_part(c, yield[e]);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        BOOST_REQUIRE(part && part->is_chunk_hdr());
+        BOOST_REQUIRE_EQUAL( *(part->as_chunk_hdr())
+                           , http_response::ChunkHdr(0, rrs_chunk_ext[1]));
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_read_byte_range) {
+    auto tmpdir = fs::unique_path();
+    auto rmdir = defer([&tmpdir] {
+        sys::error_code ec;
+        fs::remove_all(tmpdir, ec);
+    });
+    fs::create_directory(tmpdir);
+
+    asio::io_context ctx;
+    run_spawned(ctx, [&] (auto yield) {
+        cache::HttpStoreV1 store(tmpdir, ctx.get_executor());
+        store_signed_response(ctx, store, "key", yield);
+
+        // The range is extended to cover whole data blocks.
+        auto range = cache::HttpByteRange::parse("bytes=70000-");
+        BOOST_REQUIRE(range);
+
+        Cancel c;
+        sys::error_code e;
+        auto rr = store.range_reader("key", *range, e);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        BOOST_REQUIRE(rr);
+
+        // Send the partial response and verify it on the other end.
+        asio::ip::tcp::socket
+            partial_w(ctx), partial_r(ctx);
+        tie(partial_w, partial_r) = util::connected_pair(ctx, yield);
+
+        WaitCondition wc(ctx);
+        asio::spawn(ctx, [&, rr = std::move(rr), lock = wc.lock()] (auto y) mutable {
+            Cancel c;
+            sys::error_code e;
+            auto s = Session::create(std::move(rr), c, y[e]);
+            BOOST_CHECK_EQUAL(e.message(), "Success");
+            if (!e) s.flush_response(partial_w, c, y[e]);
+            BOOST_CHECK_EQUAL(e.message(), "Success");
+            partial_w.close();
+        });
+
+        auto pka = util::bytes::to_array<uint8_t, util::Ed25519PublicKey::key_size>
+            (util::base64_decode("DlBwx8WbSsZP7eni20bf5VKUH3t1XAF/+hlDoLbZzuw="));
+        cache::VerifyingReader vr(std::move(partial_r), util::Ed25519PublicKey(std::move(pka)));
+
+        auto part = vr.async_read_part(c, yield[e]);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        BOOST_REQUIRE(part && part->is_head());
+        auto& head = *(part->as_head());
+        BOOST_CHECK_EQUAL(head.result(), http::status::partial_content);
+        BOOST_CHECK_EQUAL(head[http_::response_original_http_status], "200");
+        BOOST_CHECK_EQUAL(head[http::field::content_range], "bytes 65536-131075/131076");
+
+        string data;
+        while (true) {
+            part = vr.async_read_part(c, yield[e]);
+            BOOST_REQUIRE_EQUAL(e.message(), "Success");
+            if (!part) break;
+            if (auto b = part->as_chunk_body())
+                data.append(b->cbegin(), b->cend());
+        }
+        BOOST_CHECK(vr.is_done());
+        BOOST_CHECK(data == rs_block_data[1] + rs_block_data[2]);
+        wc.wait(yield);
+
+        // Ranges beyond stored data are not satisfiable.
+        range = cache::HttpByteRange::parse("bytes=131076-");
+        BOOST_REQUIRE(range);
+        rr = store.range_reader("key", *range, e);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        BOOST_REQUIRE(rr);
+        rr->async_read_part(c, yield[e]);
+        BOOST_CHECK_EQUAL(e, sys::errc::invalid_seek);
+    });
+}
+
+
+// Read the whole response and return its body data.
+static string read_response_body(cache::reader_uptr rr, asio::yield_context yield) {
+    Cancel c;
+    sys::error_code e;
+    string data;
+    while (auto part = rr->async_read_part(c, yield[e])) {
+        BOOST_REQUIRE_EQUAL(e.message(), "Success");
+        if (auto b = part->as_chunk_body())
+            data.append(b->cbegin(), b->cend());
+    }
+    BOOST_CHECK_EQUAL(e.message(), "Success");
+    BOOST_CHECK(rr->is_done());
+    return data;
+}
+
+static size_t count_files(const fs::path& dir) {
+    size_t count = 0;
+    for (auto& p : fs::recursive_directory_iterator(dir))
+        if (fs::is_regular_file(p)) ++count;
+    return count;
+}
+
+BOOST_AUTO_TEST_CASE(test_packed_store) {
+    auto tmpdir = fs::unique_path();
+    auto rmdir = defer([&tmpdir] {
+        sys::error_code ec;
+        fs::remove_all(tmpdir, ec);
+    });
+    fs::create_directory(tmpdir);
+
+    asio::io_context ctx;
+    run_spawned(ctx, [&] (auto yield) {
+        sys::error_code e;
+
+        {
+            cache::HttpStorePacked store(tmpdir, ctx.get_executor());
+            store_signed_response(ctx, store, "key0", yield);
+            store_signed_response(ctx, store, "key1", yield);
+            store_signed_response(ctx, store, "key1", yield);  // replaced
+
+            // Write the index.
+            store.for_each_info([&] (const auto&, auto) { return true; }, yield[e]);
+            BOOST_CHECK_EQUAL(e.message(), "Success");
+
+            // Just one segment and the index.
+            BOOST_CHECK_EQUAL(count_files(tmpdir), 2);
+            BOOST_CHECK_EQUAL(store.entry_count(), 2);
+            BOOST_CHECK_EQUAL(store.dead_size(), store.size() / 2);
+
+            auto rr = store.reader("key1", e);
+            BOOST_REQUIRE_EQUAL(e.message(), "Success");
+            BOOST_CHECK(read_response_body(std::move(rr), yield) == rs_body_complete);
+
+            rr = store.range_reader("key0", cache::HttpBlockRange{1, 1}, e);
+            BOOST_REQUIRE_EQUAL(e.message(), "Success");
+            BOOST_CHECK(read_response_body(std::move(rr), yield) == rs_block_data[1]);
+
+            auto range = cache::HttpByteRange::parse("bytes=131076-");
+            BOOST_REQUIRE(range);
+            rr = store.range_reader("key0", *range, e);
+            BOOST_REQUIRE_EQUAL(e.message(), "Success");
+            Cancel c;
+            rr->async_read_part(c, yield[e]);
+            BOOST_CHECK_EQUAL(e, sys::errc::invalid_seek);
+            e = {};
+
+            store.reader("key2", e);
+            BOOST_CHECK_EQUAL(e, sys::errc::no_such_file_or_directory);
+            e = {};
+        }
+
+        // Add garbage after the last record, as if writing it was interrupted.
+        {
+            std::ofstream seg((tmpdir / "00000000.seg").native(), std::ios::app);
+            seg << "OSR1 garbage";
+        }
+
+        {
+            // Records are found again, garbage is dropped.
+            cache::HttpStorePacked store(tmpdir, ctx.get_executor());
+            BOOST_CHECK_EQUAL(store.entry_count(), 2);
+            BOOST_CHECK_EQUAL(store.dead_size(), store.size() / 2);
+            auto rr = store.reader("key0", e);
+            BOOST_REQUIRE_EQUAL(e.message(), "Success");
+            BOOST_CHECK(read_response_body(std::move(rr), yield) == rs_body_complete);
+
+            size_t count = 0;
+            store.for_each_info([&] (const auto& info, auto) {
+                BOOST_CHECK_EQUAL(info.uri, "https://example.com/foo");
+                BOOST_REQUIRE(info.data_size);
+                BOOST_CHECK_EQUAL(*info.data_size, rs_body_complete.size());
+                return ++count != 2;  // drop the second entry
+            }, yield[e]);
+            BOOST_CHECK_EQUAL(e.message(), "Success");
+            BOOST_CHECK_EQUAL(count, 2);
+            BOOST_CHECK_EQUAL(store.entry_count(), 1);
+        }
+
+        // Without an index, the remaining response is found
+        // (along with removed ones, which were not compacted).
+        fs::remove(tmpdir / "index");
+        {
+            cache::HttpStorePacked store(tmpdir, ctx.get_executor());
+            size_t count = 0;
+            store.for_each_info([&] (const auto&, auto) {
+                ++count;
+                return true;
+            }, yield[e]);
+            BOOST_CHECK_EQUAL(e.message(), "Success");
+            BOOST_CHECK_EQUAL(count, 2);
+            BOOST_CHECK_EQUAL(store.entry_count(), 2);
+        }
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_packed_store_concurrent) {
+    auto tmpdir = fs::unique_path();
+    auto rmdir = defer([&tmpdir] {
+        sys::error_code ec;
+        fs::remove_all(tmpdir, ec);
+    });
+    fs::create_directory(tmpdir);
+
+    asio::io_context ctx;
+    run_spawned(ctx, [&] (auto yield) {
+        // Small segments, so that appends also start new ones.
+        cache::HttpStorePacked store(tmpdir, ctx.get_executor(), {}, 1);
+
+        // Records appended at the same time do not get mixed.
+        WaitCondition wc(ctx);
+        for (int i = 0; i < 8; ++i) {
+            asio::spawn(ctx, [&, i, lock = wc.lock()] (auto y) {
+                store_signed_response(ctx, store, "key" + to_string(i), y);
+            });
+        }
+        wc.wait(yield);
+
+        BOOST_CHECK_EQUAL(store.entry_count(), 8);
+        BOOST_CHECK_EQUAL(count_files(tmpdir), 8);  // one segment per record
+        for (int i = 0; i < 8; ++i) {
+            sys::error_code e;
+            auto rr = store.reader("key" + to_string(i), e);
+            BOOST_REQUIRE_EQUAL(e.message(), "Success");
+            BOOST_CHECK(read_response_body(std::move(rr), yield) == rs_body_complete);
+        }
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_packed_store_rebuild_time) {
+    auto tmpdir = fs::unique_path();
+    auto rmdir = defer([&tmpdir] {
+        sys::error_code ec;
+        fs::remove_all(tmpdir, ec);
+    });
+    fs::create_directory(tmpdir);
+
+    asio::io_context ctx;
+    run_spawned(ctx, [&] (auto yield) {
+        cache::HttpStoreLimits limits;
+        limits.max_entries = 2;
+        sys::error_code e;
+
+        {
+            // One segment per record.
+            cache::HttpStorePacked store(tmpdir, ctx.get_executor(), limits, 1);
+            store_signed_response(ctx, store, "key0", yield);
+            store_signed_response(ctx, store, "key1", yield);
+        }
+
+        // Make the first response look older than the second one,
+        // but its segment newer.
+        auto seg0 = tmpdir / "00000000.seg";
+        {
+            std::fstream seg(seg0.native(), std::ios::in | std::ios::out | std::ios::binary);
+            seg.seekp(4 + 20 + 3 * 4);  // store time in the record header
+            seg.write("\0\0\0\0\0\0\0\1", 8);
+        }
+        fs::last_write_time(seg0, std::time(nullptr) + 3600);
+
+        // The store time of records is used when rebuilding the index.
+        cache::HttpStorePacked store(tmpdir, ctx.get_executor(), limits, 1);
+        store.for_each_info([] (const auto&, auto) { return true; }, yield[e]);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        store_signed_response(ctx, store, "key2", yield);
+        store.reader("key0", e);
+        BOOST_CHECK_EQUAL(e, sys::errc::no_such_file_or_directory);
+        e = {};
+        store.reader("key1", e);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_packed_store_compaction) {
+    auto tmpdir = fs::unique_path();
+    auto rmdir = defer([&tmpdir] {
+        sys::error_code ec;
+        fs::remove_all(tmpdir, ec);
+    });
+    fs::create_directory(tmpdir);
+
+    asio::io_context ctx;
+    run_spawned(ctx, [&] (auto yield) {
+        sys::error_code e;
+        // Room for two responses per segment.
+        cache::HttpStorePacked store(tmpdir, ctx.get_executor(), {}, 200000);
+
+        store_signed_response(ctx, store, "key0", yield);
+        store_signed_response(ctx, store, "key1", yield);
+        store_signed_response(ctx, store, "key2", yield);
+        BOOST_CHECK(fs::exists(tmpdir / "00000000.seg"));
+        BOOST_CHECK(fs::exists(tmpdir / "00000001.seg"));
+        BOOST_CHECK_EQUAL(store.dead_size(), 0);
+
+        // Readers keep working when their segment is removed.
+        auto rr1 = store.reader("key1", e);
+        BOOST_REQUIRE_EQUAL(e.message(), "Success");
+
+        // Half of the first segment becomes dead,
+        // so its live record is moved to a new segment.
+        store_signed_response(ctx, store, "key0", yield);
+        for (int i = 0; i < 100 && store.dead_size() > 0; ++i) {
+            asio::steady_timer t(ctx, chrono::milliseconds(10));
+            t.async_wait(yield);
+        }
+        BOOST_CHECK_EQUAL(store.dead_size(), 0);
+        BOOST_CHECK(!fs::exists(tmpdir / "00000000.seg"));
+        BOOST_CHECK(fs::exists(tmpdir / "00000002.seg"));
+
+        BOOST_CHECK(read_response_body(std::move(rr1), yield) == rs_body_complete);
+        for (auto key : {"key0", "key1", "key2"}) {
+            auto rr = store.reader(key, e);
+            BOOST_REQUIRE_EQUAL(e.message(), "Success");
+            BOOST_CHECK(read_response_body(std::move(rr), yield) == rs_body_complete);
+        }
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_packed_store_large) {
+    auto tmpdir = fs::unique_path();
+    auto rmdir = defer([&tmpdir] {
+        sys::error_code ec;
+        fs::remove_all(tmpdir, ec);
+    });
+    fs::create_directory(tmpdir);
+
+    asio::io_context ctx;
+    run_spawned(ctx, [&] (auto yield) {
+        sys::error_code e;
+        // The response is too big to be packed.
+        cache::HttpStorePacked store( tmpdir, ctx.get_executor(), {}
+                                    , cache::HttpStorePacked::default_segment_size, 1024);
+
+        store_signed_response(ctx, store, "key", yield);
+        auto key_digest = util::bytes::to_hex(util::sha1_digest(string("key")));
+        auto large_dir = tmpdir / "large" / key_digest.substr(0, 2) / key_digest.substr(2);
+        BOOST_CHECK(fs::exists(large_dir / "head"));
+        BOOST_CHECK_EQUAL(store.entry_count(), 1);
+        BOOST_CHECK(store.size() > rs_body_complete.size());
+
+        auto rr = store.reader("key", e);
+        BOOST_REQUIRE_EQUAL(e.message(), "Success");
+        BOOST_CHECK(read_response_body(std::move(rr), yield) == rs_body_complete);
+
+        // Removing the response removes its directory.
+        store.for_each_info([&] (const auto&, auto) { return false; }, yield[e]);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        BOOST_CHECK_EQUAL(store.entry_count(), 0);
+        BOOST_CHECK(!fs::exists(large_dir));
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_packed_store_migrate) {
+    // Responses are either packed or moved to their own directories.
+    for (size_t max_packed_size : { cache::HttpStorePacked::default_max_packed_size
+                                  , size_t(1024)}) {
+        auto tmpdir = fs::unique_path();
+        auto rmdir = defer([&tmpdir] {
+            sys::error_code ec;
+            fs::remove_all(tmpdir, ec);
+        });
+        auto v1dir = tmpdir / "v1";
+        auto packdir = tmpdir / "packed";
+        fs::create_directories(v1dir);
+        fs::create_directories(packdir);
+
+        asio::io_context ctx;
+        run_spawned(ctx, [&] (auto yield) {
+            sys::error_code e;
+            {
+                cache::HttpStoreV1 v1store(v1dir, ctx.get_executor());
+                store_signed_response(ctx, v1store, "key0", yield);
+                store_signed_response(ctx, v1store, "key1", yield);
+            }
+
+            cache::HttpStorePacked store( packdir, ctx.get_executor(), {}
+                                        , cache::HttpStorePacked::default_segment_size
+                                        , max_packed_size);
+            store.migrate(v1dir, {}, yield[e]);
+            BOOST_CHECK_EQUAL(e.message(), "Success");
+            BOOST_CHECK(!fs::exists(v1dir));
+            BOOST_CHECK_EQUAL(store.entry_count(), 2);
+            BOOST_CHECK_EQUAL(fs::exists(packdir / "large"), max_packed_size == 1024);
+
+            for (auto key : {"key0", "key1"}) {
+                auto rr = store.reader(key, e);
+                BOOST_REQUIRE_EQUAL(e.message(), "Success");
+                BOOST_CHECK(read_response_body(std::move(rr), yield) == rs_body_complete);
+            }
+        });
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_store_on_remove) {
+    auto test = [] (auto make_store) {
+        auto tmpdir = fs::unique_path();
+        auto rmdir = defer([&tmpdir] {
+            sys::error_code ec;
+            fs::remove_all(tmpdir, ec);
+        });
+        fs::create_directory(tmpdir);
+
+        asio::io_context ctx;
+        run_spawned(ctx, [&] (auto yield) {
+            cache::HttpStoreLimits limits;
+            limits.max_entries = 2;
+            auto store = make_store(tmpdir, ctx.get_executor(), limits);
+
+            // Responses dropped while building a missing index are not reported.
+            sys::error_code e;
+            store->for_each_info([&] (const auto&, auto) { return true; }, yield[e]);
+            BOOST_CHECK_EQUAL(e.message(), "Success");
+
+            vector<string> removed;
+            store->on_remove([&] (const auto& info) { removed.push_back(info.uri); });
+
+            store_signed_response(ctx, *store, "key0", yield);
+            store_signed_response(ctx, *store, "key1", yield);
+            BOOST_CHECK_EQUAL(removed.size(), 0);
+
+            // Replaced.
+            store_signed_response(ctx, *store, "key1", yield);
+            BOOST_CHECK_EQUAL(removed.size(), 1);
+
+            // Evicted.
+            store_signed_response(ctx, *store, "key2", yield);
+            BOOST_CHECK_EQUAL(removed.size(), 2);
+            BOOST_CHECK_EQUAL(store->entry_count(), 2);
+
+            // Removed.
+            store->for_each_info([&] (const auto&, auto) { return false; }, yield[e]);
+            BOOST_CHECK_EQUAL(e.message(), "Success");
+            BOOST_CHECK_EQUAL(removed.size(), 4);
+
+            for (auto& uri : removed)
+                BOOST_CHECK_EQUAL(uri, "https://example.com/foo");
+        });
+    };
+
+    test([] (auto& dir, auto ex, auto limits) {
+        return make_unique<cache::HttpStoreV1>(dir, ex, limits);
+    });
+    test([] (auto& dir, auto ex, auto limits) {
+        return make_unique<cache::HttpStorePacked>(dir, ex, limits);
+    });
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,164 @@
+#define BOOST_TEST_MODULE inflight_requests
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <inflight_requests.h>
+#include <util/wait_condition.h>
+
+BOOST_AUTO_TEST_SUITE(ouinet_inflight_requests)
+
+using namespace std;
+using namespace ouinet;
+using namespace ouinet::http_response;
+
+static const size_t block_size = 1024;
+static const size_t blocks = 16;
+static const string key = "GET http://example.com/";
+
+static
+void push_response(Tee& tee, Cancel& cancel, asio::yield_context yield)
+{
+    http::response_header<> rsh;
+    rsh.result(http::status::ok);
+    rsh.set(http::field::content_length, to_string(blocks * block_size));
+    tee.async_push(Head(move(rsh)), cancel, yield);
+    for (size_t i = 0; i < blocks; ++i)
+        tee.async_push(Body(vector<uint8_t>(block_size, uint8_t(i))), cancel, yield);
+    tee.finish();
+}
+
+// Return the number of body bytes read.
+static
+size_t read_response(AbstractReader& rr, asio::yield_context yield)
+{
+    Cancel cancel;
+    auto head = rr.async_read_part(cancel, yield);
+    BOOST_REQUIRE(head && head->is_head());
+
+    size_t size = 0;
+    while (auto p = rr.async_read_part(cancel, yield)) {
+        BOOST_REQUIRE(p->is_body());
+        size += p->as_body()->size();
+    }
+    BOOST_CHECK(rr.is_done());
+    return size;
+}
+
+static
+void sleep(asio::io_context& ctx, chrono::milliseconds d, asio::yield_context yield)
+{
+    asio::steady_timer t(ctx, d);
+    t.async_wait(yield);
+}
+
+BOOST_AUTO_TEST_CASE(test_leader_with_followers)
+{
+    asio::io_context ctx;
+    InFlightRequests requests;
+    size_t followers_done = 0;
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Cancel cancel;
+        // Followers reading slower than the leader pushes
+        // only get `max_buffered` bytes ahead of them.
+        Tee tee(ctx.get_executor(), 2 * block_size);
+        auto leader = requests.lead(key, tee);
+        BOOST_CHECK_EQUAL(requests.size(), 1);
+
+        // Only one request leads at a time.
+        {
+            Tee other_tee(ctx.get_executor(), block_size);
+            auto other = requests.lead(key, other_tee);
+            other.stop();
+            BOOST_CHECK_EQUAL(requests.size(), 1);
+        }
+
+        WaitCondition wc(ctx);
+        for (int i = 0; i < 3; ++i) {
+            asio::spawn(ctx, [&, i, lock = wc.lock()] (asio::yield_context y) {
+                auto rr = requests.follow(key);
+                BOOST_REQUIRE(rr);
+                if (i == 0) sleep(ctx, chrono::milliseconds(50), y);
+                BOOST_CHECK_EQUAL(read_response(*rr, y), blocks * block_size);
+                ++followers_done;
+            });
+        }
+
+        // A follower going away does not hold the response back.
+        auto gone = requests.follow(key);
+        BOOST_REQUIRE(gone);
+        gone.reset();
+
+        sleep(ctx, chrono::milliseconds(10), yield);
+
+        // No more followers once the response starts.
+        leader.stop();
+        BOOST_CHECK_EQUAL(requests.size(), 0);
+        BOOST_CHECK(!requests.follow(key));
+
+        push_response(tee, cancel, yield);
+        wc.wait(yield);
+    });
+
+    ctx.run();
+    BOOST_CHECK_EQUAL(followers_done, 3);
+}
+
+BOOST_AUTO_TEST_CASE(test_leader_fails)
+{
+    asio::io_context ctx;
+    InFlightRequests requests;
+    size_t followers_failed = 0;
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        WaitCondition wc(ctx);
+
+        {
+            Tee tee(ctx.get_executor(), block_size);
+            auto leader = requests.lead(key, tee);
+
+            for (int i = 0; i < 3; ++i) {
+                asio::spawn(ctx, [&, lock = wc.lock()] (asio::yield_context y) {
+                    auto rr = requests.follow(key);
+                    BOOST_REQUIRE(rr);
+                    Cancel cancel;
+                    sys::error_code ec;
+                    auto part = rr->async_read_part(cancel, y[ec]);
+                    // Told before getting any part.
+                    BOOST_CHECK(!part);
+                    BOOST_CHECK_EQUAL(ec, asio::error::operation_aborted);
+                    ++followers_failed;
+                });
+            }
+
+            sleep(ctx, chrono::milliseconds(10), yield);
+            // The leader fails before the response starts,
+            // dropping the tee.
+        }
+
+        wc.wait(yield);
+        BOOST_CHECK_EQUAL(requests.size(), 0);
+        BOOST_CHECK(!requests.follow(key));
+
+        // Another request may lead now.
+        Cancel cancel;
+        Tee tee(ctx.get_executor(), block_size);
+        auto leader = requests.lead(key, tee);
+        auto rr = requests.follow(key);
+        BOOST_REQUIRE(rr);
+        leader.stop();
+        asio::spawn(ctx, [&, lock = wc.lock()] (asio::yield_context y) {
+            BOOST_CHECK_EQUAL(read_response(*rr, y), blocks * block_size);
+        });
+        push_response(tee, cancel, yield);
+        wc.wait(yield);
+    });
+
+    ctx.run();
+    BOOST_CHECK_EQUAL(followers_failed, 3);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,8 +1,11 @@
 #define BOOST_TEST_MODULE logger_tester
 #include <boost/test/included/unit_test.hpp>
 
+#include <fstream>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "namespaces.h"
 #include "logger.h"
@@ -58,4 +61,72 @@ BOOST_AUTO_TEST_CASE(test_generate_node_id)
     remove(log_file.c_str());
 }
 
+BOOST_AUTO_TEST_CASE(test_async_output)
+{
+    const std::string log_file = "testlog-async.txt";
+    const size_t threads = 4, lines = 20000;  // more than the queue holds
+
+    remove(log_file.c_str());
+
+    Logger log(INFO);
+    log.config(false, true, log_file);
+    log.set_async(true);
+
+    std::vector<std::thread> ts;
+    for (size_t t = 0; t < threads; ++t) {
+        ts.emplace_back([&, t] {
+            for (size_t i = 0; i < lines; ++i)
+                log.output(util::str(t, " ", i, "\n"));
+        });
+    }
+    for (auto& t : ts) t.join();
+
+    log.debug("This should not make it out");
+    log.info("last");
+    log.flush();
+
+    // All lines are written, in order for each thread.
+    std::ifstream in(log_file);
+    std::vector<size_t> next(threads, 0);
+    std::string line;
+    size_t count = 0;
+    while (std::getline(in, line)) {
+        if (line.find("last") != std::string::npos) break;
+        size_t t, i;
+        BOOST_REQUIRE(std::sscanf(line.c_str(), "%zu %zu", &t, &i) == 2);
+        BOOST_REQUIRE(t < threads);
+        BOOST_REQUIRE_EQUAL(i, next[t]++);
+        ++count;
+    }
+    BOOST_REQUIRE_EQUAL(count, threads * lines);
+    BOOST_REQUIRE(line.find("last") != std::string::npos);
+    BOOST_REQUIRE(!std::getline(in, line));
+
+    log.set_async(false);
+    remove(log_file.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(test_async_flush)
+{
+    const std::string log_file = "testlog-flush.txt";
+    const std::string line = "0123456789abcdef\n";
+
+    remove(log_file.c_str());
+
+    Logger log(INFO);
+    log.config(false, true, log_file);
+    log.set_async(true);
+
+    // Once flushed, queued lines are in the file.
+    for (size_t i = 1; i <= 1000; ++i) {
+        log.output(line);
+        log.flush();
+        std::ifstream in(log_file, std::ios::binary | std::ios::ate);
+        BOOST_REQUIRE_EQUAL(size_t(in.tellg()), i * line.size());
+    }
+
+    log.set_async(false);
+    remove(log_file.c_str());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
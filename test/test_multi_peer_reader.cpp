@@ -0,0 +1,322 @@
+#define BOOST_TEST_MODULE multi_peer_reader
+#include <boost/test/included/unit_test.hpp>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http/read.hpp>
+#include <boost/filesystem.hpp>
+
+#include <cache/bep5_http/multi_peer_reader.h>
+#include <cache/http_sign.h>
+#include <cache/http_store.h>
+#include <defer.h>
+#include <generic_stream.h>
+#include <util/crypto.h>
+#include <util/wait_condition.h>
+
+#include <namespaces.h>
+#include "connected_pair.h"
+
+struct TestGlobalFixture {
+    void setup() {
+        ouinet::util::crypto_init();
+    }
+};
+
+BOOST_TEST_GLOBAL_FIXTURE(TestGlobalFixture);
+
+BOOST_AUTO_TEST_SUITE(ouinet_multi_peer_reader)
+
+using namespace std;
+using namespace ouinet;
+
+using Part = http_response::Part;
+using cache::bep5_http::MultiPeerReader;
+using tcp = asio::ip::tcp;
+
+// Enough data blocks for several ranges (see `blocks_per_range`),
+// the last one shorter.
+static const size_t body_size = 18 * http_::response_data_block + 100;
+static const char* uri = "https://example.com/big";
+
+static
+http::request<http::empty_body>
+request()
+{
+    http::request<http::empty_body> rq;
+    rq.method(http::verb::get);
+    rq.target(uri);
+    rq.version(11);
+    rq.set(http::field::host, "example.com");
+    return rq;
+}
+
+// Sign a response with `body_size` bytes of body and store it in v1 format.
+static
+void store_response( const fs::path& dir, const util::Ed25519PrivateKey& sk
+                   , const asio::executor& ex, asio::yield_context yield)
+{
+    auto p = util::connected_pair(ex, yield);
+
+    WaitCondition wc(ex);
+    asio::spawn(ex, [&, lock = wc.lock()] (asio::yield_context y) {
+        string head = "HTTP/1.1 200 OK\r\n"
+                      "Date: Mon, 15 Jan 2018 20:31:50 GMT\r\n"
+                      "Content-Type: application/octet-stream\r\n"
+                      "Content-Length: " + to_string(body_size) + "\r\n\r\n";
+        asio::async_write(p.first, asio::buffer(head), y);
+        for (size_t sent = 0, i = 0; sent < body_size; sent += http_::response_data_block, ++i) {
+            string block(min(http_::response_data_block, body_size - sent), 'a' + i % 26);
+            asio::async_write(p.first, asio::buffer(block), y);
+        }
+        p.first.close();
+    });
+
+    auto rq = request();
+    cache::SigningReader sr( GenericStream(move(p.second)), rq.base()
+                           , "d6076384-2295-462b-a047-fe2c9274e58d", 1516048310
+                           , sk);
+    cache::http_store_v1(sr, dir, ex, {}, yield);
+    wc.wait(yield);
+}
+
+// Chunk headers and data of a response as a string, to compare responses.
+static
+string read_chunks(http_response::AbstractReader& rr, asio::yield_context yield)
+{
+    Cancel cancel;
+    string ret;
+    while (auto part = rr.async_read_part(cancel, yield)) {
+        if (auto ch = part->as_chunk_hdr())
+            ret += "[" + to_string(ch->size) + ch->exts + "]";
+        else if (auto cb = part->as_chunk_body())
+            ret.append(cb->begin(), cb->end());
+        else if (part->is_trailer())
+            break;
+    }
+    return ret;
+}
+
+// A fake peer serving the stored response.
+struct Peer {
+    // Whether it understands `X-Ouinet-Block-Range`.
+    bool ranges = true;
+    // Wait before sending each response.
+    chrono::milliseconds delay{0};
+    // Change parts before sending them,
+    // an error drops the connection.
+    function<void(Part&, sys::error_code&)> alter;
+
+    // First blocks of ranges sent in full, in the order they were sent.
+    vector<size_t> served;
+};
+
+struct Peers {
+    fs::path dir;
+    asio::executor ex;
+    vector<Peer>& peers;
+    size_t next = 0;  // next peer to connect to
+    // Ranges sent in full by all peers, in the order they were sent.
+    vector<size_t> served;
+
+    void
+    serve(Peer& peer, tcp::socket s, asio::yield_context yield)
+    {
+        beast::flat_buffer buffer;
+        Cancel cancel;
+        while (true) {
+            sys::error_code ec;
+            http::request<http::empty_body> rq;
+            http::async_read(s, buffer, rq, yield[ec]);
+            if (ec) return;
+
+            if (peer.delay.count() > 0) {
+                asio::steady_timer t(ex, peer.delay);
+                t.async_wait(yield[ec]);
+            }
+
+            auto range = cache::HttpBlockRange::parse(rq[http_::block_range_hdr]);
+            auto rr = (range && peer.ranges)
+                ? cache::http_store_range_reader_v1(dir, ex, *range, ec)
+                : cache::http_store_reader_v1(dir, ex, ec);
+            BOOST_REQUIRE(!ec);
+
+            while (auto part = rr->async_read_part(cancel, yield[ec])) {
+                if (peer.alter) peer.alter(*part, ec);
+                if (!ec) part->async_write(s, cancel, yield[ec]);
+                if (ec) return;
+            }
+            if (ec) return;
+            size_t first = (range && peer.ranges) ? range->first : 0;
+            peer.served.push_back(first);
+            served.push_back(first);
+        }
+    }
+
+    GenericStream
+    connect(Peer& peer, asio::yield_context yield)
+    {
+        auto p = util::connected_pair(ex, yield);
+        asio::spawn(ex, [&, s = move(p.second)] (asio::yield_context y) mutable {
+            serve(peer, move(s), y);
+        });
+        return GenericStream(move(p.first));
+    }
+
+    MultiPeerReader
+    reader(const util::Ed25519PublicKey& pk, asio::yield_context yield)
+    {
+        auto first = connect(peers.at(next++), yield);
+        return MultiPeerReader(ex, request(), move(first),
+            [this] (Cancel&, asio::yield_context y) -> boost::optional<GenericStream> {
+                if (next >= peers.size()) return boost::none;
+                return connect(peers[next++], y);
+            }, pk);
+    }
+};
+
+// Run the test body with the directory of a stored response,
+// the chunks expected from reading it in full, and its public key.
+static
+void run_with_response(function<void( const fs::path&, const string&
+                                    , const util::Ed25519PublicKey&
+                                    , asio::io_context&, asio::yield_context)> f)
+{
+    auto tmpdir = fs::temp_directory_path() / fs::unique_path("ouinet-test-mpr-%%%%-%%%%");
+    auto rmdir = defer([&] { sys::error_code ec; fs::remove_all(tmpdir, ec); });
+    fs::create_directories(tmpdir);
+
+    asio::io_context ctx;
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        auto sk = util::Ed25519PrivateKey::generate();
+        store_response(tmpdir, sk, ctx.get_executor(), yield);
+        sys::error_code ec;
+        auto rr = cache::http_store_reader_v1(tmpdir, ctx.get_executor(), ec);
+        BOOST_REQUIRE(!ec);
+        auto expected = read_chunks(*rr, yield);
+        BOOST_REQUIRE(expected.size() > body_size);
+        f(tmpdir, expected, sk.public_key(), ctx, yield);
+    });
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_good_peers)
+{
+    run_with_response([] (auto& dir, auto& expected, auto& pk, auto& ctx, auto yield) {
+        vector<Peer> peers(3);
+        Peers ps{dir, ctx.get_executor(), peers};
+        auto mpr = ps.reader(pk, yield);
+        BOOST_CHECK(read_chunks(mpr, yield) == expected);
+        // Other peers helped.
+        BOOST_CHECK(!peers[1].served.empty() || !peers[2].served.empty());
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_bad_peer)
+{
+    // Blocks from a peer sending bad signatures or bad data
+    // are fetched from other peers.
+    auto bad_sig = [] (Part& p, sys::error_code&) {
+        auto ch = p.as_chunk_hdr();
+        auto pos = ch ? ch->exts.find('"') : string::npos;
+        if (pos == string::npos) return;
+        auto& c = ch->exts[pos + 1];
+        c = (c == 'A') ? 'B' : 'A';
+    };
+    auto bad_data = [] (Part& p, sys::error_code&) {
+        auto cb = p.as_chunk_body();
+        if (!cb || cb->empty()) return;
+        vector<uint8_t> data(cb->begin(), cb->end());
+        data[0] ^= 1;
+        *cb = http_response::ChunkBody(move(data), cb->remain);
+    };
+
+    using Alter = function<void(Part&, sys::error_code&)>;
+    for (auto alter : {Alter(bad_sig), Alter(bad_data)}) {
+        run_with_response([&] (auto& dir, auto& expected, auto& pk, auto& ctx, auto yield) {
+            vector<Peer> peers(3);
+            peers[1].alter = alter;
+            Peers ps{dir, ctx.get_executor(), peers};
+            auto mpr = ps.reader(pk, yield);
+            BOOST_CHECK(read_chunks(mpr, yield) == expected);
+            BOOST_CHECK(peers[1].served.empty());
+        });
+    }
+
+    // Bad blocks from the only peer make reading fail.
+    run_with_response([&] (auto& dir, auto&, auto& pk, auto& ctx, auto yield) {
+        vector<Peer> peers(1);
+        peers[0].alter = bad_data;
+        Peers ps{dir, ctx.get_executor(), peers};
+        auto mpr = ps.reader(pk, yield);
+        sys::error_code ec;
+        read_chunks(mpr, yield[ec]);
+        BOOST_CHECK_EQUAL(ec, sys::errc::bad_message);
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_dead_peer)
+{
+    // A peer going away in the middle of a range
+    // has its blocks fetched from another peer.
+    run_with_response([] (auto& dir, auto& expected, auto& pk, auto& ctx, auto yield) {
+        vector<Peer> peers(3);
+        size_t parts = 0;
+        peers[1].alter = [&] (Part&, sys::error_code& ec) {
+            if (++parts > 4) ec = asio::error::connection_reset;
+        };
+        Peers ps{dir, ctx.get_executor(), peers};
+        auto mpr = ps.reader(pk, yield);
+        BOOST_CHECK(read_chunks(mpr, yield) == expected);
+        BOOST_CHECK(peers[1].served.empty());
+        BOOST_CHECK(parts > 4);
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_no_ranges)
+{
+    // The first peer sends the whole response.
+    run_with_response([] (auto& dir, auto& expected, auto& pk, auto& ctx, auto yield) {
+        vector<Peer> peers(2);
+        peers[0].ranges = false;
+        Peers ps{dir, ctx.get_executor(), peers};
+        auto mpr = ps.reader(pk, yield);
+        BOOST_CHECK(read_chunks(mpr, yield) == expected);
+        BOOST_CHECK_EQUAL(peers[0].served.size(), 1);
+        BOOST_CHECK(peers[1].served.empty());
+    });
+
+    // Another peer sending the whole response is dropped.
+    run_with_response([] (auto& dir, auto& expected, auto& pk, auto& ctx, auto yield) {
+        vector<Peer> peers(3);
+        peers[1].ranges = false;
+        Peers ps{dir, ctx.get_executor(), peers};
+        auto mpr = ps.reader(pk, yield);
+        BOOST_CHECK(read_chunks(mpr, yield) == expected);
+        BOOST_CHECK(peers[1].served.empty());
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_out_of_order)
+{
+    // Blocks arriving from a fast peer before those of a slow one
+    // are output in order.
+    run_with_response([] (auto& dir, auto& expected, auto& pk, auto& ctx, auto yield) {
+        vector<Peer> peers(3);
+        peers[1].delay = chrono::milliseconds(200);
+        Peers ps{dir, ctx.get_executor(), peers};
+        auto mpr = ps.reader(pk, yield);
+        BOOST_CHECK(read_chunks(mpr, yield) == expected);
+        BOOST_REQUIRE(!peers[1].served.empty());
+        BOOST_CHECK(!is_sorted(ps.served.begin(), ps.served.end()));
+    });
+}
+
+BOOST_AUTO_TEST_SUITE_END()
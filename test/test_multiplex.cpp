@@ -0,0 +1,341 @@
+#define BOOST_TEST_MODULE multiplex
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+
+#include <list>
+#include <set>
+
+#include <async_sleep.h>
+#include <generic_stream.h>
+#include <ouiservice/multiplex.h>
+#include <util/async_queue.h>
+#include <util/wait_condition.h>
+
+#include "connected_pair.h"
+
+BOOST_AUTO_TEST_SUITE(ouinet_multiplex)
+
+using namespace std;
+using namespace ouinet;
+using namespace ouinet::ouiservice;
+using multiplex::Multiplexer;
+using tcp = asio::ip::tcp;
+
+// Larger than the initial window, so that WINDOW frames are needed.
+static const size_t big_size = 1024 * 1024;
+
+static
+string make_data(char seed, size_t size)
+{
+    string s(size, '\0');
+    for (size_t i = 0; i < size; ++i) s[i] = seed + (i % 23);
+    return s;
+}
+
+BOOST_AUTO_TEST_CASE(test_channels)
+{
+    asio::io_context ctx;
+    auto ex = ctx.get_executor();
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        auto pair = util::connected_pair(ex, yield);
+
+        auto client = Multiplexer::create(ex, GenericStream(move(pair.first)), Multiplexer::Side::client);
+
+        // The server side gets the preface consumed beforehand.
+        GenericStream server_con(move(pair.second));
+        string preface(Multiplexer::preface.size(), '\0');
+        asio::async_read(server_con, asio::buffer(preface), yield);
+        BOOST_REQUIRE_EQUAL(preface, Multiplexer::preface);
+        auto server = Multiplexer::create(ex, move(server_con), Multiplexer::Side::server);
+
+        WaitCondition wc(ex);
+
+        // Echo every channel back to the client.
+        asio::spawn(ctx, [&, lock = wc.lock()] (asio::yield_context yield) {
+            Cancel cancel;
+            WaitCondition echoes(ex);
+            for (int i = 0; i < 3; ++i) {
+                auto ch = server->accept(cancel, yield);
+                asio::spawn(ctx, [ch = move(ch), lock = echoes.lock()]
+                                 (asio::yield_context yield) mutable {
+                    sys::error_code ec;
+                    string buf(4096, '\0');
+                    while (true) {
+                        auto n = ch.async_read_some(asio::buffer(buf), yield[ec]);
+                        if (ec) break;
+                        asio::async_write(ch, asio::buffer(buf.data(), n), yield);
+                    }
+                    BOOST_REQUIRE_EQUAL(ec, asio::error::eof);
+                });
+            }
+            echoes.wait(yield);
+        });
+
+        // Concurrent channels sending more than a window each.
+        for (char seed : {'a', 'j', 's'}) {
+            asio::spawn(ctx, [&, seed, lock = wc.lock()] (asio::yield_context yield) {
+                auto ch = client->open();
+                BOOST_REQUIRE(ch.is_open());
+
+                auto data = make_data(seed, big_size);
+                string echoed(data.size(), '\0');
+
+                WaitCondition rwc(ex);
+                asio::spawn(ctx, [&, lock = rwc.lock()] (asio::yield_context yield) {
+                    asio::async_read(ch, asio::buffer(echoed), yield);
+                });
+
+                asio::async_write(ch, asio::buffer(data), yield);
+                rwc.wait(yield);
+                BOOST_REQUIRE(echoed == data);
+                ch.close();
+            });
+        }
+
+        wc.wait(yield);
+        BOOST_REQUIRE_EQUAL(client->channel_count(), 0u);
+
+        client->close();
+        server->close();
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_connection_failure)
+{
+    asio::io_context ctx;
+    auto ex = ctx.get_executor();
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        auto pair = util::connected_pair(ex, yield);
+
+        auto client = Multiplexer::create(ex, GenericStream(move(pair.first)), Multiplexer::Side::client);
+        auto ch = client->open();
+        asio::async_write(ch, asio::buffer("hello", 5), yield);
+
+        // The other side goes away: pending reads fail
+        // and no more channels can be opened.
+        pair.second.close();
+
+        sys::error_code ec;
+        char c;
+        ch.async_read_some(asio::buffer(&c, 1), yield[ec]);
+        BOOST_REQUIRE(ec);
+        BOOST_REQUIRE(!client->is_open());
+        BOOST_REQUIRE(!client->open().is_open());
+    });
+
+    ctx.run();
+}
+
+// Yields connections pushed by the test.
+struct FakeServer : public OuiServiceImplementationServer {
+    util::AsyncQueue<GenericStream>& queue;
+    Cancel cancel;
+
+    FakeServer(util::AsyncQueue<GenericStream>& queue) : queue(queue) {}
+
+    void start_listen(asio::yield_context) override {}
+    void stop_listen() override { cancel(); }
+
+    GenericStream accept(asio::yield_context yield) override {
+        return queue.async_pop(cancel, yield);
+    }
+};
+
+// Connects to sockets whose other ends are kept in `peers`.
+struct FakeClient : public OuiServiceImplementationClient {
+    asio::executor ex;
+    list<tcp::socket>& peers;
+
+    FakeClient(asio::executor ex, list<tcp::socket>& peers) : ex(ex), peers(peers) {}
+
+    void start(asio::yield_context) override {}
+    void stop() override {}
+
+    GenericStream connect(asio::yield_context yield, Cancel&) override {
+        auto p = util::connected_pair(ex, yield);
+        peers.push_back(move(p.second));
+        return GenericStream(move(p.first));
+    }
+};
+
+static
+string read_all(GenericStream& s, asio::yield_context yield)
+{
+    string ret;
+    sys::error_code ec;
+    char buf[256];
+    while (true) {
+        auto n = s.async_read_some(asio::buffer(buf), yield[ec]);
+        if (ec) break;
+        ret.append(buf, n);
+    }
+    BOOST_CHECK_EQUAL(ec, asio::error::eof);
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE(test_server_plain_and_multiplexed)
+{
+    asio::io_context ctx;
+    auto ex = ctx.get_executor();
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        util::AsyncQueue<GenericStream> base_queue(ex);
+        MultiplexOuiServiceServer server(ex, make_unique<FakeServer>(base_queue));
+        server.start_listen(yield);
+
+        Cancel cancel;
+        WaitCondition wc(ex);
+
+        // Plain connections are accepted as they are,
+        // including those starting like the preface.
+        const string plain = "GET / HTTP/1.1\r\n\r\n";
+        const string almost = Multiplexer::preface.substr(0, 3) + "X and more";
+        for (auto& data : {plain, almost}) {
+            auto p = util::connected_pair(ex, yield);
+            base_queue.async_push(GenericStream(move(p.second)), cancel, yield);
+            asio::spawn(ctx, [&, data, s = move(p.first), lock = wc.lock()]
+                             (asio::yield_context y) mutable {
+                asio::async_write(s, asio::buffer(data), y);
+                s.shutdown(tcp::socket::shutdown_send);
+                char c;
+                sys::error_code ec;
+                s.async_read_some(asio::buffer(&c, 1), y[ec]);  // until closed
+            });
+        }
+        for (size_t i = 0; i < 2; ++i) {
+            auto con = server.accept(yield);
+            auto data = read_all(con, yield);
+            BOOST_CHECK(data == plain || data == almost);
+            con.close();
+        }
+
+        // Channels of a multiplexed connection are accepted one by one.
+        auto p = util::connected_pair(ex, yield);
+        base_queue.async_push(GenericStream(move(p.second)), cancel, yield);
+        auto client = Multiplexer::create(ex, GenericStream(move(p.first)), Multiplexer::Side::client);
+        for (char seed : {'a', 'j'}) {
+            asio::spawn(ctx, [&, seed, lock = wc.lock()] (asio::yield_context y) {
+                auto ch = client->open();
+                auto data = make_data(seed, 1000);
+                asio::async_write(ch, asio::buffer(data), y);
+                ch.close();
+            });
+        }
+        set<string> got;
+        for (size_t i = 0; i < 2; ++i) {
+            auto con = server.accept(yield);
+            got.insert(read_all(con, yield));
+        }
+        BOOST_CHECK(got == (set<string>{make_data('a', 1000), make_data('j', 1000)}));
+
+        wc.wait(yield);
+        client->close();
+        server.stop_listen();
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_client_shared_connections)
+{
+    asio::io_context ctx;
+    auto ex = ctx.get_executor();
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        list<tcp::socket> peers;
+        MultiplexOuiServiceClient client(ex, make_unique<FakeClient>(ex, peers), 2);
+        client.start(yield);
+
+        // Concurrent connects share connections up to the channel limit.
+        vector<GenericStream> channels(3);
+        WaitCondition wc(ex);
+        for (auto& ch : channels) {
+            asio::spawn(ctx, [&, lock = wc.lock()] (asio::yield_context y) {
+                Cancel cancel;
+                ch = client.connect(y, cancel);
+            });
+        }
+        wc.wait(yield);
+        BOOST_CHECK_EQUAL(peers.size(), 2);
+
+        // A closed channel leaves room for another one.
+        channels[0].close();
+        {
+            Cancel cancel;
+            channels[0] = client.connect(yield, cancel);
+        }
+        BOOST_CHECK_EQUAL(peers.size(), 2);
+
+        // When a connection fails, its channels fail too,
+        // including those not written to yet.
+        asio::async_write(channels[1], asio::buffer("hello", 5), yield);
+        for (auto& ch : channels) {
+            asio::spawn(ctx, [&, lock = wc.lock()] (asio::yield_context y) {
+                char c;
+                sys::error_code ec;
+                ch.async_read_some(asio::buffer(&c, 1), y[ec]);
+                BOOST_CHECK(ec);
+            });
+        }
+        for (auto& peer : peers) peer.close();
+        wc.wait(yield);
+
+        // New channels go over a new connection.
+        Cancel cancel;
+        auto ch = client.connect(yield, cancel);
+        BOOST_CHECK_EQUAL(peers.size(), 3);
+
+        client.stop();
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_client_idle_connections)
+{
+    using namespace chrono_literals;
+
+    asio::io_context ctx;
+    auto ex = ctx.get_executor();
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        list<tcp::socket> peers;
+        MultiplexOuiServiceClient client( ex, make_unique<FakeClient>(ex, peers)
+                                        , 64, 100ms);
+        client.start(yield);
+
+        Cancel cancel;
+        auto ch = client.connect(yield, cancel);
+        BOOST_REQUIRE_EQUAL(peers.size(), 1);
+
+        // A connection with open channels is kept.
+        async_sleep(ex, 300ms, cancel, yield);
+        auto ch2 = client.connect(yield, cancel);
+        BOOST_CHECK_EQUAL(peers.size(), 1);
+
+        // A connection with no channels is closed after a while.
+        ch.close();
+        ch2.close();
+        async_sleep(ex, 300ms, cancel, yield);
+
+        sys::error_code ec;
+        string buf(64, '\0');
+        while (!ec) peers.front().async_read_some(asio::buffer(buf), yield[ec]);
+        BOOST_CHECK_EQUAL(ec, asio::error::eof);
+
+        ch = client.connect(yield, cancel);
+        BOOST_CHECK_EQUAL(peers.size(), 2);
+
+        client.stop();
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
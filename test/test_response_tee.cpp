@@ -0,0 +1,161 @@
+#define BOOST_TEST_MODULE response_tee
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+
+#include <response_tee.h>
+#include <util/wait_condition.h>
+
+BOOST_AUTO_TEST_SUITE(ouinet_response_tee)
+
+using namespace std;
+using namespace ouinet;
+using namespace ouinet::http_response;
+
+static const size_t block_size = 1024;
+static const size_t blocks = 16;
+
+static
+Part block(size_t i)
+{
+    return Body(vector<uint8_t>(block_size, uint8_t(i)));
+}
+
+// Push a head and some body blocks.
+static
+void push_response(Tee& tee, Cancel& cancel, asio::yield_context yield)
+{
+    http::response_header<> rsh;
+    rsh.result(http::status::ok);
+    rsh.set(http::field::content_length, to_string(blocks * block_size));
+    tee.async_push(Head(move(rsh)), cancel, yield);
+    for (size_t i = 0; i < blocks; ++i)
+        tee.async_push(block(i), cancel, yield);
+    tee.finish();
+}
+
+// Read the response and check that its blocks arrive in order.
+static
+void read_response(AbstractReader& rr, asio::yield_context yield)
+{
+    Cancel cancel;
+    auto head = rr.async_read_part(cancel, yield);
+    BOOST_REQUIRE(head && head->is_head());
+
+    for (size_t i = 0; i < blocks; ++i) {
+        auto p = rr.async_read_part(cancel, yield);
+        BOOST_REQUIRE(p && p->is_body());
+        auto b = p->as_body();
+        BOOST_REQUIRE_EQUAL(b->size(), block_size);
+        BOOST_CHECK_EQUAL((*b)[0], uint8_t(i));
+        BOOST_CHECK_EQUAL((*b)[block_size - 1], uint8_t(i));
+    }
+    BOOST_CHECK(!rr.async_read_part(cancel, yield));
+    BOOST_CHECK(rr.is_done());
+}
+
+BOOST_AUTO_TEST_CASE(test_backpressure)
+{
+    asio::io_context ctx;
+    auto ex = ctx.get_executor();
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Tee tee(ex, 4 * block_size);
+        auto fast = tee.add_reader();
+        auto slow = tee.add_reader();
+
+        // The producer cannot go far ahead of the slow consumer.
+        size_t max_ahead = 0;
+        size_t pushed = 0, read = 0;
+
+        WaitCondition wc(ex);
+        asio::spawn(ctx, [&, lock = wc.lock()] (asio::yield_context y) {
+            Cancel cancel;
+            while (fast->async_read_part(cancel, y));
+        });
+        asio::spawn(ctx, [&, lock = wc.lock()] (asio::yield_context y) {
+            Cancel cancel;
+            while (auto p = slow->async_read_part(cancel, y)) {
+                if (p->is_body()) ++read;
+                asio::steady_timer t(ex, chrono::milliseconds(1));
+                t.async_wait(y);
+            }
+        });
+
+        Cancel cancel;
+        for (size_t i = 0; i < blocks; ++i) {
+            tee.async_push(block(i), cancel, yield);
+            ++pushed;
+            max_ahead = max(max_ahead, pushed - read);
+        }
+        tee.finish();
+        wc.wait(yield);
+
+        BOOST_CHECK_EQUAL(read, blocks);
+        BOOST_CHECK_LE(max_ahead, 5);
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_spill)
+{
+    asio::io_context ctx;
+    auto ex = ctx.get_executor();
+
+    auto dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir);
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Tee tee(ex, 2 * block_size, dir);
+        auto slow = tee.add_reader();
+
+        // The producer does not wait for the consumer,
+        // the data goes to a file which is not left around.
+        Cancel cancel;
+        push_response(tee, cancel, yield);
+        BOOST_CHECK(fs::is_empty(dir));
+
+        read_response(*slow, yield);
+
+        // Data keeps its order when the file is emptied and filled again.
+        Tee tee2(ex, 2 * block_size, dir);
+        auto rr = tee2.add_reader();
+        WaitCondition wc(ex);
+        asio::spawn(ctx, [&, lock = wc.lock()] (asio::yield_context y) {
+            read_response(*rr, y);
+        });
+        push_response(tee2, cancel, yield);
+        wc.wait(yield);
+    });
+
+    ctx.run();
+    fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(test_closed_reader)
+{
+    asio::io_context ctx;
+    auto ex = ctx.get_executor();
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Tee tee(ex, block_size);
+        auto gone = tee.add_reader();
+        auto rr = tee.add_reader();
+
+        // A consumer going away does not block the producer.
+        WaitCondition wc(ex);
+        asio::spawn(ctx, [&, lock = wc.lock()] (asio::yield_context y) {
+            read_response(*rr, y);
+        });
+        Cancel cancel;
+        gone.reset();
+        push_response(tee, cancel, yield);
+        wc.wait(yield);
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
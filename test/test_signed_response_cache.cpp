@@ -0,0 +1,374 @@
+#define BOOST_TEST_MODULE signed_response_cache
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/filesystem.hpp>
+
+#include <defer.h>
+#include <session.h>
+#include <signed_response_cache.h>
+#include <util/async_queue_reader.h>
+#include <util/wait_condition.h>
+
+#include "connected_pair.h"
+
+BOOST_AUTO_TEST_SUITE(ouinet_signed_response_cache)
+
+using namespace std;
+using namespace ouinet;
+
+using Part = http_response::Part;
+
+static
+http::request_header<> request(const string& url)
+{
+    http::request_header<> rq;
+    rq.method(http::verb::get);
+    rq.target(url);
+    rq.version(11);
+    return rq;
+}
+
+static
+Part head(const string& cache_control)
+{
+    http::response_header<> rsh;
+    rsh.result(http::status::ok);
+    rsh.version(11);
+    rsh.set(http::field::content_length, "4");
+    if (!cache_control.empty()) rsh.set(http::field::cache_control, cache_control);
+    return http_response::Head(move(rsh));
+}
+
+static
+Part body()
+{
+    return http_response::Body(util::bytes::to_vector<uint8_t>(string("abcd")));
+}
+
+// Read the whole response and return its body.
+static
+string read_body( SignedResponseCache::reader_uptr rr
+                , asio::yield_context yield)
+{
+    Cancel cancel;
+    auto sess = Session::create_from_reader(move(rr), cancel, yield);
+    string data;
+    sess.flush_response(cancel, yield, [&] (Part&& p, Cancel&, asio::yield_context) {
+        if (auto b = p.as_body()) data.append((const char*) b->data(), b->size());
+    });
+    return data;
+}
+
+// A response with `blocks` body parts of `block_size` bytes,
+// each one filled with a different letter.
+static
+void queue_response( AsyncQueueReader::Queue& q, const string& cache_control
+                   , size_t blocks, size_t block_size)
+{
+    http::response_header<> rsh;
+    rsh.result(http::status::ok);
+    rsh.version(11);
+    rsh.set(http::field::content_length, to_string(blocks * block_size));
+    if (!cache_control.empty()) rsh.set(http::field::cache_control, cache_control);
+    q.push_back(Part(http_response::Head(move(rsh))));
+    for (size_t i = 0; i < blocks; ++i)
+        q.push_back(Part(http_response::Body(vector<uint8_t>(block_size, 'a' + i % 26))));
+    q.push_back(boost::none);
+}
+
+static
+string expected_body(size_t blocks, size_t block_size)
+{
+    string ret;
+    for (size_t i = 0; i < blocks; ++i) ret.append(block_size, 'a' + i % 26);
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE(test_key)
+{
+    auto rq = request("http://example.com/");
+    BOOST_REQUIRE(SignedResponseCache::key(rq));
+    // Headers not sent to the origin do not change the key, others do.
+    auto rq2 = rq;
+    rq2.set(http::field::accept_language, "en");
+    BOOST_CHECK(SignedResponseCache::key(rq) == SignedResponseCache::key(rq2));
+    rq2.set(http::field::origin, "http://example.org");
+    BOOST_CHECK(SignedResponseCache::key(rq) != SignedResponseCache::key(rq2));
+
+    rq.set(http::field::cache_control, "max-age=0");
+    BOOST_CHECK(!SignedResponseCache::key(rq));
+
+    rq = request("http://example.com/");
+    rq.method(http::verb::post);
+    BOOST_CHECK(!SignedResponseCache::key(rq));
+}
+
+BOOST_AUTO_TEST_CASE(test_coalesce_and_hit)
+{
+    asio::io_context ctx;
+    auto ex = ctx.get_executor();
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Cancel cancel;
+        SignedResponseCache cache(ex);
+        string key = "k";
+
+        BOOST_CHECK(!cache.find(key));
+        auto inj = cache.start(key);
+
+        // Requests joining before and after the head get the whole response.
+        WaitCondition wc(ex);
+        auto follow = [&] (SignedResponseCache::reader_uptr rr) {
+            BOOST_REQUIRE(rr);
+            asio::spawn(ctx, [&, rr = move(rr), lock = wc.lock()]
+                             (asio::yield_context y) mutable {
+                BOOST_CHECK_EQUAL(read_body(move(rr), y), "abcd");
+            });
+        };
+        follow(cache.find(key));
+        inj->async_push(head("max-age=60"), cancel, yield);
+        follow(cache.find(key));
+        inj->async_push(body(), cancel, yield);
+        inj->finish({});
+        wc.wait(yield);
+
+        BOOST_CHECK_EQUAL(cache.counters().misses, 1);
+        BOOST_CHECK_EQUAL(cache.counters().coalesced, 2);
+        BOOST_CHECK_EQUAL(cache.counters().stored, 1);
+
+        // Later requests get the kept response.
+        BOOST_CHECK_EQUAL(read_body(cache.find(key), yield), "abcd");
+        BOOST_CHECK_EQUAL(cache.counters().hits, 1);
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_not_kept)
+{
+    asio::io_context ctx;
+    auto ex = ctx.get_executor();
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Cancel cancel;
+        SignedResponseCache cache(ex);
+
+        // Responses which may not be shared are not kept
+        // nor followed once started.
+        for (auto cc : {"no-store", "private, max-age=60", "max-age=60, no-cache", ""}) {
+            auto inj = cache.start(cc);
+            inj->async_push(head(cc), cancel, yield);
+            BOOST_CHECK(!cache.find(cc));
+            inj->async_push(body(), cancel, yield);
+            inj->finish({});
+            BOOST_CHECK(!cache.find(cc));
+        }
+
+        // Responses older than their freshness are not kept.
+        auto inj = cache.start("old");
+        auto h = head("max-age=60");
+        h.as_head()->set(http::field::age, "120");
+        inj->async_push(h, cancel, yield);
+        inj->async_push(body(), cancel, yield);
+        inj->finish({});
+        BOOST_CHECK(!cache.find("old"));
+
+        BOOST_CHECK_EQUAL(cache.counters().stored, 0);
+        BOOST_CHECK_EQUAL(cache.size(), 0);
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_failed_injection)
+{
+    asio::io_context ctx;
+    auto ex = ctx.get_executor();
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Cancel cancel;
+        SignedResponseCache cache(ex);
+
+        // Followers of an injection which is dropped get an error.
+        auto inj = cache.start("k");
+        auto rr = cache.find("k");
+        BOOST_REQUIRE(rr);
+        inj->async_push(head("max-age=60"), cancel, yield);
+        inj.reset();
+
+        sys::error_code ec;
+        read_body(move(rr), yield[ec]);
+        BOOST_CHECK_EQUAL(ec, asio::error::operation_aborted);
+        BOOST_CHECK(!cache.find("k"));
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_eviction)
+{
+    asio::io_context ctx;
+    auto ex = ctx.get_executor();
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Cancel cancel;
+        auto store = [&] (SignedResponseCache& cache, const string& key) {
+            auto inj = cache.start(key);
+            inj->async_push(head("max-age=60"), cancel, yield);
+            inj->async_push(body(), cancel, yield);
+            inj->finish({});
+        };
+
+        SignedResponseCache probe(ex);
+        store(probe, "a");
+        auto entry_size = probe.size();
+
+        // Only room for two responses, the least recently used is dropped.
+        SignedResponseCache cache(ex, 2 * entry_size);
+        store(cache, "a");
+        store(cache, "b");
+        BOOST_CHECK(cache.find("a"));
+        store(cache, "c");
+        BOOST_CHECK(cache.find("a"));
+        BOOST_CHECK(!cache.find("b"));
+        BOOST_CHECK(cache.find("c"));
+        BOOST_CHECK_EQUAL(cache.counters().evicted, 1);
+        BOOST_CHECK_EQUAL(cache.size(), 2 * entry_size);
+
+        // Expired responses are dropped.
+        SignedResponseCache short_lived(ex, 2 * entry_size, entry_size, chrono::milliseconds(10));
+        store(short_lived, "a");
+        asio::steady_timer timer(ex, chrono::milliseconds(20));
+        timer.async_wait(yield);
+        BOOST_CHECK(!short_lived.find("a"));
+        BOOST_CHECK_EQUAL(short_lived.size(), 0);
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_flush_client_gone)
+{
+    asio::io_context ctx;
+    auto ex = ctx.get_executor();
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Cancel cancel;
+        SignedResponseCache cache(ex);
+        const size_t blocks = 16, block_size = 65536;
+
+        // The client of the injection is gone (its stream is closed),
+        // but its follower still gets the whole response (which is not kept).
+        {
+            auto inj = cache.start("k");
+            auto rr = cache.find("k");
+            BOOST_REQUIRE(rr);
+
+            WaitCondition wc(ex);
+            asio::spawn(ctx, [&, rr = move(rr), lock = wc.lock()]
+                             (asio::yield_context y) mutable {
+                BOOST_CHECK(read_body(move(rr), y) == expected_body(blocks, block_size));
+            });
+
+            AsyncQueueReader::Queue oq(ex);  // from origin
+            queue_response(oq, "", blocks, block_size);
+            auto sess = Session::create_from_reader(std::make_unique<AsyncQueueReader>(oq), cancel, yield);
+            GenericStream con(asio::ip::tcp::socket{ctx});
+
+            sys::error_code ec;
+            inj->flush(sess, con, cancel, yield[ec]);
+            BOOST_CHECK(ec);
+            wc.wait(yield);
+        }
+
+        // With nobody else needing it, the rest of the response is not read.
+        // (Pushing waits for the client, so that it notices the closed stream.)
+        cache.max_buffered(block_size, boost::none);
+        {
+            auto inj = cache.start("k2");
+            AsyncQueueReader::Queue oq(ex);
+            queue_response(oq, "", blocks, block_size);
+            auto sess = Session::create_from_reader(std::make_unique<AsyncQueueReader>(oq), cancel, yield);
+            GenericStream con(asio::ip::tcp::socket{ctx});
+
+            sys::error_code ec;
+            inj->flush(sess, con, cancel, yield[ec]);
+            BOOST_CHECK(ec);
+            BOOST_CHECK(oq.size() > 0);
+        }
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_flush_slow_follower)
+{
+    asio::io_context ctx;
+    auto ex = ctx.get_executor();
+
+    auto spill_dir = fs::temp_directory_path() / fs::unique_path("ouinet-test-src-%%%%-%%%%");
+    fs::create_directories(spill_dir);
+    auto rm_spill_dir = defer([&] { fs::remove_all(spill_dir); });
+
+    const size_t blocks = 64, block_size = 65536;
+    const size_t max_buffered = 4 * block_size;
+
+    // A follower which does not read is either left behind with its data
+    // in a file, or it makes the injection wait for it;
+    // in both cases the client and the follower get the whole response.
+    for (bool spill : {true, false}) {
+        asio::spawn(ctx, [&] (asio::yield_context yield) {
+            Cancel cancel;
+            SignedResponseCache cache(ex);
+            cache.max_buffered(max_buffered, spill ? boost::make_optional(spill_dir) : boost::none);
+
+            auto inj = cache.start("k");
+            auto rr = cache.find("k");
+            BOOST_REQUIRE(rr);
+
+            bool flushed = false;
+
+            WaitCondition wc(ex);
+            asio::spawn(ctx, [&, rr = move(rr), lock = wc.lock()]
+                             (asio::yield_context y) mutable {
+                // Start reading once the injection is done (or stuck).
+                asio::steady_timer timer(ex, chrono::milliseconds(200));
+                timer.async_wait(y);
+                BOOST_CHECK_EQUAL(flushed, spill);
+                BOOST_CHECK(read_body(move(rr), y) == expected_body(blocks, block_size));
+            });
+
+            auto sockets = util::connected_pair(ex, yield);
+            string received;
+            asio::spawn(ctx, [&, lock = wc.lock()] (asio::yield_context y) {
+                sys::error_code ec;
+                char buf[65536];
+                while (!ec) {
+                    auto n = sockets.second.async_read_some(asio::buffer(buf), y[ec]);
+                    received.append(buf, n);
+                }
+            });
+
+            AsyncQueueReader::Queue oq(ex);  // from origin
+            queue_response(oq, "", blocks, block_size);
+            auto sess = Session::create_from_reader(std::make_unique<AsyncQueueReader>(oq), cancel, yield);
+            GenericStream con(move(sockets.first));
+
+            sys::error_code ec;
+            inj->flush(sess, con, cancel, yield[ec]);
+            BOOST_CHECK(!ec);
+            flushed = true;
+            con.close();
+            wc.wait(yield);
+
+            BOOST_CHECK(received.find(expected_body(blocks, block_size)) != string::npos);
+        });
+
+        ctx.run();
+        ctx.restart();
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
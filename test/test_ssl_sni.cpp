@@ -0,0 +1,117 @@
+#define BOOST_TEST_MODULE ssl_sni
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/ssl.hpp>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+
+#include <generic_stream.h>
+#include <ssl/util.h>
+#include <util/prefixed_stream.h>
+#include <util/wait_condition.h>
+
+#include "connected_pair.h"
+
+BOOST_AUTO_TEST_SUITE(ouinet_ssl_sni)
+
+using namespace std;
+using namespace ouinet;
+using tcp = asio::ip::tcp;
+namespace ssl = asio::ssl;
+
+// A server context with a throwaway self-signed certificate.
+static
+ssl::context
+server_context()
+{
+    EVP_PKEY* pk = EVP_PKEY_new();
+    RSA* rsa = RSA_new();
+    BIGNUM* e = BN_new();
+    BN_set_word(e, RSA_F4);
+    RSA_generate_key_ex(rsa, 2048, e, nullptr);
+    BN_free(e);
+    EVP_PKEY_assign_RSA(pk, rsa);
+
+    X509* x = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(x), 1);
+    X509_gmtime_adj(X509_get_notBefore(x), 0);
+    X509_gmtime_adj(X509_get_notAfter(x), ouinet::ssl::util::ONE_HOUR);
+    X509_set_pubkey(x, pk);
+    X509_NAME_add_entry_by_txt( X509_get_subject_name(x), "CN", MBSTRING_ASC
+                              , (const unsigned char*) "test", -1, -1, 0);
+    X509_set_issuer_name(x, X509_get_subject_name(x));
+    X509_sign(x, pk, EVP_sha256());
+
+    ssl::context ctx{ssl::context::tls_server};
+    SSL_CTX_use_certificate(ctx.native_handle(), x);
+    SSL_CTX_use_PrivateKey(ctx.native_handle(), pk);
+
+    X509_free(x);
+    EVP_PKEY_free(pk);
+    return ctx;
+}
+
+// Perform a handshake with the given SNI (if not empty),
+// and check that the server sees it before the handshake
+// and that the connection works after putting the Client Hello back.
+static
+void check_sni(const string& sni)
+{
+    asio::io_context ctx;
+    auto server_ctx = server_context();
+    ssl::context client_ctx{ssl::context::tls_client};
+
+    asio::spawn(ctx, [&] (asio::yield_context y) {
+        auto ex = ctx.get_executor();
+        auto pair = util::connected_pair(ex, y);
+
+        WaitCondition wc(ex);
+
+        asio::spawn(ex, [&, lock = wc.lock()] (asio::yield_context y) {
+            ssl::stream<tcp::socket> c(move(pair.first), client_ctx);
+            if (!sni.empty())
+                SSL_set_tlsext_host_name(c.native_handle(), sni.c_str());
+            c.async_handshake(ssl::stream_base::client, y);
+
+            string msg = "hello";
+            asio::async_write(c, asio::buffer(msg), y);
+        });
+
+        GenericStream s(move(pair.second));
+        auto hello = ouinet::ssl::util::read_client_hello(s, y);
+        auto name = ouinet::ssl::util::client_hello_server_name(hello);
+
+        if (sni.empty()) BOOST_REQUIRE(!name);
+        else BOOST_REQUIRE_EQUAL(name.value_or(""), sni);
+
+        using PStream = util::PrefixedStream<GenericStream>;
+        ssl::stream<PStream> ss(PStream(move(hello), move(s)), server_ctx);
+        ss.async_handshake(ssl::stream_base::server, y);
+
+        string msg(5, '\0');
+        asio::async_read(ss, asio::buffer(&msg[0], msg.size()), y);
+        BOOST_REQUIRE_EQUAL(msg, "hello");
+
+        wc.wait(y);
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_with_sni) {
+    check_sni("www.example.com");
+}
+
+BOOST_AUTO_TEST_CASE(test_without_sni) {
+    check_sni("");
+}
+
+BOOST_AUTO_TEST_CASE(test_bad_hello) {
+    BOOST_REQUIRE(!ouinet::ssl::util::client_hello_server_name(""));
+    BOOST_REQUIRE(!ouinet::ssl::util::client_hello_server_name("GET / HTTP/1.1\r\n\r\n"));
+    BOOST_REQUIRE(!ouinet::ssl::util::client_hello_server_name(string("\x16\x03\x01\x00\x30\x01", 6)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()